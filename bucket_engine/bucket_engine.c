@@ -169,6 +169,14 @@ static TAP_ITERATOR bucket_get_tap_iterator(ENGINE_HANDLE* handle, const void* c
                                             uint32_t flags,
                                             const void* userdata, size_t nuserdata);
 
+static TAP_BATCH_ITERATOR bucket_get_tap_batch_iterator(ENGINE_HANDLE* handle,
+                                                        const void* cookie,
+                                                        const void* client,
+                                                        size_t nclient,
+                                                        uint32_t flags,
+                                                        const void* userdata,
+                                                        size_t nuserdata);
+
 static size_t bucket_errinfo(ENGINE_HANDLE *handle, const void* cookie,
                              char *buffer, size_t buffsz);
 
@@ -210,7 +218,8 @@ struct bucket_engine bucket_engine = {
         .get_tap_iterator = bucket_get_tap_iterator,
         .item_set_cas     = bucket_item_set_cas,
         .get_item_info    = bucket_get_item_info,
-        .errinfo          = bucket_errinfo
+        .errinfo          = bucket_errinfo,
+        .get_tap_batch_iterator = bucket_get_tap_batch_iterator
     },
     .initialized = false,
     .shutdown = {
@@ -2007,6 +2016,60 @@ static TAP_ITERATOR bucket_get_tap_iterator(ENGINE_HANDLE* handle, const void* c
 }
 
 
+/**
+ * The batch flavour of bucket_tap_iterator_shim. The access to the
+ * bucket is verified once for the whole batch.
+ */
+static int bucket_tap_batch_iterator_shim(ENGINE_HANDLE* handle,
+                                          const void *cookie,
+                                          tap_event_info *events,
+                                          int nevents) {
+    proxied_engine_handle_t *e = get_engine_handle(handle, cookie);
+    if (e && e->tap_batch_iterator) {
+        assert(e->pe.v0 != handle);
+        int ret = e->tap_batch_iterator(e->pe.v0, cookie, events, nevents);
+        release_engine_handle(e);
+        return ret;
+    } else {
+        if (e) {
+            release_engine_handle(e);
+        }
+        memset(events, 0, sizeof(*events));
+        events[0].event = TAP_DISCONNECT;
+        return 1;
+    }
+}
+
+/**
+ * Implementation of the get_tap_batch_iterator from the engine API.
+ * Returns NULL (so that the core falls back to get_tap_iterator) if
+ * the engine the cookie is associated with doesn't support it.
+ */
+static TAP_BATCH_ITERATOR bucket_get_tap_batch_iterator(ENGINE_HANDLE* handle,
+                                                        const void* cookie,
+                                                        const void* client,
+                                                        size_t nclient,
+                                                        uint32_t flags,
+                                                        const void* userdata,
+                                                        size_t nuserdata) {
+    TAP_BATCH_ITERATOR ret = NULL;
+
+    proxied_engine_handle_t *e = get_engine_handle(handle, cookie);
+    if (e) {
+        if (!e->tap_iterator_disabled &&
+            e->pe.v1->get_tap_batch_iterator != NULL) {
+            e->tap_batch_iterator =
+                e->pe.v1->get_tap_batch_iterator(e->pe.v0, cookie,
+                                                 client, nclient,
+                                                 flags, userdata, nuserdata);
+            ret = e->tap_batch_iterator ? bucket_tap_batch_iterator_shim : NULL;
+        }
+        release_engine_handle(e);
+    }
+
+    return ret;
+}
+
 /**
  * Implementation of the errinfo function in the engine api.
  * If the cookie is connected to an engine should proxy the function down
@@ -26,6 +26,7 @@ typedef struct proxied_engine_handle {
     void                *stats;
     topkeys_t          **topkeys;
     TAP_ITERATOR         tap_iterator;
+    TAP_BATCH_ITERATOR   tap_batch_iterator;
     bool                 tap_iterator_disabled;
     /* ON_DISCONNECT handling */
     volatile bool        wants_disconnects;
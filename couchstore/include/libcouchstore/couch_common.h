@@ -86,10 +86,34 @@ extern "C" {
         cs_off_t header_position;   /**< File offset of current header */
     } DbInfo;
 
+    /** Usage of the B-tree node cache shared by all databases. */
+    typedef struct {
+        uint64_t size;              /**< Bytes of cached nodes */
+        uint64_t max_size;          /**< Max bytes of cached nodes */
+        uint64_t num_nodes;         /**< Number of cached nodes */
+        uint64_t hits;              /**< Node reads served by the cache */
+        uint64_t misses;            /**< Node reads that went to the file */
+        uint64_t evictions;         /**< Nodes evicted to make room */
+    } NodeCacheInfo;
+
+    /** Usage of the read buffers shared by all databases. */
+    typedef struct {
+        uint64_t size;              /**< Bytes of read buffers allocated */
+        uint64_t max_size;          /**< Max bytes of read buffers */
+        uint64_t hits;              /**< Reads served from the buffers */
+        uint64_t misses;            /**< Buffer loads from the files */
+        uint64_t readaheads;        /**< Loads of read-ahead windows */
+        uint64_t bytes_requested;   /**< Bytes asked for by readers */
+        uint64_t bytes_read;        /**< Bytes read from the files */
+    } ReadBufferInfo;
+
 
     /** Opaque reference to an open database. */
     typedef struct _db Db;
 
+    /** Opaque reference to a bulk load in progress. */
+    typedef struct _bulk_loader BulkLoader;
+
 #ifdef __cplusplus
 }
 #endif
@@ -77,12 +77,37 @@ extern "C" {
     LIBCOUCHSTORE_API
     couchstore_error_t couchstore_close_db(Db *db);
 
+    /**
+     * Bring an open database handle up to date with the file on disk.
+     *
+     * If the file has grown since the handle was opened (because another
+     * handle committed to it), the most recent header is read and any
+     * buffered file data is discarded. This is meant for read-only handles
+     * that are kept open for a long time; it is much cheaper than closing
+     * and reopening the file. The handle is left unchanged on failure.
+     *
+     * @param db Pointer to the database handle to refresh.
+     * @return COUCHSTORE_SUCCESS upon success
+     */
+    LIBCOUCHSTORE_API
+    couchstore_error_t couchstore_refresh_db(Db *db);
+
     /**
      * Get the default couch_file_ops object
      */
     LIBCOUCHSTORE_API
     const couch_file_ops *couchstore_get_default_file_ops(void);
 
+    /**
+     * Get a couch_file_ops object doing direct I/O, bypassing the OS page
+     * cache. Appends are gathered in aligned buffers written asynchronously,
+     * and large reads are split in concurrent requests. Falls back to
+     * buffered I/O where direct I/O isn't supported, and is the same as the
+     * default ops on platforms other than Linux.
+     */
+    LIBCOUCHSTORE_API
+    const couch_file_ops *couchstore_get_direct_file_ops(void);
+
     /**
      * Get information about the database.
      *
@@ -127,7 +152,15 @@ extern "C" {
          * default, and if this is not set the data field of the Doc will
          * be written to disk as-is, regardless of the content_meta flags.
          */
-        COMPRESS_DOC_BODIES = 1
+        COMPRESS_DOC_BODIES = 1,
+        /**
+         * Keep the db_seq fields of the DocInfos as the sequence numbers
+         * of the documents instead of allocating new ones. They must be
+         * higher than the last sequence number of the database and in
+         * ascending order. This is meant for copying changes from another
+         * database.
+         */
+        COUCHSTORE_SEQUENCE_AS_IS = 2
     };
 
     /**
@@ -176,6 +209,58 @@ extern "C" {
                                                  DocInfo *infos[],
                                                  unsigned numDocs,
                                                  couchstore_save_options options);
+
+    /**
+     * Start loading documents into a database that doesn't have any yet.
+     * Instead of being inserted into the indexes one batch at a time, the
+     * documents must be given in ascending order of their ids, and the
+     * indexes are written bottom-up along with them in a single sequential
+     * pass over the file. couchstore_save_documents() does the same on its
+     * own when called on a database without documents.
+     *
+     * The database must not be modified by other calls until
+     * couchstore_bulk_load_end() is called.
+     *
+     * @param db the database to load, which must not have any documents
+     * @param loader set to the new loader on success
+     * @return COUCHSTORE_SUCCESS on success, or
+     *         COUCHSTORE_ERROR_INVALID_ARGUMENTS if db has documents
+     */
+    LIBCOUCHSTORE_API
+    couchstore_error_t couchstore_bulk_load_begin(Db *db, BulkLoader **loader);
+
+    /**
+     * Add a document to a bulk load, as couchstore_save_document() would.
+     * Its id must be higher than the ids of the documents already added.
+     *
+     * On return, the db_seq field of the DocInfo will be filled in with the
+     * document's (or deletion's) sequence number.
+     *
+     * @param loader the loader
+     * @param doc the document to save, or NULL to save a deletion
+     * @param info document info
+     * @param options as for couchstore_save_document()
+     * @return COUCHSTORE_SUCCESS on success, or
+     *         COUCHSTORE_ERROR_INVALID_ARGUMENTS if the document is out of
+     *         order
+     */
+    LIBCOUCHSTORE_API
+    couchstore_error_t couchstore_bulk_load_document(BulkLoader *loader,
+                                                     const Doc *doc,
+                                                     DocInfo *info,
+                                                     couchstore_save_options options);
+
+    /**
+     * Finish a bulk load: write the rest of the indexes and set them as the
+     * indexes of the database, which can then be committed. The loader is
+     * freed, and if loading any document failed the indexes are left empty.
+     *
+     * @param loader the loader
+     * @return COUCHSTORE_SUCCESS on success
+     */
+    LIBCOUCHSTORE_API
+    couchstore_error_t couchstore_bulk_load_end(BulkLoader *loader);
+
     /**
      * Commit all pending changes and flush buffers to persistent storage.
      *
@@ -185,6 +270,48 @@ extern "C" {
     LIBCOUCHSTORE_API
     couchstore_error_t couchstore_commit(Db *db);
 
+    /**
+     * Write all pending changes of a database to its file, without syncing
+     * the file. This is the first step of couchstore_commit(), exposed so
+     * that several databases can be committed with shared sync rounds
+     * ("group commit"):
+     *
+     * 1. couchstore_commit_data() on every database in the group
+     * 2. couchstore_sync_db() on every database in the group
+     * 3. couchstore_commit_header() on every database in the group
+     * 4. couchstore_sync_db() on every database in the group again
+     *
+     * couchstore_sync_db() also writes out any data the file ops still
+     * hold in memory, so a sync of the file system is not a substitute.
+     *
+     * A database must not be modified between these steps.
+     *
+     * @param db database to perform the commit on
+     * @return COUCHSTORE_SUCCESS on success
+     */
+    LIBCOUCHSTORE_API
+    couchstore_error_t couchstore_commit_data(Db *db);
+
+    /**
+     * Write a new header for the changes written by couchstore_commit_data(),
+     * without syncing the file. The header must not be written before the
+     * data it refers to has been synced.
+     *
+     * @param db database to perform the commit on
+     * @return COUCHSTORE_SUCCESS on success
+     */
+    LIBCOUCHSTORE_API
+    couchstore_error_t couchstore_commit_header(Db *db);
+
+    /**
+     * Flush buffers of a database to persistent storage.
+     *
+     * @param db database to sync
+     * @return COUCHSTORE_SUCCESS on success
+     */
+    LIBCOUCHSTORE_API
+    couchstore_error_t couchstore_sync_db(Db *db);
+
 
     /*////////////////////  RETRIEVING DOCUMENTS: */
 
@@ -377,7 +504,8 @@ extern "C" {
      * @param sequence array of document sequence numbers. Need not be sorted but must not contain
      *          duplicates.
      * @param numDocs number of documents to look up (size of sequence[] array)
-     * @param options Set the RANGES bit for range mode (see above)
+     * @param options Set the RANGES bit for range mode (see above);
+     *          COUCHSTORE_DELETES_ONLY and COUCHSTORE_NO_DELETES are supported
      * @param callback the callback function used to iterate over document infos
      * @param ctx client context (passed to the callback)
      * @return COUCHSTORE_SUCCESS on success.
@@ -406,7 +534,8 @@ extern "C" {
      * @param ids array of document ids. Need not be sorted but must not contain
      *          duplicates.
      * @param numDocs number of documents to look up (size of ids[] array)
-     * @param options Set the RANGES bit for range mode (see above)
+     * @param options Set the RANGES bit for range mode (see above);
+     *          COUCHSTORE_DELETES_ONLY and COUCHSTORE_NO_DELETES are supported
      * @param callback the callback function used to iterate over document infos
      * @param ctx client context (passed to the callback)
      * @return COUCHSTORE_SUCCESS on success.
@@ -557,7 +686,20 @@ extern "C" {
         /**
          * Do not copy the tombstones of deleted items into compacted file.
          */
-        COUCHSTORE_COMPACT_FLAG_DROP_DELETES = 1
+        COUCHSTORE_COMPACT_FLAG_DROP_DELETES = 1,
+        /**
+         * Sort the records of the new by-id index in runs on worker
+         * threads while the documents and by-sequence index are copied,
+         * and build the by-id index from a merge of the sorted runs.
+         */
+        COUCHSTORE_COMPACT_FLAG_PARALLEL = 2,
+        /**
+         * Once the copy is done, refresh the source database and copy the
+         * changes committed to it since (see couchstore_compact_catchup).
+         * This is repeated a few times at most, so the new file may still
+         * miss the latest changes when writers keep up with the catch-up.
+         */
+        COUCHSTORE_COMPACT_FLAG_CATCHUP = 4
     };
 
     /*
@@ -575,6 +717,83 @@ extern "C" {
     LIBCOUCHSTORE_API
     couchstore_error_t couchstore_compact_db_ex(Db* source, const char* target_filename,
                                                 uint64_t flags, const couch_file_ops *ops);
+
+    /*
+     * Bring a compacted database up to date with its source. The source is
+     * refreshed to its latest header, and the documents changed after the
+     * last sequence number of the target are copied to it, keeping their
+     * sequence numbers. The local documents are copied again. The target
+     * is committed on success.
+     *
+     * Writers to the source should be stopped for the last catch-up before
+     * switching to the new file.
+     *
+     * @param source the source database
+     * @param target the database created by couchstore_compact_db_ex
+     * @return COUCHSTORE_SUCCESS on success
+     */
+    LIBCOUCHSTORE_API
+    couchstore_error_t couchstore_compact_catchup(Db* source, Db* target);
+
+    /*////////////////////  NODE CACHE: */
+
+    /**
+     * Set the size of the process-wide cache of decompressed B-tree nodes,
+     * shared by all the handles of a file. Lookups read the nodes they
+     * visit from this cache, so the upper levels of the trees are read
+     * and decompressed from the file only once.
+     *
+     * The cache assumes database files are only ever appended to while
+     * they are open. The nodes of a file are dropped when its last handle
+     * is closed.
+     *
+     * @param max_size Max number of bytes of cached nodes (0, the
+     *                 default, disables the cache)
+     * @return COUCHSTORE_SUCCESS on success
+     */
+    LIBCOUCHSTORE_API
+    couchstore_error_t couchstore_set_node_cache_size(size_t max_size);
+
+    /**
+     * Get the usage counters of the B-tree node cache.
+     *
+     * @param info Pointer to where you want the info to be stored.
+     */
+    LIBCOUCHSTORE_API
+    void couchstore_get_node_cache_info(NodeCacheInfo *info);
+
+    /*////////////////////  READ BUFFERS: */
+
+    /**
+     * Configure the pool of read buffers shared by all the open files of the
+     * process. Random reads load single blocks; reads detected as a
+     * sequential scan (such as changes_since or compaction) load a read-ahead
+     * window that doubles with each load, up to max_readahead.
+     *
+     * Files opened before the call keep the block and read-ahead sizes they
+     * were opened with.
+     *
+     * @param max_size Max number of bytes of read buffers (8MB by default,
+     *                 0 leaves reads unbuffered)
+     * @param block_size Size of the blocks of random reads (8KB by default)
+     * @param max_readahead Max size of a read-ahead window (256KB by
+     *                      default, less than two blocks disables read-ahead)
+     * @return COUCHSTORE_SUCCESS on success
+     */
+    LIBCOUCHSTORE_API
+    couchstore_error_t couchstore_set_read_buffer_pool(size_t max_size,
+                                                       size_t block_size,
+                                                       size_t max_readahead);
+
+    /**
+     * Get the usage counters of the read buffer pool. Counters of open files
+     * are added to them in batches, so they may lag slightly behind.
+     *
+     * @param info Pointer to where you want the info to be stored.
+     */
+    LIBCOUCHSTORE_API
+    void couchstore_get_read_buffer_info(ReadBufferInfo *info);
+
     /*////////////////////  MISC: */
 
     /**
@@ -0,0 +1,257 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "couch_btree.h"
+#include "util.h"
+#include "node_types.h"
+
+/*
+ * Builds a new B-tree bottom-up from items given in key order. Each level
+ * of the tree has one node being filled; when it is full it is written out
+ * and a pointer to it is added to the level above, so the nodes are written
+ * in a single sequential pass and only one node per level is kept in memory.
+ */
+
+typedef struct builder_item {
+    size_t key_offset;
+    uint32_t key_size;
+    size_t data_offset;
+    uint32_t data_size;
+} builder_item;
+
+typedef struct builder_level {
+    int node_type;
+    /* The node being filled, as written to disk */
+    char *buf;
+    size_t len;
+    size_t capacity;
+    builder_item *items;
+    int count;
+    int max_count;
+    /* Sum of the subtree sizes of the pointers in a KP node */
+    uint64_t subtreesize;
+    struct builder_level *parent;
+} builder_level;
+
+struct couchfile_builder {
+    Db *db;
+    reduce_fn reduce;
+    reduce_fn rereduce;
+    builder_level *leaf;
+};
+
+static builder_level *new_level(int node_type)
+{
+    builder_level *l = calloc(1, sizeof(builder_level));
+    if (l == NULL) {
+        return NULL;
+    }
+    l->node_type = node_type;
+    l->len = 1;
+    return l;
+}
+
+static couchstore_error_t level_reserve(builder_level *l, size_t size)
+{
+    if (l->len + size > l->capacity) {
+        size_t capacity = l->capacity ? l->capacity : CHUNK_THRESHOLD + 1;
+        while (capacity < l->len + size) {
+            capacity *= 2;
+        }
+        char *buf = realloc(l->buf, capacity);
+        if (buf == NULL) {
+            return COUCHSTORE_ERROR_ALLOC_FAIL;
+        }
+        l->buf = buf;
+        l->capacity = capacity;
+    }
+    if (l->count == l->max_count) {
+        int max_count = l->max_count ? l->max_count * 2 : 64;
+        builder_item *items = realloc(l->items, max_count * sizeof(builder_item));
+        if (items == NULL) {
+            return COUCHSTORE_ERROR_ALLOC_FAIL;
+        }
+        l->items = items;
+        l->max_count = max_count;
+    }
+    return COUCHSTORE_SUCCESS;
+}
+
+static couchstore_error_t level_add(couchfile_builder *b, builder_level *l,
+                                    const sized_buf *k, const sized_buf *v);
+
+/* Writes out the node of a level and adds a pointer to it to the level above */
+static couchstore_error_t flush_level(couchfile_builder *b, builder_level *l)
+{
+    couchstore_error_t errcode;
+    nodelist *list = NULL;
+    node_pointer *pointers = NULL;
+    char ptrbuf[sizeof(raw_node_pointer) + 30];
+    size_t reducesize = 0;
+    sized_buf writebuf;
+    cs_off_t diskpos;
+    size_t disk_size;
+
+    l->buf[0] = (char) l->node_type;
+    writebuf.buf = l->buf;
+    writebuf.size = l->len;
+    error_pass(db_write_buf_compressed(b->db, &writebuf, &diskpos, &disk_size));
+
+    reduce_fn reduce = l->node_type == KV_NODE ? b->reduce : b->rereduce;
+    if (reduce) {
+        list = malloc(l->count * sizeof(nodelist));
+        error_unless(list, COUCHSTORE_ERROR_ALLOC_FAIL);
+        if (l->node_type == KP_NODE) {
+            pointers = malloc(l->count * sizeof(node_pointer));
+            error_unless(pointers, COUCHSTORE_ERROR_ALLOC_FAIL);
+        }
+        for (int ii = 0; ii < l->count; ++ii) {
+            const builder_item *itm = &l->items[ii];
+            list[ii].key.buf = l->buf + itm->key_offset;
+            list[ii].key.size = itm->key_size;
+            list[ii].data.buf = l->buf + itm->data_offset;
+            list[ii].data.size = itm->data_size;
+            list[ii].pointer = NULL;
+            list[ii].next = ii + 1 < l->count ? &list[ii + 1] : NULL;
+            if (pointers) {
+                const raw_node_pointer *raw = (const raw_node_pointer*) list[ii].data.buf;
+                pointers[ii].reduce_value.size = decode_raw16(raw->reduce_value_size);
+                pointers[ii].reduce_value.buf = list[ii].data.buf + sizeof(*raw);
+                list[ii].pointer = &pointers[ii];
+            }
+        }
+        reduce(ptrbuf + sizeof(raw_node_pointer), &reducesize, list, l->count);
+    }
+
+    raw_node_pointer *raw = (raw_node_pointer*) ptrbuf;
+    raw->pointer = encode_raw48(diskpos);
+    raw->subtreesize = encode_raw48(l->subtreesize + disk_size);
+    raw->reduce_value_size = encode_raw16((uint16_t) reducesize);
+
+    const builder_item *last = &l->items[l->count - 1];
+    sized_buf key, ptr;
+    key.buf = l->buf + last->key_offset;
+    key.size = last->key_size;
+    ptr.buf = ptrbuf;
+    ptr.size = sizeof(raw_node_pointer) + reducesize;
+
+    if (l->parent == NULL) {
+        l->parent = new_level(KP_NODE);
+        error_unless(l->parent, COUCHSTORE_ERROR_ALLOC_FAIL);
+    }
+    error_pass(level_add(b, l->parent, &key, &ptr));
+
+    l->len = 1;
+    l->count = 0;
+    l->subtreesize = 0;
+cleanup:
+    free(list);
+    free(pointers);
+    return errcode;
+}
+
+static couchstore_error_t level_add(couchfile_builder *b, builder_level *l,
+                                    const sized_buf *k, const sized_buf *v)
+{
+    couchstore_error_t errcode = COUCHSTORE_SUCCESS;
+    size_t size = k->size + v->size + 5;
+    // Fill the node up to the size modify_btree splits nodes at, with at
+    // least two pointers in a KP node
+    int min_count = l->node_type == KP_NODE ? 2 : 1;
+    if (l->count >= min_count && l->len + size > CHUNK_THRESHOLD) {
+        error_pass(flush_level(b, l));
+    }
+    error_pass(level_reserve(l, size));
+
+    builder_item *itm = &l->items[l->count++];
+    itm->key_offset = l->len + 5;
+    itm->key_size = (uint32_t) k->size;
+    itm->data_offset = itm->key_offset + k->size;
+    itm->data_size = (uint32_t) v->size;
+    write_kv(l->buf + l->len, *k, *v);
+    l->len += size;
+    if (l->node_type == KP_NODE) {
+        const raw_node_pointer *raw = (const raw_node_pointer*) v->buf;
+        l->subtreesize += decode_raw48(raw->subtreesize);
+    }
+cleanup:
+    return errcode;
+}
+
+couchfile_builder *btree_builder_new(Db *db, reduce_fn reduce, reduce_fn rereduce)
+{
+    couchfile_builder *b = calloc(1, sizeof(couchfile_builder));
+    if (b == NULL) {
+        return NULL;
+    }
+    b->db = db;
+    b->reduce = reduce;
+    b->rereduce = rereduce;
+    b->leaf = new_level(KV_NODE);
+    if (b->leaf == NULL) {
+        free(b);
+        return NULL;
+    }
+    return b;
+}
+
+couchstore_error_t btree_builder_add(couchfile_builder *b, const sized_buf *k, const sized_buf *v)
+{
+    return level_add(b, b->leaf, k, v);
+}
+
+node_pointer *btree_builder_finish(couchfile_builder *b, couchstore_error_t *errcode)
+{
+    builder_level *l = b->leaf;
+    *errcode = COUCHSTORE_SUCCESS;
+    if (l->count == 0 && l->parent == NULL) {
+        return NULL;
+    }
+    // Write out the partly filled nodes from the bottom up, until the top
+    // level is down to the pointer to the root
+    while (l->parent != NULL || l->node_type == KV_NODE || l->count > 1) {
+        if (l->count > 0) {
+            *errcode = flush_level(b, l);
+            if (*errcode != COUCHSTORE_SUCCESS) {
+                return NULL;
+            }
+        }
+        l = l->parent;
+    }
+
+    const builder_item *itm = &l->items[0];
+    const raw_node_pointer *raw = (const raw_node_pointer*) (l->buf + itm->data_offset);
+    size_t reducesize = decode_raw16(raw->reduce_value_size);
+    node_pointer *root = malloc(sizeof(node_pointer) + itm->key_size + reducesize);
+    if (root == NULL) {
+        *errcode = COUCHSTORE_ERROR_ALLOC_FAIL;
+        return NULL;
+    }
+    root->key.buf = (char*) root + sizeof(node_pointer);
+    root->key.size = itm->key_size;
+    memcpy(root->key.buf, l->buf + itm->key_offset, itm->key_size);
+    root->reduce_value.buf = root->key.buf + itm->key_size;
+    root->reduce_value.size = reducesize;
+    memcpy(root->reduce_value.buf, raw + 1, reducesize);
+    root->pointer = decode_raw48(raw->pointer);
+    root->subtreesize = decode_raw48(raw->subtreesize);
+    return root;
+}
+
+void btree_builder_free(couchfile_builder *b)
+{
+    if (b == NULL) {
+        return;
+    }
+    builder_level *l = b->leaf;
+    while (l != NULL) {
+        builder_level *parent = l->parent;
+        free(l->buf);
+        free(l->items);
+        free(l);
+        l = parent;
+    }
+    free(b);
+}
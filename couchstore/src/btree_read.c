@@ -4,6 +4,7 @@
 #include "couch_btree.h"
 #include "util.h"
 #include "node_types.h"
+#include "node_cache.h"
 
 static couchstore_error_t btree_lookup_inner(couchfile_lookup_request *rq,
                                              uint64_t diskpos,
@@ -18,8 +19,9 @@ static couchstore_error_t btree_lookup_inner(couchfile_lookup_request *rq,
     couchstore_error_t errcode = COUCHSTORE_SUCCESS;
 
     char *nodebuf = NULL;
+    node_cache_entry *noderef = NULL;
 
-    nodebuflen = pread_compressed(rq->db, diskpos, &nodebuf);
+    nodebuflen = pread_node(rq->db, diskpos, &nodebuf, &noderef);
     error_unless(nodebuflen >= 0, nodebuflen);  // if negative, it's an error code
 
     if (nodebuf[0] == 0) { //KP Node
@@ -90,7 +92,7 @@ static couchstore_error_t btree_lookup_inner(couchfile_lookup_request *rq,
     }
 
 cleanup:
-    free(nodebuf);
+    node_release(nodebuf, noderef);
 
     return errcode;
 }
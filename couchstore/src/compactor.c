@@ -11,7 +11,7 @@ static void exit_error(couchstore_error_t errcode)
 }
 
 static void usage(const char* prog) {
-    fprintf(stderr, "Usage: %s [--dropdeletes] <input file> <output file>\n", prog);
+    fprintf(stderr, "Usage: %s [--dropdeletes] [--parallel] [--catchup] <input file> <output file>\n", prog);
     exit(-1);
 }
 
@@ -27,12 +27,20 @@ int main(int argc, char** argv)
     couchstore_compact_flags flags = 0;
     const couch_file_ops* target_io_ops = couchstore_get_default_file_ops();
 
-    if(!strcmp(argv[argp],"--dropdeletes")) {
-        argp++;
-        if(argc < 4) {
+    while(argp < argc && !strncmp(argv[argp], "--", 2)) {
+        if(!strcmp(argv[argp],"--dropdeletes")) {
+            flags |= COUCHSTORE_COMPACT_FLAG_DROP_DELETES;
+        } else if(!strcmp(argv[argp],"--parallel")) {
+            flags |= COUCHSTORE_COMPACT_FLAG_PARALLEL;
+        } else if(!strcmp(argv[argp],"--catchup")) {
+            flags |= COUCHSTORE_COMPACT_FLAG_CATCHUP;
+        } else {
             usage(argv[0]);
         }
-        flags = COUCHSTORE_COMPACT_FLAG_DROP_DELETES;
+        argp++;
+    }
+    if(argc - argp < 2) {
+        usage(argv[0]);
     }
 
     errcode = couchstore_open_db(argv[argp++], COUCHSTORE_OPEN_FLAG_RDONLY, &source);
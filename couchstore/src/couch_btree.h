@@ -74,19 +74,19 @@ extern "C" {
         void (*fetch_callback) (struct couchfile_modify_request *rq, sized_buf *k, sized_buf *v, void *arg);
         reduce_fn reduce;
         reduce_fn rereduce;
-        /*  We're in the compactor */
-        int compacting;
     } couchfile_modify_request;
 
 #define KP_NODE 0
 #define KV_NODE 1
 
+    /* Nodes bigger than this are split, into nodes of about CHUNK_SIZE */
+#define CHUNK_THRESHOLD 1279
+#define CHUNK_SIZE (CHUNK_THRESHOLD * 2 / 3)
+
     /* Used to build and chunk modified nodes */
     typedef struct couchfile_modify_result {
         couchfile_modify_request *rq;
         struct arena *arena;
-        /* If this is set, prefer to put items that can be thrown away after a flush in this arena */
-        struct arena *arena_transient;
         nodelist *values;
         nodelist *values_end;
 
@@ -106,12 +106,20 @@ extern "C" {
                                node_pointer *root,
                                couchstore_error_t *errcode);
 
-    couchstore_error_t mr_push_item(sized_buf *k, sized_buf *v, couchfile_modify_result *dst);
+    /* Bulk build */
+    typedef struct couchfile_builder couchfile_builder;
+
+    /* Starts a new tree, written to db bottom-up from items added in key
+       order with btree_builder_add. */
+    couchfile_builder *btree_builder_new(Db *db, reduce_fn reduce, reduce_fn rereduce);
+
+    couchstore_error_t btree_builder_add(couchfile_builder *b, const sized_buf *k, const sized_buf *v);
 
-    couchfile_modify_result* new_btree_modres(arena* a, arena* transient_arena, Db* db, compare_info* cmp, reduce_fn reduce,
-            reduce_fn rereduce);
+    /* Writes the remaining nodes and returns the root pointer (malloc'ed,
+       NULL if no items were added). */
+    node_pointer *btree_builder_finish(couchfile_builder *b, couchstore_error_t *errcode);
 
-    node_pointer* complete_new_btree(couchfile_modify_result* mr, couchstore_error_t *errcode);
+    void btree_builder_free(couchfile_builder *b);
 
 #ifdef __cplusplus
 }
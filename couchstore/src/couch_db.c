@@ -8,6 +8,7 @@
 
 #include "internal.h"
 #include "node_types.h"
+#include "node_cache.h"
 #include "couch_btree.h"
 #include "bitfield.h"
 #include "reduces.h"
@@ -164,7 +165,7 @@ uint64_t couchstore_get_header_position(Db *db)
 }
 
 LIBCOUCHSTORE_API
-couchstore_error_t couchstore_commit(Db *db)
+couchstore_error_t couchstore_commit_data(Db *db)
 {
     cs_off_t curpos = db->file_pos;
     sized_buf zerobyte = {"\0", 1};
@@ -182,18 +183,42 @@ couchstore_error_t couchstore_commit(Db *db)
     //Extend file size to where end of header will land before we do first sync
     db_write_buf(db, &zerobyte, NULL, NULL);
 
-    couchstore_error_t errcode = db->file_ops->sync(db->file_handle);
+    couchstore_error_t errcode = couch_buffered_file_flush(db->file_handle);
 
     //Set the pos back to where it was when we started to write the real header.
     db->file_pos = curpos;
+    return errcode;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_commit_header(Db *db)
+{
+    couchstore_error_t errcode = write_header(db);
     if (errcode == COUCHSTORE_SUCCESS) {
-        errcode = write_header(db);
+        errcode = couch_buffered_file_flush(db->file_handle);
     }
+    return errcode;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_sync_db(Db *db)
+{
+    return db->file_ops->sync(db->file_handle);
+}
 
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_commit(Db *db)
+{
+    couchstore_error_t errcode = couchstore_commit_data(db);
     if (errcode == COUCHSTORE_SUCCESS) {
-        errcode = db->file_ops->sync(db->file_handle);
+        errcode = couchstore_sync_db(db);
+    }
+    if (errcode == COUCHSTORE_SUCCESS) {
+        errcode = couchstore_commit_header(db);
+    }
+    if (errcode == COUCHSTORE_SUCCESS) {
+        errcode = couchstore_sync_db(db);
     }
-
     return errcode;
 }
 
@@ -256,9 +281,11 @@ couchstore_error_t couchstore_open_db_ex(const char *filename,
         if (flags & COUCHSTORE_OPEN_FLAG_RDONLY) {
             error_pass(COUCHSTORE_ERROR_NO_HEADER);
         } else {
+            node_cache_open_file(db);
             error_pass(create_header(db));
         }
     } else {
+        node_cache_open_file(db);
         error_pass(find_header(db));
     }
 
@@ -277,6 +304,7 @@ couchstore_error_t couchstore_close_db(Db *db)
         return COUCHSTORE_SUCCESS;
     }
 
+    node_cache_close_file(db);
     if (db->file_ops) {
         db->file_ops->close(db->file_handle);
         db->file_ops->destructor(db->file_handle);
@@ -293,6 +321,44 @@ couchstore_error_t couchstore_close_db(Db *db)
     return COUCHSTORE_SUCCESS;
 }
 
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_refresh_db(Db *db)
+{
+    cs_off_t eof = db->file_ops->goto_eof(db->file_handle);
+    if (eof < 0) {
+        return (couchstore_error_t) eof;
+    }
+    if ((uint64_t)eof == db->file_pos) {
+        return COUCHSTORE_SUCCESS;
+    }
+
+    // Another handle has appended to the file. Bytes we buffered near the
+    // old end of file may since have been overwritten by a header, so drop
+    // them before looking for the newest header.
+    couch_buffered_file_drop_read_buffers(db->file_handle);
+
+    uint64_t old_file_pos = db->file_pos;
+    db_header old_header = db->header;
+    db->header.by_id_root = NULL;
+    db->header.by_seq_root = NULL;
+    db->header.local_docs_root = NULL;
+    db->file_pos = eof;
+
+    couchstore_error_t errcode = find_header(db);
+    if (errcode == COUCHSTORE_SUCCESS) {
+        free(old_header.by_id_root);
+        free(old_header.by_seq_root);
+        free(old_header.local_docs_root);
+    } else {
+        free(db->header.by_id_root);
+        free(db->header.by_seq_root);
+        free(db->header.local_docs_root);
+        db->header = old_header;
+        db->file_pos = old_file_pos;
+    }
+    return errcode;
+}
+
 LIBCOUCHSTORE_API
 const char* couchstore_get_db_filename(Db *db) {
     return db->filename;
@@ -820,7 +886,7 @@ static couchstore_error_t iterate_docinfos(Db *db,
                                            int (*key_ptr_compare)(const void *, const void *),
                                            int (*key_compare)(const sized_buf *k1, const sized_buf *k2),
                                            couchstore_changes_callback_fn callback,
-                                           int fold,
+                                           couchstore_docinfos_options options,
                                            void *ctx)
 {
     // Nothing to do if the tree is empty
@@ -837,13 +903,14 @@ static couchstore_error_t iterate_docinfos(Db *db,
     for (i = 0; i< numDocs; ++i) {
         keyptrs[i] = &keys[i];
     }
+    int fold = (options & RANGES) != 0;
     if (!fold) {
         // Sort the key pointers:
         qsort(keyptrs, numDocs, sizeof(keyptrs[0]), key_ptr_compare);
     }
 
     // Construct the lookup request:
-    lookup_context cbctx = {db, 0, callback, ctx, (tree == db->header.by_id_root), 0, NULL};
+    lookup_context cbctx = {db, options, callback, ctx, (tree == db->header.by_id_root), 0, NULL};
     couchfile_lookup_request rq;
     sized_buf cmptmp;
     rq.cmp.compare = key_compare;
@@ -873,9 +940,7 @@ couchstore_error_t couchstore_docinfos_by_id(Db *db,
 {
     return iterate_docinfos(db, ids, numDocs,
                             db->header.by_id_root, id_ptr_cmp, ebin_cmp,
-                            callback,
-                            (options & RANGES) != 0,
-                            ctx);
+                            callback, options, ctx);
 }
 
 LIBCOUCHSTORE_API
@@ -900,9 +965,7 @@ couchstore_error_t couchstore_docinfos_by_sequence(Db *db,
     
     error_pass(iterate_docinfos(db, keylist, numDocs,
                                 db->header.by_seq_root, seq_ptr_cmp, seq_cmp,
-                                callback,
-                                (options & RANGES) != 0,
-                                ctx));
+                                callback, options, ctx));
 cleanup:
     free(keylist);
     free(keyvalues);
@@ -1045,7 +1108,6 @@ couchstore_error_t couchstore_save_local_document(Db *db, LocalDoc *lDoc)
     rq.reduce = NULL;
     rq.rereduce = NULL;
     rq.db = db;
-    rq.compacting = 0;
 
     nroot = modify_btree(&rq, db->header.local_docs_root, &errcode);
     if (errcode == COUCHSTORE_SUCCESS && nroot != db->header.local_docs_root) {
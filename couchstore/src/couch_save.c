@@ -132,6 +132,59 @@ static void idfetch_update_cb(couchfile_modify_request *rq,
     ctx->actpos++;
 }
 
+static int has_duplicate_ids(const sized_buf **sorted_ids, int numdocs)
+{
+    int ii;
+    for (ii = 1; ii < numdocs; ++ii) {
+        if (ebin_cmp(sorted_ids[ii - 1], sorted_ids[ii]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Writes the indexes of a database without documents bottom-up
+static couchstore_error_t build_indexes(Db *db,
+                                        sized_buf *seqs,
+                                        sized_buf *seqvals,
+                                        const sized_buf **sorted_ids,
+                                        sized_buf *ids,
+                                        sized_buf *idvals,
+                                        int numdocs)
+{
+    couchstore_error_t errcode = COUCHSTORE_SUCCESS;
+    node_pointer *new_id_root = NULL;
+    node_pointer *new_seq_root = NULL;
+    couchfile_builder *idb = btree_builder_new(db, by_id_reduce, by_id_rereduce);
+    couchfile_builder *seqb = btree_builder_new(db, by_seq_reduce, by_seq_rereduce);
+    int ii;
+    error_unless(idb && seqb, COUCHSTORE_ERROR_ALLOC_FAIL);
+
+    for (ii = 0; ii < numdocs; ii++) {
+        ptrdiff_t isorted = sorted_ids[ii] - ids;
+        error_pass(btree_builder_add(idb, &ids[isorted], &idvals[isorted]));
+    }
+    new_id_root = btree_builder_finish(idb, &errcode);
+    error_pass(errcode);
+
+    // The sequence numbers are in ascending order already
+    for (ii = 0; ii < numdocs; ii++) {
+        error_pass(btree_builder_add(seqb, &seqs[ii], &seqvals[ii]));
+    }
+    new_seq_root = btree_builder_finish(seqb, &errcode);
+    error_pass(errcode);
+
+    db->header.by_id_root = new_id_root;
+    db->header.by_seq_root = new_seq_root;
+    new_id_root = new_seq_root = NULL;
+cleanup:
+    free(new_id_root);
+    free(new_seq_root);
+    btree_builder_free(idb);
+    btree_builder_free(seqb);
+    return errcode;
+}
+
 static couchstore_error_t update_indexes(Db *db,
                                          sized_buf *seqs,
                                          sized_buf *seqvals,
@@ -178,6 +231,14 @@ static couchstore_error_t update_indexes(Db *db,
     }
     qsort(sorted_ids, numdocs, sizeof(sorted_ids[0]), &ebin_ptr_compare);
 
+    // A new database is written bottom-up, unless the batch has several
+    // updates of a document: they are left to modify_btree
+    if (db->header.by_id_root == NULL && db->header.by_seq_root == NULL &&
+        !has_duplicate_ids(sorted_ids, numdocs)) {
+        errcode = build_indexes(db, seqs, seqvals, sorted_ids, ids, idvals, numdocs);
+        goto cleanup;
+    }
+
     // Assemble idacts[] array, in sorted order by id:
     for (ii = 0; ii < numdocs; ii++) {
         ptrdiff_t isorted = sorted_ids[ii] - ids;   // recover index of ii'th id in sort order
@@ -199,7 +260,6 @@ static couchstore_error_t update_indexes(Db *db,
     idrq.rereduce = by_id_rereduce;
     idrq.fetch_callback = idfetch_update_cb;
     idrq.db = db;
-    idrq.compacting = 0;
 
     new_id_root = modify_btree(&idrq, db->header.by_id_root, &errcode);
     error_pass(errcode);
@@ -223,7 +283,6 @@ static couchstore_error_t update_indexes(Db *db,
     seqrq.reduce = by_seq_reduce;
     seqrq.rereduce = by_seq_rereduce;
     seqrq.db = db;
-    seqrq.compacting = 0;
 
     new_seq_root = modify_btree(&seqrq, db->header.by_seq_root, &errcode);
     if (errcode != COUCHSTORE_SUCCESS) {
@@ -339,7 +398,11 @@ couchstore_error_t couchstore_save_documents(Db *db,
     idvlist = fatbuf_get(fb, numdocs * sizeof(sized_buf));
 
     for (ii = 0; ii < numdocs; ii++) {
-        seq++;
+        if (options & COUCHSTORE_SEQUENCE_AS_IS) {
+            seq = infos[ii]->db_seq;
+        } else {
+            seq++;
+        }
         if (docs) {
             curdoc = docs[ii];
         } else {
@@ -362,12 +425,18 @@ couchstore_error_t couchstore_save_documents(Db *db,
 
     fatbuf_free(fb);
     if (errcode == COUCHSTORE_SUCCESS) {
-        // Fill in the assigned sequence numbers for caller's later use:
-        seq = db->header.update_seq;
-        for (ii = 0; ii < numdocs; ii++) {
-            infos[ii]->db_seq = ++seq;
+        if (options & COUCHSTORE_SEQUENCE_AS_IS) {
+            if (numdocs > 0 && seq > db->header.update_seq) {
+                db->header.update_seq = seq;
+            }
+        } else {
+            // Fill in the assigned sequence numbers for caller's later use:
+            seq = db->header.update_seq;
+            for (ii = 0; ii < numdocs; ii++) {
+                infos[ii]->db_seq = ++seq;
+            }
+            db->header.update_seq = seq;
         }
-        db->header.update_seq = seq;
     }
 
     return errcode;
@@ -379,3 +448,127 @@ couchstore_error_t couchstore_save_document(Db *db, const Doc *doc,
 {
     return couchstore_save_documents(db, (Doc**)&doc, (DocInfo**)&info, 1, options);
 }
+
+struct _bulk_loader {
+    Db *db;
+    couchfile_builder *id_builder;
+    couchfile_builder *seq_builder;
+    uint64_t seq;
+    /* Copy of the last id added */
+    sized_buf last_id;
+    size_t last_id_capacity;
+    int count;
+    couchstore_error_t error;
+};
+
+static void free_bulk_loader(BulkLoader *loader)
+{
+    btree_builder_free(loader->id_builder);
+    btree_builder_free(loader->seq_builder);
+    free(loader->last_id.buf);
+    free(loader);
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_bulk_load_begin(Db *db, BulkLoader **loader)
+{
+    if (db->header.by_id_root != NULL || db->header.by_seq_root != NULL) {
+        return COUCHSTORE_ERROR_INVALID_ARGUMENTS;
+    }
+    BulkLoader *l = calloc(1, sizeof(BulkLoader));
+    if (l == NULL) {
+        return COUCHSTORE_ERROR_ALLOC_FAIL;
+    }
+    l->db = db;
+    l->seq = db->header.update_seq;
+    l->id_builder = btree_builder_new(db, by_id_reduce, by_id_rereduce);
+    l->seq_builder = btree_builder_new(db, by_seq_reduce, by_seq_rereduce);
+    if (l->id_builder == NULL || l->seq_builder == NULL) {
+        free_bulk_loader(l);
+        return COUCHSTORE_ERROR_ALLOC_FAIL;
+    }
+    *loader = l;
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_bulk_load_document(BulkLoader *loader,
+                                                 const Doc *doc,
+                                                 DocInfo *info,
+                                                 couchstore_save_options options)
+{
+    couchstore_error_t errcode = COUCHSTORE_SUCCESS;
+    sized_buf seqterm, idterm, seqval, idval;
+    fatbuf *fb = NULL;
+    uint64_t seq = loader->seq + 1;
+
+    if (loader->error != COUCHSTORE_SUCCESS) {
+        return loader->error;
+    }
+    if (loader->count > 0 && ebin_cmp(&info->id, &loader->last_id) <= 0) {
+        return COUCHSTORE_ERROR_INVALID_ARGUMENTS;
+    }
+    if (options & COUCHSTORE_SEQUENCE_AS_IS) {
+        if (info->db_seq <= loader->seq) {
+            return COUCHSTORE_ERROR_INVALID_ARGUMENTS;
+        }
+        seq = info->db_seq;
+    }
+
+    if (info->id.size > loader->last_id_capacity) {
+        char *buf = realloc(loader->last_id.buf, info->id.size);
+        if (buf == NULL) {
+            return COUCHSTORE_ERROR_ALLOC_FAIL;
+        }
+        loader->last_id.buf = buf;
+        loader->last_id_capacity = info->id.size;
+    }
+
+    // IMPORTANT: This must match the sizes of the fatbuf_get calls in add_doc_to_update_list!
+    fb = fatbuf_alloc(6 + 44 + info->id.size + info->rev_meta.size
+                      + 44 + 10 + info->rev_meta.size);
+    error_unless(fb, COUCHSTORE_ERROR_ALLOC_FAIL);
+    error_pass(add_doc_to_update_list(loader->db, doc, info, fb,
+                                      &seqterm, &idterm, &seqval, &idval,
+                                      seq, options));
+    error_pass(btree_builder_add(loader->id_builder, &idterm, &idval));
+    error_pass(btree_builder_add(loader->seq_builder, &seqterm, &seqval));
+
+    memcpy(loader->last_id.buf, info->id.buf, info->id.size);
+    loader->last_id.size = info->id.size;
+    loader->count++;
+    loader->seq = seq;
+    info->db_seq = seq;
+cleanup:
+    fatbuf_free(fb);
+    if (errcode != COUCHSTORE_SUCCESS) {
+        // The indexes may be missing the document now
+        loader->error = errcode;
+    }
+    return errcode;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_bulk_load_end(BulkLoader *loader)
+{
+    couchstore_error_t errcode = loader->error;
+    Db *db = loader->db;
+    node_pointer *new_id_root = NULL;
+    node_pointer *new_seq_root = NULL;
+
+    error_pass(errcode);
+    new_id_root = btree_builder_finish(loader->id_builder, &errcode);
+    error_pass(errcode);
+    new_seq_root = btree_builder_finish(loader->seq_builder, &errcode);
+    error_pass(errcode);
+
+    db->header.by_id_root = new_id_root;
+    db->header.by_seq_root = new_seq_root;
+    db->header.update_seq = loader->seq;
+    new_id_root = new_seq_root = NULL;
+cleanup:
+    free(new_id_root);
+    free(new_seq_root);
+    free_bulk_loader(loader);
+    return errcode;
+}
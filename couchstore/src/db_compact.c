@@ -11,9 +11,18 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
 
 #define ID_SORT_CHUNK_SIZE (100 * 1024 * 1024) // 100MB. Make tuneable?
 #define ID_SORT_MAX_RECORD_SIZE 4196
+/* Parallel mode: size of the runs of id records sorted by each thread */
+#define ID_SORT_RUN_SIZE (16 * 1024 * 1024)
+#define ID_SORT_THREADS 3
+/* Max number of catch-up rounds of COUCHSTORE_COMPACT_FLAG_CATCHUP */
+#define CATCHUP_MAX_ROUNDS 5
+/* Number of changed documents copied at a time when catching up */
+#define CATCHUP_BATCH_SIZE 1000
 
 typedef struct extsort_record {
     sized_buf k;
@@ -21,21 +30,54 @@ typedef struct extsort_record {
     char buf[1];
 } extsort_record;
 
+/* A run of id records, packed as: key length (2 bytes), value length
+ * (4 bytes), key, value. */
+typedef struct id_run {
+    char *buf;
+    size_t used;
+    size_t count;
+    /* Once sorted, the run is spilled to this file */
+    FILE *file;
+    struct id_run *next;
+} id_run;
+
+/* Sorts runs of id records on worker threads while they are produced */
+typedef struct id_sorter {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    /* Runs waiting to be sorted */
+    id_run *queue;
+    int queued;
+    /* Sorted runs */
+    id_run *sorted;
+    int nsorted;
+    /* The run being filled */
+    id_run *current;
+    int done;
+    couchstore_error_t error;
+    pthread_t threads[ID_SORT_THREADS];
+    int nthreads;
+} id_sorter;
+
 typedef struct compact_ctx {
     FILE* id_tmp;
-    /* Using this for stuff that doesn't need to live longer than it takes to write
-     * out a b-tree node (the k/v pairs) */
+    id_sorter *sorter;
+    /* Using this for stuff that doesn't need to live longer than it takes to
+     * add an item to the new tree */
     arena *transient_arena;
     const arena_position *transient_zero;
-    /* This is for stuff that lasts the duration of the b-tree writing (node pointers) */
-    arena *persistent_arena;
-    couchfile_modify_result *target_mr;
+    Db *target;
+    couchfile_builder *builder;
     couchstore_compact_flags flags;
 } compact_ctx;
 
 static couchstore_error_t compact_seq_tree(Db* source, Db* target, compact_ctx *ctx);
 static couchstore_error_t compact_localdocs_tree(Db* source, Db* target, compact_ctx *ctx);
 static couchstore_error_t write_id_tree(Db* target, compact_ctx *ctx);
+static couchstore_error_t start_id_sorter(compact_ctx *ctx);
+static couchstore_error_t finish_id_sorter(compact_ctx *ctx);
+static void free_id_sorter(compact_ctx *ctx);
+static couchstore_error_t merge_id_tree(Db* target, compact_ctx *ctx);
 
 couchstore_error_t couchstore_compact_db_ex(Db* source, const char* target_filename,
                                             couchstore_compact_flags flags,
@@ -45,9 +87,12 @@ couchstore_error_t couchstore_compact_db_ex(Db* source, const char* target_filen
     couchstore_error_t errcode;
     compact_ctx ctx;
     ctx.id_tmp = NULL;
+    ctx.sorter = NULL;
+    ctx.target = NULL;
     ctx.flags = flags;
 
     error_pass(couchstore_open_db_ex(target_filename, COUCHSTORE_OPEN_FLAG_CREATE, ops, &target));
+    ctx.target = target;
 
     target->file_pos = 1;
     target->header.update_seq = source->header.update_seq;
@@ -60,24 +105,50 @@ couchstore_error_t couchstore_compact_db_ex(Db* source, const char* target_filen
     target->header.purge_ptr = source->header.purge_ptr;
 
     if(source->header.by_seq_root) {
-        ctx.id_tmp = tmpfile();
-        if(!ctx.id_tmp) {
-            error_pass(COUCHSTORE_ERROR_OPEN_FILE);
+        if(flags & COUCHSTORE_COMPACT_FLAG_PARALLEL) {
+            error_pass(start_id_sorter(&ctx));
+            errcode = compact_seq_tree(source, target, &ctx);
+            couchstore_error_t sorterr = finish_id_sorter(&ctx);
+            error_pass(errcode);
+            error_pass(sorterr);
+            error_pass(merge_id_tree(target, &ctx));
+            free_id_sorter(&ctx);
+        } else {
+            ctx.id_tmp = tmpfile();
+            if(!ctx.id_tmp) {
+                error_pass(COUCHSTORE_ERROR_OPEN_FILE);
+            }
+            error_pass(compact_seq_tree(source, target, &ctx));
+            error_pass(write_id_tree(target, &ctx));
+            fclose(ctx.id_tmp);
+            ctx.id_tmp = NULL;
         }
-        error_pass(compact_seq_tree(source, target, &ctx));
-        error_pass(write_id_tree(target, &ctx));
-        fclose(ctx.id_tmp);
-        ctx.id_tmp = NULL;
     }
 
     if(source->header.local_docs_root) {
         error_pass(compact_localdocs_tree(source, target, &ctx));
     }
     error_pass(couchstore_commit(target));
+
+    if(flags & COUCHSTORE_COMPACT_FLAG_CATCHUP) {
+        // Bounded: writers that keep up with us are left to the caller
+        int round;
+        for(round = 0; round < CATCHUP_MAX_ROUNDS; ++round) {
+            uint64_t seq = target->header.update_seq;
+            error_pass(couchstore_compact_catchup(source, target));
+            if(target->header.update_seq == seq) {
+                break;
+            }
+        }
+    }
 cleanup:
     if(ctx.id_tmp) {
         fclose(ctx.id_tmp);
     }
+    if(ctx.sorter) {
+        finish_id_sorter(&ctx);
+        free_id_sorter(&ctx);
+    }
     couchstore_close_db(target);
     if(errcode != COUCHSTORE_SUCCESS && target != NULL) {
         unlink(target_filename);
@@ -148,26 +219,16 @@ static couchstore_error_t write_id_tree(Db* target, compact_ctx *ctx)
 {
     int readerr = 0;
     couchstore_error_t errcode = COUCHSTORE_SUCCESS;
-    ctx->transient_arena = new_arena(0);
-    ctx->persistent_arena = new_arena(0);
-    ctx->transient_zero = arena_mark(ctx->transient_arena);
+    char *buf = malloc(ID_SORT_MAX_RECORD_SIZE);
+    ctx->builder = btree_builder_new(target, by_id_reduce, by_id_rereduce);
+    error_unless(buf && ctx->builder, COUCHSTORE_ERROR_ALLOC_FAIL);
+
     rewind(ctx->id_tmp);
     error_pass(merge_sort(ctx->id_tmp, ctx->id_tmp, read_id_record, write_id_record, compare_id_record,
                           NULL, ID_SORT_MAX_RECORD_SIZE, ID_SORT_CHUNK_SIZE, NULL));
 
     rewind(ctx->id_tmp);
 
-    compare_info idcmp;
-    sized_buf tmp;
-    idcmp.compare = ebin_cmp;
-    idcmp.arg = &tmp;
-
-    ctx->target_mr = new_btree_modres(ctx->persistent_arena, ctx->transient_arena, target,
-            &idcmp, by_id_reduce, by_id_rereduce);
-    if(ctx->target_mr == NULL) {
-        error_pass(COUCHSTORE_ERROR_ALLOC_FAIL);
-    }
-
     uint16_t klen;
     uint32_t vlen;
     sized_buf k, v;
@@ -178,64 +239,479 @@ static couchstore_error_t write_id_tree(Db* target, compact_ctx *ctx)
         if(fread(&vlen, 4, 1, ctx->id_tmp) != 1) {
             break;
         }
+        error_unless(klen + vlen <= ID_SORT_MAX_RECORD_SIZE, COUCHSTORE_ERROR_READ);
         k.size = klen;
-        k.buf = arena_alloc(ctx->transient_arena, klen);
+        k.buf = buf;
         v.size = vlen;
-        v.buf = arena_alloc(ctx->transient_arena, vlen);
-        if(fread(k.buf, klen, 1, ctx->id_tmp) != 1) {
-            error_pass(COUCHSTORE_ERROR_READ);
-        }
-        if(fread(v.buf, vlen, 1, ctx->id_tmp) != 1) {
+        v.buf = buf + klen;
+        if(fread(buf, klen + vlen, 1, ctx->id_tmp) != 1) {
             error_pass(COUCHSTORE_ERROR_READ);
         }
         //printf("K: '%.*s'\n", klen, k.buf);
-        mr_push_item(&k, &v, ctx->target_mr);
-        if(ctx->target_mr->count == 0) {
-            /* No items queued, we must have just flushed. We can safely rewind the transient arena. */
-            arena_free_from_mark(ctx->transient_arena, ctx->transient_zero);
-        }
+        error_pass(btree_builder_add(ctx->builder, &k, &v));
     }
     readerr = ferror(ctx->id_tmp);
     if(readerr != 0 && readerr != EOF) {
         error_pass(COUCHSTORE_ERROR_READ);
     }
 
-    target->header.by_id_root = complete_new_btree(ctx->target_mr, &errcode);
+    target->header.by_id_root = btree_builder_finish(ctx->builder, &errcode);
 cleanup:
-    delete_arena(ctx->transient_arena);
-    delete_arena(ctx->persistent_arena);
+    btree_builder_free(ctx->builder);
+    ctx->builder = NULL;
+    free(buf);
     return errcode;
 }
 
-//Copy buffer to arena
-static sized_buf* arena_copy_buf(arena* a, sized_buf *src)
+static id_run *new_id_run(void)
 {
-    sized_buf *nbuf = arena_alloc(a, sizeof(sized_buf));
-    if(nbuf == NULL) {
+    id_run *run = calloc(1, sizeof(id_run));
+    if(run == NULL) {
         return NULL;
     }
-    nbuf->buf = arena_alloc(a, src->size);
-    if(nbuf->buf == NULL) {
+    run->buf = malloc(ID_SORT_RUN_SIZE);
+    if(run->buf == NULL) {
+        free(run);
         return NULL;
     }
-    nbuf->size = src->size;
-    memcpy(nbuf->buf, src->buf, src->size);
-    return nbuf;
+    return run;
 }
 
-static couchstore_error_t output_seqtree_item(sized_buf* k, sized_buf *v, compact_ctx *ctx)
+static void free_id_run(id_run *run)
+{
+    if(run->file) {
+        fclose(run->file);
+    }
+    free(run->buf);
+    free(run);
+}
+
+static void record_key(const char *rec, sized_buf *k)
+{
+    uint16_t klen;
+    memcpy(&klen, rec, 2);
+    k->size = klen;
+    k->buf = (char *) rec + 6;
+}
+
+static size_t record_size(const char *rec)
+{
+    uint16_t klen;
+    uint32_t vlen;
+    memcpy(&klen, rec, 2);
+    memcpy(&vlen, rec + 2, 4);
+    return 6 + klen + vlen;
+}
+
+static int compare_record_ptrs(const void *a, const void *b)
+{
+    sized_buf k1, k2;
+    record_key(*(const char * const *) a, &k1);
+    record_key(*(const char * const *) b, &k2);
+    return ebin_cmp(&k1, &k2);
+}
+
+/* Sorts a run in memory and spills it to a temporary file */
+static couchstore_error_t sort_id_run(id_run *run)
 {
     couchstore_error_t errcode = COUCHSTORE_SUCCESS;
-    sized_buf *k_c = arena_copy_buf(ctx->transient_arena, k);
-    if(k_c == NULL) {
-        error_pass(COUCHSTORE_ERROR_READ);
+    const char **recs = malloc(run->count * sizeof(char*));
+    error_unless(recs, COUCHSTORE_ERROR_ALLOC_FAIL);
+
+    size_t ii, pos = 0;
+    for(ii = 0; ii < run->count; ++ii) {
+        recs[ii] = run->buf + pos;
+        pos += record_size(recs[ii]);
     }
-    sized_buf *v_c = arena_copy_buf(ctx->transient_arena, v);
-    if(v_c == NULL) {
-        error_pass(COUCHSTORE_ERROR_READ);
+    qsort(recs, run->count, sizeof(char*), compare_record_ptrs);
+
+    run->file = tmpfile();
+    error_unless(run->file, COUCHSTORE_ERROR_OPEN_FILE);
+    for(ii = 0; ii < run->count; ++ii) {
+        error_unless(fwrite(recs[ii], record_size(recs[ii]), 1, run->file) == 1,
+                     COUCHSTORE_ERROR_WRITE);
+    }
+    error_unless(fflush(run->file) == 0, COUCHSTORE_ERROR_WRITE);
+    rewind(run->file);
+
+cleanup:
+    free(recs);
+    free(run->buf);
+    run->buf = NULL;
+    return errcode;
+}
+
+static void *id_sorter_thread(void *arg)
+{
+    id_sorter *sorter = arg;
+    pthread_mutex_lock(&sorter->mutex);
+    while(1) {
+        while(sorter->queue == NULL && !sorter->done) {
+            pthread_cond_wait(&sorter->cond, &sorter->mutex);
+        }
+        id_run *run = sorter->queue;
+        if(run == NULL) {
+            break;
+        }
+        sorter->queue = run->next;
+        --sorter->queued;
+        // Room for another run in the queue
+        pthread_cond_broadcast(&sorter->cond);
+        pthread_mutex_unlock(&sorter->mutex);
+
+        couchstore_error_t errcode = sort_id_run(run);
+
+        pthread_mutex_lock(&sorter->mutex);
+        if(errcode != COUCHSTORE_SUCCESS && sorter->error == COUCHSTORE_SUCCESS) {
+            sorter->error = errcode;
+        }
+        run->next = sorter->sorted;
+        sorter->sorted = run;
+        ++sorter->nsorted;
+    }
+    pthread_mutex_unlock(&sorter->mutex);
+    return NULL;
+}
+
+static couchstore_error_t start_id_sorter(compact_ctx *ctx)
+{
+    id_sorter *sorter = calloc(1, sizeof(id_sorter));
+    if(sorter == NULL) {
+        return COUCHSTORE_ERROR_ALLOC_FAIL;
+    }
+    pthread_mutex_init(&sorter->mutex, NULL);
+    pthread_cond_init(&sorter->cond, NULL);
+    ctx->sorter = sorter;
+
+    sorter->current = new_id_run();
+    if(sorter->current == NULL) {
+        return COUCHSTORE_ERROR_ALLOC_FAIL;
+    }
+    for(; sorter->nthreads < ID_SORT_THREADS; ++sorter->nthreads) {
+        if(pthread_create(&sorter->threads[sorter->nthreads], NULL,
+                          id_sorter_thread, sorter) != 0) {
+            break;
+        }
+    }
+    return sorter->nthreads > 0 ? COUCHSTORE_SUCCESS : COUCHSTORE_ERROR_ALLOC_FAIL;
+}
+
+/* Queues the current run for sorting, waiting while all the threads are busy
+   so that the memory used by the runs stays bounded */
+static couchstore_error_t submit_id_run(id_sorter *sorter)
+{
+    couchstore_error_t errcode;
+    pthread_mutex_lock(&sorter->mutex);
+    while(sorter->queued >= sorter->nthreads && sorter->error == COUCHSTORE_SUCCESS) {
+        pthread_cond_wait(&sorter->cond, &sorter->mutex);
+    }
+    errcode = sorter->error;
+    if(errcode == COUCHSTORE_SUCCESS) {
+        id_run **tail = &sorter->queue;
+        while(*tail) {
+            tail = &(*tail)->next;
+        }
+        *tail = sorter->current;
+        ++sorter->queued;
+        sorter->current = NULL;
+        pthread_cond_broadcast(&sorter->cond);
+    }
+    pthread_mutex_unlock(&sorter->mutex);
+    return errcode;
+}
+
+static couchstore_error_t add_id_record(id_sorter *sorter, const sized_buf *k, const sized_buf *v)
+{
+    uint16_t klen = (uint16_t) k->size;
+    uint32_t vlen = (uint32_t) v->size;
+    size_t size = 6 + klen + vlen;
+    if(size > ID_SORT_RUN_SIZE) {
+        return COUCHSTORE_ERROR_WRITE;
+    }
+
+    if(sorter->current && sorter->current->used + size > ID_SORT_RUN_SIZE) {
+        couchstore_error_t errcode = submit_id_run(sorter);
+        if(errcode != COUCHSTORE_SUCCESS) {
+            return errcode;
+        }
+    }
+    if(sorter->current == NULL && (sorter->current = new_id_run()) == NULL) {
+        return COUCHSTORE_ERROR_ALLOC_FAIL;
+    }
+
+    id_run *run = sorter->current;
+    char *rec = run->buf + run->used;
+    memcpy(rec, &klen, 2);
+    memcpy(rec + 2, &vlen, 4);
+    memcpy(rec + 6, k->buf, klen);
+    memcpy(rec + 6 + klen, v->buf, vlen);
+    run->used += size;
+    ++run->count;
+    return COUCHSTORE_SUCCESS;
+}
+
+/* Sorts the last run and waits for the threads to finish */
+static couchstore_error_t finish_id_sorter(compact_ctx *ctx)
+{
+    id_sorter *sorter = ctx->sorter;
+    couchstore_error_t errcode = COUCHSTORE_SUCCESS;
+    if(sorter->current && sorter->current->count > 0 && sorter->nthreads > 0) {
+        errcode = submit_id_run(sorter);
+    }
+
+    pthread_mutex_lock(&sorter->mutex);
+    sorter->done = 1;
+    pthread_cond_broadcast(&sorter->cond);
+    pthread_mutex_unlock(&sorter->mutex);
+    for(int ii = 0; ii < sorter->nthreads; ++ii) {
+        pthread_join(sorter->threads[ii], NULL);
+    }
+    sorter->nthreads = 0;
+
+    if(errcode == COUCHSTORE_SUCCESS) {
+        errcode = sorter->error;
+    }
+    return errcode;
+}
+
+static void free_id_sorter(compact_ctx *ctx)
+{
+    id_sorter *sorter = ctx->sorter;
+    id_run *lists[] = { sorter->queue, sorter->sorted, sorter->current };
+    for(size_t ii = 0; ii < sizeof(lists) / sizeof(lists[0]); ++ii) {
+        id_run *run = lists[ii];
+        while(run) {
+            id_run *next = run->next;
+            free_id_run(run);
+            run = next;
+        }
+    }
+    pthread_cond_destroy(&sorter->cond);
+    pthread_mutex_destroy(&sorter->mutex);
+    free(sorter);
+    ctx->sorter = NULL;
+}
+
+/* The next record of a sorted run being merged */
+typedef struct run_cursor {
+    FILE *file;
+    sized_buf k;
+    sized_buf v;
+    char *buf;
+    size_t bufsize;
+} run_cursor;
+
+/* Reads the next record of a run; returns 0 at the end of the run */
+static int run_cursor_next(run_cursor *c, couchstore_error_t *errcode)
+{
+    uint16_t klen;
+    uint32_t vlen;
+    if(fread(&klen, 2, 1, c->file) != 1) {
+        if(ferror(c->file)) {
+            *errcode = COUCHSTORE_ERROR_READ;
+        }
+        return 0;
+    }
+    if(fread(&vlen, 4, 1, c->file) != 1) {
+        *errcode = COUCHSTORE_ERROR_READ;
+        return 0;
+    }
+    if(klen + vlen > c->bufsize) {
+        char *buf = realloc(c->buf, klen + vlen);
+        if(buf == NULL) {
+            *errcode = COUCHSTORE_ERROR_ALLOC_FAIL;
+            return 0;
+        }
+        c->buf = buf;
+        c->bufsize = klen + vlen;
+    }
+    if(fread(c->buf, klen + vlen, 1, c->file) != 1) {
+        *errcode = COUCHSTORE_ERROR_READ;
+        return 0;
+    }
+    c->k.buf = c->buf;
+    c->k.size = klen;
+    c->v.buf = c->buf + klen;
+    c->v.size = vlen;
+    return 1;
+}
+
+static void sift_down(run_cursor **heap, int n, int pos)
+{
+    while(1) {
+        int smallest = pos;
+        int l = 2 * pos + 1, r = 2 * pos + 2;
+        if(l < n && ebin_cmp(&heap[l]->k, &heap[smallest]->k) < 0) {
+            smallest = l;
+        }
+        if(r < n && ebin_cmp(&heap[r]->k, &heap[smallest]->k) < 0) {
+            smallest = r;
+        }
+        if(smallest == pos) {
+            return;
+        }
+        run_cursor *tmp = heap[pos];
+        heap[pos] = heap[smallest];
+        heap[smallest] = tmp;
+        pos = smallest;
+    }
+}
+
+/* Builds the id tree from a k-way merge of the sorted runs */
+static couchstore_error_t merge_id_tree(Db* target, compact_ctx *ctx)
+{
+    couchstore_error_t errcode = COUCHSTORE_SUCCESS;
+    id_sorter *sorter = ctx->sorter;
+    int nruns = sorter->nsorted, n = 0;
+    run_cursor *cursors = calloc(nruns > 0 ? nruns : 1, sizeof(run_cursor));
+    run_cursor **heap = calloc(nruns > 0 ? nruns : 1, sizeof(run_cursor*));
+    ctx->builder = btree_builder_new(target, by_id_reduce, by_id_rereduce);
+    error_unless(cursors && heap && ctx->builder, COUCHSTORE_ERROR_ALLOC_FAIL);
+
+    id_run *run = sorter->sorted;
+    for(int ii = 0; ii < nruns; ++ii, run = run->next) {
+        cursors[ii].file = run->file;
+        if(run_cursor_next(&cursors[ii], &errcode)) {
+            heap[n++] = &cursors[ii];
+        }
+        error_pass(errcode);
+    }
+    for(int ii = n / 2 - 1; ii >= 0; --ii) {
+        sift_down(heap, n, ii);
+    }
+
+    while(n > 0) {
+        run_cursor *c = heap[0];
+        error_pass(btree_builder_add(ctx->builder, &c->k, &c->v));
+
+        if(!run_cursor_next(c, &errcode)) {
+            error_pass(errcode);
+            heap[0] = heap[--n];
+        }
+        sift_down(heap, n, 0);
+    }
+
+    target->header.by_id_root = btree_builder_finish(ctx->builder, &errcode);
+cleanup:
+    btree_builder_free(ctx->builder);
+    ctx->builder = NULL;
+    if(cursors) {
+        for(int ii = 0; ii < nruns; ++ii) {
+            free(cursors[ii].buf);
+        }
+    }
+    free(cursors);
+    free(heap);
+    return errcode;
+}
+
+typedef struct catchup_ctx {
+    Db *target;
+    DocInfo *infos[CATCHUP_BATCH_SIZE];
+    Doc *docs[CATCHUP_BATCH_SIZE];
+    unsigned count;
+    couchstore_error_t errcode;
+} catchup_ctx;
+
+static couchstore_error_t flush_catchup_batch(Db *source, catchup_ctx *ctx)
+{
+    couchstore_error_t errcode = COUCHSTORE_SUCCESS;
+    unsigned ii;
+    for(ii = 0; ii < ctx->count; ++ii) {
+        ctx->docs[ii] = NULL;
+    }
+    for(ii = 0; ii < ctx->count; ++ii) {
+        if(ctx->infos[ii]->bp != 0) {
+            // Raw copy: the content_meta of the info tells if it is compressed
+            error_pass(couchstore_open_doc_with_docinfo(source, ctx->infos[ii],
+                                                        &ctx->docs[ii], 0));
+        }
+    }
+    for(ii = 0; ii < ctx->count && errcode == COUCHSTORE_SUCCESS; ++ii) {
+        // Deletions without a body are saved one at a time, as a NULL
+        // document can't be mixed with bodies in one batch
+        if(ctx->docs[ii] == NULL) {
+            errcode = couchstore_save_document(ctx->target, NULL, ctx->infos[ii],
+                                               COUCHSTORE_SEQUENCE_AS_IS);
+        } else {
+            unsigned end = ii;
+            while(end < ctx->count && ctx->docs[end] != NULL) {
+                ++end;
+            }
+            errcode = couchstore_save_documents(ctx->target, ctx->docs + ii, ctx->infos + ii,
+                                                end - ii, COUCHSTORE_SEQUENCE_AS_IS);
+            ii = end - 1;
+        }
+    }
+cleanup:
+    for(ii = 0; ii < ctx->count; ++ii) {
+        couchstore_free_document(ctx->docs[ii]);
+        couchstore_free_docinfo(ctx->infos[ii]);
+    }
+    ctx->count = 0;
+    return errcode;
+}
+
+static int catchup_changes_cb(Db *db, DocInfo *info, void *ctx)
+{
+    catchup_ctx *cctx = ctx;
+    if(cctx->errcode != COUCHSTORE_SUCCESS) {
+        // Stop the iteration, which frees the info we didn't take
+        return cctx->errcode;
+    }
+    // The batch owns the info from here on, even if flushing it fails
+    cctx->infos[cctx->count++] = info;
+    if(cctx->count == CATCHUP_BATCH_SIZE) {
+        cctx->errcode = flush_catchup_batch(db, cctx);
+    }
+    return 1;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_compact_catchup(Db* source, Db* target)
+{
+    couchstore_error_t errcode;
+    catchup_ctx *ctx = NULL;
+
+    error_pass(couchstore_refresh_db(source));
+    if(source->header.update_seq <= target->header.update_seq) {
+        return COUCHSTORE_SUCCESS;
+    }
+
+    ctx = calloc(1, sizeof(catchup_ctx));
+    error_unless(ctx, COUCHSTORE_ERROR_ALLOC_FAIL);
+    ctx->target = target;
+    error_pass(couchstore_changes_since(source, target->header.update_seq + 1, 0,
+                                        catchup_changes_cb, ctx));
+    error_pass(ctx->errcode);
+    error_pass(flush_catchup_batch(source, ctx));
+
+    // The local documents are few: copy them all again
+    if(source->header.local_docs_root) {
+        compact_ctx cctx;
+        memset(&cctx, 0, sizeof(cctx));
+        free(target->header.local_docs_root);
+        target->header.local_docs_root = NULL;
+        error_pass(compact_localdocs_tree(source, target, &cctx));
+    }
+    target->header.update_seq = source->header.update_seq;
+    error_pass(couchstore_commit(target));
+
+cleanup:
+    if(ctx) {
+        // Left over after a failed iteration
+        for(unsigned ii = 0; ii < ctx->count; ++ii) {
+            couchstore_free_docinfo(ctx->infos[ii]);
+        }
+        free(ctx);
     }
+    return errcode;
+}
 
-    error_pass(mr_push_item(k_c, v_c, ctx->target_mr));
+static couchstore_error_t output_seqtree_item(sized_buf* k, sized_buf *v, compact_ctx *ctx)
+{
+    couchstore_error_t errcode = COUCHSTORE_SUCCESS;
+    error_pass(btree_builder_add(ctx->builder, k, v));
     
     // Decode the by-sequence index value. See the file format doc or
     // assemble_id_index_value in couch_db.c:
@@ -250,6 +726,7 @@ static couchstore_error_t output_seqtree_item(sized_buf* k, sized_buf *v, compac
     id_k.size = idsize;
     id_v.size = sizeof(raw_id_index_value) + revMetaSize;
     id_v.buf = arena_alloc(ctx->transient_arena, id_v.size);
+    error_unless(id_v.buf, COUCHSTORE_ERROR_ALLOC_FAIL);
 
     raw_id_index_value *raw = (raw_id_index_value*)id_v.buf;
     raw->db_seq = *(raw_48*)k->buf;  //Copy db seq from seq tree key
@@ -261,17 +738,17 @@ static couchstore_error_t output_seqtree_item(sized_buf* k, sized_buf *v, compac
 
     uint16_t klen = (uint16_t) id_k.size;
     uint32_t vlen = (uint32_t) id_v.size;
-    error_unless(fwrite(&klen, 2, 1, ctx->id_tmp) == 1, COUCHSTORE_ERROR_WRITE);
-    error_unless(fwrite(&vlen, 4, 1, ctx->id_tmp) == 1, COUCHSTORE_ERROR_WRITE);
-    error_unless(fwrite(id_k.buf, id_k.size, 1, ctx->id_tmp) == 1, COUCHSTORE_ERROR_WRITE);
-    error_unless(fwrite(id_v.buf, id_v.size, 1, ctx->id_tmp) == 1, COUCHSTORE_ERROR_WRITE);
-
-    if(ctx->target_mr->count == 0) {
-        /* No items queued, we must have just flushed. We can safely rewind the transient arena. */
-        arena_free_from_mark(ctx->transient_arena, ctx->transient_zero);
+    if(ctx->sorter) {
+        error_pass(add_id_record(ctx->sorter, &id_k, &id_v));
+    } else {
+        error_unless(fwrite(&klen, 2, 1, ctx->id_tmp) == 1, COUCHSTORE_ERROR_WRITE);
+        error_unless(fwrite(&vlen, 4, 1, ctx->id_tmp) == 1, COUCHSTORE_ERROR_WRITE);
+        error_unless(fwrite(id_k.buf, id_k.size, 1, ctx->id_tmp) == 1, COUCHSTORE_ERROR_WRITE);
+        error_unless(fwrite(id_v.buf, id_v.size, 1, ctx->id_tmp) == 1, COUCHSTORE_ERROR_WRITE);
     }
 
 cleanup:
+    arena_free_from_mark(ctx->transient_arena, ctx->transient_zero);
     return errcode;
 }
 
@@ -300,11 +777,23 @@ static couchstore_error_t compact_seq_fetchcb(couchfile_lookup_request *rq, void
         }
         item.size = itemsize;
 
-        db_write_buf(ctx->target_mr->rq->db, &item, &new_bp, &new_size);
+        db_write_buf(ctx->target, &item, &new_bp, &new_size);
+        free(item.buf);
+
+        // v may point into a cached node shared with other readers of the
+        // source file, so patch a copy of it
+        sized_buf copy;
+        copy.size = v->size;
+        copy.buf = arena_alloc(ctx->transient_arena, copy.size);
+        if(copy.buf == NULL) {
+            return COUCHSTORE_ERROR_ALLOC_FAIL;
+        }
+        memcpy(copy.buf, v->buf, copy.size);
+        v = &copy;
 
+        rawSeq = (raw_seq_index_value*)copy.buf;
         bpWithDeleted = (bpWithDeleted & BP_DELETED_FLAG) | new_bp;  //Preserve high bit
         rawSeq->bp = encode_raw48(bpWithDeleted);
-        free(item.buf);
     }
 
     return output_seqtree_item(k, v, ctx);
@@ -314,9 +803,8 @@ static couchstore_error_t compact_seq_tree(Db* source, Db* target, compact_ctx *
 {
     couchstore_error_t errcode;
     ctx->transient_arena = new_arena(0);
-    ctx->persistent_arena = new_arena(0);
-    error_unless(ctx->transient_arena, COUCHSTORE_ERROR_ALLOC_FAIL);
-    error_unless(ctx->persistent_arena, COUCHSTORE_ERROR_ALLOC_FAIL);
+    ctx->builder = btree_builder_new(target, by_seq_reduce, by_seq_rereduce);
+    error_unless(ctx->transient_arena && ctx->builder, COUCHSTORE_ERROR_ALLOC_FAIL);
     ctx->transient_zero = arena_mark(ctx->transient_arena);
     compare_info seqcmp;
     sized_buf tmp;
@@ -329,12 +817,6 @@ static couchstore_error_t compact_seq_tree(Db* source, Db* target, compact_ctx *
     low_key.size = 6;
     sized_buf *low_key_list = &low_key;
 
-    ctx->target_mr = new_btree_modres(ctx->persistent_arena, ctx->transient_arena, target,
-            &seqcmp, by_seq_reduce, by_seq_rereduce);
-    if(ctx->target_mr == NULL) {
-        error_pass(COUCHSTORE_ERROR_ALLOC_FAIL);
-    }
-
     srcfold.cmp = seqcmp;
     srcfold.db = source;
     srcfold.num_keys = 1;
@@ -347,10 +829,11 @@ static couchstore_error_t compact_seq_tree(Db* source, Db* target, compact_ctx *
 
     errcode = btree_lookup(&srcfold, source->header.by_seq_root->pointer);
     if(errcode == COUCHSTORE_SUCCESS) {
-        target->header.by_seq_root = complete_new_btree(ctx->target_mr, &errcode);
+        target->header.by_seq_root = btree_builder_finish(ctx->builder, &errcode);
     }
 cleanup:
-    delete_arena(ctx->persistent_arena);
+    btree_builder_free(ctx->builder);
+    ctx->builder = NULL;
     delete_arena(ctx->transient_arena);
     return errcode;
 }
@@ -359,15 +842,14 @@ static couchstore_error_t compact_localdocs_fetchcb(couchfile_lookup_request *rq
 {
     compact_ctx *ctx = (compact_ctx *) rq->callback_ctx;
     //printf("V: '%.*s'\n", v->size, v->buf);
-    return mr_push_item(arena_copy_buf(ctx->persistent_arena, k),
-            arena_copy_buf(ctx->persistent_arena, v), ctx->target_mr);
+    return btree_builder_add(ctx->builder, k, v);
 }
 
 static couchstore_error_t compact_localdocs_tree(Db* source, Db* target, compact_ctx *ctx)
 {
     couchstore_error_t errcode;
-    ctx->persistent_arena = new_arena(0);
-    error_unless(ctx->persistent_arena, COUCHSTORE_ERROR_ALLOC_FAIL);
+    ctx->builder = btree_builder_new(target, NULL, NULL);
+    error_unless(ctx->builder, COUCHSTORE_ERROR_ALLOC_FAIL);
     compare_info idcmp;
     sized_buf tmp;
     idcmp.compare = ebin_cmp;
@@ -379,12 +861,6 @@ static couchstore_error_t compact_localdocs_tree(Db* source, Db* target, compact
     low_key.size = 0;
     sized_buf *low_key_list = &low_key;
 
-    ctx->target_mr = new_btree_modres(ctx->persistent_arena, NULL, target,
-            &idcmp, NULL, NULL);
-    if(ctx->target_mr == NULL) {
-        error_pass(COUCHSTORE_ERROR_ALLOC_FAIL);
-    }
-
     srcfold.cmp = idcmp;
     srcfold.db = source;
     srcfold.num_keys = 1;
@@ -397,10 +873,11 @@ static couchstore_error_t compact_localdocs_tree(Db* source, Db* target, compact
 
     errcode = btree_lookup(&srcfold, source->header.local_docs_root->pointer);
     if(errcode == COUCHSTORE_SUCCESS) {
-        target->header.local_docs_root = complete_new_btree(ctx->target_mr, &errcode);
+        target->header.local_docs_root = btree_builder_finish(ctx->builder, &errcode);
     }
 cleanup:
-    delete_arena(ctx->persistent_arena);
+    btree_builder_free(ctx->builder);
+    ctx->builder = NULL;
     return errcode;
 }
 
@@ -51,6 +51,15 @@ extern "C" {
 #endif
     };
 
+    /** Identity of a database file in the node cache (all zero if its
+        nodes can't be cached). The generation tells apart the successive
+        files an inode is reused for. */
+    typedef struct {
+        uint64_t dev;
+        uint64_t ino;
+        uint64_t generation;
+    } node_cache_file;
+
     struct _db {
         uint64_t file_pos;
         const couch_file_ops *file_ops;
@@ -58,6 +67,7 @@ extern "C" {
         const char* filename;
         db_header header;
         void *userdata;
+        node_cache_file cache_file;
     };
 
 
@@ -18,9 +18,33 @@
 #endif
 
 
-#define MAX_READ_BUFFERS 8
 #define WRITE_BUFFER_CAPACITY (128*1024)
-#define READ_BUFFER_CAPACITY (8*1024)
+
+// Defaults of the read buffer pool shared by all the files of the process:
+#define DEFAULT_POOL_SIZE (8*1024*1024)
+#define DEFAULT_BLOCK_SIZE (8*1024)
+#define DEFAULT_MAX_READAHEAD (256*1024)
+
+// Max number of blocks a file holds; beyond that it recycles its own. With
+// many files open, a file's share is the pool's blocks divided among them.
+// A file below its share takes blocks from the files above theirs once the
+// pool is used up, and a file that can't get any block from the pool
+// allocates one of its own:
+#define MAX_FILE_BLOCKS 32
+// Number of slots of the per-file index of blocks (a power of 2):
+#define INDEX_SLOTS 64
+// Number of consecutive forward reads that make an access sequential:
+#define SEQ_THRESHOLD 4
+// Number of reads of a run, its first one and those moving forward from it,
+// that earn it one of the streams:
+#define STREAM_THRESHOLD 3
+// Number of sequential streams tracked per file (such as the leaves of a
+// B-tree and the documents they point to, read alternately by a scan):
+#define READ_STREAMS 4
+// Number of new runs followed per file until they become streams:
+#define READ_PROBES 2
+// Number of hits a file counts before adding them to the pool's counters:
+#define STATS_BATCH 256
 
 #ifdef min
 #undef min
@@ -32,34 +56,102 @@ static inline ssize_t min(ssize_t a, ssize_t b) {return a < b ? a : b;}
 typedef struct file_buffer {
     struct file_buffer* prev;
     struct file_buffer* next;
+    struct file_buffer* hnext;
     struct buffered_file_handle *owner;
     size_t capacity;
     size_t length;
     cs_off_t offset;
     uint8_t dirty;
+    uint8_t pooled;
     uint8_t bytes[1];
 } file_buffer;
 
 
+// A run of reads moving forward through the file:
+typedef struct read_stream {
+    cs_off_t last_offset;
+    cs_off_t next_offset;
+    unsigned seq_reads;
+    uint64_t last_used;
+    // Read-ahead buffer, and the size of its next load:
+    struct file_buffer* buffer;
+    size_t window;
+} read_stream;
+
+
+typedef struct read_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t readaheads;
+    uint64_t bytes_requested;
+    uint64_t bytes_read;
+} read_stats;
+
+
 // How I interpret a couch_file_handle:
 typedef struct buffered_file_handle {
     const couch_file_ops* raw_ops;
     couch_file_handle raw_ops_handle;
-    unsigned nbuffers;
     file_buffer* write_buffer;
+    // Read blocks, most recently used first, and indexed by offset:
     file_buffer* first_buffer;
+    file_buffer* last_buffer;
+    file_buffer* index[INDEX_SLOTS];
+    unsigned nbuffers;
+    // Pool settings when the handle was created:
+    size_t block_size;
+    size_t max_readahead;
+    // Detection of sequential access, and its read-ahead; new runs are
+    // followed by the probes until they take one of the streams:
+    read_stream streams[READ_STREAMS];
+    read_stream probes[READ_PROBES];
+    read_stream* stream;
+    uint64_t clock;
+    read_stats stats;
+    // Protects the read blocks, which other files may take away:
+    pthread_mutex_t lock;
+    // Links of the list of open files kept by the pool:
+    struct buffered_file_handle* pool_prev;
+    struct buffered_file_handle* pool_next;
 } buffered_file_handle;
 
 
+// The read buffers of all the files are allocated from a pool of limited
+// size; idle buffers of the current block size are kept for reuse.
+static struct {
+    pthread_mutex_t mutex;
+    size_t max_size;
+    size_t block_size;
+    size_t max_readahead;
+    size_t size;
+    file_buffer* free_blocks;
+    read_stats stats;
+    // The open files, and the one to look at first for blocks to take:
+    buffered_file_handle* files;
+    size_t nfiles;
+    buffered_file_handle* steal_from;
+} pool = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .max_size = DEFAULT_POOL_SIZE,
+    .block_size = DEFAULT_BLOCK_SIZE,
+    .max_readahead = DEFAULT_MAX_READAHEAD
+};
+
+
+static inline size_t buffer_size(size_t capacity) {
+    return sizeof(file_buffer) + capacity;
+}
+
 static file_buffer* new_buffer(buffered_file_handle* owner, size_t capacity) {
-    file_buffer *buf = malloc(sizeof(file_buffer) + capacity);
+    file_buffer *buf = malloc(buffer_size(capacity));
     if (buf) {
-        buf->prev = buf->next = NULL;
+        buf->prev = buf->next = buf->hnext = NULL;
         buf->owner = owner;
         buf->capacity = capacity;
         buf->length = 0;
         buf->offset = 0;
         buf->dirty = 0;
+        buf->pooled = 0;
     }
 #if LOG_BUFFER
     fprintf(stderr, "BUFFER: %p <- new_buffer(%zu)\n", buf, capacity);
@@ -75,6 +167,151 @@ static void free_buffer(file_buffer* buf) {
 }
 
 
+//////// BUFFER POOL:
+
+
+// Adds the counters of a file to the pool's. Called with the mutex held.
+static void fold_stats(buffered_file_handle* h) {
+    pool.stats.hits += h->stats.hits;
+    pool.stats.misses += h->stats.misses;
+    pool.stats.readaheads += h->stats.readaheads;
+    pool.stats.bytes_requested += h->stats.bytes_requested;
+    pool.stats.bytes_read += h->stats.bytes_read;
+    memset(&h->stats, 0, sizeof(h->stats));
+}
+
+// Takes a read buffer from the pool, or returns NULL if the pool is used up.
+static file_buffer* pool_alloc(buffered_file_handle* h, size_t capacity) {
+    file_buffer* buf = NULL;
+    pthread_mutex_lock(&pool.mutex);
+    fold_stats(h);
+    if (capacity == pool.block_size && pool.free_blocks) {
+        buf = pool.free_blocks;
+        pool.free_blocks = buf->next;
+        pthread_mutex_unlock(&pool.mutex);
+        buf->prev = buf->next = buf->hnext = NULL;
+        buf->owner = h;
+        buf->length = 0;
+        buf->offset = 0;
+        return buf;
+    }
+    if (pool.size + buffer_size(capacity) > pool.max_size) {
+        pthread_mutex_unlock(&pool.mutex);
+        return NULL;
+    }
+    pool.size += buffer_size(capacity);
+    pthread_mutex_unlock(&pool.mutex);
+
+    buf = new_buffer(h, capacity);
+    if (buf) {
+        buf->pooled = 1;
+    } else {
+        pthread_mutex_lock(&pool.mutex);
+        pool.size -= buffer_size(capacity);
+        pthread_mutex_unlock(&pool.mutex);
+    }
+    return buf;
+}
+
+static void pool_release(file_buffer* buf) {
+    if (!buf->pooled) {
+        free_buffer(buf);
+        return;
+    }
+    pthread_mutex_lock(&pool.mutex);
+    if (buf->capacity == pool.block_size && pool.size <= pool.max_size) {
+        buf->next = pool.free_blocks;
+        pool.free_blocks = buf;
+        buf = NULL;
+    } else {
+        pool.size -= buffer_size(buf->capacity);
+    }
+    pthread_mutex_unlock(&pool.mutex);
+    if (buf) {
+        free_buffer(buf);
+    }
+}
+
+static void pool_add_file(buffered_file_handle* h) {
+    pthread_mutex_lock(&pool.mutex);
+    h->pool_prev = NULL;
+    h->pool_next = pool.files;
+    if (pool.files) {
+        pool.files->pool_prev = h;
+    }
+    pool.files = h;
+    ++pool.nfiles;
+    pthread_mutex_unlock(&pool.mutex);
+}
+
+static void pool_remove_file(buffered_file_handle* h) {
+    pthread_mutex_lock(&pool.mutex);
+    if (h->pool_prev) {
+        h->pool_prev->pool_next = h->pool_next;
+    } else {
+        pool.files = h->pool_next;
+    }
+    if (h->pool_next) {
+        h->pool_next->pool_prev = h->pool_prev;
+    }
+    if (pool.steal_from == h) {
+        pool.steal_from = h->pool_next;
+    }
+    --pool.nfiles;
+    pthread_mutex_unlock(&pool.mutex);
+}
+
+// Frees idle buffers until the pool fits in its size. Called with the mutex held.
+static void pool_trim(void) {
+    while (pool.free_blocks && pool.size > pool.max_size) {
+        file_buffer* buf = pool.free_blocks;
+        pool.free_blocks = buf->next;
+        pool.size -= buffer_size(buf->capacity);
+        free_buffer(buf);
+    }
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_set_read_buffer_pool(size_t max_size,
+                                                   size_t block_size,
+                                                   size_t max_readahead)
+{
+    if (block_size == 0) {
+        return COUCHSTORE_ERROR_INVALID_ARGUMENTS;
+    }
+    pthread_mutex_lock(&pool.mutex);
+    if (block_size != pool.block_size) {
+        // Idle blocks of the old size are of no use anymore
+        while (pool.free_blocks) {
+            file_buffer* buf = pool.free_blocks;
+            pool.free_blocks = buf->next;
+            pool.size -= buffer_size(buf->capacity);
+            free_buffer(buf);
+        }
+    }
+    pool.max_size = max_size;
+    pool.block_size = block_size;
+    pool.max_readahead = max_readahead;
+    pool_trim();
+    pthread_mutex_unlock(&pool.mutex);
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+void couchstore_get_read_buffer_info(ReadBufferInfo *info)
+{
+    pthread_mutex_lock(&pool.mutex);
+    info->size = pool.size;
+    info->max_size = pool.max_size;
+    info->hits = pool.stats.hits;
+    info->misses = pool.stats.misses;
+    info->readaheads = pool.stats.readaheads;
+    info->bytes_requested = pool.stats.bytes_requested;
+    info->bytes_read = pool.stats.bytes_read;
+    pthread_mutex_unlock(&pool.mutex);
+}
+
+
 //////// BUFFER WRITES:
 
 
@@ -134,33 +371,22 @@ static size_t read_from_buffer(file_buffer* buf, void *bytes, size_t nbyte, cs_o
 }
 
 
-static couchstore_error_t load_buffer_from(file_buffer* buf, cs_off_t offset, size_t nbyte) {
-    if (buf->dirty) {
-        // If buffer contains data to be written, flush it first:
-        couchstore_error_t err = flush_buffer(buf);
-        if (err < 0) {
-            return err;
-        }
-    }
-    
-    if (offset < buf->offset || offset + nbyte > buf->offset + buf->capacity) {
-        // Reset the buffer to empty if it has to move:
-        buf->offset = offset;
-        buf->length = 0;
-    }
-
-    // Read data to extend the buffer to its capacity (if possible):
-    ssize_t bytes_read = buf->owner->raw_ops->pread(buf->owner->raw_ops_handle,
-                                           buf->bytes + buf->length,
-                                           buf->capacity - buf->length,
-                                           buf->offset + buf->length);
+// Reads up to nbyte bytes at offset from the file into the (emptied) buffer.
+static couchstore_error_t load_buffer(file_buffer* buf, cs_off_t offset, size_t nbyte) {
+    buffered_file_handle* h = buf->owner;
+    buf->offset = offset;
+    buf->length = 0;
+    ssize_t bytes_read = h->raw_ops->pread(h->raw_ops_handle, buf->bytes,
+                                           min(nbyte, buf->capacity), offset);
 #if LOG_BUFFER
-    fprintf(stderr, "BUFFER: %p loaded %zd bytes from %zd\n", buf, bytes_read, offset + buf->length);
+    fprintf(stderr, "BUFFER: %p loaded %zd bytes from %zd\n", buf, bytes_read, offset);
 #endif
     if (bytes_read < 0) {
         return (couchstore_error_t) bytes_read;
     }
-    buf->length += bytes_read;
+    buf->length = bytes_read;
+    ++h->stats.misses;
+    h->stats.bytes_read += bytes_read;
     return COUCHSTORE_SUCCESS;
 }
 
@@ -168,38 +394,282 @@ static couchstore_error_t load_buffer_from(file_buffer* buf, cs_off_t offset, si
 //////// BUFFER MANAGEMENT:
 
 
-static file_buffer* find_buffer(buffered_file_handle* h, cs_off_t offset) {
-    offset = offset - offset % READ_BUFFER_CAPACITY;
-    // Find a buffer for this offset, or use the last one:
-    file_buffer* buffer = h->first_buffer;
-    while (buffer->offset != offset && buffer->next != NULL)
-        buffer = buffer->next;
-    if (buffer->offset != offset) {
-        if (h->nbuffers < MAX_READ_BUFFERS) {
-            // Didn't find a matching one, but we can still create another:
-            file_buffer* buffer2 = new_buffer(h, READ_BUFFER_CAPACITY);
-            if (buffer2) {
-                buffer = buffer2;
+static inline file_buffer** index_slot(buffered_file_handle* h, cs_off_t offset) {
+    return &h->index[(offset / h->block_size) & (INDEX_SLOTS - 1)];
+}
+
+static file_buffer* find_block(buffered_file_handle* h, cs_off_t offset) {
+    file_buffer* buffer = *index_slot(h, offset);
+    while (buffer && buffer->offset != offset)
+        buffer = buffer->hnext;
+    return buffer;
+}
+
+static void lru_unlink(buffered_file_handle* h, file_buffer* buffer) {
+    if (buffer->prev) buffer->prev->next = buffer->next;
+    else h->first_buffer = buffer->next;
+    if (buffer->next) buffer->next->prev = buffer->prev;
+    else h->last_buffer = buffer->prev;
+}
+
+static void lru_push_front(buffered_file_handle* h, file_buffer* buffer) {
+    buffer->prev = NULL;
+    buffer->next = h->first_buffer;
+    if (h->first_buffer) h->first_buffer->prev = buffer;
+    else h->last_buffer = buffer;
+    h->first_buffer = buffer;
+}
+
+static void index_remove(buffered_file_handle* h, file_buffer* buffer) {
+    file_buffer** slot = index_slot(h, buffer->offset);
+    while (*slot != buffer)
+        slot = &(*slot)->hnext;
+    *slot = buffer->hnext;
+}
+
+// Number of blocks a file may take from the pool. Called with the mutex held.
+static unsigned file_share(void) {
+    size_t share = pool.max_size / buffer_size(pool.block_size);
+    if (pool.nfiles > 1) {
+        share /= pool.nfiles;
+    }
+    if (share < 1) {
+        share = 1;
+    } else if (share > MAX_FILE_BLOCKS) {
+        share = MAX_FILE_BLOCKS;
+    }
+    return (unsigned) share;
+}
+
+// Takes the least recently used block of a file holding more than its
+// share, skipping the files busy reading. Called with the mutex held.
+static file_buffer* steal_block(buffered_file_handle* h, unsigned share) {
+    buffered_file_handle* other = pool.steal_from ? pool.steal_from : pool.files;
+    size_t ii;
+    for (ii = 0; ii < pool.nfiles; ++ii) {
+        if (other != h && pthread_mutex_trylock(&other->lock) == 0) {
+            file_buffer* buf = other->last_buffer;
+            if (other->nbuffers > share && buf && buf->pooled &&
+                buf->capacity == h->block_size) {
+                lru_unlink(other, buf);
+                index_remove(other, buf);
+                --other->nbuffers;
+                pthread_mutex_unlock(&other->lock);
+                // Take the next one from the next file
+                pool.steal_from = other->pool_next;
+                buf->prev = buf->next = buf->hnext = NULL;
+                buf->owner = h;
+                buf->length = 0;
+                buf->offset = 0;
+                return buf;
+            }
+            pthread_mutex_unlock(&other->lock);
+        }
+        other = other->pool_next ? other->pool_next : pool.files;
+    }
+    return NULL;
+}
+
+// Takes a block from the pool for a file below its share, from the files
+// above theirs if the pool is used up. Returns NULL if there is none.
+static file_buffer* pool_alloc_block(buffered_file_handle* h) {
+    pthread_mutex_lock(&pool.mutex);
+    unsigned share = file_share();
+    pthread_mutex_unlock(&pool.mutex);
+    if (h->nbuffers >= share) {
+        return NULL;
+    }
+    file_buffer* buffer = pool_alloc(h, h->block_size);
+    if (!buffer) {
+        pthread_mutex_lock(&pool.mutex);
+        buffer = steal_block(h, share);
+        pthread_mutex_unlock(&pool.mutex);
+    }
+    return buffer;
+}
+
+// Returns the block starting at offset, taking a new one from the pool or
+// recycling the least recently used one if it isn't there. A file the pool
+// has no block for allocates one outside of it, so that every file keeps
+// at least one block however many files are open. Returns NULL only if
+// that allocation fails. Called with the file's lock held.
+static file_buffer* get_block(buffered_file_handle* h, cs_off_t offset) {
+    file_buffer* buffer = find_block(h, offset);
+    if (buffer) {
+        lru_unlink(h, buffer);
+    } else {
+        if (h->nbuffers < MAX_FILE_BLOCKS) {
+            buffer = pool_alloc_block(h);
+            if (!buffer && h->nbuffers == 0) {
+                buffer = new_buffer(h, h->block_size);
+            }
+            if (buffer) {
                 ++h->nbuffers;
             }
-        } else {
+        }
+        if (!buffer) {
+            buffer = h->last_buffer;
+            if (!buffer) {
+                return NULL;
+            }
 #if LOG_BUFFER
             fprintf(stderr, "BUFFER: %p recycled, from %zd to %zd\n", buffer, buffer->offset, offset);
 #endif
+            lru_unlink(h, buffer);
+            index_remove(h, buffer);
         }
+        buffer->offset = offset;
+        buffer->length = 0;
+        file_buffer** slot = index_slot(h, offset);
+        buffer->hnext = *slot;
+        *slot = buffer;
     }
-    if (buffer != h->first_buffer) {
-        // Move the buffer to the start of the list:
-        if (buffer->prev) buffer->prev->next = buffer->next;
-        if (buffer->next) buffer->next->prev = buffer->prev;
-        buffer->prev = NULL;
-        h->first_buffer->prev = buffer;
-        buffer->next = h->first_buffer;
-        h->first_buffer = buffer;
-    }
+    lru_push_front(h, buffer);
     return buffer;
 }
 
+static void release_stream(read_stream* stream) {
+    if (stream->buffer) {
+        pool_release(stream->buffer);
+    }
+    memset(stream, 0, sizeof(*stream));
+}
+
+static read_stream* find_run(buffered_file_handle* h, read_stream* runs, int nruns,
+                             cs_off_t offset) {
+    int ii;
+    for (ii = 0; ii < nruns; ++ii) {
+        read_stream* s = &runs[ii];
+        if (s->last_used && offset >= s->last_offset &&
+            offset <= s->next_offset + (cs_off_t) h->block_size) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+static read_stream* least_recent_run(read_stream* runs, int nruns) {
+    read_stream* run = &runs[0];
+    int ii;
+    for (ii = 1; ii < nruns; ++ii) {
+        if (runs[ii].last_used < run->last_used) {
+            run = &runs[ii];
+        }
+    }
+    return run;
+}
+
+// Tracks whether the file is being read sequentially: reads that start at
+// or a little past the end of a previous one, as when scanning changes or
+// compacting, as opposed to the backward jumps of B-tree lookups. A read
+// continuing none of the streams starts a new run in a probe, which takes
+// the place of the least recently used stream only after moving forward a
+// few times, so that random lookups don't drop the streams' read-ahead.
+static void track_access(buffered_file_handle* h, cs_off_t offset, size_t nbyte) {
+    read_stream* stream = find_run(h, h->streams, READ_STREAMS, offset);
+    if (stream) {
+        if (stream->seq_reads < SEQ_THRESHOLD) {
+            ++stream->seq_reads;
+        }
+    } else if ((stream = find_run(h, h->probes, READ_PROBES, offset)) != NULL) {
+        if (++stream->seq_reads >= STREAM_THRESHOLD) {
+            read_stream* probe = stream;
+            stream = least_recent_run(h->streams, READ_STREAMS);
+            release_stream(stream);
+            stream->seq_reads = probe->seq_reads;
+            memset(probe, 0, sizeof(*probe));
+        }
+    } else {
+        stream = least_recent_run(h->probes, READ_PROBES);
+        memset(stream, 0, sizeof(*stream));
+        stream->seq_reads = 1;
+    }
+    stream->last_offset = offset;
+    stream->next_offset = offset + nbyte;
+    stream->last_used = ++h->clock;
+    h->stream = stream;
+}
+
+// Copies what the read buffers hold of the data at offset.
+static size_t read_cached(buffered_file_handle* h, void *bytes, size_t nbyte, cs_off_t offset) {
+    size_t nbyte_read = 0;
+    int ii;
+    for (ii = 0; ii < READ_STREAMS && nbyte_read == 0; ++ii) {
+        if (h->streams[ii].buffer) {
+            nbyte_read = read_from_buffer(h->streams[ii].buffer, bytes, nbyte, offset);
+        }
+    }
+    if (nbyte_read == 0 && h->first_buffer) {
+        file_buffer* buffer = find_block(h, offset - offset % h->block_size);
+        if (buffer) {
+            nbyte_read = read_from_buffer(buffer, bytes, nbyte, offset);
+            if (nbyte_read > 0 && buffer != h->first_buffer) {
+                lru_unlink(h, buffer);
+                lru_push_front(h, buffer);
+            }
+        }
+    }
+    if (nbyte_read > 0 && ++h->stats.hits >= STATS_BATCH) {
+        pthread_mutex_lock(&pool.mutex);
+        fold_stats(h);
+        pthread_mutex_unlock(&pool.mutex);
+    }
+    return nbyte_read;
+}
+
+// Loads the data at offset into a read buffer and copies it; sequential
+// streams load a read-ahead window that doubles with each load, into a
+// buffer replaced by a larger one as the window grows.
+static ssize_t read_uncached(buffered_file_handle* h, void *bytes, size_t nbyte, cs_off_t offset) {
+    couchstore_error_t err;
+    cs_off_t block_start = offset - offset % h->block_size;
+    read_stream* stream = h->stream;
+
+    if (stream->seq_reads >= SEQ_THRESHOLD && h->max_readahead >= 2 * h->block_size) {
+        size_t window = stream->window ? stream->window * 2 : 2 * h->block_size;
+        if (window > h->max_readahead) {
+            window = h->max_readahead;
+        }
+        if (!stream->buffer || stream->buffer->capacity < window) {
+            file_buffer* buffer = pool_alloc(h, window);
+            if (buffer) {
+                if (stream->buffer) {
+                    pool_release(stream->buffer);
+                }
+                stream->buffer = buffer;
+            } else if (stream->buffer) {
+                // Keep loading the window the pool could give
+                window = stream->buffer->capacity;
+            }
+        }
+        if (stream->buffer) {
+            stream->window = window;
+            err = load_buffer(stream->buffer, block_start, stream->window);
+            if (err < 0) {
+                return err;
+            }
+            ++h->stats.readaheads;
+            return read_from_buffer(stream->buffer, bytes, nbyte, offset);
+        }
+    }
+
+    file_buffer* buffer = get_block(h, block_start);
+    if (!buffer) {
+        // No buffer to spare: read straight from the file
+        ssize_t nbyte_read = h->raw_ops->pread(h->raw_ops_handle, bytes, nbyte, offset);
+        if (nbyte_read > 0) {
+            ++h->stats.misses;
+            h->stats.bytes_read += nbyte_read;
+        }
+        return nbyte_read;
+    }
+    err = load_buffer(buffer, block_start, h->block_size);
+    if (err < 0) {
+        return err;
+    }
+    return read_from_buffer(buffer, bytes, nbyte, offset);
+}
+
 
 //////// FILE API:
 
@@ -211,27 +681,41 @@ static void buffered_destructor(couch_file_handle handle)
         return;
     }
     h->raw_ops->destructor(h->raw_ops_handle);
+    // No other file can take blocks away from here anymore
+    pool_remove_file(h);
 	
     free_buffer(h->write_buffer);
     file_buffer* buffer, *next;
     for (buffer = h->first_buffer; buffer; buffer = next) {
         next = buffer->next;
-        free_buffer(buffer);
+        pool_release(buffer);
     }
+    int ii;
+    for (ii = 0; ii < READ_STREAMS; ++ii) {
+        release_stream(&h->streams[ii]);
+    }
+    pthread_mutex_lock(&pool.mutex);
+    fold_stats(h);
+    pthread_mutex_unlock(&pool.mutex);
+    pthread_mutex_destroy(&h->lock);
     free(h);
 }
 
 static couch_file_handle buffered_constructor_with_raw_ops(const couch_file_ops* raw_ops)
 {
-    buffered_file_handle *h = malloc(sizeof(buffered_file_handle));
+    buffered_file_handle *h = calloc(1, sizeof(buffered_file_handle));
     if (h) {
         h->raw_ops = raw_ops;
         h->raw_ops_handle = raw_ops->constructor(raw_ops->cookie);
-        h->nbuffers = 1;
+        pthread_mutex_init(&h->lock, NULL);
+        pthread_mutex_lock(&pool.mutex);
+        h->block_size = pool.block_size;
+        h->max_readahead = pool.max_readahead;
+        pthread_mutex_unlock(&pool.mutex);
+        pool_add_file(h);
         h->write_buffer = new_buffer(h, WRITE_BUFFER_CAPACITY);
-        h->first_buffer = new_buffer(h, READ_BUFFER_CAPACITY);
         
-        if (!h->write_buffer || !h->first_buffer) {
+        if (!h->write_buffer) {
             buffered_destructor((couch_file_handle)h);
             h = NULL;
         }
@@ -273,36 +757,28 @@ static ssize_t buffered_pread(couch_file_handle handle, void *buf, size_t nbyte,
         return err;
     }
     
+    pthread_mutex_lock(&h->lock);
+    track_access(h, offset, nbyte);
     ssize_t total_read = 0;
     while (nbyte > 0) {
-        file_buffer* buffer = find_buffer(h, offset);
-        
-        // Read as much as we can from the current buffer:
-        ssize_t nbyte_read = read_from_buffer(buffer, buf, nbyte, offset);
+        // Read as much as we can from the buffers, else load them:
+        ssize_t nbyte_read = read_cached(h, buf, nbyte, offset);
         if (nbyte_read == 0) {
-            /*if (nbyte > buffer->capacity) {
-                // Remainder won't fit in a single buffer, so just read it directly:
-                nbyte_read = h->raw_ops->pread(h->raw_ops_handle, buf, nbyte, offset);
-                if (nbyte_read < 0) {
-                    return nbyte_read;
-                }
-            } else*/ {
-                // Move the buffer to cover the remainder of the data to be read.
-                cs_off_t block_start = offset - (offset % READ_BUFFER_CAPACITY);
-                err = load_buffer_from(buffer, block_start, (size_t)(offset + nbyte - block_start));
-                if (err < 0) {
-                    return err;
-                }
-                nbyte_read = read_from_buffer(buffer, buf, nbyte, offset);
-                if (nbyte_read == 0)
-                    break;  // must be at EOF
+            nbyte_read = read_uncached(h, buf, nbyte, offset);
+            if (nbyte_read < 0) {
+                pthread_mutex_unlock(&h->lock);
+                return nbyte_read;
             }
+            if (nbyte_read == 0)
+                break;  // must be at EOF
         }
         buf = (char*)buf + nbyte_read;
         nbyte -= nbyte_read;
         offset += nbyte_read;
         total_read += nbyte_read;
     }
+    h->stats.bytes_requested += total_read;
+    pthread_mutex_unlock(&h->lock);
     return total_read;
 }
 
@@ -389,3 +865,27 @@ const couch_file_ops *couch_get_buffered_file_ops(const couch_file_ops* raw_ops,
     *handle = buffered_constructor_with_raw_ops(raw_ops);
     return &ops;
 }
+
+void couch_buffered_file_drop_read_buffers(couch_file_handle handle)
+{
+    buffered_file_handle *h = (buffered_file_handle*)handle;
+    file_buffer* buffer;
+    pthread_mutex_lock(&h->lock);
+    for (buffer = h->first_buffer; buffer; buffer = buffer->next) {
+        // Read buffers are never dirty, so they can simply be emptied:
+        buffer->length = 0;
+    }
+    int ii;
+    for (ii = 0; ii < READ_STREAMS; ++ii) {
+        if (h->streams[ii].buffer) {
+            h->streams[ii].buffer->length = 0;
+        }
+    }
+    pthread_mutex_unlock(&h->lock);
+}
+
+couchstore_error_t couch_buffered_file_flush(couch_file_handle handle)
+{
+    buffered_file_handle *h = (buffered_file_handle*)handle;
+    return flush_buffer(h->write_buffer);
+}
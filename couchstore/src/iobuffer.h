@@ -21,4 +21,19 @@
 const couch_file_ops *couch_get_buffered_file_ops(const couch_file_ops* raw_ops,
                                                   couch_file_handle* handle);
 
+/**
+ * Discards all data cached by the read buffers of a buffered file handle, so that
+ * subsequent reads go to the underlying file again.
+ * @param handle a handle created by couch_get_buffered_file_ops
+ */
+void couch_buffered_file_drop_read_buffers(couch_file_handle handle);
+
+/**
+ * Writes any data pending in the write buffer of a buffered file handle to the
+ * underlying file, without syncing it.
+ * @param handle a handle created by couch_get_buffered_file_ops
+ * @return COUCHSTORE_SUCCESS on success
+ */
+couchstore_error_t couch_buffered_file_flush(couch_file_handle handle);
+
 #endif // LIBCOUCHSTORE_IOBUFFER_H
@@ -0,0 +1,336 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "node_cache.h"
+
+#define MIN_BUCKETS 1024
+/* Expected average size of a cached node, to size the hash table */
+#define NODE_SIZE_HINT 2048
+
+struct node_cache_entry {
+    node_cache_file file;
+    uint64_t pos;
+    char *buf;
+    int len;
+    /* Number of readers using the node, plus one while it is cached */
+    int refcount;
+    node_cache_entry *hnext;
+    /* Position in the LRU list, most recently used first */
+    node_cache_entry *prev;
+    node_cache_entry *next;
+};
+
+/* A file with open handles, and the generation its nodes are cached under */
+typedef struct open_file {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t generation;
+    int refcount;
+    struct open_file *next;
+} open_file;
+
+static struct {
+    pthread_mutex_t mutex;
+    node_cache_entry **buckets;
+    size_t nbuckets;
+    node_cache_entry lru;
+    size_t size;
+    size_t max_size;
+    uint64_t num_nodes;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    open_file *open_files;
+    uint64_t generation;
+} cache = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .lru = { .prev = &cache.lru, .next = &cache.lru }
+};
+
+static size_t entry_size(const node_cache_entry *e)
+{
+    return sizeof(*e) + e->len;
+}
+
+static size_t hash_node(const node_cache_file *file, uint64_t pos)
+{
+    uint64_t h = pos ^ (file->generation * 0x9e3779b97f4a7c15ULL);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (size_t) h;
+}
+
+static int same_file(const node_cache_file *a, const node_cache_file *b)
+{
+    return a->generation == b->generation;
+}
+
+static void lru_unlink(node_cache_entry *e)
+{
+    e->prev->next = e->next;
+    e->next->prev = e->prev;
+}
+
+static void lru_push_front(node_cache_entry *e)
+{
+    e->prev = &cache.lru;
+    e->next = cache.lru.next;
+    cache.lru.next->prev = e;
+    cache.lru.next = e;
+}
+
+static node_cache_entry **find_slot(const node_cache_file *file, uint64_t pos)
+{
+    node_cache_entry **slot = &cache.buckets[hash_node(file, pos) & (cache.nbuckets - 1)];
+    while (*slot && !((*slot)->pos == pos && same_file(&(*slot)->file, file))) {
+        slot = &(*slot)->hnext;
+    }
+    return slot;
+}
+
+static void free_entry(node_cache_entry *e)
+{
+    free(e->buf);
+    free(e);
+}
+
+/** Drops the cache's reference to an entry; the entry is freed once the
+    readers still using it release it. Called with the mutex held. */
+static int remove_entry(node_cache_entry **slot)
+{
+    node_cache_entry *e = *slot;
+    *slot = e->hnext;
+    lru_unlink(e);
+    cache.size -= entry_size(e);
+    --cache.num_nodes;
+    return --e->refcount == 0;
+}
+
+static void evict(void)
+{
+    while (cache.size > cache.max_size) {
+        node_cache_entry *e = cache.lru.prev;
+        if (remove_entry(find_slot(&e->file, e->pos))) {
+            free_entry(e);
+        }
+        ++cache.evictions;
+    }
+}
+
+static couchstore_error_t resize_buckets(size_t max_size)
+{
+    size_t nbuckets = MIN_BUCKETS;
+    while (nbuckets < max_size / NODE_SIZE_HINT) {
+        nbuckets <<= 1;
+    }
+    if (nbuckets == cache.nbuckets) {
+        return COUCHSTORE_SUCCESS;
+    }
+
+    node_cache_entry **buckets = calloc(nbuckets, sizeof(node_cache_entry*));
+    if (buckets == NULL) {
+        return COUCHSTORE_ERROR_ALLOC_FAIL;
+    }
+    for (size_t ii = 0; ii < cache.nbuckets; ++ii) {
+        node_cache_entry *e = cache.buckets[ii];
+        while (e) {
+            node_cache_entry *next = e->hnext;
+            size_t b = hash_node(&e->file, e->pos) & (nbuckets - 1);
+            e->hnext = buckets[b];
+            buckets[b] = e;
+            e = next;
+        }
+    }
+    free(cache.buckets);
+    cache.buckets = buckets;
+    cache.nbuckets = nbuckets;
+    return COUCHSTORE_SUCCESS;
+}
+
+LIBCOUCHSTORE_API
+couchstore_error_t couchstore_set_node_cache_size(size_t max_size)
+{
+    couchstore_error_t errcode = COUCHSTORE_SUCCESS;
+    pthread_mutex_lock(&cache.mutex);
+    cache.max_size = max_size;
+    evict();
+    if (max_size > 0) {
+        errcode = resize_buckets(max_size);
+        if (errcode != COUCHSTORE_SUCCESS && cache.buckets == NULL) {
+            cache.max_size = 0;
+        }
+    }
+    pthread_mutex_unlock(&cache.mutex);
+    return errcode;
+}
+
+LIBCOUCHSTORE_API
+void couchstore_get_node_cache_info(NodeCacheInfo *info)
+{
+    pthread_mutex_lock(&cache.mutex);
+    info->size = cache.size;
+    info->max_size = cache.max_size;
+    info->num_nodes = cache.num_nodes;
+    info->hits = cache.hits;
+    info->misses = cache.misses;
+    info->evictions = cache.evictions;
+    pthread_mutex_unlock(&cache.mutex);
+}
+
+void node_cache_open_file(Db *db)
+{
+    struct stat st;
+    open_file *f;
+    memset(&db->cache_file, 0, sizeof(db->cache_file));
+    if (stat(db->filename, &st) != 0 || st.st_ino == 0) {
+        /* Without an identity the file's nodes are just not cached */
+        return;
+    }
+
+    pthread_mutex_lock(&cache.mutex);
+    for (f = cache.open_files; f; f = f->next) {
+        if (f->dev == (uint64_t) st.st_dev && f->ino == (uint64_t) st.st_ino) {
+            break;
+        }
+    }
+    if (f == NULL) {
+        /* Nothing cached under an earlier generation can match this one */
+        f = malloc(sizeof(open_file));
+        if (f == NULL) {
+            pthread_mutex_unlock(&cache.mutex);
+            return;
+        }
+        f->dev = (uint64_t) st.st_dev;
+        f->ino = (uint64_t) st.st_ino;
+        f->generation = ++cache.generation;
+        f->refcount = 0;
+        f->next = cache.open_files;
+        cache.open_files = f;
+    }
+    ++f->refcount;
+    db->cache_file.dev = f->dev;
+    db->cache_file.ino = f->ino;
+    db->cache_file.generation = f->generation;
+    pthread_mutex_unlock(&cache.mutex);
+}
+
+void node_cache_close_file(Db *db)
+{
+    open_file **fp, *f;
+    if (db->cache_file.generation == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache.mutex);
+    for (fp = &cache.open_files; *fp; fp = &(*fp)->next) {
+        if ((*fp)->generation == db->cache_file.generation) {
+            break;
+        }
+    }
+    f = *fp;
+    if (f && --f->refcount == 0) {
+        *fp = f->next;
+        free(f);
+        /* The inode may be reused by another file once closed */
+        for (size_t ii = 0; ii < cache.nbuckets; ++ii) {
+            node_cache_entry **slot = &cache.buckets[ii];
+            while (*slot) {
+                node_cache_entry *e = *slot;
+                if (same_file(&e->file, &db->cache_file)) {
+                    if (remove_entry(slot)) {
+                        free_entry(e);
+                    }
+                } else {
+                    slot = &e->hnext;
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&cache.mutex);
+    memset(&db->cache_file, 0, sizeof(db->cache_file));
+}
+
+int pread_node(Db *db, cs_off_t pos, char **ret_ptr, node_cache_entry **ref)
+{
+    *ref = NULL;
+    if (db->cache_file.generation == 0) {
+        return pread_compressed(db, pos, ret_ptr);
+    }
+
+    pthread_mutex_lock(&cache.mutex);
+    if (cache.max_size == 0) {
+        pthread_mutex_unlock(&cache.mutex);
+        return pread_compressed(db, pos, ret_ptr);
+    }
+    node_cache_entry *e = *find_slot(&db->cache_file, pos);
+    if (e) {
+        ++cache.hits;
+        ++e->refcount;
+        lru_unlink(e);
+        lru_push_front(e);
+        pthread_mutex_unlock(&cache.mutex);
+        *ret_ptr = e->buf;
+        *ref = e;
+        return e->len;
+    }
+    ++cache.misses;
+    pthread_mutex_unlock(&cache.mutex);
+
+    char *buf;
+    int len = pread_compressed(db, pos, &buf);
+    if (len < 0) {
+        return len;
+    }
+    *ret_ptr = buf;
+
+    e = malloc(sizeof(node_cache_entry));
+    if (e == NULL) {
+        return len;
+    }
+    e->file = db->cache_file;
+    e->pos = pos;
+    e->buf = buf;
+    e->len = len;
+    e->refcount = 2;
+
+    pthread_mutex_lock(&cache.mutex);
+    node_cache_entry **slot = NULL;
+    if (cache.max_size >= entry_size(e)) {
+        slot = find_slot(&db->cache_file, pos);
+    }
+    if (slot == NULL || *slot != NULL) {
+        /* Too big, or another reader cached it meanwhile */
+        pthread_mutex_unlock(&cache.mutex);
+        free(e);
+        return len;
+    }
+    e->hnext = NULL;
+    *slot = e;
+    lru_push_front(e);
+    cache.size += entry_size(e);
+    ++cache.num_nodes;
+    evict();
+    pthread_mutex_unlock(&cache.mutex);
+
+    *ref = e;
+    return len;
+}
+
+void node_release(char *buf, node_cache_entry *ref)
+{
+    if (ref == NULL) {
+        free(buf);
+        return;
+    }
+    pthread_mutex_lock(&cache.mutex);
+    int last = --ref->refcount == 0;
+    pthread_mutex_unlock(&cache.mutex);
+    if (last) {
+        free_entry(ref);
+    }
+}
@@ -0,0 +1,46 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef COUCHSTORE_NODE_CACHE_H
+#define COUCHSTORE_NODE_CACHE_H 1
+
+#include "internal.h"
+
+/*
+ * A process-wide cache of decompressed B-tree nodes, keyed by the file and
+ * the position of the node in the file. All the Db handles open at the same
+ * time on a file (device and inode) share a generation number that the
+ * nodes are cached under; the nodes are dropped when the last of them
+ * closes, so a file reusing the inode later never sees them. This relies on
+ * nodes never being rewritten in place while the file is open, which holds
+ * as long as files are only appended to.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    typedef struct node_cache_entry node_cache_entry;
+
+    /** Sets db->cache_file to the identity of the file the handle is open on. */
+    void node_cache_open_file(Db *db);
+
+    /** Releases the identity set by node_cache_open_file. The nodes of the
+        file are purged when its last handle closes. */
+    void node_cache_close_file(Db *db);
+
+    /** Reads a decompressed B-tree node, from the node cache if possible.
+        @param db The database to read from
+        @param pos The byte position of the node
+        @param ret_ptr On success, set to the node data, which stays valid until
+                node_release is called. It must not be modified.
+        @param ref On success, set to the reference to pass to node_release
+        @return The length of the node, or a negative error code */
+    int pread_node(Db *db, cs_off_t pos, char **ret_ptr, node_cache_entry **ref);
+
+    /** Releases a node read with pread_node. */
+    void node_release(char *buf, node_cache_entry *ref);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
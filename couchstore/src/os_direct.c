@@ -0,0 +1,755 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+
+#include "internal.h"
+#include "util.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+
+/*
+ * File ops doing direct I/O (O_DIRECT), so that file data isn't cached by
+ * the page cache on top of the caches of the process. Direct I/O has to
+ * be done in aligned blocks:
+ *
+ * - The last, partial block of the file is kept in an aligned tail block.
+ * - Appends (the only writes couchstore does) are gathered in write
+ *   buffers, allocated on the first write and released again by sync().
+ *   The buffer being filled takes over the tail block. Full buffers are
+ *   written asynchronously with Linux native AIO, so a few writes can be
+ *   in flight while the next buffer fills. sync() writes the partial block
+ *   padded with zeros, waits for all the writes and truncates the padding.
+ * - Reads are done in whole blocks into an aligned buffer, and large ones
+ *   as several concurrent AIO reads.
+ *
+ * All the files share one AIO context. Without AIO the same is done with
+ * synchronous I/O, and on file systems that don't support O_DIRECT (such
+ * as tmpfs) the file is opened without it.
+ */
+
+#define DIRECT_ALIGN 4096
+#define WRITE_SLOTS 4
+#define WRITE_SLOT_SIZE (256 * 1024)
+#define READ_CHUNK_SIZE (64 * 1024)
+#define MAX_READ_CHUNKS 16
+#define AIO_EVENTS 256
+
+typedef struct aio_op {
+    struct iocb cb;
+    /* Result of the operation, valid once it is done */
+    int64_t res;
+    int done;
+} aio_op;
+
+typedef struct write_slot {
+    aio_op op;
+    char *buf;
+    /* Position and length of the write in flight */
+    cs_off_t pos;
+    size_t len;
+    int busy;
+} write_slot;
+
+typedef struct direct_file {
+    int fd;
+    aio_context_t aio;
+    /* Logical size of the file */
+    cs_off_t eof;
+    /* The data from fill_pos (aligned) to eof is in the slot being filled,
+       or in the tail block when no slot is */
+    int fill;
+    int filling;
+    cs_off_t fill_pos;
+    char *tail;
+    /* Data was appended since the slot being filled was last written */
+    int dirty;
+    /* The file was padded up to the end of its last block */
+    int padded;
+    /* Error of a write that completed asynchronously */
+    couchstore_error_t write_error;
+    write_slot slots[WRITE_SLOTS];
+    char *readbuf;
+    size_t readbuf_size;
+    aio_op *read_ops;
+} direct_file;
+
+/* The AIO context shared by all the files. Whoever waits for an operation
+   reaps the completions of the others too, one thread at a time. */
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int initialized;
+    int reaping;
+    aio_context_t ctx;
+} aio = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static inline cs_off_t align_down(cs_off_t pos)
+{
+    return pos & ~(cs_off_t)(DIRECT_ALIGN - 1);
+}
+
+static inline cs_off_t align_up(cs_off_t pos)
+{
+    return align_down(pos + DIRECT_ALIGN - 1);
+}
+
+static inline void save_errno(int err)
+{
+    get_os_error_store()->errno_err = err;
+}
+
+static long sys_io_setup(unsigned nr, aio_context_t *ctx)
+{
+    return syscall(SYS_io_setup, nr, ctx);
+}
+
+static long sys_io_submit(aio_context_t ctx, long nr, struct iocb **iocbpp)
+{
+    return syscall(SYS_io_submit, ctx, nr, iocbpp);
+}
+
+static long sys_io_getevents(aio_context_t ctx, long min_nr, long nr,
+                             struct io_event *events)
+{
+    long rv;
+    do {
+        rv = syscall(SYS_io_getevents, ctx, min_nr, nr, events, NULL);
+    } while (rv == -1 && errno == EINTR);
+    return rv;
+}
+
+static void prep_op(aio_op *op, int fd, int opcode, void *buf,
+                    size_t len, cs_off_t pos)
+{
+    struct iocb *cb = &op->cb;
+    memset(cb, 0, sizeof(*cb));
+    cb->aio_data = (uint64_t)(uintptr_t)op;
+    cb->aio_lio_opcode = opcode;
+    cb->aio_fildes = fd;
+    cb->aio_buf = (uint64_t)(uintptr_t)buf;
+    cb->aio_nbytes = len;
+    cb->aio_offset = pos;
+    op->res = 0;
+    op->done = 0;
+}
+
+/* Returns the shared AIO context, 0 if AIO isn't available */
+static aio_context_t get_aio_context(void)
+{
+    aio_context_t ctx;
+    pthread_mutex_lock(&aio.mutex);
+    if (!aio.initialized) {
+        if (sys_io_setup(AIO_EVENTS, &aio.ctx) == -1) {
+            aio.ctx = 0;
+        }
+        aio.initialized = 1;
+    }
+    ctx = aio.ctx;
+    pthread_mutex_unlock(&aio.mutex);
+    return ctx;
+}
+
+/* Waits for the completion of a submitted operation */
+static int wait_op(aio_op *op)
+{
+    struct io_event events[32];
+    int rv = 0;
+
+    pthread_mutex_lock(&aio.mutex);
+    while (!op->done) {
+        if (aio.reaping) {
+            pthread_cond_wait(&aio.cond, &aio.mutex);
+            continue;
+        }
+        aio.reaping = 1;
+        pthread_mutex_unlock(&aio.mutex);
+        long n = sys_io_getevents(aio.ctx, 1, 32, events);
+        int err = errno;
+        pthread_mutex_lock(&aio.mutex);
+        aio.reaping = 0;
+        for (long ii = 0; ii < n; ++ii) {
+            aio_op *done = (aio_op*)(uintptr_t)events[ii].data;
+            done->res = events[ii].res;
+            done->done = 1;
+        }
+        pthread_cond_broadcast(&aio.cond);
+        if (n < 0) {
+            save_errno(err);
+            rv = -1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&aio.mutex);
+    return rv;
+}
+
+/* Synchronous I/O of whole blocks; short transfers are errors */
+static int pread_full(int fd, char *buf, size_t len, cs_off_t pos)
+{
+    while (len > 0) {
+        ssize_t rv = pread(fd, buf, len, pos);
+        if (rv <= 0) {
+            if (rv == -1 && errno == EINTR) {
+                continue;
+            }
+            save_errno(rv == 0 ? EIO : errno);
+            return -1;
+        }
+        buf += rv;
+        len -= rv;
+        pos += rv;
+    }
+    return 0;
+}
+
+static int pwrite_full(int fd, const char *buf, size_t len, cs_off_t pos)
+{
+    while (len > 0) {
+        ssize_t rv = pwrite(fd, buf, len, pos);
+        if (rv <= 0) {
+            if (rv == -1 && errno == EINTR) {
+                continue;
+            }
+            save_errno(rv == 0 ? EIO : errno);
+            return -1;
+        }
+        buf += rv;
+        len -= rv;
+        pos += rv;
+    }
+    return 0;
+}
+
+//////// WRITES:
+
+/* Waits for the writes in flight to the range [from, to) */
+static couchstore_error_t wait_writes(direct_file *f, cs_off_t from, cs_off_t to)
+{
+    for (int ii = 0; ii < WRITE_SLOTS; ++ii) {
+        write_slot *slot = &f->slots[ii];
+        if (slot->busy && slot->pos < to && slot->pos + (cs_off_t)slot->len > from) {
+            if (wait_op(&slot->op) < 0) {
+                return COUCHSTORE_ERROR_WRITE;
+            }
+            slot->busy = 0;
+            if (slot->op.res != (int64_t)slot->len) {
+                save_errno(slot->op.res < 0 ? (int)-slot->op.res : EIO);
+                f->write_error = COUCHSTORE_ERROR_WRITE;
+            }
+        }
+    }
+    return COUCHSTORE_SUCCESS;
+}
+
+static couchstore_error_t start_write(direct_file *f, write_slot *slot,
+                                      cs_off_t pos, size_t len)
+{
+    slot->pos = pos;
+    slot->len = len;
+    if (f->aio) {
+        struct iocb *cb = &slot->op.cb;
+        prep_op(&slot->op, f->fd, IOCB_CMD_PWRITE, slot->buf, len, pos);
+        if (sys_io_submit(f->aio, 1, &cb) == 1) {
+            slot->busy = 1;
+            return COUCHSTORE_SUCCESS;
+        }
+        // Out of AIO resources: do it synchronously
+    }
+    if (pwrite_full(f->fd, slot->buf, len, pos) < 0) {
+        return COUCHSTORE_ERROR_WRITE;
+    }
+    return COUCHSTORE_SUCCESS;
+}
+
+static couchstore_error_t alloc_slot(write_slot *slot)
+{
+    void *buf;
+    if (slot->buf == NULL) {
+        if (posix_memalign(&buf, DIRECT_ALIGN, WRITE_SLOT_SIZE) != 0) {
+            return COUCHSTORE_ERROR_ALLOC_FAIL;
+        }
+        slot->buf = buf;
+    }
+    return COUCHSTORE_SUCCESS;
+}
+
+/* Where the data from fill_pos to eof is */
+static inline char *fill_buf(direct_file *f)
+{
+    return f->filling ? f->slots[f->fill].buf : f->tail;
+}
+
+/* Moves the data of the tail block into a slot to append to */
+static couchstore_error_t start_filling(direct_file *f)
+{
+    if (!f->filling) {
+        write_slot *slot = &f->slots[f->fill];
+        couchstore_error_t errcode = alloc_slot(slot);
+        if (errcode != COUCHSTORE_SUCCESS) {
+            return errcode;
+        }
+        memcpy(slot->buf, f->tail, f->eof - f->fill_pos);
+        f->filling = 1;
+    }
+    return COUCHSTORE_SUCCESS;
+}
+
+/* Moves the data of the slot being filled back into the tail block and
+   releases the slots. All the writes must have completed. */
+static void stop_filling(direct_file *f)
+{
+    if (f->filling) {
+        memcpy(f->tail, f->slots[f->fill].buf, f->eof - f->fill_pos);
+        f->filling = 0;
+    }
+    for (int ii = 0; ii < WRITE_SLOTS; ++ii) {
+        free(f->slots[ii].buf);
+        f->slots[ii].buf = NULL;
+    }
+}
+
+/* Writes out the slot being filled (with its last block padded if partial),
+   and moves on to the next slot, carrying over the partial block */
+static couchstore_error_t write_fill(direct_file *f)
+{
+    couchstore_error_t errcode = COUCHSTORE_SUCCESS;
+    write_slot *slot = &f->slots[f->fill];
+    size_t used = f->eof - f->fill_pos;
+    size_t len = align_up(f->eof) - f->fill_pos;
+    size_t partial = f->eof - align_down(f->eof);
+
+    memset(slot->buf + used, 0, len - used);
+    error_pass(wait_writes(f, f->fill_pos, f->fill_pos + len));
+    error_pass(start_write(f, slot, f->fill_pos, len));
+    f->dirty = 0;
+    if (partial) {
+        f->padded = 1;
+    }
+
+    f->fill = (f->fill + 1) % WRITE_SLOTS;
+    write_slot *next = &f->slots[f->fill];
+    error_pass(wait_writes(f, next->pos, next->pos + next->len));
+    error_pass(alloc_slot(next));
+    memcpy(next->buf, slot->buf + (len - (partial ? DIRECT_ALIGN : 0)), partial);
+    f->fill_pos = align_down(f->eof);
+cleanup:
+    return errcode;
+}
+
+/* Appends data (zeros if NULL) to the file */
+static couchstore_error_t append(direct_file *f, const char *data, size_t len)
+{
+    if (len > 0) {
+        couchstore_error_t errcode = start_filling(f);
+        if (errcode != COUCHSTORE_SUCCESS) {
+            return errcode;
+        }
+    }
+    while (len > 0) {
+        write_slot *slot = &f->slots[f->fill];
+        size_t used = f->eof - f->fill_pos;
+        size_t n = WRITE_SLOT_SIZE - used;
+        if (n > len) {
+            n = len;
+        }
+        if (data) {
+            memcpy(slot->buf + used, data, n);
+            data += n;
+        } else {
+            memset(slot->buf + used, 0, n);
+        }
+        f->eof += n;
+        f->dirty = 1;
+        len -= n;
+        if (used + n == WRITE_SLOT_SIZE) {
+            couchstore_error_t errcode = write_fill(f);
+            if (errcode != COUCHSTORE_SUCCESS) {
+                return errcode;
+            }
+        }
+    }
+    return COUCHSTORE_SUCCESS;
+}
+
+static couchstore_error_t flush_writes(direct_file *f)
+{
+    couchstore_error_t errcode = COUCHSTORE_SUCCESS;
+    if (f->dirty) {
+        error_pass(write_fill(f));
+    }
+    error_pass(wait_writes(f, 0, INT64_MAX));
+    error_pass(f->write_error);
+    if (f->padded) {
+        int rv;
+        do {
+            rv = ftruncate(f->fd, f->eof);
+        } while (rv == -1 && errno == EINTR);
+        if (rv == -1) {
+            save_errno(errno);
+            error_pass(COUCHSTORE_ERROR_WRITE);
+        }
+        f->padded = 0;
+    }
+cleanup:
+    return errcode;
+}
+
+//////// READS:
+
+static couchstore_error_t reserve_readbuf(direct_file *f, size_t size)
+{
+    if (size > f->readbuf_size) {
+        void *buf;
+        if (posix_memalign(&buf, DIRECT_ALIGN, size) != 0) {
+            return COUCHSTORE_ERROR_ALLOC_FAIL;
+        }
+        free(f->readbuf);
+        f->readbuf = buf;
+        f->readbuf_size = size;
+    }
+    return COUCHSTORE_SUCCESS;
+}
+
+/* Reads the whole blocks [pos, pos + len) into the read buffer */
+static couchstore_error_t read_blocks(direct_file *f, cs_off_t pos, size_t len)
+{
+    couchstore_error_t errcode = COUCHSTORE_SUCCESS;
+    error_pass(reserve_readbuf(f, len));
+
+    if (f->aio && len > READ_CHUNK_SIZE) {
+        // Keep several chunks in flight, the device may serve them in parallel
+        struct iocb *cbps[MAX_READ_CHUNKS];
+        size_t done = 0;
+        if (f->read_ops == NULL) {
+            f->read_ops = calloc(MAX_READ_CHUNKS, sizeof(aio_op));
+            error_unless(f->read_ops, COUCHSTORE_ERROR_ALLOC_FAIL);
+        }
+        while (done < len) {
+            long nr = 0;
+            while (nr < MAX_READ_CHUNKS && done < len) {
+                size_t n = len - done < READ_CHUNK_SIZE ? len - done : READ_CHUNK_SIZE;
+                prep_op(&f->read_ops[nr], f->fd, IOCB_CMD_PREAD, f->readbuf + done,
+                        n, pos + done);
+                cbps[nr] = &f->read_ops[nr].cb;
+                done += n;
+                ++nr;
+            }
+            long submitted = sys_io_submit(f->aio, nr, cbps);
+            if (submitted < 0) {
+                submitted = 0;
+            }
+            // Whatever couldn't be submitted is read synchronously
+            for (long ii = submitted; ii < nr; ++ii) {
+                if (pread_full(f->fd, (char*)(uintptr_t)cbps[ii]->aio_buf,
+                               cbps[ii]->aio_nbytes, cbps[ii]->aio_offset) < 0) {
+                    errcode = COUCHSTORE_ERROR_READ;
+                }
+            }
+            for (long ii = 0; ii < submitted; ++ii) {
+                aio_op *op = &f->read_ops[ii];
+                if (wait_op(op) < 0) {
+                    // The buffers may still be in use: don't let them go
+                    f->readbuf = NULL;
+                    f->readbuf_size = 0;
+                    f->read_ops = NULL;
+                    return COUCHSTORE_ERROR_READ;
+                }
+                if (op->res != (int64_t)op->cb.aio_nbytes) {
+                    save_errno(op->res < 0 ? (int)-op->res : EIO);
+                    errcode = COUCHSTORE_ERROR_READ;
+                }
+            }
+            error_pass(errcode);
+        }
+    } else if (pread_full(f->fd, f->readbuf, len, pos) < 0) {
+        error_pass(COUCHSTORE_ERROR_READ);
+    }
+cleanup:
+    return errcode;
+}
+
+/* Loads the last, partial block of the file into the tail block. No data
+   may be buffered for writing. */
+static couchstore_error_t load_tail(direct_file *f, cs_off_t eof)
+{
+    couchstore_error_t errcode = COUCHSTORE_SUCCESS;
+    f->filling = 0;
+    f->eof = eof;
+    f->fill_pos = align_down(eof);
+    if (eof > f->fill_pos) {
+        // Only part of the block is there: read it as a whole
+        ssize_t rv;
+        do {
+            rv = pread(f->fd, f->tail, DIRECT_ALIGN, f->fill_pos);
+        } while (rv == -1 && errno == EINTR);
+        if (rv < eof - f->fill_pos) {
+            save_errno(rv < 0 ? errno : EIO);
+            error_pass(COUCHSTORE_ERROR_READ);
+        }
+    }
+cleanup:
+    return errcode;
+}
+
+//////// FILE OPS:
+
+static couch_file_handle direct_constructor(void* cookie)
+{
+    (void) cookie;
+    direct_file *f = calloc(1, sizeof(direct_file));
+    void *tail;
+    if (f) {
+        if (posix_memalign(&tail, DIRECT_ALIGN, DIRECT_ALIGN) != 0) {
+            free(f);
+            return NULL;
+        }
+        f->tail = tail;
+        f->fd = -1;
+    }
+    return (couch_file_handle) f;
+}
+
+static couchstore_error_t direct_open(couch_file_handle* handle, const char *path, int oflag)
+{
+    direct_file *f = (direct_file*) *handle;
+    couchstore_error_t errcode = COUCHSTORE_SUCCESS;
+    struct stat st;
+    int fd;
+
+    if (f == NULL) {
+        return COUCHSTORE_ERROR_ALLOC_FAIL;
+    }
+    do {
+        fd = open(path, oflag | O_LARGEFILE | O_DIRECT, 0666);
+    } while (fd == -1 && errno == EINTR);
+    if (fd == -1 && errno == EINVAL) {
+        // The file system doesn't support direct I/O
+        do {
+            fd = open(path, oflag | O_LARGEFILE, 0666);
+        } while (fd == -1 && errno == EINTR);
+    }
+    if (fd < 0) {
+        save_errno(errno);
+        if (errno == ENOENT) {
+            return COUCHSTORE_ERROR_NO_SUCH_FILE;
+        } else {
+            return COUCHSTORE_ERROR_OPEN_FILE;
+        }
+    }
+    f->fd = fd;
+    f->write_error = COUCHSTORE_SUCCESS;
+
+    if (fstat(fd, &st) == -1) {
+        save_errno(errno);
+        error_pass(COUCHSTORE_ERROR_OPEN_FILE);
+    }
+    error_pass(load_tail(f, st.st_size));
+    f->aio = get_aio_context();
+    return COUCHSTORE_SUCCESS;
+
+cleanup:
+    close(fd);
+    f->fd = -1;
+    return errcode;
+}
+
+static void direct_close(couch_file_handle handle)
+{
+    direct_file *f = (direct_file*) handle;
+    int rv;
+
+    if (f->fd == -1) {
+        return;
+    }
+    // Nothing to report errors to: sync() is where they are expected
+    flush_writes(f);
+    do {
+        rv = close(f->fd);
+    } while (rv == -1 && errno == EINTR);
+    if (rv < 0) {
+        save_errno(errno);
+    }
+    f->fd = -1;
+}
+
+static ssize_t direct_pread(couch_file_handle handle, void *buf, size_t nbyte, cs_off_t offset)
+{
+    direct_file *f = (direct_file*) handle;
+    couchstore_error_t errcode = COUCHSTORE_SUCCESS;
+    char *dst = buf;
+
+    if (offset >= f->eof) {
+        return 0;
+    }
+    if (offset + (cs_off_t)nbyte > f->eof) {
+        nbyte = f->eof - offset;
+    }
+    size_t from_disk = nbyte;
+    if (offset + (cs_off_t)nbyte > f->fill_pos) {
+        // The end is still in the write buffer
+        cs_off_t from = offset > f->fill_pos ? offset : f->fill_pos;
+        from_disk = from - offset;
+        memcpy(dst + from_disk, fill_buf(f) + (from - f->fill_pos),
+               nbyte - from_disk);
+    }
+    if (from_disk > 0) {
+        cs_off_t start = align_down(offset);
+        cs_off_t end = align_up(offset + from_disk);
+        error_pass(wait_writes(f, start, end));
+        error_pass(read_blocks(f, start, end - start));
+        memcpy(dst, f->readbuf + (offset - start), from_disk);
+    }
+    return nbyte;
+
+cleanup:
+    return (ssize_t) (errcode == COUCHSTORE_ERROR_WRITE ? COUCHSTORE_ERROR_READ : errcode);
+}
+
+/* Rewrites data already in the file, which couchstore itself never does */
+static couchstore_error_t overwrite(direct_file *f, const char *data, size_t len, cs_off_t offset)
+{
+    couchstore_error_t errcode = COUCHSTORE_SUCCESS;
+    if (offset + (cs_off_t)len > f->fill_pos) {
+        cs_off_t from = offset > f->fill_pos ? offset : f->fill_pos;
+        error_pass(start_filling(f));
+        memcpy(f->slots[f->fill].buf + (from - f->fill_pos), data + (from - offset),
+               offset + len - from);
+        f->dirty = 1;
+        len = from - offset;
+    }
+    if (len > 0) {
+        cs_off_t start = align_down(offset);
+        cs_off_t end = align_up(offset + len);
+        error_pass(wait_writes(f, start, end));
+        error_pass(read_blocks(f, start, end - start));
+        memcpy(f->readbuf + (offset - start), data, len);
+        if (pwrite_full(f->fd, f->readbuf, end - start, start) < 0) {
+            error_pass(COUCHSTORE_ERROR_WRITE);
+        }
+    }
+cleanup:
+    return errcode;
+}
+
+static ssize_t direct_pwrite(couch_file_handle handle, const void *buf, size_t nbyte, cs_off_t offset)
+{
+    direct_file *f = (direct_file*) handle;
+    couchstore_error_t errcode = COUCHSTORE_SUCCESS;
+    const char *src = buf;
+    size_t len = nbyte;
+
+    error_pass(f->write_error);
+    if (offset < f->eof) {
+        size_t n = f->eof - offset;
+        if (n > len) {
+            n = len;
+        }
+        error_pass(overwrite(f, src, n, offset));
+        src += n;
+        len -= n;
+        offset += n;
+    }
+    if (len > 0) {
+        // Headers are written at block boundaries, past a gap
+        error_pass(append(f, NULL, offset - f->eof));
+        error_pass(append(f, src, len));
+    }
+    return nbyte;
+
+cleanup:
+    return (ssize_t) (errcode == COUCHSTORE_ERROR_READ ? COUCHSTORE_ERROR_WRITE : errcode);
+}
+
+static cs_off_t direct_goto_eof(couch_file_handle handle)
+{
+    direct_file *f = (direct_file*) handle;
+    struct stat st;
+
+    if (!f->dirty && !f->padded && fstat(f->fd, &st) == 0 && st.st_size > f->eof) {
+        // Another handle appended to the file
+        if (wait_writes(f, 0, INT64_MAX) != COUCHSTORE_SUCCESS ||
+            load_tail(f, st.st_size) != COUCHSTORE_SUCCESS) {
+            return -1;
+        }
+    }
+    return f->eof;
+}
+
+static couchstore_error_t direct_sync(couch_file_handle handle)
+{
+    direct_file *f = (direct_file*) handle;
+    couchstore_error_t errcode = COUCHSTORE_SUCCESS;
+    int rv;
+
+    error_pass(flush_writes(f));
+    do {
+        rv = fdatasync(f->fd);
+    } while (rv == -1 && errno == EINTR);
+    if (rv == -1) {
+        save_errno(errno);
+        error_pass(COUCHSTORE_ERROR_WRITE);
+    }
+    // Nothing is in flight anymore: don't hold the write buffers while idle
+    stop_filling(f);
+cleanup:
+    return errcode;
+}
+
+static void direct_destructor(couch_file_handle handle)
+{
+    direct_file *f = (direct_file*) handle;
+    if (f == NULL) {
+        return;
+    }
+    for (int ii = 0; ii < WRITE_SLOTS; ++ii) {
+        // A write we failed to wait for may still use its buffer
+        if (!f->slots[ii].busy) {
+            free(f->slots[ii].buf);
+        }
+    }
+    free(f->tail);
+    free(f->readbuf);
+    free(f->read_ops);
+    free(f);
+}
+
+static const couch_file_ops direct_file_ops = {
+    (uint64_t)3,
+    direct_constructor,
+    direct_open,
+    direct_close,
+    direct_pread,
+    direct_pwrite,
+    direct_goto_eof,
+    direct_sync,
+    direct_destructor,
+    NULL
+};
+
+LIBCOUCHSTORE_API
+const couch_file_ops *couchstore_get_direct_file_ops(void)
+{
+    return &direct_file_ops;
+}
+
+#else
+
+LIBCOUCHSTORE_API
+const couch_file_ops *couchstore_get_direct_file_ops(void)
+{
+    return couchstore_get_default_file_ops();
+}
+
+#endif
@@ -157,3 +157,9 @@ const couch_file_ops *couchstore_get_default_file_ops(void)
 {
     return &default_file_ops;
 }
+
+LIBCOUCHSTORE_API
+const couch_file_ops *couchstore_get_direct_file_ops(void)
+{
+    return &default_file_ops;
+}
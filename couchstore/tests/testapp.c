@@ -671,6 +671,690 @@ static void test_huge_revseq(void)
     assert(remove("bigrevseq.couch") == 0);
 }
 
+static void test_refresh_db(void)
+{
+    Db *db, *reader;
+    Doc d;
+    DocInfo i;
+    DocInfo *i2;
+    couchstore_error_t err;
+
+    fprintf(stderr, "refresh db... ");
+    fflush(stderr);
+
+    unlink(testfilepath);
+    setdoc(&d, &i, "one", 3, "foo", 3, NULL, 0);
+    err = couchstore_open_db(testfilepath, COUCHSTORE_OPEN_FLAG_CREATE, &db);
+    assert(err == COUCHSTORE_SUCCESS);
+    assert(couchstore_save_document(db, &d, &i, 0) == COUCHSTORE_SUCCESS);
+    assert(couchstore_commit(db) == COUCHSTORE_SUCCESS);
+
+    err = couchstore_open_db(testfilepath, COUCHSTORE_OPEN_FLAG_RDONLY, &reader);
+    assert(err == COUCHSTORE_SUCCESS);
+    assert(couchstore_docinfo_by_id(reader, "one", 3, &i2) == COUCHSTORE_SUCCESS);
+    couchstore_free_docinfo(i2);
+
+    /* Nothing was written, so refreshing is a no-op */
+    assert(couchstore_refresh_db(reader) == COUCHSTORE_SUCCESS);
+
+    setdoc(&d, &i, "two", 3, "bar", 3, NULL, 0);
+    assert(couchstore_save_document(db, &d, &i, 0) == COUCHSTORE_SUCCESS);
+    assert(couchstore_commit(db) == COUCHSTORE_SUCCESS);
+
+    /* The reader still sees the header it was opened with */
+    assert(couchstore_docinfo_by_id(reader, "two", 3, &i2) == COUCHSTORE_ERROR_DOC_NOT_FOUND);
+    assert(couchstore_refresh_db(reader) == COUCHSTORE_SUCCESS);
+    assert(couchstore_get_header_position(reader) == couchstore_get_header_position(db));
+    assert(couchstore_docinfo_by_id(reader, "two", 3, &i2) == COUCHSTORE_SUCCESS);
+    couchstore_free_docinfo(i2);
+    assert(couchstore_docinfo_by_id(reader, "one", 3, &i2) == COUCHSTORE_SUCCESS);
+    couchstore_free_docinfo(i2);
+
+    assert(couchstore_close_db(reader) == COUCHSTORE_SUCCESS);
+    assert(couchstore_close_db(db) == COUCHSTORE_SUCCESS);
+    unlink(testfilepath);
+}
+
+static void test_group_commit(void)
+{
+    char otherfilepath[1024];
+    Db *db, *other;
+    Doc d;
+    DocInfo i;
+    DocInfo *i2;
+    couchstore_error_t err;
+
+    fprintf(stderr, "group commit... ");
+    fflush(stderr);
+
+    snprintf(otherfilepath, sizeof(otherfilepath), "%s.2", testfilepath);
+    unlink(testfilepath);
+    unlink(otherfilepath);
+    err = couchstore_open_db(testfilepath, COUCHSTORE_OPEN_FLAG_CREATE, &db);
+    assert(err == COUCHSTORE_SUCCESS);
+    err = couchstore_open_db(otherfilepath, COUCHSTORE_OPEN_FLAG_CREATE, &other);
+    assert(err == COUCHSTORE_SUCCESS);
+
+    setdoc(&d, &i, "one", 3, "foo", 3, NULL, 0);
+    assert(couchstore_save_document(db, &d, &i, 0) == COUCHSTORE_SUCCESS);
+    setdoc(&d, &i, "two", 3, "bar", 3, NULL, 0);
+    assert(couchstore_save_document(other, &d, &i, 0) == COUCHSTORE_SUCCESS);
+
+    assert(couchstore_commit_data(db) == COUCHSTORE_SUCCESS);
+    assert(couchstore_commit_data(other) == COUCHSTORE_SUCCESS);
+    assert(couchstore_sync_db(db) == COUCHSTORE_SUCCESS);
+    assert(couchstore_sync_db(other) == COUCHSTORE_SUCCESS);
+    assert(couchstore_commit_header(db) == COUCHSTORE_SUCCESS);
+    assert(couchstore_commit_header(other) == COUCHSTORE_SUCCESS);
+    assert(couchstore_sync_db(db) == COUCHSTORE_SUCCESS);
+    assert(couchstore_sync_db(other) == COUCHSTORE_SUCCESS);
+    assert(couchstore_close_db(db) == COUCHSTORE_SUCCESS);
+    assert(couchstore_close_db(other) == COUCHSTORE_SUCCESS);
+
+    /* Both files have a header covering their document */
+    err = couchstore_open_db(testfilepath, COUCHSTORE_OPEN_FLAG_RDONLY, &db);
+    assert(err == COUCHSTORE_SUCCESS);
+    assert(couchstore_docinfo_by_id(db, "one", 3, &i2) == COUCHSTORE_SUCCESS);
+    couchstore_free_docinfo(i2);
+    assert(couchstore_close_db(db) == COUCHSTORE_SUCCESS);
+
+    err = couchstore_open_db(otherfilepath, COUCHSTORE_OPEN_FLAG_RDONLY, &other);
+    assert(err == COUCHSTORE_SUCCESS);
+    assert(couchstore_docinfo_by_id(other, "two", 3, &i2) == COUCHSTORE_SUCCESS);
+    couchstore_free_docinfo(i2);
+    assert(couchstore_close_db(other) == COUCHSTORE_SUCCESS);
+
+    unlink(testfilepath);
+    unlink(otherfilepath);
+}
+
+
+/* Overwrites the contents of a file without changing its inode */
+static void copy_file_in_place(const char *from, const char *to)
+{
+    char buf[4096];
+    size_t n;
+    FILE *in = fopen(from, "rb");
+    FILE *out = fopen(to, "r+b");
+    assert(in && out);
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        assert(fwrite(buf, 1, n, out) == n);
+    }
+    fclose(in);
+    fclose(out);
+}
+
+static int sum_bp_cb(Db *db, DocInfo *info, void *ctx)
+{
+    (void) db;
+    *(uint64_t *) ctx += info->bp;
+    return 0;
+}
+
+static void test_node_cache(void)
+{
+    char otherpath[1024];
+    Db *db, *reader, *other;
+    Doc d;
+    DocInfo i;
+    DocInfo *i2;
+    NodeCacheInfo before, after;
+    uint64_t bp_sum = 0, bp_sum2 = 0;
+    char key[32];
+    int ii;
+    int errcode = 0;
+
+    fprintf(stderr, "node cache... ");
+    fflush(stderr);
+
+    assert(couchstore_set_node_cache_size(1024 * 1024) == COUCHSTORE_SUCCESS);
+
+    unlink(testfilepath);
+    try(couchstore_open_db(testfilepath, COUCHSTORE_OPEN_FLAG_CREATE, &db));
+    for (ii = 0; ii < 1000; ++ii) {
+        int nkey = snprintf(key, sizeof(key), "doc%d", ii);
+        setdoc(&d, &i, key, nkey, "foo", 3, NULL, 0);
+        try(couchstore_save_document(db, &d, &i, 0));
+    }
+    try(couchstore_commit(db));
+    try(couchstore_close_db(db));
+
+    try(couchstore_open_db(testfilepath, COUCHSTORE_OPEN_FLAG_RDONLY, &reader));
+    try(couchstore_open_db(testfilepath, COUCHSTORE_OPEN_FLAG_RDONLY, &other));
+
+    /* The first lookup reads the nodes from the file... */
+    couchstore_get_node_cache_info(&before);
+    try(couchstore_docinfo_by_id(reader, "doc1", 4, &i2));
+    couchstore_free_docinfo(i2);
+    couchstore_get_node_cache_info(&after);
+    assert(after.misses > before.misses);
+    assert(after.hits == before.hits);
+    assert(after.num_nodes > before.num_nodes);
+
+    /* ...which are then shared by all the handles of the file */
+    before = after;
+    try(couchstore_docinfo_by_id(other, "doc1", 4, &i2));
+    assert(i2->id.size == 4 && memcmp(i2->id.buf, "doc1", 4) == 0);
+    couchstore_free_docinfo(i2);
+    couchstore_get_node_cache_info(&after);
+    assert(after.misses == before.misses);
+    assert(after.hits > before.hits);
+
+    for (ii = 0; ii < 1000; ++ii) {
+        int nkey = snprintf(key, sizeof(key), "doc%d", ii);
+        try(couchstore_docinfo_by_id(other, key, nkey, &i2));
+        assert(i2->id.size == (size_t)nkey && memcmp(i2->id.buf, key, nkey) == 0);
+        couchstore_free_docinfo(i2);
+    }
+
+    /* Shrinking the cache evicts the least recently used nodes */
+    assert(couchstore_set_node_cache_size(4096) == COUCHSTORE_SUCCESS);
+    couchstore_get_node_cache_info(&after);
+    assert(after.size <= 4096);
+    assert(after.evictions > 0);
+    try(couchstore_close_db(reader));
+    try(couchstore_close_db(other));
+
+    /* The nodes of a file go away with its last handle */
+    couchstore_get_node_cache_info(&after);
+    assert(after.num_nodes == 0 && after.size == 0);
+
+    /* Nodes of a deleted file are not served for a new one */
+    unlink(testfilepath);
+    try(couchstore_open_db(testfilepath, COUCHSTORE_OPEN_FLAG_CREATE, &db));
+    setdoc(&d, &i, "other", 5, "bar", 3, NULL, 0);
+    try(couchstore_save_document(db, &d, &i, 0));
+    try(couchstore_commit(db));
+    assert(couchstore_docinfo_by_id(db, "doc1", 4, &i2) == COUCHSTORE_ERROR_DOC_NOT_FOUND);
+    try(couchstore_docinfo_by_id(db, "other", 5, &i2));
+    couchstore_free_docinfo(i2);
+    try(couchstore_close_db(db));
+
+    /* Nor for a file written over it in place, as by a restore, once
+       its handles are closed */
+    assert(couchstore_set_node_cache_size(1024 * 1024) == COUCHSTORE_SUCCESS);
+    snprintf(otherpath, sizeof(otherpath), "%s.other", testfilepath);
+    unlink(otherpath);
+    try(couchstore_open_db(otherpath, COUCHSTORE_OPEN_FLAG_CREATE, &db));
+    setdoc(&d, &i, "third", 5, "baz", 3, NULL, 0);
+    try(couchstore_save_document(db, &d, &i, 0));
+    try(couchstore_commit(db));
+    try(couchstore_close_db(db));
+    try(couchstore_open_db(testfilepath, COUCHSTORE_OPEN_FLAG_RDONLY, &db));
+    try(couchstore_docinfo_by_id(db, "other", 5, &i2));
+    couchstore_free_docinfo(i2);
+    try(couchstore_close_db(db));
+    copy_file_in_place(otherpath, testfilepath);
+    try(couchstore_open_db(testfilepath, COUCHSTORE_OPEN_FLAG_RDONLY, &db));
+    assert(couchstore_docinfo_by_id(db, "other", 5, &i2) == COUCHSTORE_ERROR_DOC_NOT_FOUND);
+    try(couchstore_docinfo_by_id(db, "third", 5, &i2));
+    couchstore_free_docinfo(i2);
+    try(couchstore_close_db(db));
+    unlink(otherpath);
+
+    /* Compacting a file leaves its cached nodes as they are */
+    try(couchstore_open_db(testfilepath, 0, &db));
+    for (ii = 0; ii < 200; ++ii) {
+        int nkey = snprintf(key, sizeof(key), "doc%d", ii);
+        setdoc(&d, &i, key, nkey, "foo", 3, NULL, 0);
+        try(couchstore_save_document(db, &d, &i, 0));
+    }
+    try(couchstore_commit(db));
+    try(couchstore_changes_since(db, 0, 0, sum_bp_cb, &bp_sum));
+    try(couchstore_compact_db(db, otherpath));
+    try(couchstore_changes_since(db, 0, 0, sum_bp_cb, &bp_sum2));
+    assert(bp_sum == bp_sum2);
+    try(couchstore_close_db(db));
+    unlink(otherpath);
+
+    /* No cache holds nothing */
+    assert(couchstore_set_node_cache_size(0) == COUCHSTORE_SUCCESS);
+    couchstore_get_node_cache_info(&after);
+    assert(after.size == 0 && after.num_nodes == 0);
+
+    unlink(testfilepath);
+cleanup:
+    assert(errcode == 0);
+}
+
+static int compare_docs_cb(Db *db, DocInfo *info, void *ctx)
+{
+    Db *other = ctx;
+    DocInfo *info2;
+    Doc *doc, *doc2;
+
+    assert(couchstore_docinfo_by_id(other, info->id.buf, info->id.size,
+                                    &info2) == COUCHSTORE_SUCCESS);
+    assert(info2->db_seq == info->db_seq);
+    assert(info2->rev_seq == info->rev_seq);
+    assert(info2->deleted == info->deleted);
+    assert(info2->content_meta == info->content_meta);
+    if (info->bp != 0) {
+        assert(couchstore_open_doc_with_docinfo(db, info, &doc, 0) == COUCHSTORE_SUCCESS);
+        assert(couchstore_open_doc_with_docinfo(other, info2, &doc2, 0) == COUCHSTORE_SUCCESS);
+        assert(doc->data.size == doc2->data.size);
+        assert(memcmp(doc->data.buf, doc2->data.buf, doc->data.size) == 0);
+        couchstore_free_document(doc);
+        couchstore_free_document(doc2);
+    }
+    couchstore_free_docinfo(info2);
+    return 0;
+}
+
+/* Checks that two databases hold the same documents */
+static void assert_same_docs(Db *db, Db *other)
+{
+    DbInfo info, info2;
+    assert(couchstore_db_info(db, &info) == COUCHSTORE_SUCCESS);
+    assert(couchstore_db_info(other, &info2) == COUCHSTORE_SUCCESS);
+    assert(info.last_sequence == info2.last_sequence);
+    assert(info.doc_count == info2.doc_count);
+    assert(info.deleted_count == info2.deleted_count);
+    assert(couchstore_changes_since(db, 0, 0, compare_docs_cb, other) == COUCHSTORE_SUCCESS);
+}
+
+static void save_numbered_docs(Db *db, int from, int to, char *value)
+{
+    char key[32];
+    Doc d;
+    DocInfo i;
+    int ii;
+    for (ii = from; ii < to; ++ii) {
+        int nkey = snprintf(key, sizeof(key), "doc%d", ii);
+        setdoc(&d, &i, key, nkey, value, strlen(value), NULL, 0);
+        assert(couchstore_save_document(db, &d, &i, 0) == COUCHSTORE_SUCCESS);
+    }
+}
+
+static void test_compact_parallel_catchup(void)
+{
+    char compactpath[1024], parallelpath[1024];
+    Db *db, *reader, *compacted, *parallel;
+    Doc d;
+    DocInfo i;
+
+    fprintf(stderr, "parallel compaction and catch-up... ");
+    fflush(stderr);
+
+    snprintf(compactpath, sizeof(compactpath), "%s.compact", testfilepath);
+    snprintf(parallelpath, sizeof(parallelpath), "%s.parallel", testfilepath);
+    unlink(testfilepath);
+    unlink(compactpath);
+    unlink(parallelpath);
+
+    assert(couchstore_open_db(testfilepath, COUCHSTORE_OPEN_FLAG_CREATE, &db) == COUCHSTORE_SUCCESS);
+    save_numbered_docs(db, 0, 5000, "{\"v\":1}");
+    save_numbered_docs(db, 0, 1000, "{\"v\":2}");
+    setdoc(&d, &i, "doc42", 5, NULL, 0, NULL, 0);
+    i.deleted = 1;
+    assert(couchstore_save_document(db, NULL, &i, 0) == COUCHSTORE_SUCCESS);
+    setdoc(&d, &i, "_local/state", 12, "{\"s\":1}", 7, NULL, 0);
+    LocalDoc ld;
+    ld.id = d.id;
+    ld.json = d.data;
+    ld.deleted = 0;
+    assert(couchstore_save_local_document(db, &ld) == COUCHSTORE_SUCCESS);
+    assert(couchstore_commit(db) == COUCHSTORE_SUCCESS);
+
+    /* Both modes produce the same documents */
+    assert(couchstore_open_db(testfilepath, COUCHSTORE_OPEN_FLAG_RDONLY, &reader) == COUCHSTORE_SUCCESS);
+    assert(couchstore_compact_db(reader, compactpath) == COUCHSTORE_SUCCESS);
+    assert(couchstore_compact_db_ex(reader, parallelpath, COUCHSTORE_COMPACT_FLAG_PARALLEL,
+                                    couchstore_get_default_file_ops()) == COUCHSTORE_SUCCESS);
+    assert(couchstore_open_db(compactpath, 0, &compacted) == COUCHSTORE_SUCCESS);
+    assert(couchstore_open_db(parallelpath, 0, &parallel) == COUCHSTORE_SUCCESS);
+    assert_same_docs(reader, compacted);
+    assert_same_docs(reader, parallel);
+    assert_same_docs(parallel, reader);
+
+    /* Changes committed after the compaction started are caught up */
+    save_numbered_docs(db, 4000, 6000, "{\"v\":3}");
+    setdoc(&d, &i, "doc7", 4, NULL, 0, NULL, 0);
+    i.deleted = 1;
+    assert(couchstore_save_document(db, NULL, &i, 0) == COUCHSTORE_SUCCESS);
+    ld.json.buf = "{\"s\":2}";
+    assert(couchstore_save_local_document(db, &ld) == COUCHSTORE_SUCCESS);
+    assert(couchstore_commit(db) == COUCHSTORE_SUCCESS);
+
+    assert(couchstore_compact_catchup(reader, parallel) == COUCHSTORE_SUCCESS);
+    assert_same_docs(db, parallel);
+    assert_same_docs(parallel, db);
+    LocalDoc *ld2;
+    assert(couchstore_open_local_document(parallel, "_local/state", 12, &ld2) == COUCHSTORE_SUCCESS);
+    assert(ld2->json.size == 7 && memcmp(ld2->json.buf, "{\"s\":2}", 7) == 0);
+    couchstore_free_local_document(ld2);
+
+    /* Nothing new: a no-op */
+    assert(couchstore_compact_catchup(reader, parallel) == COUCHSTORE_SUCCESS);
+    assert_same_docs(db, parallel);
+    assert(couchstore_close_db(parallel) == COUCHSTORE_SUCCESS);
+
+    /* The catch-up reopens cleanly */
+    assert(couchstore_open_db(parallelpath, COUCHSTORE_OPEN_FLAG_RDONLY, &parallel) == COUCHSTORE_SUCCESS);
+    assert_same_docs(db, parallel);
+
+    /* A batch that fails to save fails the catch-up */
+    save_numbered_docs(db, 6000, 9000, "{\"v\":4}");
+    assert(couchstore_commit(db) == COUCHSTORE_SUCCESS);
+    assert(couchstore_compact_catchup(reader, parallel) != COUCHSTORE_SUCCESS);
+    assert(couchstore_close_db(parallel) == COUCHSTORE_SUCCESS);
+
+    /* The catch-up flag does it as part of the compaction */
+    assert(couchstore_close_db(compacted) == COUCHSTORE_SUCCESS);
+    unlink(compactpath);
+    assert(couchstore_compact_db_ex(reader, compactpath, COUCHSTORE_COMPACT_FLAG_CATCHUP,
+                                    couchstore_get_default_file_ops()) == COUCHSTORE_SUCCESS);
+    assert(couchstore_open_db(compactpath, COUCHSTORE_OPEN_FLAG_RDONLY, &compacted) == COUCHSTORE_SUCCESS);
+    assert_same_docs(db, compacted);
+    assert(couchstore_close_db(compacted) == COUCHSTORE_SUCCESS);
+
+    assert(couchstore_close_db(reader) == COUCHSTORE_SUCCESS);
+    assert(couchstore_close_db(db) == COUCHSTORE_SUCCESS);
+    unlink(testfilepath);
+    unlink(compactpath);
+    unlink(parallelpath);
+}
+
+static void test_bulk_load(void)
+{
+    char key[32];
+    char keys[100][16];
+    sized_buf ids[100];
+    char *value = "{\"v\":1}";
+    Db *db;
+    BulkLoader *loader;
+    DbInfo info;
+    Doc d;
+    DocInfo i, *out_info;
+    int ii;
+
+    fprintf(stderr, "bulk load... ");
+    fflush(stderr);
+
+    unlink(testfilepath);
+    assert(couchstore_open_db(testfilepath, COUCHSTORE_OPEN_FLAG_CREATE, &db) == COUCHSTORE_SUCCESS);
+    assert(couchstore_bulk_load_begin(db, &loader) == COUCHSTORE_SUCCESS);
+    for (ii = 0; ii < 20000; ++ii) {
+        int nkey = snprintf(key, sizeof(key), "doc%06d", ii);
+        setdoc(&d, &i, key, nkey, value, strlen(value), NULL, 0);
+        if (ii % 10 == 0) {
+            i.deleted = 1;
+            assert(couchstore_bulk_load_document(loader, NULL, &i, 0) == COUCHSTORE_SUCCESS);
+        } else {
+            assert(couchstore_bulk_load_document(loader, &d, &i, 0) == COUCHSTORE_SUCCESS);
+        }
+        assert(i.db_seq == (uint64_t) ii + 1);
+    }
+    // Out of order
+    setdoc(&d, &i, "doc000005", 9, value, strlen(value), NULL, 0);
+    assert(couchstore_bulk_load_document(loader, &d, &i, 0) == COUCHSTORE_ERROR_INVALID_ARGUMENTS);
+    assert(couchstore_bulk_load_end(loader) == COUCHSTORE_SUCCESS);
+    assert(couchstore_commit(db) == COUCHSTORE_SUCCESS);
+
+    // Only a database without documents can be bulk loaded
+    assert(couchstore_bulk_load_begin(db, &loader) == COUCHSTORE_ERROR_INVALID_ARGUMENTS);
+    assert(couchstore_close_db(db) == COUCHSTORE_SUCCESS);
+
+    assert(couchstore_open_db(testfilepath, 0, &db) == COUCHSTORE_SUCCESS);
+    assert(couchstore_db_info(db, &info) == COUCHSTORE_SUCCESS);
+    assert(info.last_sequence == 20000);
+    assert(info.doc_count == 18000);
+    assert(info.deleted_count == 2000);
+    ZERO(counters);
+    assert(couchstore_changes_since(db, 0, 0, counter_inc, &counters) == COUCHSTORE_SUCCESS);
+    assert(counters.totaldocs == 20000);
+    assert(counters.deleted == 2000);
+    for (ii = 0; ii < 20000; ii += 7) {
+        int nkey = snprintf(key, sizeof(key), "doc%06d", ii);
+        assert(couchstore_docinfo_by_id(db, key, nkey, &out_info) == COUCHSTORE_SUCCESS);
+        assert(out_info->db_seq == (uint64_t) ii + 1);
+        assert(out_info->deleted == (ii % 10 == 0));
+        couchstore_free_docinfo(out_info);
+    }
+
+    // Bulk lookups leave out deleted documents, or keep only them
+    for (ii = 0; ii < 100; ++ii) {
+        ids[ii].buf = keys[ii];
+        ids[ii].size = snprintf(keys[ii], sizeof(keys[ii]), "doc%06d", ii);
+    }
+    ZERO(counters);
+    assert(couchstore_docinfos_by_id(db, ids, 100, COUCHSTORE_NO_DELETES,
+                                     counter_inc, &counters) == COUCHSTORE_SUCCESS);
+    assert(counters.totaldocs == 90);
+    assert(counters.deleted == 0);
+    ZERO(counters);
+    assert(couchstore_docinfos_by_id(db, ids, 100, COUCHSTORE_DELETES_ONLY,
+                                     counter_inc, &counters) == COUCHSTORE_SUCCESS);
+    assert(counters.totaldocs == 10);
+    assert(counters.deleted == 10);
+
+    // The tree takes updates afterwards
+    for (ii = 0; ii < 100; ++ii) {
+        int nkey = snprintf(key, sizeof(key), "doc%06d", ii);
+        setdoc(&d, &i, key, nkey, value, strlen(value), NULL, 0);
+        assert(couchstore_save_document(db, &d, &i, 0) == COUCHSTORE_SUCCESS);
+    }
+    assert(couchstore_commit(db) == COUCHSTORE_SUCCESS);
+    assert(couchstore_db_info(db, &info) == COUCHSTORE_SUCCESS);
+    assert(info.last_sequence == 20100);
+    assert(info.doc_count == 18010);
+    assert(info.deleted_count == 1990);
+    assert(couchstore_close_db(db) == COUCHSTORE_SUCCESS);
+    unlink(testfilepath);
+}
+
+static void test_direct_io(void)
+{
+    char directpath[1024], compactpath[1024];
+    const couch_file_ops *direct = couchstore_get_direct_file_ops();
+    Db *db, *direct_db, *reader, *compacted;
+    Doc d, *out_doc;
+    DocInfo i;
+    char *big;
+    size_t bigsize = 700 * 1024;
+    int ii;
+
+    fprintf(stderr, "direct io... ");
+    fflush(stderr);
+
+    snprintf(directpath, sizeof(directpath), "%s.direct", testfilepath);
+    snprintf(compactpath, sizeof(compactpath), "%s.compact", testfilepath);
+    unlink(testfilepath);
+    unlink(directpath);
+    unlink(compactpath);
+    big = malloc(bigsize);
+    assert(big);
+    for (ii = 0; ii < (int) bigsize; ++ii) {
+        big[ii] = 'a' + ii % 26;
+    }
+
+    /* The same changes through both ops give the same documents */
+    assert(couchstore_open_db(testfilepath, COUCHSTORE_OPEN_FLAG_CREATE, &db) == COUCHSTORE_SUCCESS);
+    assert(couchstore_open_db_ex(directpath, COUCHSTORE_OPEN_FLAG_CREATE, direct,
+                                 &direct_db) == COUCHSTORE_SUCCESS);
+    for (ii = 0; ii < 4; ++ii) {
+        save_numbered_docs(db, ii * 1000, ii * 1000 + 3000, "{\"v\":1}");
+        save_numbered_docs(direct_db, ii * 1000, ii * 1000 + 3000, "{\"v\":1}");
+        assert(couchstore_commit(db) == COUCHSTORE_SUCCESS);
+        assert(couchstore_commit(direct_db) == COUCHSTORE_SUCCESS);
+    }
+    assert(couchstore_open_db_ex(directpath, COUCHSTORE_OPEN_FLAG_RDONLY, direct,
+                                 &reader) == COUCHSTORE_SUCCESS);
+    assert_same_docs(db, reader);
+
+    /* Documents bigger than the write buffers and the read chunks */
+    setdoc(&d, &i, "big", 3, big, bigsize, NULL, 0);
+    assert(couchstore_save_document(db, &d, &i, 0) == COUCHSTORE_SUCCESS);
+    assert(couchstore_save_document(direct_db, &d, &i, 0) == COUCHSTORE_SUCCESS);
+    assert(couchstore_open_document(direct_db, "big", 3, &out_doc, 0) == COUCHSTORE_SUCCESS);
+    assert(out_doc->data.size == bigsize && memcmp(out_doc->data.buf, big, bigsize) == 0);
+    couchstore_free_document(out_doc);
+    save_numbered_docs(db, 0, 100, "{\"v\":2}");
+    save_numbered_docs(direct_db, 0, 100, "{\"v\":2}");
+    assert(couchstore_commit(db) == COUCHSTORE_SUCCESS);
+    assert(couchstore_commit(direct_db) == COUCHSTORE_SUCCESS);
+
+    /* A reader picks up what another handle appended */
+    assert(couchstore_refresh_db(reader) == COUCHSTORE_SUCCESS);
+    assert_same_docs(db, reader);
+    assert_same_docs(reader, db);
+    assert(couchstore_close_db(reader) == COUCHSTORE_SUCCESS);
+    assert(couchstore_close_db(direct_db) == COUCHSTORE_SUCCESS);
+
+    /* The file reopens with either ops */
+    assert(couchstore_open_db(directpath, COUCHSTORE_OPEN_FLAG_RDONLY, &reader) == COUCHSTORE_SUCCESS);
+    assert_same_docs(db, reader);
+    assert(couchstore_close_db(reader) == COUCHSTORE_SUCCESS);
+    assert(couchstore_open_db_ex(directpath, 0, direct, &direct_db) == COUCHSTORE_SUCCESS);
+    assert_same_docs(db, direct_db);
+    assert(couchstore_open_document(direct_db, "big", 3, &out_doc, 0) == COUCHSTORE_SUCCESS);
+    assert(out_doc->data.size == bigsize && memcmp(out_doc->data.buf, big, bigsize) == 0);
+    couchstore_free_document(out_doc);
+
+    /* Compaction writes through the direct ops too */
+    assert(couchstore_compact_db_ex(direct_db, compactpath, 0, direct) == COUCHSTORE_SUCCESS);
+    assert(couchstore_open_db_ex(compactpath, COUCHSTORE_OPEN_FLAG_RDONLY, direct,
+                                 &compacted) == COUCHSTORE_SUCCESS);
+    assert_same_docs(db, compacted);
+    assert_same_docs(compacted, db);
+    assert(couchstore_close_db(compacted) == COUCHSTORE_SUCCESS);
+
+    assert(couchstore_close_db(direct_db) == COUCHSTORE_SUCCESS);
+    assert(couchstore_close_db(db) == COUCHSTORE_SUCCESS);
+    free(big);
+    unlink(testfilepath);
+    unlink(directpath);
+    unlink(compactpath);
+}
+
+static int read_body_cb(Db *db, DocInfo *info, void *ctx)
+{
+    Doc *doc;
+    (void) ctx;
+    if (info->bp != 0) {
+        assert(couchstore_open_doc_with_docinfo(db, info, &doc, 0) == COUCHSTORE_SUCCESS);
+        couchstore_free_document(doc);
+    }
+    return 0;
+}
+
+static void test_read_buffers(void)
+{
+    char key[32];
+    char value[256];
+    char keys[500][32];
+    Doc docs[500], *docptrs[500];
+    DocInfo infos[500], *infoptrs[500];
+    Db *db, *reader;
+    DocInfo *out_info;
+    ReadBufferInfo before, after;
+    int ii, jj;
+
+    fprintf(stderr, "read buffer pool... ");
+    fflush(stderr);
+
+    unlink(testfilepath);
+    memset(value, 'x', sizeof(value) - 1);
+    value[sizeof(value) - 1] = 0;
+    assert(couchstore_open_db(testfilepath, COUCHSTORE_OPEN_FLAG_CREATE, &db) == COUCHSTORE_SUCCESS);
+    /* In batches, as the flusher does, so documents are laid out together */
+    for (ii = 0; ii < 5000; ii += 500) {
+        for (jj = 0; jj < 500; ++jj) {
+            int nkey = snprintf(keys[jj], sizeof(keys[jj]), "doc%d", ii + jj);
+            setdoc(&docs[jj], &infos[jj], keys[jj], nkey, value, strlen(value), NULL, 0);
+            docptrs[jj] = &docs[jj];
+            infoptrs[jj] = &infos[jj];
+        }
+        assert(couchstore_save_documents(db, docptrs, infoptrs, 500, 0) == COUCHSTORE_SUCCESS);
+    }
+    assert(couchstore_commit(db) == COUCHSTORE_SUCCESS);
+
+    assert(couchstore_set_read_buffer_pool(1024 * 1024, 0, 0) == COUCHSTORE_ERROR_INVALID_ARGUMENTS);
+    assert(couchstore_set_read_buffer_pool(1024 * 1024, 4096, 128 * 1024) == COUCHSTORE_SUCCESS);
+    assert(couchstore_open_db(testfilepath, COUCHSTORE_OPEN_FLAG_RDONLY, &reader) == COUCHSTORE_SUCCESS);
+
+    /* A scan reads ahead, with far fewer loads than documents */
+    couchstore_get_read_buffer_info(&before);
+    assert(couchstore_changes_since(reader, 0, 0, read_body_cb, NULL) == COUCHSTORE_SUCCESS);
+    couchstore_get_read_buffer_info(&after);
+    assert(after.readaheads > before.readaheads);
+    assert(after.misses - before.misses < 500);
+    assert(after.bytes_read - before.bytes_read < 2 * (after.bytes_requested - before.bytes_requested));
+    assert(after.bytes_requested - before.bytes_requested > 5000 * sizeof(value));
+    assert(after.size <= after.max_size);
+
+    /* Lookups of the same documents hit the blocks they loaded */
+    before = after;
+    for (ii = 0; ii < 2000; ++ii) {
+        int nkey = snprintf(key, sizeof(key), "doc%d", (ii * 7919) % 50);
+        assert(couchstore_docinfo_by_id(reader, key, nkey, &out_info) == COUCHSTORE_SUCCESS);
+        couchstore_free_docinfo(out_info);
+    }
+    assert(couchstore_close_db(reader) == COUCHSTORE_SUCCESS);
+    couchstore_get_read_buffer_info(&after);
+    assert(after.hits - before.hits > after.misses - before.misses);
+
+    /* A pool smaller than the read-ahead limit reads ahead in the windows it holds */
+    assert(couchstore_set_read_buffer_pool(1024 * 1024, 4096, 2 * 1024 * 1024) == COUCHSTORE_SUCCESS);
+    assert(couchstore_open_db(testfilepath, COUCHSTORE_OPEN_FLAG_RDONLY, &reader) == COUCHSTORE_SUCCESS);
+    couchstore_get_read_buffer_info(&before);
+    assert(couchstore_changes_since(reader, 0, 0, read_body_cb, NULL) == COUCHSTORE_SUCCESS);
+    couchstore_get_read_buffer_info(&after);
+    assert(after.readaheads > before.readaheads);
+    assert(couchstore_close_db(reader) == COUCHSTORE_SUCCESS);
+
+    /* A file the pool has no block for keeps one of its own */
+    assert(couchstore_set_read_buffer_pool(0, 4096, 128 * 1024) == COUCHSTORE_SUCCESS);
+    assert(couchstore_open_db(testfilepath, COUCHSTORE_OPEN_FLAG_RDONLY, &reader) == COUCHSTORE_SUCCESS);
+    assert(couchstore_docinfo_by_id(reader, "doc7", 4, &out_info) == COUCHSTORE_SUCCESS);
+    couchstore_get_read_buffer_info(&before);
+    for (ii = 0; ii < 100; ++ii) {
+        read_body_cb(reader, out_info, NULL);
+    }
+    couchstore_free_docinfo(out_info);
+    assert(couchstore_close_db(reader) == COUCHSTORE_SUCCESS);
+    couchstore_get_read_buffer_info(&after);
+    assert(after.hits - before.hits > after.misses - before.misses);
+    assert(couchstore_set_read_buffer_pool(1024 * 1024, 4096, 128 * 1024) == COUCHSTORE_SUCCESS);
+
+    /* The same data comes back buffered or not */
+    assert(couchstore_open_db(testfilepath, COUCHSTORE_OPEN_FLAG_RDONLY, &reader) == COUCHSTORE_SUCCESS);
+    assert_same_docs(db, reader);
+    assert(couchstore_close_db(reader) == COUCHSTORE_SUCCESS);
+    assert(couchstore_set_read_buffer_pool(0, 4096, 128 * 1024) == COUCHSTORE_SUCCESS);
+    assert(couchstore_open_db(testfilepath, COUCHSTORE_OPEN_FLAG_RDONLY, &reader) == COUCHSTORE_SUCCESS);
+    assert_same_docs(reader, db);
+    assert(couchstore_close_db(reader) == COUCHSTORE_SUCCESS);
+
+    assert(couchstore_close_db(db) == COUCHSTORE_SUCCESS);
+    couchstore_get_read_buffer_info(&after);
+    assert(after.size == 0);
+
+    /* A file that used up the pool while alone gives blocks to the next one */
+    assert(couchstore_set_read_buffer_pool(20 * 4096, 4096, 0) == COUCHSTORE_SUCCESS);
+    assert(couchstore_open_db(testfilepath, COUCHSTORE_OPEN_FLAG_RDONLY, &db) == COUCHSTORE_SUCCESS);
+    for (ii = 0; ii < 2000; ++ii) {
+        int nkey = snprintf(key, sizeof(key), "doc%d", (ii * 7919) % 5000);
+        assert(couchstore_docinfo_by_id(db, key, nkey, &out_info) == COUCHSTORE_SUCCESS);
+        couchstore_free_docinfo(out_info);
+    }
+    couchstore_get_read_buffer_info(&after);
+    assert(after.size + 4096 > after.max_size);
+    assert(couchstore_open_db(testfilepath, COUCHSTORE_OPEN_FLAG_RDONLY, &reader) == COUCHSTORE_SUCCESS);
+    couchstore_get_read_buffer_info(&before);
+    for (ii = 0; ii < 100; ++ii) {
+        assert(couchstore_docinfo_by_id(reader, "doc7", 4, &out_info) == COUCHSTORE_SUCCESS);
+        read_body_cb(reader, out_info, NULL);
+        couchstore_free_docinfo(out_info);
+    }
+    couchstore_get_read_buffer_info(&after);
+    assert(after.hits - before.hits > 2 * (after.misses - before.misses));
+    assert(after.size <= after.max_size);
+    assert(couchstore_close_db(reader) == COUCHSTORE_SUCCESS);
+    assert(couchstore_close_db(db) == COUCHSTORE_SUCCESS);
+    assert(couchstore_set_read_buffer_pool(8 * 1024 * 1024, 8 * 1024, 256 * 1024) == COUCHSTORE_SUCCESS);
+    unlink(testfilepath);
+}
 
 int main(int argc, const char *argv[])
 {
@@ -721,6 +1405,20 @@ int main(int argc, const char *argv[])
     test_huge_revseq();
     fprintf(stderr, " OK\n");
     unlink(testfilepath);
+    test_refresh_db();
+    fprintf(stderr, " OK\n");
+    test_group_commit();
+    fprintf(stderr, " OK\n");
+    test_node_cache();
+    fprintf(stderr, " OK\n");
+    test_compact_parallel_catchup();
+    fprintf(stderr, " OK\n");
+    test_bulk_load();
+    fprintf(stderr, " OK\n");
+    test_direct_io();
+    fprintf(stderr, " OK\n");
+    test_read_buffers();
+    fprintf(stderr, " OK\n");
 
     // make sure os.c didn't accidentally call close(0):
     assert(lseek(0, 0, SEEK_CUR) >= 0 || errno != EBADF);
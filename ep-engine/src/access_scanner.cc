@@ -17,7 +17,8 @@ public:
         prev = name + ".old";
         next = name + ".next";
 
-        log = new MutationLog(next, conf.getAlogBlockSize());
+        log = new MutationLog(next, conf.getAlogBlockSize(),
+                              LOG_COMPRESSED_VERSION);
         assert(log != NULL);
         log->open();
         if (!log->isOpen()) {
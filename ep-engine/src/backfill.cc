@@ -40,6 +40,10 @@ void BackfillDiskCallback::callback(GetValue &gv) {
     // if the tap connection is closed, then free an Item instance
     if (!connMap.performTapOp(tapConnName, tapop, gv.getValue())) {
         delete gv.getValue();
+        gv.setStatus(ENGINE_DISCONNECT);
+    } else if (tapop.isBufferFull() || isMemoryUsageTooHigh(engine->getEpStats())) {
+        // Stop reading until the connection catches up
+        gv.setStatus(ENGINE_TMPFAIL);
     }
 }
 
@@ -58,15 +62,28 @@ bool BackfillDiskLoad::callback(Dispatcher &d, TaskId &t) {
                                                                              name, connMap,
                                                                              engine));
         if (backfillType == ALL_MUTATIONS) {
-            store->dump(vbucket, backfill_cb);
+            resumeSeqno = store->dumpSince(vbucket, resumeSeqno, false,
+                                           backfill_cb);
         } else if (store->getStorageProperties().hasPersistedDeletions() &&
                    backfillType == DELETIONS_ONLY) {
-            store->dumpDeleted(vbucket, backfill_cb);
+            resumeSeqno = store->dumpSince(vbucket, resumeSeqno, true,
+                                           backfill_cb);
         } else {
             getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                      "Underlying KVStore doesn't support this kind of backfill.\n");
             abort();
         }
+
+        if (resumeSeqno != 0) {
+            // Sleep until the connection drains its backfill buffer, or
+            // for a second at most if it went away meanwhile.
+            d.snooze(t, 1);
+            PauseDiskBackfillTapOperation tapop(d);
+            if (!connMap.performTapOp(name, tapop, t) || !tapop.isPaused()) {
+                d.snooze(t, 0);
+            }
+            return true;
+        }
     }
 
     getLogger()->log(EXTENSION_LOG_INFO, NULL,
@@ -21,6 +21,10 @@ typedef enum backfill_t {
  * Dispatcher callback responsible for bulk backfilling tap queues
  * from a KVStore.
  *
+ * The vbucket is streamed in sequence order: the task stops reading
+ * whenever the tap connection has a full backfill buffer (or memory is
+ * short), and resumes where it stopped once the connection drained it.
+ *
  * Note that this is only used if the KVStore reports that it has
  * efficient vbucket ops.
  */
@@ -31,7 +35,7 @@ public:
                      TapConnMap &tcm, KVStore *s, uint16_t vbid, backfill_t type,
                      hrtime_t token)
         : name(n), engine(e), connMap(tcm), store(s), vbucket(vbid), backfillType(type),
-       connToken(token) { }
+       connToken(token), resumeSeqno(0) { }
 
     void callback(GetValue &gv);
 
@@ -47,6 +51,7 @@ private:
     uint16_t                    vbucket;
     backfill_t                  backfillType;
     hrtime_t                    connToken;
+    uint64_t                    resumeSeqno;
 };
 
 /**
@@ -3,6 +3,7 @@
 #include "ep.hh"
 
 const double BgFetcher::sleepInterval = 1.0;
+const size_t BgFetcher::sloMinSamples = 100;
 
 bool BgFetcherCallback::callback(Dispatcher &, TaskId &t) {
     return bgfetcher->run(t);
@@ -21,14 +22,28 @@ void BgFetcher::stop() {
     dispatcher->cancel(task);
 }
 
-void BgFetcher::doFetch(uint16_t vbId) {
+size_t BgFetcher::doFetch(uint16_t vbId) {
     hrtime_t startTime(gethrtime());
     getLogger()->log(EXTENSION_LOG_DEBUG, NULL,
                      "BgFetcher is fetching data, vBucket = %d numDocs = %d, "
                      "startTime = %lld\n",
                      vbId, items2fetch.size(), startTime/1000000);
 
-    store->getROUnderlying()->getMulti(vbId, items2fetch);
+    size_t batchSize = 0;
+    hrtime_t oldest = startTime;
+    vb_bgfetch_queue_t::iterator qitr = items2fetch.begin();
+    for (; qitr != items2fetch.end(); qitr++) {
+        std::list<VBucketBGFetchItem *> &requestedItems = (*qitr).second;
+        std::list<VBucketBGFetchItem *>::iterator itm = requestedItems.begin();
+        for (; itm != requestedItems.end(); itm++) {
+            oldest = std::min(oldest, (*itm)->initTime);
+            ++batchSize;
+        }
+    }
+    stats.bgFetchBatchSizeHisto.add(batchSize);
+    stats.bgFetchBatchWaitHisto.add((startTime - oldest) / 1000);
+
+    kvstore->getMulti(vbId, items2fetch);
 
     int totalfetches = 0;
     std::vector<VBucketBGFetchItem *> fetchedItems;
@@ -44,7 +59,7 @@ void BgFetcher::doFetch(uint16_t vbId) {
                 // it for retry later
                 getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                     "Warning: bgfetcher failed to fetch data for vb = %d "
-                    "seq = %lld key = %s retry = %d\n", vbId, (*itr).first,
+                    "key = %s retry = %d\n", vbId,
                      (*itm)->key.c_str(), (*itm)->getRetryCount());
                 continue;
             }
@@ -55,18 +70,29 @@ void BgFetcher::doFetch(uint16_t vbId) {
 
     if (totalfetches > 0) {
         store->completeBGFetchMulti(vbId, fetchedItems, startTime);
-        stats.getMultiHisto.add((gethrtime()-startTime)/1000, totalfetches);
+        hrtime_t endTime = gethrtime();
+        stats.getMultiHisto.add((endTime - startTime)/1000, totalfetches);
+
+        hrtime_t slo = stats.bgFetchLatencySLO.get();
+        std::vector<VBucketBGFetchItem *>::iterator fitr = fetchedItems.begin();
+        for (; fitr != fetchedItems.end(); fitr++) {
+            if ((endTime - (*fitr)->initTime) / 1000 > slo) {
+                ++sloMisses;
+            }
+        }
+        sloSamples += totalfetches;
     }
 
     // failed requests will get requeued for retry within clearItems()
     clearItems(vbId);
+    return batchSize;
 }
 
 void BgFetcher::clearItems(uint16_t vbId) {
     vb_bgfetch_queue_t::iterator itr = items2fetch.begin();
     size_t numRequeuedItems = 0;
     for(; itr != items2fetch.end(); itr++) {
-        // every fetched item belonging to the same seq_id shares
+        // every fetched item belonging to the same key shares
         // a single data buffer, just delete it from the first fetched item
         std::list<VBucketBGFetchItem *> &doneItems = (*itr).second;
         VBucketBGFetchItem *firstItem = doneItems.front();
@@ -83,8 +109,8 @@ void BgFetcher::clearItems(uint16_t vbId) {
                 (*dItr)->incrRetryCount();
                 getLogger()->log(EXTENSION_LOG_DEBUG, NULL,
                     "BgFetcher is re-queueing failed request for vb = %d "
-                    "seq = %lld key = %s retry = %d\n",
-                     vbId, (*itr).first, (*dItr)->key.c_str(),
+                    "key = %s retry = %d\n",
+                     vbId, (*dItr)->key.c_str(),
                      (*dItr)->getRetryCount());
                 ++numRequeuedItems;
                 vb->queueBGFetchItem(*dItr, this, false);
@@ -94,6 +120,7 @@ void BgFetcher::clearItems(uint16_t vbId) {
 
     if (numRequeuedItems) {
         stats.numRemainingBgJobs.incr(numRequeuedItems);
+        pendingFetches.incr(numRequeuedItems);
     }
 }
 
@@ -103,35 +130,73 @@ bool BgFetcher::run(TaskId &tid) {
 
     const VBucketMap &vbMap = store->getVBuckets();
     size_t numVbuckets = vbMap.getSize();
-    for (size_t vbid = 0; vbid < numVbuckets; vbid++) {
+    for (size_t vbid = id; vbid < numVbuckets; vbid += numFetchers) {
         RCPtr<VBucket> vb = vbMap.getBucket(vbid);
         assert(items2fetch.empty());
         if (vb && vb->getBGFetchItems(items2fetch)) {
-            doFetch(vbid);
-            num_fetched_items += items2fetch.size();
+            num_fetched_items += doFetch(vbid);
             items2fetch.clear();
         }
     }
 
-    size_t remains = stats.numRemainingBgJobs.decr(num_fetched_items);
+    adjustBatchWindow();
+
+    stats.numRemainingBgJobs.decr(num_fetched_items);
+    size_t remains = pendingFetches.decr(num_fetched_items);
+    if (remains && !num_fetched_items && !pendingJob()) {
+        // the fetches left were dropped along with their vbuckets
+        stats.numRemainingBgJobs.decr(remains);
+        remains = pendingFetches.decr(remains);
+    }
     if (!remains) {
         // wait a bit until next fetch request arrives
         double sleep = std::max(store->getBGFetchDelay(), sleepInterval);
         dispatcher->snooze(tid, sleep);
 
-        if (stats.numRemainingBgJobs.get()) {
-           // check again numRemainingBgJobs, a new fetch request
+        if (pendingFetches.get()) {
+           // check again pendingFetches, a new fetch request
            // could have arrvied right before calling above snooze()
-           dispatcher->snooze(tid, 0);
+           dispatcher->snooze(tid, getBatchWindow());
         }
+    } else if (remains < stats.bgFetchBatchSize.get()) {
+        // let the fetches that arrived meanwhile gather for a bit
+        dispatcher->snooze(tid, getBatchWindow());
     }
     return true;
 }
 
+void BgFetcher::adjustBatchWindow() {
+    if (sloSamples < sloMinSamples) {
+        return;
+    }
+
+    // the 99th percentile is above the target, batch less
+    bool shrink = sloMisses * 100 > sloSamples;
+    bool grow = sloMisses == 0;
+    sloSamples = 0;
+    sloMisses = 0;
+
+    // the window is shared by all the fetchers, don't lose an update
+    // made by another one meanwhile
+    size_t maxWindow = stats.bgFetchMaxWindow.get();
+    size_t current, window;
+    do {
+        current = stats.bgFetchWindow.get();
+        window = std::min(current, maxWindow);
+        if (shrink) {
+            window /= 2;
+        } else if (grow) {
+            window = std::min(maxWindow,
+                              window + std::max(maxWindow / 8,
+                                                static_cast<size_t>(1)));
+        }
+    } while (!stats.bgFetchWindow.cas(current, window));
+}
+
 bool BgFetcher::pendingJob() {
     const VBucketMap &vbMap = store->getVBuckets();
     size_t numVbuckets = vbMap.getSize();
-    for (size_t vbid = 0; vbid < numVbuckets; ++vbid) {
+    for (size_t vbid = id; vbid < numVbuckets; vbid += numFetchers) {
         RCPtr<VBucket> vb = vbMap.getBucket(vbid);
         if (vb && vb->hasPendingBGFetchItems()) {
             return true;
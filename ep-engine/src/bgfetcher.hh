@@ -40,10 +40,12 @@ public:
     hrtime_t initTime;
 };
 
-typedef unordered_map<uint64_t, std::list<VBucketBGFetchItem *> > vb_bgfetch_queue_t;
+// Pending fetches of a vbucket, grouped by key
+typedef unordered_map<std::string, std::list<VBucketBGFetchItem *> > vb_bgfetch_queue_t;
 
 // Forward declaration.
 class EventuallyPersistentStore;
+class KVStore;
 class BgFetcher;
 
 /**
@@ -65,6 +67,10 @@ private:
 /**
  * Dispatcher job responsible for batching data reads and push to
  * underlying storage
+ *
+ * A vbucket is fetched by bg fetcher (vbid % number of bg fetchers),
+ * every bg fetcher reads through its own KVStore on its own dispatcher
+ * so that several disk reads can be outstanding at once.
  */
 class BgFetcher {
 public:
@@ -73,34 +79,68 @@ public:
      * Construct a BgFetcher task.
      *
      * @param s the store
+     * @param k the read only KVStore to fetch from
      * @param d the dispatcher
+     * @param st the engine stats
+     * @param i the id of this bg fetcher
+     * @param n the number of bg fetchers
      */
-    BgFetcher(EventuallyPersistentStore *s, Dispatcher *d, EPStats &st) :
-        store(s), dispatcher(d), stats(st) {}
+    BgFetcher(EventuallyPersistentStore *s, KVStore *k, Dispatcher *d,
+              EPStats &st, uint16_t i = 0, uint16_t n = 1) :
+        store(s), kvstore(k), dispatcher(d), stats(st), id(i),
+        numFetchers(n), sloSamples(0), sloMisses(0) {}
 
     void start(void);
     void stop(void);
     bool run(TaskId &tid);
     bool pendingJob(void);
 
+    /**
+     * Wake the task up for a new fetch.
+     *
+     * The first fetch of a shallow queue is held back for the batching
+     * window so that more fetches can join its batch, a deep queue is
+     * drained at once.
+     */
     void notifyBGEvent(void) {
-        if (++stats.numRemainingBgJobs == 1) {
+        ++stats.numRemainingBgJobs;
+        size_t pending = ++pendingFetches;
+        size_t batchSize = stats.bgFetchBatchSize.get();
+        if (pending == 1 || pending == batchSize) {
             LockHolder lh(taskMutex);
             assert(task.get());
-            dispatcher->wake(task);
+            dispatcher->wake(task, pending >= batchSize ? 0 : getBatchWindow());
         }
     }
 
+    KVStore *getKVStore(void) { return kvstore; }
+    Dispatcher *getDispatcher(void) { return dispatcher; }
+    uint16_t getId(void) const { return id; }
+
 private:
-    void doFetch(uint16_t vbId);
+    //! Min number of fetches to look at before resizing the window
+    static const size_t sloMinSamples;
+
+    size_t doFetch(uint16_t vbId);
     void clearItems(uint16_t vbId);
+    void adjustBatchWindow(void);
+
+    double getBatchWindow(void) {
+        return static_cast<double>(stats.bgFetchWindow.get()) / 1000000.0;
+    }
 
     EventuallyPersistentStore *store;
+    KVStore *kvstore;
     Dispatcher *dispatcher;
     vb_bgfetch_queue_t items2fetch;
     TaskId task;
     Mutex taskMutex;
     EPStats &stats;
+    uint16_t id;
+    uint16_t numFetchers;
+    Atomic<size_t> pendingFetches;    // fetches queued for this bg fetcher
+    size_t sloSamples;
+    size_t sloMisses;    // fetches slower than the latency target
 };
 
 #endif /* BGFETCHER_HH */
@@ -1,5 +1,8 @@
 /* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
 #include "config.h"
+
+#include <algorithm>
+
 #include "vbucket.hh"
 #include "checkpoint.hh"
 #include "ep_engine.h"
@@ -40,6 +43,90 @@ private:
 #include "statwriter.hh"
 #undef STATWRITER_NAMESPACE
 
+CheckpointQueue::~CheckpointQueue() {
+    std::deque<Chunk*>::iterator it = chunks.begin();
+    for (; it != chunks.end(); ++it) {
+        delete *it;
+    }
+}
+
+CheckpointQueue::iterator CheckpointQueue::push_back(const queued_item &qi) {
+    if (static_cast<size_t>(last - base) == numSlots) {
+        std::vector<queued_item> *tail = chunks.empty() ? NULL : &chunks.back()->items;
+        if (tail && tail->size() < chunkSize) {
+            size_t grown = std::min(tail->size() * 2, chunkSize);
+            numSlots += grown - tail->size();
+            tail->resize(grown);
+        } else {
+            size_t n = chunks.empty() ? firstChunkSize : chunkSize;
+            chunks.push_back(new Chunk(n));
+            numSlots += n;
+        }
+    }
+    at(last) = qi;
+    ++numItems;
+    return iterator(this, last++);
+}
+
+CheckpointQueue::iterator CheckpointQueue::push_front(const queued_item &qi) {
+    if (first == base) {
+        // The slots are filled from the back of this chunk, it has to be whole.
+        chunks.push_front(new Chunk(chunkSize));
+        base -= chunkSize;
+        numSlots += chunkSize;
+    }
+    at(--first) = qi;
+    ++numItems;
+    return iterator(this, first);
+}
+
+void CheckpointQueue::erase(iterator it) {
+    assert(it.queue == this && it.pos >= first && it.pos < last && at(it.pos));
+    at(it.pos).reset();
+    --numItems;
+    // Keep the first and the last slot occupied, so that iterators never
+    // stop on an empty slot.
+    while (first < last && !at(first)) {
+        ++first;
+    }
+    while (last > first && !at(last - 1)) {
+        --last;
+    }
+}
+
+void CheckpointQueue::compact(std::vector<iterator*> &iterators) {
+    std::sort(iterators.begin(), iterators.end(), positionLess);
+    std::vector<iterator*>::iterator it = iterators.begin();
+    int64_t pos = first;
+    for (int64_t i = first; i < last; ++i) {
+        queued_item &qi = at(i);
+        bool empty = !qi;
+        for (; it != iterators.end() && (*it)->pos == i; ++it) {
+            // An iterator on an empty slot moves to the item before it.
+            (*it)->pos = empty ? std::max(pos - 1, first) : pos;
+        }
+        if (!empty) {
+            if (pos != i) {
+                at(pos) = qi;
+                qi.reset();
+            }
+            ++pos;
+        }
+    }
+    for (; it != iterators.end(); ++it) {
+        (*it)->pos = pos;
+    }
+    last = pos;
+    assert(static_cast<size_t>(last - first) == numItems);
+
+    while (!chunks.empty() &&
+           base + static_cast<int64_t>((chunks.size() - 1) * chunkSize) >= last) {
+        numSlots -= chunks.back()->items.size();
+        delete chunks.back();
+        chunks.pop_back();
+    }
+}
+
 Checkpoint::~Checkpoint() {
     getLogger()->log(EXTENSION_LOG_INFO, NULL,
                      "Checkpoint %llu for vbucket %d is purged from memory.\n",
@@ -53,14 +140,72 @@ void Checkpoint::setState(checkpoint_state state) {
 }
 
 void Checkpoint::popBackCheckpointEndItem() {
-    if (toWrite.size() > 0 && toWrite.back()->getOperation() == queue_op_checkpoint_end) {
-        keyIndex.erase(toWrite.back()->getKey());
+    if (!toWrite.empty() && toWrite.back()->getOperation() == queue_op_checkpoint_end) {
+        keyIndex.erase(&toWrite.back()->getKey());
         toWrite.pop_back();
     }
 }
 
+void Checkpoint::setCheckpointStartItem(const queued_item &qi) {
+    CheckpointQueue::iterator it = ++(toWrite.begin());
+    assert((*it)->getOperation() == queue_op_checkpoint_start);
+    // The index refers to the key of the item being replaced.
+    checkpoint_index::iterator ita = keyIndex.find(&(*it)->getKey());
+    assert(ita != keyIndex.end());
+    index_entry entry = ita->second;
+    keyIndex.erase(ita);
+    *it = qi;
+    keyIndex[&qi->getKey()] = entry;
+}
+
 bool Checkpoint::keyExists(const std::string &key) {
-    return keyIndex.find(key) != keyIndex.end();
+    return keyIndex.find(&key) != keyIndex.end();
+}
+
+void Checkpoint::getCursorPositions(CheckpointManager *checkpointManager,
+                                    std::vector<CheckpointQueue::iterator*> &positions) {
+    CheckpointCursor &pcursor = checkpointManager->persistenceCursor;
+    if (*(pcursor.currentCheckpoint) == this) {
+        positions.push_back(&pcursor.currentPos);
+    }
+    std::map<const std::string, CheckpointCursor>::iterator map_it;
+    for (map_it = checkpointManager->tapCursors.begin();
+         map_it != checkpointManager->tapCursors.end(); map_it++) {
+        if (*(map_it->second.currentCheckpoint) == this) {
+            positions.push_back(&map_it->second.currentPos);
+        }
+    }
+}
+
+void Checkpoint::compact(CheckpointManager *checkpointManager) {
+    std::vector<CheckpointQueue::iterator*> positions;
+    getCursorPositions(checkpointManager, positions);
+    toWrite.compact(positions);
+
+    // The items moved, point the index to their new positions.
+    CheckpointQueue::iterator it = toWrite.begin();
+    for (; it != toWrite.end(); ++it) {
+        const std::string &key = (*it)->getKey();
+        if (key.size() > 0) {
+            checkpoint_index::iterator ita = keyIndex.find(&key);
+            assert(ita != keyIndex.end());
+            ita->second.position = it;
+        }
+    }
+    updateQueueOverhead();
+}
+
+void Checkpoint::updateQueueOverhead() {
+    size_t newOverhead = toWrite.memorySize();
+    if (newOverhead > queueOverhead) {
+        memOverhead += newOverhead - queueOverhead;
+        stats.memOverhead.incr(newOverhead - queueOverhead);
+    } else if (newOverhead < queueOverhead) {
+        memOverhead -= queueOverhead - newOverhead;
+        stats.memOverhead.decr(queueOverhead - newOverhead);
+    }
+    assert(stats.memOverhead.get() < GIGANTOR);
+    queueOverhead = newOverhead;
 }
 
 queue_dirty_t Checkpoint::queueDirty(const queued_item &qi, CheckpointManager *checkpointManager) {
@@ -69,10 +214,10 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi, CheckpointManager *c
     uint64_t newMutationId = checkpointManager->nextMutationId();
     queue_dirty_t rv;
 
-    checkpoint_index::iterator it = keyIndex.find(qi->getKey());
+    checkpoint_index::iterator it = keyIndex.find(&qi->getKey());
     // Check if this checkpoint already had an item for the same key.
     if (it != keyIndex.end()) {
-        std::list<queued_item>::iterator currPos = it->second.position;
+        CheckpointQueue::iterator currPos = it->second.position;
         uint64_t currMutationId = it->second.mutation_id;
         CheckpointCursor &pcursor = checkpointManager->persistenceCursor;
 
@@ -80,7 +225,7 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi, CheckpointManager *c
             // If the existing item is in the left-hand side of the item pointed by the
             // persistence cursor, decrease the persistence cursor's offset by 1.
             const std::string &key = (*(pcursor.currentPos))->getKey();
-            checkpoint_index::iterator ita = keyIndex.find(key);
+            checkpoint_index::iterator ita = keyIndex.find(&key);
             if (ita != keyIndex.end()) {
                 uint64_t mutationId = ita->second.mutation_id;
                 if (currMutationId <= mutationId) {
@@ -100,7 +245,7 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi, CheckpointManager *c
 
             if (*(map_it->second.currentCheckpoint) == this) {
                 const std::string &key = (*(map_it->second.currentPos))->getKey();
-                checkpoint_index::iterator ita = keyIndex.find(key);
+                checkpoint_index::iterator ita = keyIndex.find(&key);
                 if (ita != keyIndex.end()) {
                     uint64_t mutationId = ita->second.mutation_id;
                     if (currMutationId <= mutationId) {
@@ -114,75 +259,118 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi, CheckpointManager *c
             }
         }
 
-        queued_item &existing_itm = *currPos;
+        queued_item existing_itm = *currPos;
         existing_itm->setOperation(qi->getOperation());
         existing_itm->setQueuedTime(qi->getQueuedTime());
-        toWrite.push_back(existing_itm);
-        // Remove the existing item for the same key from the list.
+        // Remove the existing item for the same key from its slot and push it
+        // back into the queue. The index keeps pointing at its key.
         toWrite.erase(currPos);
+        index_entry entry = {toWrite.push_back(existing_itm), newMutationId};
+        it->second = entry;
         rv = EXISTING_ITEM;
+
+        if (toWrite.getNumEmptySlots() >= CheckpointQueue::firstChunkSize &&
+            toWrite.getNumEmptySlots() > toWrite.size()) {
+            compact(checkpointManager);
+        }
     } else {
         if (qi->getOperation() == queue_op_set || qi->getOperation() == queue_op_del) {
             ++numItems;
         }
         rv = NEW_ITEM;
-        // Push the new item into the list
-        toWrite.push_back(qi);
-    }
-
-    if (qi->getKey().size() > 0) {
-        std::list<queued_item>::iterator last = toWrite.end();
-        // --last is okay as the list is not empty now.
-        index_entry entry = {--last, newMutationId};
-        // Set the index of the key to the new item that is pushed back into the list.
-        keyIndex[qi->getKey()] = entry;
-        if (rv == NEW_ITEM) {
-            size_t newEntrySize = qi->getKey().size() + sizeof(index_entry) + sizeof(queued_item);
+        // Push the new item into the queue
+        CheckpointQueue::iterator pos = toWrite.push_back(qi);
+        if (qi->getKey().size() > 0) {
+            index_entry entry = {pos, newMutationId};
+            keyIndex[&qi->getKey()] = entry;
+            size_t newEntrySize = sizeof(checkpoint_index::value_type);
             memOverhead += newEntrySize;
             stats.memOverhead.incr(newEntrySize);
             assert(stats.memOverhead.get() < GIGANTOR);
         }
     }
+    updateQueueOverhead();
     return rv;
 }
 
-size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
+size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint,
+                                       CheckpointManager *checkpointManager) {
     size_t numNewItems = 0;
     size_t newEntryMemOverhead = 0;
-    std::list<queued_item>::reverse_iterator rit = pPrevCheckpoint->rbegin();
 
     getLogger()->log(EXTENSION_LOG_INFO, NULL,
                      "Collapse the checkpoint %llu into the checkpoint %llu for vbucket %d.\n",
                      pPrevCheckpoint->getId(), checkpointId, vbucketId);
 
-    for (; rit != pPrevCheckpoint->rend(); ++rit) {
-        const std::string &key = (*rit)->getKey();
-        if ((*rit)->getOperation() != queue_op_del &&
-            (*rit)->getOperation() != queue_op_set) {
+    // Collect the items that don't exist in this checkpoint, from the last one.
+    std::vector<queued_item> newItems;
+    CheckpointQueue::iterator pit = pPrevCheckpoint->end();
+    while (pit != pPrevCheckpoint->begin()) {
+        --pit;
+        if ((*pit)->getOperation() != queue_op_del &&
+            (*pit)->getOperation() != queue_op_set) {
             continue;
         }
-        checkpoint_index::iterator it = keyIndex.find(key);
-        if (it == keyIndex.end()) {
-            std::list<queued_item>::iterator pos = toWrite.begin();
-            // Skip the first two meta items
-            ++pos; ++pos;
-            toWrite.insert(pos, *rit);
-            index_entry entry = {--pos, pPrevCheckpoint->getMutationIdForKey(key)};
-            keyIndex[key] = entry;
-            newEntryMemOverhead += key.size() + sizeof(index_entry);
-            ++numItems;
-            ++numNewItems;
+        if (keyIndex.find(&(*pit)->getKey()) == keyIndex.end()) {
+            newItems.push_back(*pit);
+        }
+    }
+    if (newItems.empty()) {
+        return 0;
+    }
+
+    // The new items go right after the first two meta items. Take the meta
+    // items off the front, push the new items in front and the meta items
+    // back on top of them, keeping the cursors on the meta items.
+    std::vector<CheckpointQueue::iterator*> positions;
+    getCursorPositions(checkpointManager, positions);
+    std::vector<CheckpointQueue::iterator*> metaPositions[2];
+    queued_item metaItems[2];
+    for (int i = 0; i < 2; ++i) {
+        CheckpointQueue::iterator head = toWrite.begin();
+        std::vector<CheckpointQueue::iterator*>::iterator pos_it = positions.begin();
+        for (; pos_it != positions.end(); ++pos_it) {
+            if (**pos_it == head) {
+                metaPositions[i].push_back(*pos_it);
+            }
         }
+        metaItems[i] = *head;
+        toWrite.erase(head);
     }
+
+    std::vector<queued_item>::iterator nit = newItems.begin();
+    for (; nit != newItems.end(); ++nit) {
+        const std::string &key = (*nit)->getKey();
+        index_entry entry = {toWrite.push_front(*nit),
+                             pPrevCheckpoint->getMutationIdForKey(key)};
+        keyIndex[&key] = entry;
+        newEntryMemOverhead += sizeof(checkpoint_index::value_type);
+        ++numItems;
+        ++numNewItems;
+    }
+
+    for (int i = 1; i >= 0; --i) {
+        CheckpointQueue::iterator head = toWrite.push_front(metaItems[i]);
+        checkpoint_index::iterator ita = keyIndex.find(&metaItems[i]->getKey());
+        if (ita != keyIndex.end()) {
+            ita->second.position = head;
+        }
+        std::vector<CheckpointQueue::iterator*>::iterator pos_it = metaPositions[i].begin();
+        for (; pos_it != metaPositions[i].end(); ++pos_it) {
+            **pos_it = head;
+        }
+    }
+
     memOverhead += newEntryMemOverhead;
     stats.memOverhead.incr(newEntryMemOverhead);
     assert(stats.memOverhead.get() < GIGANTOR);
+    updateQueueOverhead();
     return numNewItems;
 }
 
 uint64_t Checkpoint::getMutationIdForKey(const std::string &key) {
     uint64_t mid = 0;
-    checkpoint_index::iterator it = keyIndex.find(key);
+    checkpoint_index::iterator it = keyIndex.find(&key);
     if (it != keyIndex.end()) {
         mid = it->second.mutation_id;
     }
@@ -233,8 +421,7 @@ void CheckpointManager::setOpenCheckpointId_UNLOCKED(uint64_t id) {
         checkpointList.back()->setId(id);
         // Update the checkpoint_start item with the new Id.
         queued_item qi = createCheckpointItem(id, vbucketId, queue_op_checkpoint_start);
-        std::list<queued_item>::iterator it = ++(checkpointList.back()->begin());
-        *it = qi;
+        checkpointList.back()->setCheckpointStartItem(qi);
     }
 }
 
@@ -387,7 +574,7 @@ bool CheckpointManager::registerTAPCursor_UNLOCKED(const std::string &name,
         (*it)->registerCursorName(name);
     } else {
         size_t offset = 0;
-        std::list<queued_item>::iterator curr;
+        CheckpointQueue::iterator curr;
 
         getLogger()->log(EXTENSION_LOG_DEBUG, NULL,
                          "Checkpoint %llu for vbucket %d exists in memory. "
@@ -639,7 +826,7 @@ void CheckpointManager::collapseClosedCheckpoints(std::list<Checkpoint*> &collap
         ++rit; ++rit;// Move to the second lastest closed checkpoint.
         size_t numDuplicatedItems = 0, numMetaItems = 0;
         for (; rit != checkpointList.rend(); ++rit) {
-            size_t numAddedItems = (*lastClosedChk)->mergePrevCheckpoint(*rit);
+            size_t numAddedItems = (*lastClosedChk)->mergePrevCheckpoint(*rit, this);
             numDuplicatedItems += ((*rit)->getNumItems() - numAddedItems);
             numMetaItems += 2; // checkpoint start and end meta items
             slowCursors.insert((*rit)->getCursorNameList().begin(),
@@ -1002,7 +1189,7 @@ void CheckpointManager::decrTapCursorFromCheckpointEnd(const std::string &name)
 }
 
 bool CheckpointManager::isLastMutationItemInCheckpoint(CheckpointCursor &cursor) {
-    std::list<queued_item>::iterator it = cursor.currentPos;
+    CheckpointQueue::iterator it = cursor.currentPos;
     ++it;
     if (it == (*(cursor.currentCheckpoint))->end() ||
         (*it)->getOperation() == queue_op_checkpoint_end) {
@@ -1072,7 +1259,7 @@ void CheckpointManager::checkAndAddNewCheckpoint(uint64_t id) {
         size_t numDuplicatedItems = 0, numMetaItems = 0;
         // Collapse all checkpoints.
         for (; rit != checkpointList.rend(); ++rit) {
-            size_t numAddedItems = checkpointList.back()->mergePrevCheckpoint(*rit);
+            size_t numAddedItems = checkpointList.back()->mergePrevCheckpoint(*rit, this);
             numDuplicatedItems += ((*rit)->getNumItems() - numAddedItems);
             numMetaItems += 2; // checkpoint start and end meta items
             delete *rit;
@@ -1102,7 +1289,7 @@ bool CheckpointManager::hasNext(const std::string &name) {
     }
 
     bool hasMore = true;
-    std::list<queued_item>::iterator curr = it->second.currentPos;
+    CheckpointQueue::iterator curr = it->second.currentPos;
     ++curr;
     if (curr == (*(it->second.currentCheckpoint))->end() &&
         (*(it->second.currentCheckpoint)) == checkpointList.back()) {
@@ -1128,7 +1315,7 @@ queued_item CheckpointManager::createCheckpointItem(uint64_t id,
 bool CheckpointManager::hasNextForPersistence() {
     LockHolder lh(queueLock);
     bool hasMore = true;
-    std::list<queued_item>::iterator curr = persistenceCursor.currentPos;
+    CheckpointQueue::iterator curr = persistenceCursor.currentPos;
     ++curr;
     if (curr == (*(persistenceCursor.currentCheckpoint))->end() &&
         (*(persistenceCursor.currentCheckpoint)) == checkpointList.back()) {
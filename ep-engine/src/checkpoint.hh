@@ -3,9 +3,11 @@
 #define CHECKPOINT_HH 1
 
 #include <assert.h>
+#include <deque>
 #include <list>
 #include <map>
 #include <set>
+#include <vector>
 
 #include "common.hh"
 #include "atomic.hh"
@@ -32,18 +34,200 @@ typedef enum {
     CHECKPOINT_CLOSED  //!< The checkpoint is not open.
 } checkpoint_state;
 
+/**
+ * The queue of items in a checkpoint.
+ *
+ * Items are kept in chunks of item pointers, so walking the queue touches
+ * contiguous memory and queueing an item rarely allocates. Only the last
+ * chunk may be smaller than chunkSize: a queue starts with a chunk of
+ * firstChunkSize slots and doubles it as it fills, so the many checkpoints
+ * holding a handful of items don't pay for a full chunk each.
+ * The position of an item never changes when other items are added to
+ * either end or removed; a removed item leaves an empty slot behind that
+ * the iterators skip until compact() squeezes the empty slots out.
+ */
+class CheckpointQueue {
+public:
+
+    static const size_t chunkSize = 256;
+    static const size_t firstChunkSize = 8;
+
+    /**
+     * An iterator over the items in the queue.
+     */
+    class iterator {
+        friend class CheckpointQueue;
+    public:
+        iterator() : queue(NULL), pos(0) { }
+
+        queued_item &operator *() const {
+            return queue->at(pos);
+        }
+
+        iterator &operator ++() {
+            do {
+                ++pos;
+            } while (pos < queue->last && !queue->at(pos));
+            return *this;
+        }
+
+        iterator &operator --() {
+            do {
+                --pos;
+            } while (pos > queue->first && !queue->at(pos));
+            return *this;
+        }
+
+        bool operator ==(const iterator &other) const {
+            return pos == other.pos && queue == other.queue;
+        }
+
+        bool operator !=(const iterator &other) const {
+            return !(*this == other);
+        }
+
+    private:
+        iterator(CheckpointQueue *q, int64_t p) : queue(q), pos(p) { }
+
+        CheckpointQueue *queue;
+        int64_t          pos;
+    };
+
+    CheckpointQueue() : base(0), first(0), last(0), numItems(0), numSlots(0) { }
+
+    ~CheckpointQueue();
+
+    iterator begin() {
+        return iterator(this, first);
+    }
+
+    iterator end() {
+        return iterator(this, last);
+    }
+
+    /**
+     * Return the last item in the queue.
+     */
+    queued_item &back() {
+        assert(numItems > 0);
+        return at(last - 1);
+    }
+
+    /**
+     * Add an item to the end of the queue.
+     * @return the position of the new item
+     */
+    iterator push_back(const queued_item &qi);
+
+    /**
+     * Add an item in front of the queue.
+     * @return the position of the new item
+     */
+    iterator push_front(const queued_item &qi);
+
+    /**
+     * Remove the last item from the queue.
+     */
+    void pop_back() {
+        erase(iterator(this, last - 1));
+    }
+
+    /**
+     * Remove the item at the given position, leaving an empty slot.
+     */
+    void erase(iterator it);
+
+    /**
+     * Remove the empty slots by moving the items towards the front of
+     * the queue. This invalidates all iterators except for the given
+     * ones, which are moved along with their items.
+     */
+    void compact(std::vector<iterator*> &iterators);
+
+    bool empty() const {
+        return numItems == 0;
+    }
+
+    /**
+     * Return the number of items in the queue.
+     */
+    size_t size() const {
+        return numItems;
+    }
+
+    /**
+     * Return the number of empty slots between the items.
+     */
+    size_t getNumEmptySlots() const {
+        return static_cast<size_t>(last - first) - numItems;
+    }
+
+    /**
+     * Return the memory used by the chunks of this queue.
+     */
+    size_t memorySize() const {
+        return chunks.size() * sizeof(Chunk) + numSlots * sizeof(queued_item);
+    }
+
+private:
+
+    struct Chunk {
+        Chunk(size_t n) : items(n) { }
+        std::vector<queued_item> items;
+    };
+
+    queued_item &at(int64_t pos) {
+        size_t offset = static_cast<size_t>(pos - base);
+        return chunks[offset / chunkSize]->items[offset % chunkSize];
+    }
+
+    static bool positionLess(const iterator *a, const iterator *b) {
+        return a->pos < b->pos;
+    }
+
+    std::deque<Chunk*> chunks;
+    int64_t            base;     // position of the first slot of the first chunk
+    int64_t            first;    // position of the first item
+    int64_t            last;     // position after the last item
+    size_t             numItems;
+    size_t             numSlots; // slots in all the chunks
+
+    DISALLOW_COPY_AND_ASSIGN(CheckpointQueue);
+};
+
 /**
  * A checkpoint index entry.
  */
 struct index_entry {
-    std::list<queued_item>::iterator position;
+    CheckpointQueue::iterator position;
     uint64_t mutation_id;
 };
 
 /**
- * The checkpoint index maps a key to a checkpoint index_entry.
+ * Hash function for the keys in the checkpoint index.
+ */
+struct checkpoint_key_hash {
+    size_t operator()(const std::string *key) const {
+        return UNORDERED_MAP_NAMESPACE::hash<std::string>()(*key);
+    }
+};
+
+/**
+ * Equality of the keys in the checkpoint index.
+ */
+struct checkpoint_key_equal {
+    bool operator()(const std::string *a, const std::string *b) const {
+        return *a == *b;
+    }
+};
+
+/**
+ * The checkpoint index maps a key to a checkpoint index_entry. The keys
+ * point to the keys of the queued items rather than copying them, so an
+ * entry must be removed or repointed before its item is dropped.
  */
-typedef unordered_map<std::string, index_entry> checkpoint_index;
+typedef unordered_map<const std::string*, index_entry,
+                      checkpoint_key_hash, checkpoint_key_equal> checkpoint_index;
 
 class Checkpoint;
 class CheckpointManager;
@@ -63,7 +247,7 @@ public:
 
     CheckpointCursor(const std::string &n,
                      std::list<Checkpoint*>::iterator checkpoint,
-                     std::list<queued_item>::iterator pos,
+                     CheckpointQueue::iterator pos,
                      size_t os = 0, bool isClosedCheckpointOnly = false,
                      uint64_t openChkId = 1) :
         name(n), currentCheckpoint(checkpoint), currentPos(pos),
@@ -73,7 +257,7 @@ public:
 private:
     std::string                      name;
     std::list<Checkpoint*>::iterator currentCheckpoint;
-    std::list<queued_item>::iterator currentPos;
+    CheckpointQueue::iterator        currentPos;
     Atomic<size_t>                   offset;
     bool                             closedCheckpointOnly;
     uint64_t                         openChkIdAtRegistration;
@@ -95,7 +279,7 @@ public:
     Checkpoint(EPStats &st, uint64_t id, uint16_t vbid,
                checkpoint_state state = CHECKPOINT_OPEN) :
         stats(st), checkpointId(id), vbucketId(vbid), creationTime(ep_real_time()),
-        checkpointState(state), numItems(0), memOverhead(0) {
+        checkpointState(state), numItems(0), memOverhead(0), queueOverhead(0) {
         stats.memOverhead.incr(memorySize());
         assert(stats.memOverhead.get() < GIGANTOR);
     }
@@ -146,6 +330,12 @@ public:
 
     void popBackCheckpointEndItem();
 
+    /**
+     * Replace the checkpoint_start meta item of this checkpoint.
+     * @param qi the new checkpoint_start item
+     */
+    void setCheckpointStartItem(const queued_item &qi);
+
     /**
      * Return the number of cursors that are currently walking through this checkpoint.
      */
@@ -190,22 +380,14 @@ public:
     queue_dirty_t queueDirty(const queued_item &qi, CheckpointManager *checkpointManager);
 
 
-    std::list<queued_item>::iterator begin() {
+    CheckpointQueue::iterator begin() {
         return toWrite.begin();
     }
 
-    std::list<queued_item>::iterator end() {
+    CheckpointQueue::iterator end() {
         return toWrite.end();
     }
 
-    std::list<queued_item>::reverse_iterator rbegin() {
-        return toWrite.rbegin();
-    }
-
-    std::list<queued_item>::reverse_iterator rend() {
-        return toWrite.rend();
-    }
-
     bool keyExists(const std::string &key);
 
     /**
@@ -222,9 +404,11 @@ public:
      * Merge the previous checkpoint into the this checkpoint by adding the items from
      * the previous checkpoint, which don't exist in this checkpoint.
      * @param pPrevCheckpoint pointer to the previous checkpoint.
+     * @param checkpointManager the checkpoint manager to which this checkpoint belongs
      * @return the number of items added from the previous checkpoint.
      */
-    size_t mergePrevCheckpoint(Checkpoint *pPrevCheckpoint);
+    size_t mergePrevCheckpoint(Checkpoint *pPrevCheckpoint,
+                               CheckpointManager *checkpointManager);
 
     /**
      * Get the mutation id for a given key in this checkpoint
@@ -234,6 +418,22 @@ public:
     uint64_t getMutationIdForKey(const std::string &key);
 
 private:
+    /**
+     * Collect the positions of the cursors currently walking through this checkpoint.
+     */
+    void getCursorPositions(CheckpointManager *checkpointManager,
+                            std::vector<CheckpointQueue::iterator*> &positions);
+
+    /**
+     * Squeeze the slots of deduplicated items out of the queue.
+     */
+    void compact(CheckpointManager *checkpointManager);
+
+    /**
+     * Account for the chunks allocated or freed by the queue.
+     */
+    void updateQueueOverhead();
+
     EPStats                       &stats;
     uint64_t                       checkpointId;
     uint16_t                       vbucketId;
@@ -241,10 +441,10 @@ private:
     checkpoint_state               checkpointState;
     size_t                         numItems;
     std::set<std::string>          cursors; // List of cursors with their unique names.
-    // List is used for queueing mutations as vector incurs shift operations for deduplication.
-    std::list<queued_item>         toWrite;
+    CheckpointQueue                toWrite;
     checkpoint_index               keyIndex;
     size_t                         memOverhead;
+    size_t                         queueOverhead;
 };
 
 /**
@@ -14,7 +14,9 @@ static couchstore_error_t cfs_sync(couch_file_handle);
 static void cfs_destroy(couch_file_handle);
 }
 
-couch_file_ops getCouchstoreStatsOps(CouchstoreStats* stats) {
+couch_file_ops getCouchstoreStatsOps(CouchstoreStats* stats,
+                                     const couch_file_ops *baseOps) {
+    stats->baseOps = baseOps;
     couch_file_ops ops = {
         3,
         cfs_construct,
@@ -41,7 +43,7 @@ extern "C" {
 static couch_file_handle cfs_construct(void* cookie) {
     StatFile* sf = new StatFile;
     sf->stats = static_cast<CouchstoreStats*>(cookie);
-    sf->orig_ops = couchstore_get_default_file_ops();
+    sf->orig_ops = sf->stats->baseOps;
     sf->orig_handle = sf->orig_ops->constructor(sf->orig_ops->cookie);
     sf->last_offs = 0;
     return reinterpret_cast<couch_file_handle>(sf);
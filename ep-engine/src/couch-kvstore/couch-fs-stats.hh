@@ -7,7 +7,8 @@ public:
     CouchstoreStats() :
         readSeekHisto(ExponentialGenerator<size_t>(1, 2), 50),
         readSizeHisto(ExponentialGenerator<size_t>(1, 2), 25),
-        writeSizeHisto(ExponentialGenerator<size_t>(1, 2), 25) { }
+        writeSizeHisto(ExponentialGenerator<size_t>(1, 2), 25),
+        baseOps(couchstore_get_default_file_ops()) { }
 
     //Read time length
     Histogram<hrtime_t> readTimeHisto;
@@ -21,6 +22,8 @@ public:
     Histogram<size_t> writeSizeHisto;
     //Time spent in sync
     Histogram<hrtime_t> syncTimeHisto;
+    //File ops doing the actual I/O
+    const couch_file_ops *baseOps;
 
     void reset() {
         readTimeHisto.reset();
@@ -32,6 +35,7 @@ public:
     }
 };
 
-couch_file_ops getCouchstoreStatsOps(CouchstoreStats* stats);
+couch_file_ops getCouchstoreStatsOps(CouchstoreStats* stats,
+                                     const couch_file_ops *baseOps);
 
 #endif
@@ -112,6 +112,34 @@ static uint64_t computeMaxDeletedSeqNum(DocInfo **docinfos, const int numdocs)
     return max;
 }
 
+static Mutex sharedCachesMutex;
+static bool sharedCachesConfigured = false;
+static size_t sharedNodeCacheSize = 0;
+static size_t sharedReadBufferPoolSize = 0;
+
+/**
+ * The node cache and the read buffer pool of couchstore are shared by all
+ * the buckets of the process. Size them for the largest request seen so
+ * far rather than for whichever bucket happened to start last. The block
+ * and read-ahead sizes go with the largest pool.
+ */
+static void configureSharedCaches(Configuration &config)
+{
+    LockHolder lh(sharedCachesMutex);
+    size_t size = config.getCouchNodeCacheSize();
+    if (!sharedCachesConfigured || size > sharedNodeCacheSize) {
+        sharedNodeCacheSize = size;
+        couchstore_set_node_cache_size(size);
+    }
+    size = config.getCouchReadBufferPoolSize();
+    if (!sharedCachesConfigured || size > sharedReadBufferPoolSize) {
+        sharedReadBufferPoolSize = size;
+        couchstore_set_read_buffer_pool(size, config.getCouchReadBlockSize(),
+                                        config.getCouchMaxReadahead());
+    }
+    sharedCachesConfigured = true;
+}
+
 static int getMutationStatus(couchstore_error_t errCode)
 {
     switch (errCode) {
@@ -170,14 +198,14 @@ static void batchWarmupCallback(uint16_t vbId,
         vb_bgfetch_queue_t items2fetch;
         std::vector<std::pair<std::string, uint64_t> >::iterator itm = fetches.begin();
         for (; itm != fetches.end(); itm++) {
-            // ignore duplicate key with the same db seq id in the access log
-            if (items2fetch.find((*itm).second) != items2fetch.end()) {
+            // ignore duplicate key in the access log
+            if (items2fetch.find((*itm).first) != items2fetch.end()) {
                 continue;
             }
             VBucketBGFetchItem *fit = new VBucketBGFetchItem((*itm).first,
                                                              (*itm).second,
                                                              NULL);
-            items2fetch[(*itm).second].push_back(fit);
+            items2fetch[(*itm).first].push_back(fit);
         }
 
         c->store->getMulti(vbId, items2fetch);
@@ -211,8 +239,20 @@ struct GetMultiCbCtx {
     CouchKVStore &cks;
     uint16_t vbId;
     vb_bgfetch_queue_t &fetches;
+    std::vector<DocInfo *> docinfos;
 };
 
+static bool docInfoBpLess(const DocInfo *a, const DocInfo *b) {
+    return a->bp < b->bp;
+}
+
+static const couch_file_ops *getBaseFileOps(Configuration &config) {
+    // Direct I/O keeps the database files out of the page cache, the
+    // engine caches what it needs itself
+    return config.isCouchDirectIo() ? couchstore_get_direct_file_ops()
+                                    : couchstore_get_default_file_ops();
+}
+
 struct StatResponseCtx {
 public:
     StatResponseCtx(std::map<std::pair<uint16_t, uint16_t>, vbucket_state> &sm,
@@ -229,6 +269,8 @@ struct LoadResponseCtx {
     uint16_t vbucketId;
     bool keysonly;
     EventuallyPersistentEngine *engine;
+    // Where to resume once the callback stopped the load
+    uint64_t resumeSeqno;
 };
 
 CouchRequest::CouchRequest(const Item &it, uint64_t rev, CouchRequestCallback &cb, bool del) :
@@ -283,10 +325,19 @@ CouchKVStore::CouchKVStore(EventuallyPersistentEngine &theEngine,
     configuration(theEngine.getConfiguration()),
     dbname(configuration.getDbname()),
     couchNotifier(NULL), pendingCommitCnt(0),
-    intransaction(false)
+    intransaction(false),
+    groupCommit(configuration.isCouchGroupCommit()),
+    groupMaxDocs(configuration.getCouchGroupMaxDocs()),
+    groupWindow(configuration.getCouchGroupWindow() * 1000000),
+    groupStart(0),
+    maxCachedDbs(configuration.getCouchDbCacheSize()),
+    commitSeqnos(DbCommitSeqnos::acquire(dbname,
+                                         configuration.getMaxVbuckets()))
 {
     open();
-    statCollectingFileOps = getCouchstoreStatsOps(&st.fsStats);
+    statCollectingFileOps = getCouchstoreStatsOps(&st.fsStats,
+                                                  getBaseFileOps(configuration));
+    configureSharedCaches(configuration);
 }
 
 CouchKVStore::CouchKVStore(const CouchKVStore &copyFrom) :
@@ -295,11 +346,19 @@ CouchKVStore::CouchKVStore(const CouchKVStore &copyFrom) :
     configuration(copyFrom.configuration),
     dbname(copyFrom.dbname),
     couchNotifier(NULL),
-    pendingCommitCnt(0), intransaction(false)
+    pendingCommitCnt(0), intransaction(false),
+    groupCommit(copyFrom.groupCommit),
+    groupMaxDocs(copyFrom.groupMaxDocs),
+    groupWindow(copyFrom.groupWindow),
+    groupStart(0),
+    maxCachedDbs(copyFrom.maxCachedDbs),
+    commitSeqnos(DbCommitSeqnos::acquire(dbname,
+                                         configuration.getMaxVbuckets()))
 {
     open();
     dbFileMap = copyFrom.dbFileMap;
-    statCollectingFileOps = getCouchstoreStatsOps(&st.fsStats);
+    statCollectingFileOps = getCouchstoreStatsOps(&st.fsStats,
+                                                  getBaseFileOps(configuration));
 }
 
 void CouchKVStore::reset()
@@ -308,6 +367,7 @@ void CouchKVStore::reset()
     // TODO CouchKVStore::flush() when couchstore api ready
     RememberingCallback<bool> cb;
 
+    clearDbCache();
     couchNotifier->flush(cb);
     cb.waitForValue();
 
@@ -416,7 +476,12 @@ void CouchKVStore::get(const std::string &key, uint64_t, uint16_t vb,
     }
 
     couchstore_free_docinfo(docInfo);
-    closeDatabaseHandle(db);
+    if (errCode != COUCHSTORE_SUCCESS &&
+        errCode != COUCHSTORE_ERROR_DOC_NOT_FOUND) {
+        // don't keep a handle around that just failed on us
+        evictCachedDB(vb);
+    }
+    releaseDB(vb, db);
     rv.setStatus(couchErr2EngineErr(errCode));
     cb.callback(rv);
 }
@@ -454,18 +519,30 @@ void CouchKVStore::getMulti(uint16_t vb, vb_bgfetch_queue_t &itms)
         return;
     }
 
-    std::vector<uint64_t> seqIds;
-    VBucketBGFetchItem *item2fetch;
+    // Look up all the keys in one walk of the by id tree.
+    std::vector<sized_buf> ids;
+    ids.reserve(itms.size());
     vb_bgfetch_queue_t::iterator itr = itms.begin();
     for (; itr != itms.end(); itr++) {
-        item2fetch = (*itr).second.front();
-        seqIds.push_back(item2fetch->value.getId());
+        sized_buf id;
+        id.buf = const_cast<char *>((*itr).first.data());
+        id.size = (*itr).first.size();
+        ids.push_back(id);
     }
 
     GetMultiCbCtx ctx(*this, vb, itms);
-    errCode = couchstore_docinfos_by_sequence(db, &seqIds[0], seqIds.size(),
-                                              0, getMultiCbC, &ctx);
-    if (errCode != COUCHSTORE_SUCCESS) {
+    errCode = couchstore_docinfos_by_id(db, &ids[0], ids.size(),
+                                        COUCHSTORE_NO_DELETES,
+                                        getMultiCbC, &ctx);
+    if (errCode == COUCHSTORE_SUCCESS) {
+        // Read the document bodies in the order they are laid out in
+        // the file instead of the order of their keys.
+        std::sort(ctx.docinfos.begin(), ctx.docinfos.end(), docInfoBpLess);
+        std::vector<DocInfo *>::iterator it = ctx.docinfos.begin();
+        for (; it != ctx.docinfos.end(); ++it) {
+            fetchMultiDoc(db, *it, ctx);
+        }
+    } else {
         st.numGetFailure += numItems;
         for (itr = itms.begin(); itr != itms.end(); itr++) {
             std::list<VBucketBGFetchItem *> &fetches = (*itr).second;
@@ -473,17 +550,22 @@ void CouchKVStore::getMulti(uint16_t vb, vb_bgfetch_queue_t &itms)
             for (; fitr != fetches.end(); fitr++) {
                 getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                                  "Warning: failed to read database by "
-                                 "sequence id = %lld, vBucketId = %d "
-                                 "key = %s file = %s error = %s [%s]\n",
-                                 (*fitr)->value.getId(), vb,
+                                 "id, vBucketId = %d key = %s file = %s "
+                                 "error = %s [%s]\n", vb,
                                  (*fitr)->key.c_str(), dbFile.c_str(),
                                  couchstore_strerror(errCode),
                                  couchkvstore_strerrno(errCode).c_str());
                 (*fitr)->value.setStatus(couchErr2EngineErr(errCode));
             }
         }
+        evictCachedDB(vb);
     }
-    closeDatabaseHandle(db);
+
+    std::vector<DocInfo *>::iterator it = ctx.docinfos.begin();
+    for (; it != ctx.docinfos.end(); ++it) {
+        couchstore_free_docinfo(*it);
+    }
+    releaseDB(vb, db);
 }
 
 void CouchKVStore::del(const Item &itm,
@@ -516,8 +598,10 @@ bool CouchKVStore::delVBucket(uint16_t vbucket, bool recreate)
     assert(couchNotifier);
     RememberingCallback<bool> cb;
 
+    evictCachedDB(vbucket);
     couchNotifier->delVBucket(vbucket, cb);
     cb.waitForValue();
+    commitSeqnos->bump(vbucket);
 
     if (recreate) {
         vbucket_state vbstate(vbucket_state_dead, 0, 0);
@@ -573,7 +657,7 @@ vbucket_map_t CouchKVStore::listPersistedVbuckets()
             cachedVBStates[vbID] = vb_state;
             /* update stat */
             ++st.numLoadedVb;
-            closeDatabaseHandle(db);
+            releaseDB(vbID, db);
         }
         db = NULL;
     }
@@ -788,7 +872,8 @@ bool CouchKVStore::setVBucketState(uint16_t vbucketId, vbucket_state &vbstate,
             getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                             "Warning: failed to save local doc, name=%s\n",
                             dbFileName.c_str());
-            closeDatabaseHandle(db);
+            evictCachedDB(vbucketId);
+            releaseDB(vbucketId, db);
             return false;
         }
 
@@ -800,9 +885,11 @@ bool CouchKVStore::setVBucketState(uint16_t vbucketId, vbucket_state &vbstate,
                              "error=%s [%s]\n",
                              vbucketId, fileRev, couchstore_strerror(errorCode),
                              couchkvstore_strerrno(errorCode).c_str());
-            closeDatabaseHandle(db);
+            evictCachedDB(vbucketId);
+            releaseDB(vbucketId, db);
             return false;
         } else {
+            noteCommit(vbucketId, db);
             if (notify) {
                 uint64_t newHeaderPos = couchstore_get_header_position(db);
                 RememberingCallback<uint16_t> lcb;
@@ -816,6 +903,10 @@ bool CouchKVStore::setVBucketState(uint16_t vbucketId, vbucket_state &vbstate,
                         getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                                 "Retry notify CouchDB of update, "
                                 "vbid=%u rev=%llu\n", vbucketId, fileRev);
+                        // the file may be about to be replaced, so make
+                        // the retry and the other instances open it again
+                        evictCachedDB(vbucketId);
+                        commitSeqnos->bump(vbucketId);
                         retry = true;
                     } else {
                         getLogger()->log(EXTENSION_LOG_WARNING, NULL,
@@ -823,14 +914,14 @@ bool CouchKVStore::setVBucketState(uint16_t vbucketId, vbucket_state &vbstate,
                                 "vbid=%u rev=%llu error=0x%x\n",
                                 vbucketId, fileRev, lcb.val);
                         if (!engine.isShutdownMode()) {
-                            closeDatabaseHandle(db);
+                            releaseDB(vbucketId, db);
                             return false;
                         }
                     }
                 }
             }
         }
-        closeDatabaseHandle(db);
+        releaseDB(vbucketId, db);
     }
 
     return true;
@@ -850,8 +941,15 @@ void CouchKVStore::dump(uint16_t vb, shared_ptr<Callback<GetValue> > cb)
 
 void CouchKVStore::dumpKeys(const std::vector<uint16_t> &vbids,  shared_ptr<Callback<GetValue> > cb)
 {
-    (void)vbids;
-    loadDB(cb, true, NULL, COUCHSTORE_NO_DELETES);
+    std::vector<uint16_t> ids(vbids);
+    loadDB(cb, true, &ids, COUCHSTORE_NO_DELETES);
+}
+
+void CouchKVStore::dumpVBuckets(const std::vector<uint16_t> &vbids,
+                                shared_ptr<Callback<GetValue> > cb)
+{
+    std::vector<uint16_t> ids(vbids);
+    loadDB(cb, false, &ids, COUCHSTORE_NO_DELETES);
 }
 
 void CouchKVStore::dumpDeleted(uint16_t vb,  shared_ptr<Callback<GetValue> > cb)
@@ -861,11 +959,29 @@ void CouchKVStore::dumpDeleted(uint16_t vb,  shared_ptr<Callback<GetValue> > cb)
     loadDB(cb, true, &vbids, COUCHSTORE_DELETES_ONLY);
 }
 
+uint64_t CouchKVStore::dumpSince(uint16_t vb, uint64_t since,
+                                 bool deletionsOnly,
+                                 shared_ptr<Callback<GetValue> > cb)
+{
+    std::vector<uint16_t> vbids;
+    vbids.push_back(vb);
+    if (deletionsOnly) {
+        return loadDB(cb, true, &vbids, COUCHSTORE_DELETES_ONLY, since);
+    }
+    return loadDB(cb, false, &vbids, COUCHSTORE_NO_OPTIONS, since);
+}
+
 StorageProperties CouchKVStore::getStorageProperties()
 {
     size_t concurrency(10);
-    StorageProperties rv(concurrency, concurrency - 1, 1, true, true,
-                         true, true);
+    // Each vbucket lives in its own file, so every flusher shard may write
+    // its own vbuckets. The read-only and the auxiliary IO stores take two
+    // of the connections.
+    size_t writers = std::min(configuration.getMaxNumFlushers(),
+                              concurrency - 2);
+    StorageProperties rv(concurrency, concurrency - 1,
+                         std::max(writers, static_cast<size_t>(1)), true,
+                         true, true, true);
     return rv;
 }
 
@@ -889,6 +1005,9 @@ void CouchKVStore::addStats(const std::string &prefix,
     addStat(prefix_str, "backend_type",   "couchstore",       add_stat, c);
     addStat(prefix_str, "open",           st.numOpen,         add_stat, c);
     addStat(prefix_str, "close",          st.numClose,        add_stat, c);
+    addStat(prefix_str, "dbCacheHit",     st.numDbCacheHit,   add_stat, c);
+    addStat(prefix_str, "dbCacheMiss",    st.numDbCacheMiss,  add_stat, c);
+    addStat(prefix_str, "dbCacheEvict",   st.numDbCacheEvict, add_stat, c);
     addStat(prefix_str, "readTime",       st.readTimeHisto,   add_stat, c);
     addStat(prefix_str, "readSize",       st.readSizeHisto,   add_stat, c);
     addStat(prefix_str, "numLoadedVb",    st.numLoadedVb,     add_stat, c);
@@ -897,13 +1016,30 @@ void CouchKVStore::addStats(const std::string &prefix,
     addStat(prefix_str, "failure_open",   st.numOpenFailure, add_stat, c);
     addStat(prefix_str, "failure_get",    st.numGetFailure,  add_stat, c);
 
-    if (prefix.compare("rw") == 0) {
+    if (prefix.compare(0, 2, "rw") == 0) {
         addStat(prefix_str, "failure_set",   st.numSetFailure,   add_stat, c);
         addStat(prefix_str, "failure_del",   st.numDelFailure,   add_stat, c);
         addStat(prefix_str, "failure_vbset", st.numVbSetFailure, add_stat, c);
         addStat(prefix_str, "lastCommDocs",  st.docsCommitted,   add_stat, c);
         addStat(prefix_str, "numCommitRetry", st.numCommitRetry, add_stat, c);
 
+        NodeCacheInfo nodeCache;
+        couchstore_get_node_cache_info(&nodeCache);
+        addStat(prefix_str, "nodeCacheHit",   nodeCache.hits,      add_stat, c);
+        addStat(prefix_str, "nodeCacheMiss",  nodeCache.misses,    add_stat, c);
+        addStat(prefix_str, "nodeCacheEvict", nodeCache.evictions, add_stat, c);
+        addStat(prefix_str, "nodeCacheSize",  nodeCache.size,      add_stat, c);
+
+        ReadBufferInfo readBuf;
+        couchstore_get_read_buffer_info(&readBuf);
+        addStat(prefix_str, "readBufHit",       readBuf.hits,       add_stat, c);
+        addStat(prefix_str, "readBufMiss",      readBuf.misses,     add_stat, c);
+        addStat(prefix_str, "readBufReadahead", readBuf.readaheads, add_stat, c);
+        addStat(prefix_str, "readBufSize",      readBuf.size,       add_stat, c);
+        addStat(prefix_str, "readBufBytesRequested", readBuf.bytes_requested,
+                add_stat, c);
+        addStat(prefix_str, "readBufBytesRead", readBuf.bytes_read, add_stat, c);
+
         // stats for CouchNotifier
         if (!isReadOnly()) {
             couchNotifier->addStats(prefix, add_stat, c);
@@ -913,7 +1049,7 @@ void CouchKVStore::addStats(const std::string &prefix,
 
 void CouchKVStore::addTimingStats(const std::string &prefix,
                                   ADD_STAT add_stat, const void *c) {
-    if (prefix.compare("rw") != 0) {
+    if (prefix.compare(0, 2, "rw") != 0) {
         return;
     }
     const char *prefix_str = prefix.c_str();
@@ -924,6 +1060,7 @@ void CouchKVStore::addTimingStats(const std::string &prefix,
     addStat(prefix_str, "writeTime",   st.writeTimeHisto,   add_stat, c);
     addStat(prefix_str, "writeSize",   st.writeSizeHisto,   add_stat, c);
     addStat(prefix_str, "bulkSize",    st.batchSize,        add_stat, c);
+    addStat(prefix_str, "docsPerSync", st.docsPerSync,      add_stat, c);
 
     // Couchstore file ops stats
     addStat(prefix_str, "fsReadTime",  st.fsStats.readTimeHisto,  add_stat, c);
@@ -953,12 +1090,13 @@ void CouchKVStore::optimizeWrites(std::vector<queued_item> &items)
     std::sort(items.begin(), items.end(), cq);
 }
 
-void CouchKVStore::loadDB(shared_ptr<Callback<GetValue> > cb, bool keysOnly,
-                          std::vector<uint16_t> *vbids,
-                          couchstore_docinfos_options options)
+uint64_t CouchKVStore::loadDB(shared_ptr<Callback<GetValue> > cb,
+                              bool keysOnly, std::vector<uint16_t> *vbids,
+                              couchstore_docinfos_options options,
+                              uint64_t since)
 {
     std::vector<std::string> files;
-    std::map<uint16_t, uint64_t> &filemap = dbFileMap;
+    std::map<uint16_t, uint64_t> *filemap = &dbFileMap;
     std::map<uint16_t, uint64_t> vbmap;
     std::vector< std::pair<uint16_t, uint64_t> > vbuckets;
     std::vector< std::pair<uint16_t, uint64_t> > replicaVbuckets;
@@ -974,7 +1112,7 @@ void CouchKVStore::loadDB(shared_ptr<Callback<GetValue> > cb, bool keysOnly,
         // get entries for given vbucket(s) from dbFileMap
         std::string dirname = dbname;
         getFileNameMap(vbids, dirname, vbmap);
-        filemap = vbmap;
+        filemap = &vbmap;
     }
 
     // order vbuckets data loading by using vbucket states
@@ -982,8 +1120,8 @@ void CouchKVStore::loadDB(shared_ptr<Callback<GetValue> > cb, bool keysOnly,
         listPersistedVbuckets();
     }
 
-    std::map<uint16_t, uint64_t>::iterator fitr = filemap.begin();
-    for (; fitr != filemap.end(); fitr++) {
+    std::map<uint16_t, uint64_t>::iterator fitr = filemap->begin();
+    for (; fitr != filemap->end(); fitr++) {
         if (loadingData) {
             vbucket_map_t::const_iterator vsit = cachedVBStates.find(fitr->first);
             if (vsit != cachedVBStates.end()) {
@@ -1029,13 +1167,19 @@ void CouchKVStore::loadDB(shared_ptr<Callback<GetValue> > cb, bool keysOnly,
             ctx.keysonly = keysOnly;
             ctx.callback = cb;
             ctx.engine = &engine;
-            errorCode = couchstore_changes_since(db, 0, options, recordDbDumpC,
+            ctx.resumeSeqno = 0;
+            errorCode = couchstore_changes_since(db, since, options,
+                                                 recordDbDumpC,
                                                  static_cast<void *>(&ctx));
             if (errorCode != COUCHSTORE_SUCCESS) {
-                if (errorCode == COUCHSTORE_ERROR_CANCEL) {
+                if (ctx.resumeSeqno != 0) {
+                    // The callback wants no more items for now
+                    releaseDB(itr->first, db);
+                    return ctx.resumeSeqno;
+                } else if (errorCode == COUCHSTORE_ERROR_CANCEL) {
                     getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                             "Canceling loading database, warmup has completed\n");
-                    closeDatabaseHandle(db);
+                    releaseDB(itr->first, db);
                     break;
                 } else {
                     getLogger()->log(EXTENSION_LOG_WARNING, NULL,
@@ -1044,12 +1188,14 @@ void CouchKVStore::loadDB(shared_ptr<Callback<GetValue> > cb, bool keysOnly,
                                      couchstore_strerror(errorCode),
                                      couchkvstore_strerrno(errorCode).c_str());
                     remVBucketFromDbFileMap(itr->first);
+                    evictCachedDB(itr->first);
                 }
             }
-            closeDatabaseHandle(db);
+            releaseDB(itr->first, db);
         }
         db = NULL;
     }
+    return 0;
 }
 
 void CouchKVStore::open()
@@ -1081,6 +1227,7 @@ void CouchKVStore::open()
 void CouchKVStore::close()
 {
     intransaction = false;
+    clearDbCache();
     if (!isReadOnly()) {
         delete couchNotifier;
     }
@@ -1188,6 +1335,19 @@ couchstore_error_t CouchKVStore::openDB(uint16_t vbucketId,
                                         uint64_t options,
                                         uint64_t *newFileRev)
 {
+    bool readOnly = (options & COUCHSTORE_OPEN_FLAG_RDONLY) != 0;
+    *db = getCachedDB(vbucketId, fileRev, readOnly);
+    if (*db) {
+        if (newFileRev != NULL) {
+            *newFileRev = fileRev;
+        }
+        return COUCHSTORE_SUCCESS;
+    }
+
+    // Sample it before reading the header, so that a commit racing with
+    // the open gets the handle validated again on its next use.
+    uint64_t commitSeqno = commitSeqnos->get(vbucketId);
+
     std::string dbFileName = getDBFileName(dbname, vbucketId, fileRev);
     couch_file_ops* ops = &statCollectingFileOps;
 
@@ -1237,6 +1397,8 @@ couchstore_error_t CouchKVStore::openDB(uint16_t vbucketId,
             // new revision number found, update it
             updateDbFileMap(vbucketId, newRevNum);
         }
+        cacheDB(vbucketId, (newRevNum > fileRev) ? newRevNum : fileRev,
+                readOnly, commitSeqno, *db);
     }
 
     if (newFileRev != NULL) {
@@ -1449,6 +1611,12 @@ int CouchKVStore::recordDbDump(Db *db, DocInfo *docinfo, void *ctx)
 
     couchstore_free_document(doc);
 
+    if (rv.getStatus() != ENGINE_SUCCESS) {
+        // the callback doesn't want more items for now
+        loadCtx->resumeSeqno = docinfo->db_seq + 1;
+        return COUCHSTORE_ERROR_CANCEL;
+    }
+
     int returnCode = COUCHSTORE_SUCCESS;
     if (warmup) {
         if (!engine->stillWarmingUp()) {
@@ -1474,10 +1642,9 @@ bool CouchKVStore::commit2couchstore(void)
     CouchRequest **committedReqs = new CouchRequest *[pendingCommitCnt];
     Doc **docs = new Doc *[pendingCommitCnt];
     DocInfo **docinfos = new DocInfo *[pendingCommitCnt];
+    std::vector<CouchDocsBatch> batches;
 
     assert(pendingReqsQ[0]);
-    uint16_t vbucket2flush = pendingReqsQ[0]->getVBucketId();
-    uint64_t fileRev = pendingReqsQ[0]->getRevNum();
     int reqIndex = 0;
     for (; pendingCommitCnt > 0; ++reqIndex, --pendingCommitCnt) {
         CouchRequest *req = pendingReqsQ[reqIndex];
@@ -1485,21 +1652,39 @@ bool CouchKVStore::commit2couchstore(void)
         committedReqs[reqIndex] = req;
         docs[reqIndex] = req->getDbDoc();
         docinfos[reqIndex] = req->getDbDocInfo();
-        assert(vbucket2flush == req->getVBucketId());
+        if (batches.empty() || batches.back().vbid != req->getVBucketId()) {
+            batches.push_back(CouchDocsBatch(req->getVBucketId(),
+                                             req->getRevNum(),
+                                             docs + reqIndex,
+                                             docinfos + reqIndex));
+        }
+        ++batches.back().docCount;
     }
+    assert(groupCommit || batches.size() == 1);
 
     // flush all
-    couchstore_error_t errCode = saveDocs(vbucket2flush, fileRev, docs, docinfos, reqIndex);
-    if (errCode) {
-        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
-                "Warning: commit failed, cannot save CouchDB docs "
-                "for vbucket = %d rev = %llu\n", vbucket2flush, fileRev);
-        ++epStats.commitFailed;
+    if (batches.size() == 1) {
+        saveDocs(batches[0]);
+    } else {
+        saveDocsGroup(batches);
+    }
+
+    CouchRequest **batchReqs = committedReqs;
+    std::vector<CouchDocsBatch>::iterator it = batches.begin();
+    for (; it != batches.end(); ++it) {
+        if (it->errCode) {
+            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                    "Warning: commit failed, cannot save CouchDB docs "
+                    "for vbucket = %d rev = %llu\n", it->vbid, it->fileRev);
+            ++epStats.commitFailed;
+        }
+        commitCallback(batchReqs, it->docCount, it->errCode);
+        batchReqs += it->docCount;
     }
-    commitCallback(committedReqs, reqIndex, errCode);
 
     // clean up
     pendingReqsQ.clear();
+    pendingVBuckets.clear();
     while (reqIndex--) {
         delete committedReqs[reqIndex];
     }
@@ -1509,123 +1694,246 @@ bool CouchKVStore::commit2couchstore(void)
     return success;
 }
 
-couchstore_error_t CouchKVStore::saveDocs(uint16_t vbid, uint64_t rev, Doc **docs,
-                                          DocInfo **docinfos, int docCount)
+couchstore_error_t CouchKVStore::saveDocs(CouchDocsBatch &batch)
 {
-    couchstore_error_t errCode;
     bool retry_save_docs = false;
     bool retried = false;
     hrtime_t retry_begin = 0;
-    uint64_t fileRev = rev;
-    assert(fileRev);
+    assert(batch.fileRev);
 
     do {
-        Db *db = NULL;
-        uint64_t newFileRev;
-        retry_save_docs = false;
-        errCode = openDB(vbid, fileRev, &db, 0, &newFileRev);
-        if (errCode != COUCHSTORE_SUCCESS) {
+        if (writeDocs(batch) != COUCHSTORE_SUCCESS) {
+            return batch.errCode;
+        }
+
+        hrtime_t cs_begin = gethrtime();
+        couchstore_error_t errCode = couchstore_commit(batch.db);
+        st.commitHisto.add((gethrtime() - cs_begin) / 1000);
+        if (errCode) {
             getLogger()->log(EXTENSION_LOG_WARNING, NULL,
-                             "Warning: failed to open database, vbucketId = %d "
-                             "fileRev = %llu numDocs = %d\n", vbid, fileRev,
-                             docCount);
+                "Warning: couchstore_commit failed, error=%s [%s]\n",
+                couchstore_strerror(errCode),
+                couchkvstore_strerrno(errCode).c_str());
+            abortDocs(batch, errCode);
             return errCode;
-        } else {
-            uint64_t max = computeMaxDeletedSeqNum(docinfos, docCount);
-
-            // update max_deleted_seq in the local doc (vbstate)
-            // before save docs for the given vBucket
-            if (max > 0) {
-                vbucket_map_t::iterator it =
-                    cachedVBStates.find(vbid);
-                if (it != cachedVBStates.end() && it->second.maxDeletedSeqno < max) {
-                    it->second.maxDeletedSeqno = max;
-                    errCode = saveVBState(db, it->second);
-                    if (errCode != COUCHSTORE_SUCCESS) {
-                        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
-                                         "Warning: failed to save local doc for, "
-                                         "vBucket = %d numDocs = %d\n",
-                                         vbid, docCount);
-                        closeDatabaseHandle(db);
-                        return errCode;
-                    }
-                }
-            }
+        }
+        st.docsPerSync.add(batch.docCount);
 
-            hrtime_t cs_begin = gethrtime();
-            errCode = couchstore_save_documents(db, docs, docinfos, docCount,
-                                                COMPRESS_DOC_BODIES);
-            st.saveDocsHisto.add((gethrtime() - cs_begin) / 1000);
-            if (errCode != COUCHSTORE_SUCCESS) {
+        retry_save_docs = notifyDocs(batch);
+        if (retry_save_docs && !retried) {
+            retry_begin = gethrtime();
+            retried = true;
+        }
+    } while (retry_save_docs);
+
+    /* update stat */
+    st.docsCommitted = batch.docCount;
+    if (retried) {
+        st.commitRetryHisto.add((gethrtime() - retry_begin) / 1000);
+    }
+
+    return batch.errCode;
+}
+
+void CouchKVStore::saveDocsGroup(std::vector<CouchDocsBatch> &batches)
+{
+    std::vector<CouchDocsBatch>::iterator it;
+    for (it = batches.begin(); it != batches.end(); ++it) {
+        writeDocs(*it);
+    }
+
+    // Commit all the files in two rounds, so that the data and then the
+    // headers of the whole group are made durable at once.
+    hrtime_t cs_begin = gethrtime();
+    for (it = batches.begin(); it != batches.end(); ++it) {
+        if (it->db) {
+            couchstore_error_t errCode = couchstore_commit_data(it->db);
+            if (errCode) {
                 getLogger()->log(EXTENSION_LOG_WARNING, NULL,
-                    "Warning: failed to save docs to database, numDocs = %d "
-                    "error=%s [%s]\n", docCount,
+                    "Warning: couchstore_commit_data failed, vbucket=%d "
+                    "error=%s [%s]\n", it->vbid,
                     couchstore_strerror(errCode),
                     couchkvstore_strerrno(errCode).c_str());
-                closeDatabaseHandle(db);
-                return errCode;
+                abortDocs(*it, errCode);
             }
-
-            cs_begin = gethrtime();
-            errCode = couchstore_commit(db);
-            st.commitHisto.add((gethrtime() - cs_begin) / 1000);
+        }
+    }
+    syncDocsGroup(batches);
+    for (it = batches.begin(); it != batches.end(); ++it) {
+        if (it->db) {
+            couchstore_error_t errCode = couchstore_commit_header(it->db);
             if (errCode) {
                 getLogger()->log(EXTENSION_LOG_WARNING, NULL,
-                    "Warning: couchstore_commit failed, error=%s [%s]\n",
+                    "Warning: couchstore_commit_header failed, vbucket=%d "
+                    "error=%s [%s]\n", it->vbid,
                     couchstore_strerror(errCode),
                     couchkvstore_strerrno(errCode).c_str());
-                closeDatabaseHandle(db);
-                return errCode;
+                abortDocs(*it, errCode);
             }
+        }
+    }
+    syncDocsGroup(batches);
+    st.commitHisto.add((gethrtime() - cs_begin) / 1000);
 
-            RememberingCallback<uint16_t> cb;
-            uint64_t newHeaderPos = couchstore_get_header_position(db);
-            couchNotifier->notify_headerpos_update(vbid, newFileRev, newHeaderPos, cb);
-            if (cb.val != PROTOCOL_BINARY_RESPONSE_SUCCESS) {
-                if (cb.val == PROTOCOL_BINARY_RESPONSE_ETMPFAIL) {
-                    getLogger()->log(EXTENSION_LOG_WARNING, NULL,
-                                   "Retry notify CouchDB of update, vbucket=%d rev=%llu\n",
-                                     vbid, newFileRev);
-                    fileRev = newFileRev;
-                    retry_save_docs = true;
-                    ++st.numCommitRetry;
-                    if (!retried) {
-                        retry_begin = gethrtime();
-                        retried = true;
-                    }
-                } else {
-                    getLogger()->log(EXTENSION_LOG_WARNING, NULL,
-                                     "Warning: failed to notify CouchDB of "
-                                     "update for vbucket=%d, error=0x%x\n",
-                                     vbid, cb.val);
-                }
-            }
-            st.batchSize.add(docCount);
-            closeDatabaseHandle(db);
+    size_t docsCommitted = 0;
+    for (it = batches.begin(); it != batches.end(); ++it) {
+        if (it->db) {
+            docsCommitted += it->docCount;
         }
-    } while (retry_save_docs);
+    }
+    if (docsCommitted > 0) {
+        st.docsPerSync.add(docsCommitted);
+        st.docsCommitted = docsCommitted;
+    }
 
-    /* update stat */
-    if(errCode == COUCHSTORE_SUCCESS) {
-        st.docsCommitted = docCount;
+    for (it = batches.begin(); it != batches.end(); ++it) {
+        if (it->db && notifyDocs(*it)) {
+            // the file was replaced underneath us, so save the docs of
+            // this vbucket again on their own
+            hrtime_t retry_begin = gethrtime();
+            saveDocs(*it);
+            st.commitRetryHisto.add((gethrtime() - retry_begin) / 1000);
+        }
     }
-    if (retried) {
-        st.commitRetryHisto.add((gethrtime() - retry_begin) / 1000);
+}
+
+couchstore_error_t CouchKVStore::writeDocs(CouchDocsBatch &batch)
+{
+    couchstore_error_t errCode = openDB(batch.vbid, batch.fileRev, &batch.db,
+                                        0, &batch.newFileRev);
+    if (errCode != COUCHSTORE_SUCCESS) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Warning: failed to open database, vbucketId = %d "
+                         "fileRev = %llu numDocs = %d\n", batch.vbid,
+                         batch.fileRev, batch.docCount);
+        batch.db = NULL;
+        batch.errCode = errCode;
+        return errCode;
+    }
+
+    uint64_t max = computeMaxDeletedSeqNum(batch.docinfos, batch.docCount);
+
+    // update max_deleted_seq in the local doc (vbstate)
+    // before save docs for the given vBucket
+    if (max > 0) {
+        vbucket_map_t::iterator it = cachedVBStates.find(batch.vbid);
+        if (it != cachedVBStates.end() && it->second.maxDeletedSeqno < max) {
+            it->second.maxDeletedSeqno = max;
+            errCode = saveVBState(batch.db, it->second);
+            if (errCode != COUCHSTORE_SUCCESS) {
+                getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                                 "Warning: failed to save local doc for, "
+                                 "vBucket = %d numDocs = %d\n",
+                                 batch.vbid, batch.docCount);
+                abortDocs(batch, errCode);
+                return errCode;
+            }
+        }
     }
 
+    hrtime_t cs_begin = gethrtime();
+    errCode = couchstore_save_documents(batch.db, batch.docs, batch.docinfos,
+                                        batch.docCount, COMPRESS_DOC_BODIES);
+    st.saveDocsHisto.add((gethrtime() - cs_begin) / 1000);
+    if (errCode != COUCHSTORE_SUCCESS) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+            "Warning: failed to save docs to database, numDocs = %d "
+            "error=%s [%s]\n", batch.docCount,
+            couchstore_strerror(errCode),
+            couchkvstore_strerrno(errCode).c_str());
+        abortDocs(batch, errCode);
+        return errCode;
+    }
+
+    batch.errCode = COUCHSTORE_SUCCESS;
     return errCode;
 }
 
+bool CouchKVStore::notifyDocs(CouchDocsBatch &batch)
+{
+    bool retry = false;
+    RememberingCallback<uint16_t> cb;
+    noteCommit(batch.vbid, batch.db);
+    uint64_t newHeaderPos = couchstore_get_header_position(batch.db);
+    couchNotifier->notify_headerpos_update(batch.vbid, batch.newFileRev,
+                                           newHeaderPos, cb);
+    if (cb.val != PROTOCOL_BINARY_RESPONSE_SUCCESS) {
+        if (cb.val == PROTOCOL_BINARY_RESPONSE_ETMPFAIL) {
+            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                             "Retry notify CouchDB of update, vbucket=%d rev=%llu\n",
+                             batch.vbid, batch.newFileRev);
+            // the file may be about to be replaced, so make the
+            // retry and the other instances open it again
+            evictCachedDB(batch.vbid);
+            commitSeqnos->bump(batch.vbid);
+            batch.fileRev = batch.newFileRev;
+            retry = true;
+            ++st.numCommitRetry;
+        } else {
+            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                             "Warning: failed to notify CouchDB of "
+                             "update for vbucket=%d, error=0x%x\n",
+                             batch.vbid, cb.val);
+        }
+    }
+    st.batchSize.add(batch.docCount);
+    releaseDB(batch.vbid, batch.db);
+    batch.db = NULL;
+    return retry;
+}
+
+void CouchKVStore::abortDocs(CouchDocsBatch &batch, couchstore_error_t errCode)
+{
+    evictCachedDB(batch.vbid);
+    releaseDB(batch.vbid, batch.db);
+    batch.db = NULL;
+    batch.errCode = errCode;
+}
+
+void CouchKVStore::syncDocsGroup(std::vector<CouchDocsBatch> &batches)
+{
+    // Sync every file of the group on its own, so that a failed sync
+    // only fails the vbucket it belongs to.
+    std::vector<CouchDocsBatch>::iterator it = batches.begin();
+    for (; it != batches.end(); ++it) {
+        if (it->db) {
+            couchstore_error_t errCode = couchstore_sync_db(it->db);
+            if (errCode) {
+                getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                    "Warning: couchstore_sync_db failed, vbucket=%d "
+                    "error=%s [%s]\n", it->vbid,
+                    couchstore_strerror(errCode),
+                    couchkvstore_strerrno(errCode).c_str());
+                abortDocs(*it, errCode);
+            }
+        }
+    }
+}
+
 void CouchKVStore::queueItem(CouchRequest *req)
 {
-    if (pendingCommitCnt &&
-        pendingReqsQ.front()->getVBucketId() != req->getVBucketId()) {
+    uint16_t vbid = req->getVBucketId();
+    if (pendingCommitCnt && pendingReqsQ.back()->getVBucketId() != vbid) {
         // got new request for a different vb, commit pending
-        // pending requests of the current vb firt
-        commit2couchstore();
+        // pending requests of the current vb firt. In group commit mode
+        // only do so if the docs of this vb would be split up.
+        if (!groupCommit || pendingVBuckets.count(vbid) > 0) {
+            commit2couchstore();
+        }
+    }
+    if (pendingCommitCnt == 0) {
+        groupStart = gethrtime();
     }
     pendingReqsQ.push_back(req);
     pendingCommitCnt++;
+
+    if (groupCommit) {
+        pendingVBuckets.insert(vbid);
+        if (pendingCommitCnt >= groupMaxDocs ||
+            gethrtime() - groupStart >= groupWindow) {
+            commit2couchstore();
+        }
+    }
 }
 
 void CouchKVStore::remVBucketFromDbFileMap(uint16_t vbucketId)
@@ -1744,42 +2052,55 @@ couchstore_error_t CouchKVStore::saveVBState(Db *db, vbucket_state &vbState)
 
 int CouchKVStore::getMultiCb(Db *db, DocInfo *docinfo, void *ctx)
 {
+    (void) db;
     assert(docinfo);
-    std::string keyStr(docinfo->id.buf, docinfo->id.size);
     assert(ctx);
     GetMultiCbCtx *cbCtx = static_cast<GetMultiCbCtx *>(ctx);
-    CouchKVStoreStats &st = cbCtx->cks.getCKVStoreStat();
-
+    std::string keyStr(docinfo->id.buf, docinfo->id.size);
 
-    vb_bgfetch_queue_t::iterator qitr = cbCtx->fetches.find(docinfo->db_seq);
-    if (qitr == cbCtx->fetches.end()) {
+    if (cbCtx->fetches.find(keyStr) == cbCtx->fetches.end()) {
         // this could be a serious race condition in couchstore,
         // log a warning message and continue
         getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                          "Warning: couchstore returned invalid docinfo, "
-                         "no pending bgfetch has been issued for db_seq=%lld "
-                         "key = %s\n", docinfo->db_seq, keyStr.c_str());
+                         "no pending bgfetch has been issued for "
+                         "key = %s\n", keyStr.c_str());
+        return 0;
+    }
+
+    if (docinfo->deleted) {
+        // leave the fetches of a deleted key as not found
         return 0;
     }
 
-    std::list<VBucketBGFetchItem *> &fetches = (*qitr).second;
+    // keep the docinfo, the bodies are read once the walk is done
+    cbCtx->docinfos.push_back(docinfo);
+    return 1;
+}
+
+void CouchKVStore::fetchMultiDoc(Db *db, DocInfo *docinfo,
+                                 GetMultiCbCtx &ctx)
+{
+    std::string keyStr(docinfo->id.buf, docinfo->id.size);
+    std::list<VBucketBGFetchItem *> &fetches = ctx.fetches[keyStr];
+
     GetValue returnVal;
-    couchstore_error_t errCode = cbCtx->cks.fetchDoc(db, docinfo, returnVal,
-                                                     cbCtx->vbId, false);
+    couchstore_error_t errCode = fetchDoc(db, docinfo, returnVal,
+                                          ctx.vbId, false);
     if (errCode != COUCHSTORE_SUCCESS) {
         getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                 "Warning: failed to fetch data from database, "
-                "vBucket=%d key=%s error=%s [%s]\n", cbCtx->vbId,
+                "vBucket=%d key=%s error=%s [%s]\n", ctx.vbId,
                 keyStr.c_str(), couchstore_strerror(errCode),
                          couchkvstore_strerrno(errCode).c_str());
         st.numGetFailure++;
     }
 
-    returnVal.setStatus(cbCtx->cks.couchErr2EngineErr(errCode));
+    returnVal.setStatus(couchErr2EngineErr(errCode));
     std::list<VBucketBGFetchItem *>::iterator itr = fetches.begin();
     for (; itr != fetches.end(); itr++) {
         // populate return value for remaining fetch items with the
-        // same seqid
+        // same key
         (*itr)->value = returnVal;
         st.readTimeHisto.add((gethrtime() - (*itr)->initTime) / 1000);
         if (errCode == COUCHSTORE_SUCCESS) {
@@ -1787,10 +2108,194 @@ int CouchKVStore::getMultiCb(Db *db, DocInfo *docinfo, void *ctx)
                                  returnVal.getValue()->getNBytes());
         }
     }
-    return 0;
 }
 
 
+void CouchKVStore::releaseDB(uint16_t vbucketId, Db *db)
+{
+    std::map<uint16_t, db_handle_list_t::iterator>::iterator it;
+    it = dbHandles.find(vbucketId);
+    if (it != dbHandles.end() && it->second->db == db) {
+        // keep the cached handle open for the next request
+        it->second->inUse = false;
+    } else {
+        closeDatabaseHandle(db);
+    }
+}
+
+Db *CouchKVStore::getCachedDB(uint16_t vbucketId, uint64_t fileRev,
+                              bool readOnly)
+{
+    if (maxCachedDbs == 0) {
+        return NULL;
+    }
+
+    std::map<uint16_t, db_handle_list_t::iterator>::iterator it;
+    it = dbHandles.find(vbucketId);
+    if (it == dbHandles.end()) {
+        ++st.numDbCacheMiss;
+        return NULL;
+    }
+
+    db_handle_list_t::iterator handle = it->second;
+    if (handle->inUse) {
+        // couchstore handles can't be shared, so open another one
+        ++st.numDbCacheMiss;
+        return NULL;
+    }
+
+    // A read-only handle can't serve writes, and a handle for an older
+    // revision is stale once compaction has switched to a new file.
+    bool valid = handle->fileRev == fileRev &&
+                 (readOnly || !handle->readOnly);
+
+    // Reads only look at the file again once another instance committed
+    // to it or removed it since the handle was last validated. Writes are
+    // batched, so they can afford to check it on every open.
+    uint64_t commitSeqno = commitSeqnos->get(vbucketId);
+    if (valid && (!readOnly || handle->commitSeqno != commitSeqno)) {
+        valid = revalidateCachedDB(*handle, commitSeqno);
+    }
+
+    if (!valid) {
+        dropCachedDB(handle);
+        ++st.numDbCacheMiss;
+        return NULL;
+    }
+
+    // move it to the front of the LRU list
+    dbHandleLRU.splice(dbHandleLRU.begin(), dbHandleLRU, handle);
+    handle->inUse = true;
+    ++st.numDbCacheHit;
+    return handle->db;
+}
+
+bool CouchKVStore::revalidateCachedDB(CachedDbHandle &handle,
+                                      uint64_t commitSeqno)
+{
+    // Make sure the file wasn't removed or replaced underneath us.
+    struct stat fst;
+    if (stat(couchstore_get_db_filename(handle.db), &fst) != 0 ||
+        (uint64_t)fst.st_ino != handle.fileId) {
+        return false;
+    }
+
+    if (handle.commitSeqno == commitSeqno) {
+        return true;
+    }
+
+    // A writable handle can't pick up a foreign header without losing
+    // its own view of the file, so it is simply opened again.
+    if (!handle.readOnly) {
+        return false;
+    }
+
+    couchstore_error_t errCode = couchstore_refresh_db(handle.db);
+    if (errCode != COUCHSTORE_SUCCESS) {
+        getLogger()->log(EXTENSION_LOG_INFO, NULL,
+                         "INFO: failed to refresh cached database handle, "
+                         "vbucket=%d rev=%llu error=%s [%s]\n",
+                         handle.vbucketId, handle.fileRev,
+                         couchstore_strerror(errCode),
+                         couchkvstore_strerrno(errCode).c_str());
+        return false;
+    }
+    handle.commitSeqno = commitSeqno;
+    return true;
+}
+
+void CouchKVStore::cacheDB(uint16_t vbucketId, uint64_t fileRev,
+                           bool readOnly, uint64_t commitSeqno, Db *db)
+{
+    if (maxCachedDbs == 0) {
+        return;
+    }
+
+    struct stat fst;
+    if (stat(couchstore_get_db_filename(db), &fst) != 0) {
+        // can't validate it later on, so just close it after use
+        return;
+    }
+
+    evictCachedDB(vbucketId);
+    while (dbHandleLRU.size() >= maxCachedDbs) {
+        db_handle_list_t::iterator last = dbHandleLRU.end();
+        dropCachedDB(--last);
+        ++st.numDbCacheEvict;
+    }
+
+    dbHandleLRU.push_front(CachedDbHandle(vbucketId, fileRev, db, readOnly));
+    CachedDbHandle &handle = dbHandleLRU.front();
+    handle.inUse = true;
+    handle.fileId = fst.st_ino;
+    handle.commitSeqno = commitSeqno;
+    dbHandles[vbucketId] = dbHandleLRU.begin();
+}
+
+void CouchKVStore::noteCommit(uint16_t vbucketId, Db *db)
+{
+    uint64_t commitSeqno = commitSeqnos->bump(vbucketId);
+    std::map<uint16_t, db_handle_list_t::iterator>::iterator it;
+    it = dbHandles.find(vbucketId);
+    if (it != dbHandles.end() && it->second->db == db &&
+        it->second->commitSeqno + 1 == commitSeqno) {
+        // nobody else committed in between, so the handle already has
+        // the most recent header
+        it->second->commitSeqno = commitSeqno;
+    }
+}
+
+void CouchKVStore::evictCachedDB(uint16_t vbucketId)
+{
+    std::map<uint16_t, db_handle_list_t::iterator>::iterator it;
+    it = dbHandles.find(vbucketId);
+    if (it != dbHandles.end()) {
+        dropCachedDB(it->second);
+    }
+}
+
+void CouchKVStore::dropCachedDB(db_handle_list_t::iterator handle)
+{
+    // A handle that is still in use gets closed by releaseDB() once
+    // its user is done with it.
+    if (!handle->inUse) {
+        closeDatabaseHandle(handle->db);
+    }
+    dbHandles.erase(handle->vbucketId);
+    dbHandleLRU.erase(handle);
+}
+
+void CouchKVStore::clearDbCache(void)
+{
+    while (!dbHandleLRU.empty()) {
+        dropCachedDB(dbHandleLRU.begin());
+    }
+}
+
+static Mutex commitSeqnosMutex;
+static std::map<std::string, DbCommitSeqnos*> commitSeqnosMap;
+
+DbCommitSeqnos *DbCommitSeqnos::acquire(const std::string &dbname,
+                                        size_t maxVBuckets)
+{
+    LockHolder lh(commitSeqnosMutex);
+    DbCommitSeqnos *&seqnos = commitSeqnosMap[dbname];
+    if (seqnos == NULL) {
+        seqnos = new DbCommitSeqnos(dbname, maxVBuckets);
+    }
+    ++seqnos->refs;
+    return seqnos;
+}
+
+void DbCommitSeqnos::release(DbCommitSeqnos *seqnos)
+{
+    LockHolder lh(commitSeqnosMutex);
+    if (--seqnos->refs == 0) {
+        commitSeqnosMap.erase(seqnos->dbname);
+        delete seqnos;
+    }
+}
+
 void CouchKVStore::closeDatabaseHandle(Db *db) {
     couchstore_error_t ret = couchstore_close_db(db);
     if (ret != COUCHSTORE_SUCCESS) {
@@ -1833,7 +2338,7 @@ size_t CouchKVStore::warmup(MutationLog &lf,
     }
 
     hrtime_t start = gethrtime();
-    if (!harvester.load()) {
+    if (!harvester.load(engine.getConfiguration().getAlogReaderThreads())) {
         return -1;
     }
     hrtime_t end = gethrtime();
@@ -1882,7 +2387,7 @@ bool CouchKVStore::getEstimatedItemCount(size_t &items)
                                  "vBucket = %d rev = %llu\n",
                                  fitr->first, fitr->second);
             }
-            closeDatabaseHandle(db);
+            releaseDB(fitr->first, db);
         } else {
             getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                              "Warning: failed to open database file for "
@@ -1,6 +1,9 @@
 #ifndef COUCH_KVSTORE_H
 #define COUCH_KVSTORE_H 1
 
+#include <list>
+#include <set>
+
 #include "libcouchstore/couch_db.h"
 #include "kvstore.hh"
 #include "item.hh"
@@ -12,6 +15,64 @@
 
 #define COUCHSTORE_NO_OPTIONS 0
 
+/**
+ * A couchstore database handle kept open by CouchKVStore for reuse
+ */
+struct CachedDbHandle {
+    CachedDbHandle(uint16_t vb, uint64_t rev, Db *d, bool ro) :
+        vbucketId(vb), fileRev(rev), db(d), readOnly(ro), inUse(false),
+        fileId(0), commitSeqno(0) { }
+
+    uint16_t vbucketId;
+    uint64_t fileRev;
+    Db *db;
+    // true if the handle was opened with COUCHSTORE_OPEN_FLAG_RDONLY
+    bool readOnly;
+    // true between openDB() and releaseDB()
+    bool inUse;
+    // inode number of the file when it was opened
+    uint64_t fileId;
+    // DbCommitSeqnos value of the vbucket the handle is up to date with
+    uint64_t commitSeqno;
+};
+
+typedef std::list<CachedDbHandle> db_handle_list_t;
+
+/**
+ * Per vbucket commit counters shared by all the CouchKVStore instances
+ * of a bucket. A cached handle only needs to be validated again once
+ * another instance committed to (or removed) the file of its vbucket.
+ */
+class DbCommitSeqnos {
+public:
+    static DbCommitSeqnos *acquire(const std::string &dbname,
+                                   size_t maxVBuckets);
+    static void release(DbCommitSeqnos *seqnos);
+
+    uint64_t get(uint16_t vbucketId) const {
+        return vbucketId < size ? seqnos[vbucketId].get() : 0;
+    }
+
+    uint64_t bump(uint16_t vbucketId) {
+        return vbucketId < size ? ++seqnos[vbucketId] : 0;
+    }
+
+private:
+    DbCommitSeqnos(const std::string &name, size_t n) :
+        dbname(name), seqnos(new Atomic<uint64_t>[n]), size(n), refs(0) { }
+
+    ~DbCommitSeqnos() {
+        delete []seqnos;
+    }
+
+    const std::string dbname;
+    Atomic<uint64_t> *seqnos;
+    size_t size;
+    size_t refs;
+
+    DISALLOW_COPY_AND_ASSIGN(DbCommitSeqnos);
+};
+
 /**
  * Stats and timings for couchKVStore
  */
@@ -23,16 +84,21 @@ public:
      */
     CouchKVStoreStats() :
       docsCommitted(0), numOpen(0), numClose(0),
+      numDbCacheHit(0), numDbCacheMiss(0), numDbCacheEvict(0),
       numLoadedVb(0), numGetFailure(0), numSetFailure(0),
       numDelFailure(0), numOpenFailure(0), numVbSetFailure(0),
       readSizeHisto(ExponentialGenerator<size_t>(1, 2), 25),
-      writeSizeHisto(ExponentialGenerator<size_t>(1, 2), 25) {
+      writeSizeHisto(ExponentialGenerator<size_t>(1, 2), 25),
+      docsPerSync(ExponentialGenerator<size_t>(1, 2), 20) {
     }
 
     void reset() {
         docsCommitted.set(0);
         numOpen.set(0);
         numClose.set(0);
+        numDbCacheHit.set(0);
+        numDbCacheMiss.set(0);
+        numDbCacheEvict.set(0);
         numLoadedVb.set(0);
         numGetFailure.set(0);
         numSetFailure.set(0);
@@ -50,6 +116,7 @@ public:
         commitRetryHisto.reset();
         saveDocsHisto.reset();
         batchSize.reset();
+        docsPerSync.reset();
         fsStats.reset();
     }
 
@@ -59,6 +126,12 @@ public:
     Atomic<size_t> numOpen;
     // the number of close() calls
     Atomic<size_t> numClose;
+    // the number of open requests served by an already open db handle
+    Atomic<size_t> numDbCacheHit;
+    // the number of open requests that had to open the db file
+    Atomic<size_t> numDbCacheMiss;
+    // the number of cached db handles closed to make room for others
+    Atomic<size_t> numDbCacheEvict;
     // the number of vbuckets loaded
     Atomic<size_t> numLoadedVb;
 
@@ -91,6 +164,8 @@ public:
     Histogram<hrtime_t> saveDocsHisto;
     // Batch size of saveDocs calls
     Histogram<size_t> batchSize;
+    // Number of docs made durable by a commit or a group commit
+    Histogram<size_t> docsPerSync;
 
     // Stats from the underlying OS file operations done by couchstore.
     CouchstoreStats fsStats;
@@ -98,6 +173,7 @@ public:
 
 class EventuallyPersistentEngine;
 class EPStats;
+struct GetMultiCbCtx;
 
 typedef union {
     Callback <mutation_result> *setCb;
@@ -242,6 +318,25 @@ private :
     hrtime_t start;
 };
 
+/**
+ * The documents of a single vbucket that are saved together.
+ */
+struct CouchDocsBatch {
+    CouchDocsBatch(uint16_t vb, uint64_t rev, Doc **d, DocInfo **di) :
+        vbid(vb), fileRev(rev), newFileRev(rev), docs(d), docinfos(di),
+        docCount(0), db(NULL), errCode(COUCHSTORE_SUCCESS) { }
+
+    uint16_t vbid;
+    uint64_t fileRev;
+    uint64_t newFileRev;
+    Doc **docs;
+    DocInfo **docinfos;
+    int docCount;
+    // open from the time the docs are written until the commit is done
+    Db *db;
+    couchstore_error_t errCode;
+};
+
 /**
  * KVStore with couchstore as the underlying storage system
  */
@@ -269,6 +364,7 @@ public:
      */
     virtual ~CouchKVStore() {
         close();
+        DbCommitSeqnos::release(commitSeqnos);
     }
 
     /**
@@ -333,6 +429,9 @@ public:
     /**
      * Retrieve the multiple documents from the underlying storage system at once.
      *
+     * All the keys are looked up in a single walk of the by id tree, the
+     * document bodies are then read in the order of their file offsets.
+     *
      * @param vb vbucket id of a document
      * @param itms list of items whose documents are going to be retrieved
      */
@@ -411,6 +510,16 @@ public:
      */
     void dumpKeys(const std::vector<uint16_t> &vbids,  shared_ptr<Callback<GetValue> > cb);
 
+    /**
+     * Retrieve all the documents of the given vbuckets, skipping the
+     * deleted ones.
+     *
+     * @param vbids list of vbucket ids whose documents are going to be retrieved
+     * @param cb callback instance to process each document retrieved
+     */
+    void dumpVBuckets(const std::vector<uint16_t> &vbids,
+                      shared_ptr<Callback<GetValue> > cb);
+
     /**
      * Retrieve the list of keys and their meta data for a given
      * vbucket, which were deleted.
@@ -419,6 +528,19 @@ public:
      */
     void dumpDeleted(uint16_t vb,  shared_ptr<Callback<GetValue> > cb);
 
+    /**
+     * Retrieve the items (or the keys of the deleted items) of a given
+     * vbucket in sequence order, from a given sequence number on.
+     * @param vb vbucket id
+     * @param since the sequence number to start from
+     * @param deletionsOnly true to retrieve the deleted keys
+     * @param cb callback instance to process each item
+     * @return the sequence number to resume from if the callback stopped
+     *         the dump, 0 otherwise
+     */
+    uint64_t dumpSince(uint16_t vb, uint64_t since, bool deletionsOnly,
+                       shared_ptr<Callback<GetValue> > cb);
+
     /**
      * Does the underlying storage system support key-only retrieval operations?
      *
@@ -501,14 +623,16 @@ public:
     couchstore_error_t fetchDoc(Db *db, DocInfo *docinfo,
                                 GetValue &docValue, uint16_t vbId,
                                 bool metaOnly);
+    void fetchMultiDoc(Db *db, DocInfo *docinfo, GetMultiCbCtx &ctx);
     ENGINE_ERROR_CODE couchErr2EngineErr(couchstore_error_t errCode);
 
     CouchKVStoreStats &getCKVStoreStat(void) { return st; }
 
 protected:
-    void loadDB(shared_ptr<Callback<GetValue> > cb, bool keysOnly,
-                std::vector<uint16_t> *vbids,
-                couchstore_docinfos_options options=COUCHSTORE_NO_OPTIONS);
+    uint64_t loadDB(shared_ptr<Callback<GetValue> > cb, bool keysOnly,
+                    std::vector<uint16_t> *vbids,
+                    couchstore_docinfos_options options=COUCHSTORE_NO_OPTIONS,
+                    uint64_t since = 0);
     bool setVBucketState(uint16_t vbucketId, vbucket_state &vbstate,
                          uint32_t vb_change_type, bool newfile = false,
                          bool notify = true);
@@ -543,8 +667,21 @@ private:
     couchstore_error_t openDB_retry(std::string &dbfile, uint64_t options,
                                     const couch_file_ops *ops,
                                     Db **db, uint64_t *newFileRev);
-    couchstore_error_t saveDocs(uint16_t vbid, uint64_t rev, Doc **docs,
-                                DocInfo **docinfos, int docCount);
+    void releaseDB(uint16_t vbucketId, Db *db);
+    Db *getCachedDB(uint16_t vbucketId, uint64_t fileRev, bool readOnly);
+    bool revalidateCachedDB(CachedDbHandle &handle, uint64_t commitSeqno);
+    void cacheDB(uint16_t vbucketId, uint64_t fileRev, bool readOnly,
+                 uint64_t commitSeqno, Db *db);
+    void noteCommit(uint16_t vbucketId, Db *db);
+    void evictCachedDB(uint16_t vbucketId);
+    void dropCachedDB(db_handle_list_t::iterator it);
+    void clearDbCache(void);
+    couchstore_error_t saveDocs(CouchDocsBatch &batch);
+    void saveDocsGroup(std::vector<CouchDocsBatch> &batches);
+    couchstore_error_t writeDocs(CouchDocsBatch &batch);
+    bool notifyDocs(CouchDocsBatch &batch);
+    void abortDocs(CouchDocsBatch &batch, couchstore_error_t errCode);
+    void syncDocsGroup(std::vector<CouchDocsBatch> &batches);
     void commitCallback(CouchRequest **committedReqs, int numReqs,
                         couchstore_error_t errCode);
     couchstore_error_t saveVBState(Db *db, vbucket_state &vbState);
@@ -561,6 +698,26 @@ private:
     size_t pendingCommitCnt;
     bool intransaction;
 
+    /* In group commit mode the pending requests may span several
+     * vbuckets; they are committed together once there are groupMaxDocs
+     * of them, groupWindow has passed or the transaction is committed. */
+    bool groupCommit;
+    size_t groupMaxDocs;
+    hrtime_t groupWindow;
+    hrtime_t groupStart;
+    std::set<uint16_t> pendingVBuckets;
+
+    /* LRU list of open db handles (most recently used first) indexed by
+     * vbucket id. Like the rest of this class it is not thread safe: each
+     * instance is only used by the single dispatcher thread it was
+     * created for (see EventuallyPersistentStore's constructor). Other
+     * instances of the same bucket may write the files though, which is
+     * what commitSeqnos tracks. */
+    db_handle_list_t dbHandleLRU;
+    std::map<uint16_t, db_handle_list_t::iterator> dbHandles;
+    size_t maxCachedDbs;
+    DbCommitSeqnos *commitSeqnos;
+
     /* all stats */
     CouchKVStoreStats   st;
     couch_file_ops statCollectingFileOps;
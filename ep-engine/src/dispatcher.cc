@@ -23,9 +23,10 @@ extern "C" {
 }
 
 static void* launch_dispatcher_thread(void *arg) {
-    Dispatcher *dispatcher = (Dispatcher*) arg;
+    DispatcherWorker *worker = (DispatcherWorker*) arg;
+    Dispatcher *dispatcher = &worker->getDispatcher();
     try {
-        dispatcher->run();
+        dispatcher->run(*worker);
     } catch (std::exception& e) {
         getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                          "%s: Caught an exception: %s\n",
@@ -87,116 +88,220 @@ void Task::snooze(const double secs, bool first) {
 
 void Dispatcher::start() {
     assert(state == dispatcher_running);
-    if(pthread_create(&thread, NULL, launch_dispatcher_thread, this) != 0) {
-        std::stringstream ss;
-        ss << getName().c_str() << ": Initialization error!!!";
-        throw std::runtime_error(ss.str().c_str());
+    std::vector<DispatcherWorker*>::iterator it = workers.begin();
+    for (; it != workers.end(); ++it) {
+        if(pthread_create(&(*it)->thread, NULL, launch_dispatcher_thread,
+                          *it) != 0) {
+            std::stringstream ss;
+            ss << getName().c_str() << ": Initialization error!!!";
+            throw std::runtime_error(ss.str().c_str());
+        }
     }
 }
 
-TaskId Dispatcher::nextTask() {
-    assert (!empty());
-    return readyQueue.empty() ? futureQueue.top() : readyQueue.top();
+TaskId DispatcherWorker::popReady() {
+    LockHolder lh(mutex);
+    TaskId task;
+    if (!readyQueue.empty()) {
+        task = readyQueue.top();
+        readyQueue.pop();
+    }
+    return task;
 }
 
-void Dispatcher::popNext() {
-    assert (!empty());
-    readyQueue.empty() ? futureQueue.pop() : readyQueue.pop();
+int DispatcherWorker::getReadyPriority() {
+    LockHolder lh(mutex);
+    return readyQueue.empty() ? -1 : readyQueue.top()->priority;
 }
 
-void Dispatcher::moveReadyTasks(const struct timeval &tv) {
-    if (!readyQueue.empty()) {
-        return;
+TaskId Dispatcher::takeReadyTask(DispatcherWorker &worker) {
+    TaskId task = worker.popReady();
+    while (!task) {
+        // Steal the most urgent ready task of the other workers.
+        DispatcherWorker *victim = NULL;
+        int best = -1;
+        std::vector<DispatcherWorker*>::iterator it = workers.begin();
+        for (; it != workers.end(); ++it) {
+            int p = (*it)->getReadyPriority();
+            if (*it != &worker && p >= 0 && (victim == NULL || p < best)) {
+                victim = *it;
+                best = p;
+            }
+        }
+        if (victim == NULL) {
+            break;
+        }
+        task = victim->popReady();
     }
+    return task;
+}
+
+bool Dispatcher::moveReadyTasks(const struct timeval &tv,
+                                DispatcherWorker &worker) {
+    size_t next = worker.getId();
+    bool moved = false;
     while (!futureQueue.empty()) {
-        const TaskId &tid = futureQueue.top();
+        TaskId tid = futureQueue.top();
         if (less_tv(tid->waketime, tv)) {
-            readyQueue.push(tid);
             futureQueue.pop();
+            DispatcherWorker *w = workers[next];
+            LockHolder lh(w->mutex);
+            w->readyQueue.push(tid);
+            next = (next + 1) % workers.size();
+            moved = true;
         } else {
             // We found all the ready stuff.
-            return;
+            break;
         }
     }
+    if (moved && workers.size() > 1) {
+        // Let the idle workers pick the other tasks up.
+        notify();
+    }
+    return moved;
 }
 
-void Dispatcher::run() {
+void Dispatcher::run(DispatcherWorker &worker) {
     ObjectRegistry::onSwitchThread(&engine);
-    getLogger()->log(EXTENSION_LOG_INFO, NULL, "%s: Starting\n", getName().c_str());
+    getLogger()->log(EXTENSION_LOG_INFO, NULL, "%s: Starting worker %d\n",
+                     getName().c_str(), static_cast<int>(worker.getId()));
     for (;;) {
-        LockHolder lh(mutex);
-        // Having acquired the lock, verify our state and break out if
-        // it's changed.
         if (state != dispatcher_running) {
             break;
         }
 
-        if (empty()) {
-            // Wait forever as long as the state didn't change while
-            // we grabbed the lock.
-            if (state == dispatcher_running) {
-                noTask();
-                mutex.wait();
+        TaskId task = takeReadyTask(worker);
+        if (!task) {
+            LockHolder lh(mutex);
+            // Having acquired the lock, verify our state and break out if
+            // it's changed.
+            if (state != dispatcher_running) {
+                break;
             }
-        } else {
-            struct timeval tv;
-            gettimeofday(&tv, NULL);
 
-            // Get any ready tasks out of the due queue.
-            moveReadyTasks(tv);
+            // Tasks only become ready with the lock held, so look once more
+            // before going to sleep.
+            task = takeReadyTask(worker);
+            if (!task) {
+                struct timeval tv;
+                gettimeofday(&tv, NULL);
+                if (moveReadyTasks(tv, worker)) {
+                    continue;
+                }
 
-            TaskId task = nextTask();
-            assert(task);
-            LockHolder tlh(task->mutex);
-            if (task->state == task_dead) {
-                popNext();
-                continue;
-            }
+                if (futureQueue.empty()) {
+                    // Wait forever as long as the state didn't change while
+                    // we grabbed the lock.
+                    LockHolder wlh(worker.mutex);
+                    worker.noTask();
+                    wlh.unlock();
+                    mutex.wait();
+                    continue;
+                }
 
-            if (less_tv(tv, task->waketime)) {
-                idleTask->setWaketime(task->waketime);
-                idleTask->setDispatcherNotifications(notifications.get());
-                task = static_cast<Task *>(idleTask.get());
-                taskDesc = task->getName();
-            } else {
-                // Otherwise, do the normal thing.
-                popNext();
-                taskDesc = task->getName();
-            }
-            tlh.unlock();
-
-            taskStart = gethrtime();
-            lh.unlock();
-            rel_time_t startReltime = ep_current_time();
-            try {
-                running_task = true;
-                if(task->run(*this, task)) {
-                    reschedule(task);
+                TaskId next = futureQueue.top();
+                LockHolder tlh(next->mutex);
+                if (next->state == task_dead) {
+                    futureQueue.pop();
+                    continue;
                 }
-            } catch (std::exception& e) {
-                getLogger()->log(EXTENSION_LOG_WARNING, NULL,
-                                 "%s: Exception caught in task \"%s\": %s\n",
-                                 getName().c_str(), task->getName().c_str(), e.what());
-            } catch(...) {
-                getLogger()->log(EXTENSION_LOG_WARNING, NULL,
-                                 "%s: Fatal exception caught in task \"%s\"\n",
-                                 getName().c_str(), task->getName().c_str());
+                worker.idleTask->setWaketime(next->waketime);
+                tlh.unlock();
+                worker.idleTask->setDispatcherNotifications(notifications.get());
+                task = static_cast<Task *>(worker.idleTask.get());
             }
-            running_task = false;
+        }
 
-            hrtime_t runtime((gethrtime() - taskStart) / 1000);
-            JobLogEntry jle(taskDesc, runtime, startReltime);
-            joblog.add(jle);
-            if (runtime > task->maxExpectedDuration()) {
-                slowjobs.add(jle);
-            }
+        LockHolder tlh(task->mutex);
+        if (task->state == task_dead) {
+            continue;
+        }
+        tlh.unlock();
+        if (task->exclusive && !startExclusive(task)) {
+            continue;
+        }
+        runTask(worker, task);
+        if (task->exclusive) {
+            finishExclusive(worker);
         }
     }
 
-    completeNonDaemonTasks();
-    state = dispatcher_stopped;
-    notify();
-    getLogger()->log(EXTENSION_LOG_INFO, NULL, "%s: Exited\n", getName().c_str());
+    if (&worker == workers[0]) {
+        // The first worker waits for the others to finish their tasks,
+        // then runs the tasks that must complete before shutting down.
+        for (size_t i = 1; i < workers.size(); ++i) {
+            pthread_join(workers[i]->thread, NULL);
+        }
+        completeNonDaemonTasks();
+        LockHolder lh(mutex);
+        state = dispatcher_stopped;
+        notify();
+    }
+    getLogger()->log(EXTENSION_LOG_INFO, NULL, "%s: Exited worker %d\n",
+                     getName().c_str(), static_cast<int>(worker.getId()));
+}
+
+void Dispatcher::runTask(DispatcherWorker &worker, TaskId &task) {
+    bool idle = task.get() == worker.idleTask.get();
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    hrtime_t queueDelay = 0;
+    if (!idle && less_tv(task->waketime, now)) {
+        queueDelay = (now.tv_sec - task->waketime.tv_sec) * 1000000 +
+                     (now.tv_usec - task->waketime.tv_usec);
+    }
+
+    std::string taskDesc = task->getName();
+    hrtime_t taskStart = gethrtime();
+    LockHolder wlh(worker.mutex);
+    worker.taskDesc = taskDesc;
+    worker.taskStart = taskStart;
+    worker.running_task = true;
+    wlh.unlock();
+
+    rel_time_t startReltime = ep_current_time();
+    try {
+        if(task->run(*this, task)) {
+            reschedule(task);
+        }
+    } catch (std::exception& e) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "%s: Exception caught in task \"%s\": %s\n",
+                         getName().c_str(), task->getName().c_str(), e.what());
+    } catch(...) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "%s: Fatal exception caught in task \"%s\"\n",
+                         getName().c_str(), task->getName().c_str());
+    }
+
+    hrtime_t runtime((gethrtime() - taskStart) / 1000);
+    JobLogEntry jle(taskDesc, runtime, startReltime, queueDelay);
+    wlh.lock();
+    worker.running_task = false;
+    worker.joblog.add(jle);
+    if (runtime > task->maxExpectedDuration()) {
+        worker.slowjobs.add(jle);
+    }
+}
+
+bool Dispatcher::startExclusive(TaskId &task) {
+    LockHolder lh(exclusiveMutex);
+    if (exclusiveRunning) {
+        exclusiveWaiting.push(task);
+        return false;
+    }
+    exclusiveRunning = true;
+    return true;
+}
+
+void Dispatcher::finishExclusive(DispatcherWorker &worker) {
+    LockHolder lh(exclusiveMutex);
+    exclusiveRunning = false;
+    if (!exclusiveWaiting.empty()) {
+        LockHolder wlh(worker.mutex);
+        worker.readyQueue.push(exclusiveWaiting.top());
+        exclusiveWaiting.pop();
+    }
 }
 
 void Dispatcher::stop(bool force) {
@@ -209,7 +314,7 @@ void Dispatcher::stop(bool force) {
     state = dispatcher_stopping;
     notify();
     lh.unlock();
-    pthread_join(thread, NULL);
+    pthread_join(workers[0]->thread, NULL);
     getLogger()->log(EXTENSION_LOG_INFO, NULL, "%s: Stopped\n", getName().c_str());
 }
 
@@ -242,9 +347,9 @@ void Dispatcher::schedule(shared_ptr<DispatcherCallback> callback,
     notify();
 }
 
-void Dispatcher::wake(TaskId &task) {
+void Dispatcher::wake(TaskId &task, double delay) {
     LockHolder lh(mutex);
-    task->snooze(0);
+    task->snooze(delay);
     getLogger()->log(EXTENSION_LOG_DEBUG, NULL,
                      "%s: Wake a task \"%s\"",
                      getName().c_str(), task->getName().c_str());
@@ -277,9 +382,28 @@ void Dispatcher::reschedule(TaskId &task) {
 
 void Dispatcher::completeNonDaemonTasks() {
     LockHolder lh(mutex);
-    while (!empty()) {
-        TaskId task = nextTask();
-        popNext();
+    std::vector<TaskId> tasks;
+    std::vector<DispatcherWorker*>::iterator it = workers.begin();
+    for (; it != workers.end(); ++it) {
+        TaskId task;
+        while ((task = (*it)->popReady())) {
+            tasks.push_back(task);
+        }
+    }
+    while (!futureQueue.empty()) {
+        tasks.push_back(futureQueue.top());
+        futureQueue.pop();
+    }
+    LockHolder elh(exclusiveMutex);
+    while (!exclusiveWaiting.empty()) {
+        tasks.push_back(exclusiveWaiting.top());
+        exclusiveWaiting.pop();
+    }
+    elh.unlock();
+
+    std::vector<TaskId>::iterator tit = tasks.begin();
+    for (; tit != tasks.end(); ++tit) {
+        TaskId task = *tit;
         assert(task);
         // Skip a daemon task
         if (task->isDaemonTask) {
@@ -4,6 +4,7 @@
 
 #include <stdexcept>
 #include <queue>
+#include <vector>
 
 #include "common.hh"
 #include "atomic.hh"
@@ -14,6 +15,7 @@
 #define JOB_LOG_SIZE 20
 
 class Dispatcher;
+class DispatcherWorker;
 
 /**
  * States a task may be in.
@@ -41,9 +43,10 @@ class JobLogEntry {
 public:
 
     // This is useful for the ringbuffer to initialize
-    JobLogEntry() : name("invalid"), duration(0) {}
-    JobLogEntry(const std::string &n, const hrtime_t d, rel_time_t t = 0)
-        : name(n), ts(t), duration(d) {}
+    JobLogEntry() : name("invalid"), duration(0), queueDelay(0) {}
+    JobLogEntry(const std::string &n, const hrtime_t d, rel_time_t t = 0,
+                hrtime_t q = 0)
+        : name(n), ts(t), duration(d), queueDelay(q) {}
 
     /**
      * Get the name of the job.
@@ -60,10 +63,17 @@ public:
      */
     rel_time_t getTimestamp() const { return ts; }
 
+    /**
+     * Get the amount of time (in microseconds) this job was due before
+     * a worker got to run it.
+     */
+    hrtime_t getQueueDelay() const { return queueDelay; }
+
 private:
     std::string name;
     rel_time_t ts;
     hrtime_t duration;
+    hrtime_t queueDelay;
 };
 
 class Task;
@@ -104,6 +114,14 @@ public:
     virtual size_t startTime() {
         return 24;
     }
+
+    /**
+     * Exclusive tasks of a dispatcher never run at the same time as one
+     * another, whatever its number of workers.
+     */
+    virtual bool isExclusive() {
+        return false;
+    }
 };
 
 class CompareTasksByDueDate;
@@ -125,7 +143,8 @@ protected:
          bool isDaemon = true, bool completeBeforeShutdown = false) :
         RCValue(), callback(cb), priority(p),
         state(task_running), isDaemonTask(isDaemon),
-        blockShutdown(completeBeforeShutdown)
+        blockShutdown(completeBeforeShutdown),
+        exclusive(cb && cb->isExclusive())
     {
         snooze(sleeptime, true);
     }
@@ -150,6 +169,7 @@ protected:
     }
 
     friend class Dispatcher;
+    friend class DispatcherWorker;
     struct timeval waketime;
     shared_ptr<DispatcherCallback> callback;
     int priority;
@@ -160,6 +180,9 @@ protected:
     // Some of the tasks must complete during shutdown
     bool blockShutdown;
 
+    // Never runs alongside another exclusive task of the dispatcher
+    const bool exclusive;
+
     DISALLOW_COPY_AND_ASSIGN(Task);
 };
 
@@ -285,21 +308,94 @@ private:
     const bool running_task;
 };
 
+typedef std::priority_queue<TaskId, std::deque<TaskId>,
+                            CompareTasksByPriority> ready_queue_t;
+
 /**
- * Schedule and run tasks in another thread.
+ * A thread of a dispatcher.
+ *
+ * Every worker runs the tasks of its own ready queue, and steals the
+ * most urgent ready task of another worker once its own queue is empty.
  */
-class Dispatcher {
+class DispatcherWorker {
 public:
-    Dispatcher(EventuallyPersistentEngine &e, const char *desc = NULL) :
-        notifications(0), joblog(JOB_LOG_SIZE), slowjobs(JOB_LOG_SIZE),
-        idleTask(new IdleTask), state(dispatcher_running),
-        forceTermination(false), engine(e), name(desc ? desc : "Dispatcher")
+    DispatcherWorker(Dispatcher &d, size_t i) :
+        dispatcher(d), id(i), joblog(JOB_LOG_SIZE), slowjobs(JOB_LOG_SIZE),
+        idleTask(new IdleTask), taskStart(0), running_task(false)
     {
         noTask();
     }
 
+    Dispatcher &getDispatcher() { return dispatcher; }
+
+    size_t getId() const { return id; }
+
+private:
+
+    friend class Dispatcher;
+
+    void noTask() {
+        taskDesc = "none";
+    }
+
+    //! Take the most urgent task of the ready queue, if any.
+    TaskId popReady();
+
+    //! Priority of the most urgent ready task, or -1 if there's none.
+    int getReadyPriority();
+
+    Dispatcher &dispatcher;
+    size_t id;
+    pthread_t thread;
+    // Guards the ready queue, the job logs and the current task.
+    Mutex mutex;
+    ready_queue_t readyQueue;
+    RingBuffer<JobLogEntry> joblog;
+    RingBuffer<JobLogEntry> slowjobs;
+    SingleThreadedRCPtr<IdleTask> idleTask;
+    std::string taskDesc;
+    hrtime_t taskStart;
+    bool running_task;
+
+    DISALLOW_COPY_AND_ASSIGN(DispatcherWorker);
+};
+
+/**
+ * Schedule and run tasks in other threads.
+ *
+ * Tasks are kept in a queue ordered by due date until they are ready to
+ * run, then they are handed out to the ready queues of the workers, which
+ * run them in order of priority.  A task is never run by two workers at
+ * the same time.
+ */
+class Dispatcher {
+public:
+    /**
+     * Create a dispatcher.
+     *
+     * @param e the engine
+     * @param desc the name of the dispatcher
+     * @param numWorkers the number of threads running the tasks, tasks
+     *        sharing state without locks need a single thread
+     */
+    Dispatcher(EventuallyPersistentEngine &e, const char *desc = NULL,
+               size_t numWorkers = 1) :
+        notifications(0), state(dispatcher_running),
+        forceTermination(false), exclusiveRunning(false),
+        engine(e), name(desc ? desc : "Dispatcher")
+    {
+        numWorkers = std::max(numWorkers, static_cast<size_t>(1));
+        for (size_t i = 0; i < numWorkers; ++i) {
+            workers.push_back(new DispatcherWorker(*this, i));
+        }
+    }
+
     ~Dispatcher() {
         stop();
+        std::vector<DispatcherWorker*>::iterator it = workers.begin();
+        for (; it != workers.end(); ++it) {
+            delete *it;
+        }
     }
 
     /**
@@ -324,11 +420,12 @@ public:
      * Wake up the given task.
      *
      * @param task the task to wake up
+     * @param delay how long (in seconds) the task should wait before it runs
      */
-    void wake(TaskId &task);
+    void wake(TaskId &task, double delay = 0);
 
     /**
-     * Start this dispatcher's thread.
+     * Start this dispatcher's threads.
      */
     void start();
     /**
@@ -338,9 +435,9 @@ public:
     void stop(bool force = false);
 
     /**
-     * Dispatcher's main loop.  Don't run this.
+     * Main loop of a worker.  Don't run this.
      */
-    void run();
+    void run(DispatcherWorker &worker);
 
     /**
      * Delay a task.
@@ -356,31 +453,38 @@ public:
     void cancel(TaskId &t);
 
     /**
-     * Get the name of the currently executing task.
+     * Get the name of the task currently executed by the given worker.
      */
-    std::string getCurrentTaskName() { return taskDesc; }
+    std::string getCurrentTaskName(size_t worker = 0) {
+        DispatcherWorker *w = workers[worker];
+        LockHolder lh(w->mutex);
+        return w->taskDesc;
+    }
 
     /**
      * Get the state of the dispatcher.
      */
     enum dispatcher_state getState() { return state; }
 
-    DispatcherState getDispatcherState() {
-        LockHolder lh(mutex);
-        return DispatcherState(taskDesc, state, taskStart, running_task,
-                               joblog.contents(), slowjobs.contents());
+    /**
+     * Get the state of the dispatcher as seen by the given worker.
+     */
+    DispatcherState getDispatcherState(size_t worker = 0) {
+        DispatcherWorker *w = workers[worker];
+        LockHolder lh(w->mutex);
+        return DispatcherState(w->taskDesc, state, w->taskStart,
+                               w->running_task, w->joblog.contents(),
+                               w->slowjobs.contents());
     }
 
+    size_t getNumWorkers() const { return workers.size(); }
+
     const std::string &getName() { return name; }
 
 private:
 
     friend class IdleTask;
 
-    void noTask() {
-        taskDesc = "none";
-    }
-
     void reschedule(TaskId &task);
 
     void notify() {
@@ -394,35 +498,49 @@ private:
     void completeNonDaemonTasks();
 
     /**
-     * Move all tasks that are ready for execution into the "ready"
-     * priority queue.
+     * Hand all tasks that are ready for execution out to the ready
+     * queues of the workers, starting with the given one.
+     *
+     * @return true if any task was ready
+     */
+    bool moveReadyTasks(const struct timeval &tv, DispatcherWorker &worker);
+
+    /**
+     * Get a ready task for the given worker, stealing one from another
+     * worker if its own ready queue is empty.
      */
-    void moveReadyTasks(const struct timeval &tv);
+    TaskId takeReadyTask(DispatcherWorker &worker);
 
-    //! True if there are no tasks scheduled.
-    bool empty() { return readyQueue.empty() && futureQueue.empty(); }
+    /**
+     * Run a task on the given worker and record it in the job log.
+     */
+    void runTask(DispatcherWorker &worker, TaskId &task);
 
-    //! Get the next task.
-    TaskId nextTask();
+    /**
+     * Claim the right to run the given exclusive task, or park the task
+     * until the exclusive task that is running completes.
+     *
+     * @return true if the task may run now
+     */
+    bool startExclusive(TaskId &task);
 
-    //! Remove the next task.
-    void popNext();
+    /**
+     * Give up the right to run exclusive tasks, handing the most urgent
+     * parked one to the ready queue of the given worker.
+     */
+    void finishExclusive(DispatcherWorker &worker);
 
-    std::string taskDesc;
-    pthread_t thread;
     SyncObject mutex;
     Atomic<size_t> notifications;
-    std::priority_queue<TaskId, std::deque<TaskId >,
-                        CompareTasksByPriority> readyQueue;
     std::priority_queue<TaskId, std::deque<TaskId >,
                         CompareTasksByDueDate> futureQueue;
-    RingBuffer<JobLogEntry> joblog;
-    RingBuffer<JobLogEntry> slowjobs;
-    SingleThreadedRCPtr<IdleTask> idleTask;
+    std::vector<DispatcherWorker*> workers;
     enum dispatcher_state state;
-    hrtime_t taskStart;
-    bool running_task;
     bool forceTermination;
+    // Guards the exclusive tasks that are running or waiting to run.
+    Mutex exclusiveMutex;
+    bool exclusiveRunning;
+    ready_queue_t exclusiveWaiting;
 
     EventuallyPersistentEngine &engine;
     std::string name;
@@ -63,6 +63,12 @@ public:
             stats.warmupMemUsedCap.set(static_cast<double>(value) / 100.0);
         } else if (key.compare("warmup_min_items_threshold") == 0) {
             stats.warmupNumReadCap.set(static_cast<double>(value) / 100.0);
+        } else if (key.compare("bg_fetch_batch_size") == 0) {
+            stats.bgFetchBatchSize.set(value);
+        } else if (key.compare("bg_fetch_latency_slo") == 0) {
+            stats.bgFetchLatencySLO.set(value);
+        } else if (key.compare("bg_fetch_max_window") == 0) {
+            stats.bgFetchMaxWindow.set(value);
         } else {
             getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                              "Failed to change value for unknown variable, %s\n",
@@ -208,20 +214,24 @@ private:
  */
 class SnapshotVBucketsCallback : public DispatcherCallback {
 public:
-    SnapshotVBucketsCallback(EventuallyPersistentStore *e, const Priority &p)
-        : ep(e), priority(p) { }
+    SnapshotVBucketsCallback(EventuallyPersistentStore *e, const Priority &p,
+                             uint16_t shard)
+        : ep(e), priority(p), shardId(shard) { }
 
     bool callback(Dispatcher &, TaskId &) {
-        ep->snapshotVBuckets(priority);
+        ep->snapshotVBuckets(priority, shardId);
         return false;
     }
 
     std::string description() {
-        return "Snapshotting vbuckets";
+        std::stringstream ss;
+        ss << "Snapshotting vbuckets of flusher shard " << shardId;
+        return ss.str();
     }
 private:
     EventuallyPersistentStore *ep;
     const Priority &priority;
+    uint16_t shardId;
 };
 
 class VBucketMemoryDeletionCallback : public DispatcherCallback {
@@ -241,6 +251,10 @@ public:
         return ss.str();
     }
 
+    bool isExclusive() {
+        return true;
+    }
+
 private:
     EventuallyPersistentStore *ep;
     RCPtr<VBucket> vbucket;
@@ -294,14 +308,12 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
                                                      bool startVb0,
                                                      bool concurrentDB) :
     engine(theEngine), stats(engine.getEpStats()), rwUnderlying(t),
-    storageProperties(t->getStorageProperties()), bgFetcher(NULL),
+    storageProperties(t->getStorageProperties()),
     vbuckets(theEngine.getConfiguration()),
     mutationLog(theEngine.getConfiguration().getKlogPath(),
                 theEngine.getConfiguration().getKlogBlockSize()),
     accessLog(engine.getConfiguration().getAlogPath(),
               engine.getConfiguration().getAlogBlockSize()),
-    diskFlushAll(false),
-    tctx(stats, t, mutationLog),
     bgFetchDelay(0),
     snapshotVBState(false)
 {
@@ -331,11 +343,61 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
         auxUnderlying = roUnderlying;
         auxIODispatcher = roDispatcher;
     }
-    nonIODispatcher = new Dispatcher(theEngine, "NONIO_Dispatcher");
-    flusher = new Flusher(this, dispatcher);
+    // The non-IO tasks don't share a KVStore, so a slow one (say a
+    // backfill) may run alongside the others.
+    nonIODispatcher = new Dispatcher(theEngine, "NONIO_Dispatcher",
+                                     theEngine.getConfiguration().getMaxNumNonioWorkers());
+
+    // Each flusher shard writes its vbuckets through its own KVStore on
+    // its own dispatcher; the first one uses the main RW dispatcher.
+    // A KVStore isn't thread safe (e.g. its cache of open db handles), so
+    // it must never be shared by two dispatcher threads.
+    size_t numShards = std::min(theEngine.getConfiguration().getMaxNumFlushers(),
+                                storageProperties.maxWriters());
+    numShards = std::max(std::min(numShards, vbuckets.getSize()),
+                         static_cast<size_t>(1));
+    if (numShards > 1 && !theEngine.getConfiguration().getKlogPath().empty()) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "The mutation log can't be shared between flushers, "
+                         "using a single flusher\n");
+        numShards = 1;
+    }
+    for (size_t i = 0; i < numShards; ++i) {
+        KVStore *kvstore = rwUnderlying;
+        Dispatcher *d = dispatcher;
+        if (i > 0) {
+            std::stringstream name;
+            name << "RW_Dispatcher_" << i;
+            kvstore = engine.newKVStore();
+            d = new Dispatcher(theEngine, name.str().c_str());
+        }
+        FlusherShard *shard = new FlusherShard(stats, static_cast<uint16_t>(i),
+                                               kvstore, d, mutationLog);
+        shard->flusher = new Flusher(this, d, shard->id);
+        shards.push_back(shard);
+    }
 
     if (multiBGFetchEnabled()) {
-        bgFetcher = new BgFetcher(this, roDispatcher, stats);
+        // Each bg fetcher reads its vbuckets through its own KVStore on
+        // its own dispatcher; the first one uses the main RO dispatcher,
+        // whose tasks are the only users of roUnderlying.
+        size_t numFetchers = std::min(theEngine.getConfiguration().getMaxNumBgfetchers(),
+                                      storageProperties.maxReaders());
+        numFetchers = std::max(std::min(numFetchers, vbuckets.getSize()),
+                               static_cast<size_t>(1));
+        for (size_t i = 0; i < numFetchers; ++i) {
+            KVStore *kvstore = roUnderlying;
+            Dispatcher *d = roDispatcher;
+            if (i > 0) {
+                std::stringstream name;
+                name << "RO_Dispatcher_" << i;
+                kvstore = engine.newKVStore(true);
+                d = new Dispatcher(theEngine, name.str().c_str());
+            }
+            bgFetchers.push_back(new BgFetcher(this, kvstore, d, stats,
+                                               static_cast<uint16_t>(i),
+                                               static_cast<uint16_t>(numFetchers)));
+        }
     }
 
     stats.memOverhead = sizeof(EventuallyPersistentStore);
@@ -385,6 +447,17 @@ EventuallyPersistentStore::EventuallyPersistentStore(EventuallyPersistentEngine
     config.addValueChangedListener("bg_fetch_delay",
                                    new EPStoreValueChangeListener(*this));
 
+    stats.bgFetchBatchSize.set(config.getBgFetchBatchSize());
+    config.addValueChangedListener("bg_fetch_batch_size",
+                                   new StatsValueChangeListener(stats));
+    stats.bgFetchLatencySLO.set(config.getBgFetchLatencySlo());
+    config.addValueChangedListener("bg_fetch_latency_slo",
+                                   new StatsValueChangeListener(stats));
+    stats.bgFetchMaxWindow.set(config.getBgFetchMaxWindow());
+    stats.bgFetchWindow.set(config.getBgFetchMaxWindow());
+    config.addValueChangedListener("bg_fetch_max_window",
+                                   new StatsValueChangeListener(stats));
+
     stats.warmupMemUsedCap.set(static_cast<double>(config.getWarmupMinMemoryThreshold()) / 100.0);
     config.addValueChangedListener("warmup_min_memory_threshold",
                                    new StatsValueChangeListener(stats));
@@ -538,6 +611,12 @@ EventuallyPersistentStore::~EventuallyPersistentStore() {
     dispatcher->schedule(shared_ptr<DispatcherCallback>(new StatSnap(&engine, true)),
                          NULL, Priority::StatSnapPriority, 0, false, true);
     dispatcher->stop(forceShutdown);
+    for (size_t i = 1; i < shards.size(); ++i) {
+        shards[i]->dispatcher->stop(forceShutdown);
+    }
+    for (size_t i = 1; i < bgFetchers.size(); ++i) {
+        bgFetchers[i]->getDispatcher()->stop(forceShutdown);
+    }
     if (hasSeparateRODispatcher()) {
         roDispatcher->stop(forceShutdown);
         delete roDispatcher;
@@ -550,8 +629,25 @@ EventuallyPersistentStore::~EventuallyPersistentStore() {
     }
     nonIODispatcher->stop(forceShutdown);
 
-    delete flusher;
-    delete bgFetcher;
+    std::vector<FlusherShard*>::iterator it = shards.begin();
+    for (; it != shards.end(); ++it) {
+        FlusherShard *shard = *it;
+        delete shard->flusher;
+        if (shard->id > 0) {
+            delete shard->dispatcher;
+            delete shard->store;
+        }
+        delete shard;
+    }
+    std::vector<BgFetcher*>::iterator bit = bgFetchers.begin();
+    for (; bit != bgFetchers.end(); ++bit) {
+        BgFetcher *bgFetcher = *bit;
+        if (bgFetcher->getId() > 0) {
+            delete bgFetcher->getDispatcher();
+            delete bgFetcher->getKVStore();
+        }
+        delete bgFetcher;
+    }
     delete dispatcher;
     delete nonIODispatcher;
     delete warmupTask;
@@ -559,9 +655,15 @@ EventuallyPersistentStore::~EventuallyPersistentStore() {
 
 void EventuallyPersistentStore::startDispatcher() {
     dispatcher->start();
+    for (size_t i = 1; i < shards.size(); ++i) {
+        shards[i]->dispatcher->start();
+    }
     if (hasSeparateRODispatcher()) {
         roDispatcher->start();
     }
+    for (size_t i = 1; i < bgFetchers.size(); ++i) {
+        bgFetchers[i]->getDispatcher()->start();
+    }
     if (hasSeparateAuxIODispatcher()) {
         auxIODispatcher->start();
     }
@@ -572,7 +674,7 @@ void EventuallyPersistentStore::startNonIODispatcher() {
 }
 
 const Flusher* EventuallyPersistentStore::getFlusher() {
-    return flusher;
+    return shards[0]->flusher;
 }
 
 Warmup* EventuallyPersistentStore::getWarmup(void) const {
@@ -581,48 +683,131 @@ Warmup* EventuallyPersistentStore::getWarmup(void) const {
 
 
 void EventuallyPersistentStore::startFlusher() {
-    flusher->start();
+    std::vector<FlusherShard*>::iterator it = shards.begin();
+    for (; it != shards.end(); ++it) {
+        (*it)->flusher->start();
+    }
 }
 
 void EventuallyPersistentStore::stopFlusher() {
-    bool rv = flusher->stop(engine.isForceShutdown());
-    if (rv && !engine.isForceShutdown()) {
-        flusher->wait();
+    // Let all the shards drain their queues in parallel before waiting.
+    std::vector<bool> stopped;
+    std::vector<FlusherShard*>::iterator it = shards.begin();
+    for (; it != shards.end(); ++it) {
+        stopped.push_back((*it)->flusher->stop(engine.isForceShutdown()));
+    }
+    if (!engine.isForceShutdown()) {
+        for (size_t i = 0; i < shards.size(); ++i) {
+            if (stopped[i]) {
+                shards[i]->flusher->wait();
+            }
+        }
     }
 }
 
 bool EventuallyPersistentStore::pauseFlusher() {
-    return flusher->pause();
+    bool rv = true;
+    std::vector<FlusherShard*>::iterator it = shards.begin();
+    for (; it != shards.end(); ++it) {
+        rv = (*it)->flusher->pause() && rv;
+    }
+    return rv;
 }
 
 bool EventuallyPersistentStore::resumeFlusher() {
-    return flusher->resume();
+    bool rv = true;
+    std::vector<FlusherShard*>::iterator it = shards.begin();
+    for (; it != shards.end(); ++it) {
+        rv = (*it)->flusher->resume() && rv;
+    }
+    return rv;
 }
 
 void EventuallyPersistentStore::wakeUpFlusher() {
-    if (stats.queue_size == 0 && stats.flusher_todo == 0) {
-        flusher->wake();
+    std::vector<FlusherShard*>::iterator it = shards.begin();
+    for (; it != shards.end(); ++it) {
+        if ((*it)->queueSize == 0 && (*it)->todo == 0) {
+            (*it)->flusher->wake();
+        }
     }
 }
 
+void EventuallyPersistentStore::addHighPriorityVBEntry(uint16_t vbid,
+                                                       uint64_t chkid,
+                                                       const void *cookie) {
+    getShard(vbid).flusher->addHighPriorityVBEntry(vbid, chkid, cookie);
+}
+
+size_t EventuallyPersistentStore::getNumOfHighPriorityVBs() {
+    size_t rv = 0;
+    std::vector<FlusherShard*>::iterator it = shards.begin();
+    for (; it != shards.end(); ++it) {
+        rv += (*it)->flusher->getNumOfHighPriorityVBs();
+    }
+    return rv;
+}
+
+size_t EventuallyPersistentStore::getCheckpointFlushTimeout() {
+    size_t rv = 0;
+    std::vector<FlusherShard*>::iterator it = shards.begin();
+    for (; it != shards.end(); ++it) {
+        rv = std::max(rv, (*it)->flusher->getCheckpointFlushTimeout());
+    }
+    return rv;
+}
+
+size_t EventuallyPersistentStore::getNumUncommittedItems() {
+    size_t rv = 0;
+    std::vector<FlusherShard*>::iterator it = shards.begin();
+    for (; it != shards.end(); ++it) {
+        rv += (*it)->tctx.getNumUncommittedItems();
+    }
+    return rv;
+}
+
+double EventuallyPersistentStore::getTransactionTimePerItem() {
+    uint64_t time = 0;
+    size_t items = 0;
+    std::vector<FlusherShard*>::iterator it = shards.begin();
+    for (; it != shards.end(); ++it) {
+        time += (*it)->tctx.getLastTransactionTime();
+        items += (*it)->tctx.getLastTransactionItems();
+    }
+    return items > 0 ? static_cast<double>(time) / static_cast<double>(items) : 0;
+}
+
+bool EventuallyPersistentStore::isFlushAllScheduled() {
+    std::vector<FlusherShard*>::iterator it = shards.begin();
+    for (; it != shards.end(); ++it) {
+        if ((*it)->flushAll) {
+            return true;
+        }
+    }
+    return false;
+}
+
 void EventuallyPersistentStore::startBgFetcher() {
-    if (multiBGFetchEnabled()) {
+    std::vector<BgFetcher*>::iterator it = bgFetchers.begin();
+    for (; it != bgFetchers.end(); ++it) {
         getLogger()->log(EXTENSION_LOG_INFO, NULL,
-                         "Starting bg fetcher for underlying storage\n");
-        bgFetcher->start();
+                         "Starting bg fetcher %d for underlying storage\n",
+                         (*it)->getId());
+        (*it)->start();
     }
 }
 
 void EventuallyPersistentStore::stopBgFetcher() {
-    if (multiBGFetchEnabled()) {
-        if (bgFetcher->pendingJob()) {
+    std::vector<BgFetcher*>::iterator it = bgFetchers.begin();
+    for (; it != bgFetchers.end(); ++it) {
+        if ((*it)->pendingJob()) {
             getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                              "Shutting down engine while there are "
                              "still pending data read from database storage\n");
         }
         getLogger()->log(EXTENSION_LOG_INFO, NULL,
-                         "Stopping bg fetcher for underlying storage\n");
-        bgFetcher->stop();
+                         "Stopping bg fetcher %d for underlying storage\n",
+                         (*it)->getId());
+        (*it)->stop();
     }
 }
 
@@ -880,12 +1065,17 @@ ENGINE_ERROR_CODE EventuallyPersistentStore::addTAPBackfillItem(const Item &itm,
 }
 
 
-void EventuallyPersistentStore::snapshotVBuckets(const Priority &priority) {
+void EventuallyPersistentStore::snapshotVBuckets(const Priority &priority,
+                                                 uint16_t shardId) {
 
     class VBucketStateVisitor : public VBucketVisitor {
     public:
-        VBucketStateVisitor(VBucketMap &vb_map) : vbuckets(vb_map) { }
+        VBucketStateVisitor(VBucketMap &vb_map, uint16_t shard, size_t nshards)
+            : vbuckets(vb_map), shardId(shard), numShards(nshards) { }
         bool visitBucket(RCPtr<VBucket> &vb) {
+            if (vb->getId() % numShards != shardId) {
+                return false;
+            }
             vbucket_state vb_state;
             vb_state.state = vb->getState();
             vb_state.checkpointId = vbuckets.getPersistenceCheckpointId(vb->getId());
@@ -902,22 +1092,27 @@ void EventuallyPersistentStore::snapshotVBuckets(const Priority &priority) {
 
     private:
         VBucketMap &vbuckets;
+        uint16_t shardId;
+        size_t numShards;
     };
 
+    // Every shard runs its own snapshot task for its vbuckets. Clearing
+    // the flag as each one starts ensures that a state change made after
+    // this point schedules new tasks for all the shards.
     if (priority == Priority::VBucketPersistHighPriority) {
         vbuckets.setHighPriorityVbSnapshotFlag(false);
         size_t numVBs = vbuckets.getSize();
-        for (size_t i = 0; i < numVBs; ++i) {
+        for (size_t i = shardId; i < numVBs; i += shards.size()) {
             vbuckets.setBucketCreation(static_cast<uint16_t>(i), false);
         }
     } else {
         vbuckets.setLowPriorityVbSnapshotFlag(false);
     }
 
-    VBucketStateVisitor v(vbuckets);
+    VBucketStateVisitor v(vbuckets, shardId, shards.size());
     visit(v);
     hrtime_t start = gethrtime();
-    if (!rwUnderlying->snapshotVBuckets(v.states)) {
+    if (!shards[shardId]->store->snapshotVBuckets(v.states)) {
         getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                          "VBucket snapshot task failed!!! Reschedule it...\n");
         scheduleVBSnapshot(priority);
@@ -970,8 +1165,13 @@ void EventuallyPersistentStore::scheduleVBSnapshot(const Priority &p) {
             return;
         }
     }
-    dispatcher->schedule(shared_ptr<DispatcherCallback>(new SnapshotVBucketsCallback(this, p)),
-                         NULL, p, 0, false);
+    std::vector<FlusherShard*>::iterator it = shards.begin();
+    for (; it != shards.end(); ++it) {
+        FlusherShard *shard = *it;
+        shared_ptr<DispatcherCallback> cb(new SnapshotVBucketsCallback(this, p,
+                                                                       shard->id));
+        shard->dispatcher->schedule(cb, NULL, p, 0, false);
+    }
 }
 
 vbucket_del_result
@@ -981,16 +1181,19 @@ EventuallyPersistentStore::completeVBucketDeletion(uint16_t vbid, bool recreate)
     RCPtr<VBucket> vb = vbuckets.getBucket(vbid);
     if (!vb || vb->getState() == vbucket_state_dead || vbuckets.isBucketDeletion(vbid)) {
         lh.unlock();
+        // This runs on the dispatcher of the shard owning the vbucket.
+        FlusherShard &shard = getShard(vbid);
         // Clean up the vbucket outgoing flush queue.
-        vb_flush_queue_t::iterator it = writingQueues.find(vbid);
-        if (it != writingQueues.end()) {
+        vb_flush_queue_t::iterator it = shard.writingQueues.find(vbid);
+        if (it != shard.writingQueues.end()) {
             std::queue<queued_item> &vb_queue = it->second;
             stats.flusher_todo.decr(vb_queue.size());
+            shard.todo.decr(vb_queue.size());
             stats.memOverhead.decr(sizeof(queued_item) * vb_queue.size());
             assert(stats.memOverhead.get() < GIGANTOR);
-            writingQueues.erase(vbid);
+            shard.writingQueues.erase(vbid);
         }
-        if (rwUnderlying->delVBucket(vbid, recreate)) {
+        if (shard.store->delVBucket(vbid, recreate)) {
             vbuckets.setBucketDeletion(vbid, false);
             mutationLog.deleteAll(vbid);
             // This is happening in an independent transaction, so
@@ -1019,9 +1222,9 @@ void EventuallyPersistentStore::scheduleVBDeletion(RCPtr<VBucket> &vb,
                                                                       stats,
                                                                       cookie,
                                                                       recreate));
-        dispatcher->schedule(cb,
-                             NULL, Priority::VBucketDeletionPriority,
-                             delay, false);
+        getShard(vb->getId()).dispatcher->schedule(cb,
+                                                   NULL, Priority::VBucketDeletionPriority,
+                                                   delay, false);
     }
 }
 
@@ -1244,7 +1447,7 @@ void EventuallyPersistentStore::bgFetch(const std::string &key,
 
         // schedule to the current batch of background fetch of the given vbucket
         VBucketBGFetchItem * fetchThis = new VBucketBGFetchItem(key, rowid, cookie);
-        vb->queueBGFetchItem(fetchThis, bgFetcher);
+        vb->queueBGFetchItem(fetchThis, getBgFetcher(vbucket));
         ss << "Queued a background fetch, now at "
            << vb->numPendingBGFetchItems() << std::endl;
         getLogger()->log(EXTENSION_LOG_DEBUG, NULL, "%s\n", ss.str().c_str());
@@ -1286,6 +1489,13 @@ GetValue EventuallyPersistentStore::getInternal(const std::string &key,
         }
     }
 
+    bool referenced(false);
+    Item *it = vb->ht.optimisticGet(key, vbucket, ep_real_time(),
+                                    trackReference, referenced);
+    if (it) {
+        return GetValue(it, ENGINE_SUCCESS, it->getId(), false, referenced);
+    }
+
     int bucket_num(0);
     LockHolder lh = vb->ht.getLockedBucket(key, &bucket_num);
     StoredValue *v = fetchValidValue(vb, key, bucket_num, false, trackReference);
@@ -1442,11 +1652,13 @@ GetValue EventuallyPersistentStore::getAndUpdateTtl(const std::string &key,
     StoredValue *v = fetchValidValue(vb, key, bucket_num);
 
     if (v) {
-        bool exptime_mutated = exptime != v->getExptime() ? true : false;
+        time_t previous = v->getExptime();
+        bool exptime_mutated = exptime != previous ? true : false;
         if (exptime_mutated) {
            v->markDirty();
         }
         v->setExptime(exptime);
+        v->indexExpiry(vb->ht, previous);
 
         if (v->isResident()) {
             if (exptime_mutated) {
@@ -1742,25 +1954,35 @@ void EventuallyPersistentStore::reset() {
             vb->resetStats();
         }
     }
-    if (diskFlushAll.cas(false, true)) {
-        // Increase the write queue size by 1 as flusher will execute flush_all as a single task.
-        stats.queue_size.set(incomingQueueSize() + 1);
+    size_t scheduled = 0;
+    std::vector<FlusherShard*>::iterator sit = shards.begin();
+    for (; sit != shards.end(); ++sit) {
+        if ((*sit)->flushAll.cas(false, true)) {
+            (*sit)->queueSize.set(incomingQueueSize((*sit)->id) + 1);
+            ++scheduled;
+        }
+    }
+    if (scheduled > 0) {
+        // Increase the write queue size by the number of flushers as each of
+        // them will execute flush_all as a single task.
+        stats.queue_size.set(incomingQueueSize() + scheduled);
     }
 }
 
-bool EventuallyPersistentStore::diskQueueEmpty() {
-    if (diskFlushAll) {
+bool EventuallyPersistentStore::diskQueueEmpty(uint16_t shardId) {
+    FlusherShard &shard = *shards[shardId];
+    if (shard.flushAll) {
         return false;
     }
 
     bool hasItems = false;
     size_t numOfVBuckets = vbuckets.getSize();
     assert(numOfVBuckets <= std::numeric_limits<uint16_t>::max());
-    for (size_t i = 0; i < numOfVBuckets; ++i) {
+    for (size_t i = shardId; i < numOfVBuckets; i += shards.size()) {
         uint16_t vbid = static_cast<uint16_t>(i);
         // Check the outgoing queue first.
-        vb_flush_queue_t::iterator iter = writingQueues.find(vbid);
-        if (iter != writingQueues.end() && !iter->second.empty()) {
+        vb_flush_queue_t::iterator iter = shard.writingQueues.find(vbid);
+        if (iter != shard.writingQueues.end() && !iter->second.empty()) {
             hasItems = true;
             break;
         }
@@ -1778,10 +2000,11 @@ bool EventuallyPersistentStore::diskQueueEmpty() {
     return !hasItems;
 }
 
-bool EventuallyPersistentStore::outgoingQueueEmpty() {
+bool EventuallyPersistentStore::outgoingQueueEmpty(uint16_t shardId) {
+    FlusherShard &shard = *shards[shardId];
     bool hasItems = false;
-    vb_flush_queue_t::iterator iter = writingQueues.begin();
-    for (; iter != writingQueues.end(); ++iter) {
+    vb_flush_queue_t::iterator iter = shard.writingQueues.begin();
+    for (; iter != shard.writingQueues.end(); ++iter) {
         if (!iter->second.empty()) {
             hasItems = true;
             break;
@@ -1790,15 +2013,17 @@ bool EventuallyPersistentStore::outgoingQueueEmpty() {
     return !hasItems;
 }
 
-vb_flush_queue_t* EventuallyPersistentStore::beginFlush() {
+vb_flush_queue_t* EventuallyPersistentStore::beginFlush(uint16_t shardId) {
+    FlusherShard &shard = *shards[shardId];
+    Flusher *flusher = shard.flusher;
     vb_flush_queue_t *rv(NULL);
 
-    if (diskQueueEmpty()) {
+    if (diskQueueEmpty(shardId)) {
         // If the persistence queue is empty, reset queue-related stats for each vbucket.
         bool schedule_vb_snapshot = false;
         size_t numOfVBuckets = vbuckets.getSize();
         assert(numOfVBuckets <= std::numeric_limits<uint16_t>::max());
-        for (size_t i = 0; i < numOfVBuckets; ++i) {
+        for (size_t i = shardId; i < numOfVBuckets; i += shards.size()) {
             uint16_t vbid = static_cast<uint16_t>(i);
             RCPtr<VBucket> vb = vbuckets.getBucket(vbid);
             if (vb) {
@@ -1850,21 +2075,24 @@ vb_flush_queue_t* EventuallyPersistentStore::beginFlush() {
             scheduleVBSnapshot(Priority::VBucketPersistHighPriority);
         }
     } else {
-        assert(rwUnderlying);
+        assert(shard.store);
 
         size_t num_items = 0;
         std::vector<queued_item> item_list;
-        item_list.reserve(getTxnSize());
+        item_list.reserve(shard.tctx.getTxnSize());
 
         const std::vector<int> vblist = vbuckets.getBuckets();
         std::vector<int>::const_iterator itr;
         for (itr = vblist.begin(); itr != vblist.end(); ++itr) {
             uint16_t vbid = static_cast<uint16_t>(*itr);
+            if (vbid % shards.size() != shardId) {
+                continue;
+            }
             RCPtr<VBucket> vb = vbuckets.getBucket(vbid);
 
             if (!vb) {
                 // Undefined vbucket..
-                writingQueues.erase(vbid);
+                shard.writingQueues.erase(vbid);
                 continue;
             }
 
@@ -1879,29 +2107,32 @@ vb_flush_queue_t* EventuallyPersistentStore::beginFlush() {
             // Get all dirty items from the checkpoint.
             vb->checkpointManager.getAllItemsForPersistence(item_list);
             if (item_list.size() > 0) {
-                num_items += pushToOutgoingQueue(item_list, vbid);
+                num_items += pushToOutgoingQueue(shard, item_list, vbid);
             }
         }
 
         size_t queue_size = incomingQueueSize();
-        stats.flusher_todo.set(num_items);
+        stats.flusher_todo.incr(num_items);
+        shard.todo.incr(num_items);
         stats.queue_size.set(queue_size);
+        shard.queueSize.set(incomingQueueSize(shardId));
         getLogger()->log(EXTENSION_LOG_DEBUG, NULL,
                          "Flushing %ld items with %ld still in queue\n",
                          num_items, queue_size);
-        rv = &writingQueues;
+        rv = &shard.writingQueues;
     }
     return rv;
 }
 
-size_t EventuallyPersistentStore::pushToOutgoingQueue(std::vector<queued_item> &items,
+size_t EventuallyPersistentStore::pushToOutgoingQueue(FlusherShard &shard,
+                                                      std::vector<queued_item> &items,
                                                       uint16_t vbid) {
     size_t num_items = 0;
-    rwUnderlying->optimizeWrites(items);
-    vb_flush_queue_t::iterator qit = writingQueues.find(vbid);
-    if (qit == writingQueues.end()) {
-        writingQueues.insert(std::make_pair(vbid, std::queue<queued_item>()));
-        qit = writingQueues.find(vbid);
+    shard.store->optimizeWrites(items);
+    vb_flush_queue_t::iterator qit = shard.writingQueues.find(vbid);
+    if (qit == shard.writingQueues.end()) {
+        shard.writingQueues.insert(std::make_pair(vbid, std::queue<queued_item>()));
+        qit = shard.writingQueues.find(vbid);
     }
 
     std::queue<queued_item> &writing = qit->second;
@@ -1924,26 +2155,34 @@ size_t EventuallyPersistentStore::pushToOutgoingQueue(std::vector<queued_item> &
     return num_items;
 }
 
-void EventuallyPersistentStore::completeFlush(rel_time_t flush_start) {
+void EventuallyPersistentStore::completeFlush(uint16_t shardId,
+                                              rel_time_t flush_start) {
     // Schedule the vbucket state snapshot task to record the latest checkpoint Id
     // that was successfully persisted for each vbucket.
     if (snapshotVBState) {
         scheduleVBSnapshot(Priority::VBucketPersistHighPriority);
     }
 
-    stats.flusher_todo.set(0);
+    // The outgoing queues of this shard are empty now.
+    FlusherShard &shard = *shards[shardId];
+    stats.flusher_todo.decr(shard.todo.get());
+    shard.todo.set(0);
     stats.queue_size.set(incomingQueueSize());
+    shard.queueSize.set(incomingQueueSize(shardId));
     rel_time_t complete_time = ep_current_time();
     stats.cumulativeFlushTime.incr(complete_time - flush_start);
 }
 
-int EventuallyPersistentStore::flushOutgoingQueue(vb_flush_queue_t *flushQueue,
+int EventuallyPersistentStore::flushOutgoingQueue(uint16_t shardId,
+                                                  vb_flush_queue_t *flushQueue,
                                                   size_t &flushPhase,
                                                   uint16_t &nextVbid) {
-    if (diskFlushAll) {
-        flushOneDeleteAll(); // Reset the database.
+    FlusherShard &shard = *shards[shardId];
+    if (shard.flushAll) {
+        flushOneDeleteAll(shard); // Reset the database.
     }
 
+    TransactionContext &tctx = shard.tctx;
     tctx.enter();
 
     int oldest = stats.min_data_age;
@@ -1955,13 +2194,13 @@ int EventuallyPersistentStore::flushOutgoingQueue(vb_flush_queue_t *flushQueue,
         uint16_t vbid = vit->first;
         std::queue<queued_item> &vb_queue = vit->second;
         // Interleave regular and high priority vbuckets.
-        size_t priority_vbs = flusher->getNumOfHighPriorityVBs();
+        size_t priority_vbs = shard.flusher->getNumOfHighPriorityVBs();
         if (flushPhase == 1 && priority_vbs != 0 && (iteration % priority_vbs) == 0) {
-            oldest = flushHighPriorityVBQueue(flushQueue, oldest);
+            oldest = flushHighPriorityVBQueue(shard, flushQueue, oldest);
         }
         RCPtr<VBucket> vb = getVBucket(vbid);
         completed += vb_queue.size();
-        oldest = flushVBQueue(vb, vb_queue, vbid, oldest);
+        oldest = flushVBQueue(shard, vb, vb_queue, vbid, oldest);
         if (!vb && vb_queue.empty()) {
             invalid_vbs.push_back(vbid);
         }
@@ -1992,10 +2231,12 @@ int EventuallyPersistentStore::flushOutgoingQueue(vb_flush_queue_t *flushQueue,
     return oldest;
 }
 
-int EventuallyPersistentStore::flushVBQueue(RCPtr<VBucket> &vb,
+int EventuallyPersistentStore::flushVBQueue(FlusherShard &shard,
+                                            RCPtr<VBucket> &vb,
                                             std::queue<queued_item> &vb_queue,
                                             uint16_t vbid,
                                             int data_age) {
+    Flusher *flusher = shard.flusher;
     int oldest = data_age;
 
     if (vb_queue.empty() || vbuckets.isBucketCreation(vbid)) {
@@ -2019,7 +2260,7 @@ int EventuallyPersistentStore::flushVBQueue(RCPtr<VBucket> &vb,
 
     std::queue<queued_item> rejectQueue;
     while (!vb_queue.empty()) {
-        int n = flushOne(vb_queue, rejectQueue, vb);
+        int n = flushOne(shard, vb_queue, rejectQueue, vb);
         if (n != 0 && n < oldest) {
             oldest = n;
         }
@@ -2042,6 +2283,7 @@ int EventuallyPersistentStore::flushVBQueue(RCPtr<VBucket> &vb,
             stats.memOverhead.incr(qsize * sizeof(queued_item));
             assert(stats.memOverhead.get() < GIGANTOR);
             stats.flusher_todo.incr(qsize);
+            shard.todo.incr(qsize);
         }
     }
 
@@ -2077,8 +2319,10 @@ int EventuallyPersistentStore::flushVBQueue(RCPtr<VBucket> &vb,
     return oldest;
 }
 
-int EventuallyPersistentStore::flushHighPriorityVBQueue(vb_flush_queue_t *flushQueue,
+int EventuallyPersistentStore::flushHighPriorityVBQueue(FlusherShard &shard,
+                                                        vb_flush_queue_t *flushQueue,
                                                         int data_age) {
+    TransactionContext &tctx = shard.tctx;
     int oldest = data_age;
     size_t num_items = 0;
 
@@ -2086,7 +2330,7 @@ int EventuallyPersistentStore::flushHighPriorityVBQueue(vb_flush_queue_t *flushQ
     tctx.enter();
 
     std::vector<uint16_t> vblist;
-    flusher->getAllHighPriorityVBuckets(vblist);
+    shard.flusher->getAllHighPriorityVBuckets(vblist);
     std::vector<uint16_t>::iterator it = vblist.begin();
     for (; it != vblist.end(); ++it) {
         uint16_t vbid = *it;
@@ -2098,7 +2342,7 @@ int EventuallyPersistentStore::flushHighPriorityVBQueue(vb_flush_queue_t *flushQ
         vb_flush_queue_t::iterator vit = flushQueue->find(vbid);
         if (vit != flushQueue->end()) {
             std::queue<queued_item> &vb_queue = vit->second;
-            oldest = flushVBQueue(vb, vb_queue, vbid, oldest);
+            oldest = flushVBQueue(shard, vb, vb_queue, vbid, oldest);
             // Don't grab any new dirty items from the vbucket incoming queue
             // if the new empty vbucket database isn't created on disk yet.
             if (vbuckets.isBucketCreation(vbid)) {
@@ -2112,7 +2356,7 @@ int EventuallyPersistentStore::flushHighPriorityVBQueue(vb_flush_queue_t *flushQ
                 // Get all dirty items from the checkpoint.
                 vb->checkpointManager.getAllItemsForPersistence(item_list);
                 if (item_list.size() > 0) {
-                    num_items += pushToOutgoingQueue(item_list, vbid);
+                    num_items += pushToOutgoingQueue(shard, item_list, vbid);
                 }
             }
         }
@@ -2127,7 +2371,13 @@ int EventuallyPersistentStore::flushHighPriorityVBQueue(vb_flush_queue_t *flushQ
         } else {
             stats.queue_size.set(0);
         }
+        if (shard.queueSize > num_items) {
+            shard.queueSize.decr(num_items);
+        } else {
+            shard.queueSize.set(0);
+        }
         stats.flusher_todo.incr(num_items);
+        shard.todo.incr(num_items);
     }
     return oldest;
 }
@@ -2146,6 +2396,20 @@ size_t EventuallyPersistentStore::incomingQueueSize(void) {
     return size;
 }
 
+size_t EventuallyPersistentStore::incomingQueueSize(uint16_t shardId) {
+    size_t size = 0;
+    size_t numOfVBuckets = vbuckets.getSize();
+    assert(numOfVBuckets <= std::numeric_limits<uint16_t>::max());
+    for (size_t i = shardId; i < numOfVBuckets; i += shards.size()) {
+        uint16_t vbid = static_cast<uint16_t>(i);
+        RCPtr<VBucket> vb = vbuckets.getBucket(vbid);
+        if (vb && (vb->getState() != vbucket_state_dead)) {
+            size += vb->checkpointManager.getNumItemsForPersistence() + vb->getBackfillSize();
+        }
+    }
+    return size;
+}
+
 /**
  * Callback invoked after persisting an item from memory to disk.
  *
@@ -2298,10 +2562,21 @@ private:
     DISALLOW_COPY_AND_ASSIGN(PersistenceCallback);
 };
 
-int EventuallyPersistentStore::flushOneDeleteAll() {
-    rwUnderlying->reset();
-    // Log a flush of every known vbucket.
+int EventuallyPersistentStore::flushOneDeleteAll(FlusherShard &shard) {
     std::vector<int> vbs(vbuckets.getBuckets());
+    if (shards.size() == 1) {
+        shard.store->reset();
+    } else {
+        // A KVStore reset wipes the files of all the vbuckets, including
+        // the ones the other shards are writing, so reset ours one by one.
+        for (std::vector<int>::iterator it(vbs.begin()); it != vbs.end(); ++it) {
+            uint16_t vbid = static_cast<uint16_t>(*it);
+            if (vbid % shards.size() == shard.id) {
+                shard.store->delVBucket(vbid, true);
+            }
+        }
+    }
+    // Log a flush of every known vbucket.
     for (std::vector<int>::iterator it(vbs.begin()); it != vbs.end(); ++it) {
         mutationLog.deleteAll(static_cast<uint16_t>(*it));
     }
@@ -2309,14 +2584,15 @@ int EventuallyPersistentStore::flushOneDeleteAll() {
     // go ahead and commit it out.
     mutationLog.commit1();
     mutationLog.commit2();
-    diskFlushAll.cas(true, false);
+    shard.flushAll.cas(true, false);
     return 1;
 }
 
 // While I actually know whether a delete or set was intended, I'm
 // still a bit better off running the older code that figures it out
 // based on what's in memory.
-int EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
+int EventuallyPersistentStore::flushOneDelOrSet(FlusherShard &shard,
+                                                const queued_item &qi,
                                                 std::queue<queued_item> &rejectQueue,
                                                 RCPtr<VBucket> &vb) {
 
@@ -2416,8 +2692,8 @@ int EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
             PersistenceCallback *cb;
             cb = new PersistenceCallback(qi, rejectQueue, this, &mutationLog,
                                          dirtied, &stats, itm.getCas());
-            tctx.addCallback(cb);
-            rwUnderlying->set(itm, *cb);
+            shard.tctx.addCallback(cb);
+            shard.store->set(itm, *cb);
             if (rowid == -1)  {
                 ++vb->opsCreate;
             } else {
@@ -2442,17 +2718,19 @@ int EventuallyPersistentStore::flushOneDelOrSet(const queued_item &qi,
             PersistenceCallback *cb;
             cb = new PersistenceCallback(qi, rejectQueue, this, &mutationLog,
                                          dirtied, &stats, 0);
-            tctx.addCallback(cb);
-            rwUnderlying->del(itm, rowid, *cb);
+            shard.tctx.addCallback(cb);
+            shard.store->del(itm, rowid, *cb);
         }
     }
 
     return ret;
 }
 
-int EventuallyPersistentStore::flushOne(std::queue<queued_item> &queue,
+int EventuallyPersistentStore::flushOne(FlusherShard &shard,
+                                        std::queue<queued_item> &queue,
                                         std::queue<queued_item> &rejectQueue,
                                         RCPtr<VBucket> &vb) {
+    TransactionContext &tctx = shard.tctx;
 
     queued_item qi = queue.front();
     queue.pop();
@@ -2465,7 +2743,7 @@ int EventuallyPersistentStore::flushOne(std::queue<queued_item> &queue,
     case queue_op_del:
         {
             size_t prevRejectCount = rejectQueue.size();
-            rv = flushOneDelOrSet(qi, rejectQueue, vb);
+            rv = flushOneDelOrSet(shard, qi, rejectQueue, vb);
             if (rejectQueue.size() == prevRejectCount) {
                 // flush operation was not rejected
                 tctx.addUncommittedItem(qi);
@@ -2483,6 +2761,7 @@ int EventuallyPersistentStore::flushOne(std::queue<queued_item> &queue,
         break;
     }
     stats.flusher_todo--;
+    shard.todo--;
 
     return rv;
 
@@ -2500,8 +2779,10 @@ void EventuallyPersistentStore::queueDirty(RCPtr<VBucket> &vb,
             bool rv = tapBackfill ?
                       vb->queueBackfillItem(itm) : vb->checkpointManager.queueDirty(itm, vb);
             if (rv) {
-                if (++stats.queue_size == 1 && stats.flusher_todo == 0) {
-                    flusher->wake();
+                ++stats.queue_size;
+                FlusherShard &shard = getShard(vbid);
+                if (++shard.queueSize == 1 && shard.todo == 0) {
+                    shard.flusher->wake();
                 }
                 ++stats.totalEnqueued;
                 vb->doStatsForQueueing(*itm, itm->size());
@@ -2794,6 +3075,7 @@ void TransactionContext::commit() {
     }
     mutationLog.commit2();
     ++stats.flusherCommits;
+    ++numCommits;
 
     std::list<PersistenceCallback*>::iterator iter;
     for (iter = transactionCallbacks.begin();
@@ -2807,8 +3089,8 @@ void TransactionContext::commit() {
     uint64_t commit_time = (end - start) / 1000000;
     uint64_t trans_time = (end - tranStartTime) / 1000000;
 
-    lastTranTimePerItem = numUncommittedItems > 0 ?
-        static_cast<double>(trans_time) / static_cast<double>(numUncommittedItems) : 0;
+    lastTranTime.set(trans_time);
+    lastTranItems.set(numUncommittedItems);
     stats.commit_time.set(commit_time);
     stats.cumulativeCommitTime.incr(commit_time);
     intxn = false;
@@ -122,8 +122,8 @@ class TransactionContext {
 public:
 
     TransactionContext(EPStats &st, KVStore *ks, MutationLog &log)
-        : stats(st), underlying(ks), mutationLog(log),
-          tranStartTime(0),intxn(false) {}
+        : stats(st), underlying(ks), mutationLog(log), numCommits(0),
+          lastTranTime(0), lastTranItems(0), tranStartTime(0), intxn(false) {}
 
     /**
      * Call this whenever entering a transaction.
@@ -159,10 +159,24 @@ public:
     }
 
     /**
-     * Return the last transaction time per item in millisecond.
+     * Get the number of transactions committed so far.
      */
-    double getTransactionTimePerItem() {
-        return lastTranTimePerItem;
+    size_t getNumCommits() {
+        return numCommits;
+    }
+
+    /**
+     * Return the duration of the last transaction in milliseconds.
+     */
+    uint64_t getLastTransactionTime() {
+        return lastTranTime;
+    }
+
+    /**
+     * Return the number of items committed by the last transaction.
+     */
+    size_t getLastTransactionItems() {
+        return lastTranItems;
     }
 
     void addCallback(PersistenceCallback *cb) {
@@ -175,12 +189,47 @@ private:
     MutationLog &mutationLog;
     Atomic<int> txnSize;
     Atomic<size_t> numUncommittedItems;
-    Atomic<double> lastTranTimePerItem;
+    Atomic<size_t> numCommits;
+    Atomic<uint64_t> lastTranTime;
+    Atomic<size_t> lastTranItems;
     hrtime_t tranStartTime;
     bool intxn;
     std::list<PersistenceCallback*> transactionCallbacks;
 };
 
+/**
+ * The persistence state of a disjoint subset of the vbuckets.
+ *
+ * A vbucket belongs to shard (vbid % number of shards). Every shard has
+ * its own flusher, dispatcher thread and read-write KVStore, and all the
+ * disk writes for its vbuckets (mutations, vbucket state snapshots and
+ * vbucket deletions) are run on that dispatcher, so a database file is
+ * only ever written through a single KVStore instance.
+ */
+struct FlusherShard {
+    FlusherShard(EPStats &st, uint16_t i, KVStore *kvstore, Dispatcher *d,
+                 MutationLog &log)
+        : id(i), store(kvstore), dispatcher(d), flusher(NULL),
+          tctx(st, kvstore, log), flushAll(false), queueSize(0), todo(0) { }
+
+    uint16_t id;
+    KVStore *store;
+    Dispatcher *dispatcher;
+    Flusher *flusher;
+
+    // The writing queue is used by the flusher thread of this shard to
+    // keep track of the objects it works on. It should _not_ be used by
+    // any other threads (because the flusher use it without locking...
+    vb_flush_queue_t writingQueues;
+    TransactionContext tctx;
+    // Set when a flush_all is pending for the vbuckets of this shard.
+    Atomic<bool> flushAll;
+    // Number of items in the incoming queues of the vbuckets of this shard.
+    Atomic<size_t> queueSize;
+    // Number of items in the writing queues.
+    Atomic<size_t> todo;
+};
+
 /**
  * VBucket visitor callback adaptor.
  */
@@ -198,6 +247,15 @@ public:
 
     bool callback(Dispatcher &d, TaskId &t);
 
+    /**
+     * The pagers, the resizer, the checkpoint remover and the memory
+     * backfills all walk the hash tables through adaptors, so only one
+     * of them walks at a time.
+     */
+    bool isExclusive() {
+        return true;
+    }
+
 private:
     std::queue<uint16_t>        vbList;
     EventuallyPersistentStore  *store;
@@ -536,7 +594,7 @@ public:
         return vbuckets.getPersistenceCheckpointId(vb);
     }
 
-    void snapshotVBuckets(const Priority &priority);
+    void snapshotVBuckets(const Priority &priority, uint16_t shardId);
     ENGINE_ERROR_CODE setVBucketState(uint16_t vbid, vbucket_state_t state);
 
     /**
@@ -574,23 +632,58 @@ public:
                     NULL, prio, 0, isDaemon);
     }
 
+    /**
+     * Get the number of updates permitted per transaction. Every
+     * flusher shard runs its own transactions of that size.
+     */
     int getTxnSize() {
-        return tctx.getTxnSize();
+        return shards[0]->tctx.getTxnSize();
     }
 
+    /**
+     * Set the number of updates permitted per transaction of every
+     * flusher shard.
+     */
     void setTxnSize(int to) {
-        tctx.setTxnSize(to);
+        std::vector<FlusherShard*>::iterator it = shards.begin();
+        for (; it != shards.end(); ++it) {
+            (*it)->tctx.setTxnSize(to);
+        }
     }
 
-    size_t getNumUncommittedItems() {
-        return tctx.getNumUncommittedItems();
+    size_t getNumUncommittedItems();
+    /**
+     * Get the time per item of the last transactions of all the
+     * flusher shards, in milliseconds.
+     */
+    double getTransactionTimePerItem();
+
+    const Flusher* getFlusher();
+
+    size_t getNumOfFlusherShards() const {
+        return shards.size();
     }
 
-    double getTransactionTimePerItem() {
-        return tctx.getTransactionTimePerItem();
+    FlusherShard* getFlusherShard(size_t shardId) {
+        return shards[shardId];
     }
 
-    const Flusher* getFlusher();
+    size_t getNumOfBgFetchers() const {
+        return bgFetchers.size();
+    }
+
+    BgFetcher* getBgFetcherById(size_t fetcherId) {
+        return bgFetchers[fetcherId];
+    }
+
+    /**
+     * Ask the flusher owning the given vbucket to notify the cookie
+     * once the given checkpoint is persisted.
+     */
+    void addHighPriorityVBEntry(uint16_t vbid, uint64_t chkid,
+                                const void *cookie);
+    size_t getNumOfHighPriorityVBs();
+    size_t getCheckpointFlushTimeout();
     Warmup* getWarmup(void) const;
 
     ENGINE_ERROR_CODE getKeyStats(const std::string &key, uint16_t vbucket,
@@ -663,9 +756,7 @@ public:
         return expiryPager.sleeptime;
     }
 
-    bool isFlushAllScheduled() {
-        return diskFlushAll.get();
-    }
+    bool isFlushAllScheduled();
 
     void setItemExpiryWindow(size_t value) {
         itemExpiryWindow = value;
@@ -787,30 +878,52 @@ private:
     }
 
     /**
-     * Return true if both incoming and outgoing queues are empty
+     * Get the flusher shard responsible for persisting the given vbucket.
+     */
+    FlusherShard &getShard(uint16_t vbid) {
+        return *shards[vbid % shards.size()];
+    }
+
+    /**
+     * Get the bg fetcher responsible for reading the given vbucket.
      */
-    bool diskQueueEmpty();
+    BgFetcher *getBgFetcher(uint16_t vbid) {
+        return bgFetchers[vbid % bgFetchers.size()];
+    }
+
+    /**
+     * Return true if both incoming and outgoing queues of the shard
+     * are empty
+     */
+    bool diskQueueEmpty(uint16_t shardId);
 
     /**
-     * Return true if the outgoing queues are empty
+     * Return true if the outgoing queues of the shard are empty
      */
-    bool outgoingQueueEmpty();
+    bool outgoingQueueEmpty(uint16_t shardId);
 
-    vb_flush_queue_t* beginFlush();
-    size_t pushToOutgoingQueue(std::vector<queued_item> &items, uint16_t vbid);
-    void completeFlush(rel_time_t flush_start);
+    vb_flush_queue_t* beginFlush(uint16_t shardId);
+    size_t pushToOutgoingQueue(FlusherShard &shard,
+                               std::vector<queued_item> &items,
+                               uint16_t vbid);
+    void completeFlush(uint16_t shardId, rel_time_t flush_start);
 
-    int flushOutgoingQueue(vb_flush_queue_t *queue,
+    int flushOutgoingQueue(uint16_t shardId,
+                           vb_flush_queue_t *queue,
                            size_t &flushPhase,
                            uint16_t &nextVbid);
-    int flushHighPriorityVBQueue(vb_flush_queue_t *queue, int data_age);
-    int flushVBQueue(RCPtr<VBucket> &vb, std::queue<queued_item> &vb_queue,
+    int flushHighPriorityVBQueue(FlusherShard &shard,
+                                 vb_flush_queue_t *queue, int data_age);
+    int flushVBQueue(FlusherShard &shard,
+                     RCPtr<VBucket> &vb, std::queue<queued_item> &vb_queue,
                      uint16_t vbid, int data_age);
-    int flushOne(std::queue<queued_item> &queue,
+    int flushOne(FlusherShard &shard,
+                 std::queue<queued_item> &queue,
                  std::queue<queued_item> &rejectQueue,
                  RCPtr<VBucket> &vb);
-    int flushOneDeleteAll(void);
-    int flushOneDelOrSet(const queued_item &qi,
+    int flushOneDeleteAll(FlusherShard &shard);
+    int flushOneDelOrSet(FlusherShard &shard,
+                         const queued_item &qi,
                          std::queue<queued_item> &rejectQueue,
                          RCPtr<VBucket> &vb);
 
@@ -819,6 +932,7 @@ private:
                                  bool trackReference=true, bool queueExpired=true);
 
     size_t incomingQueueSize(void);
+    size_t incomingQueueSize(uint16_t shardId);
 
     GetValue getInternal(const std::string &key, uint16_t vbucket,
                          const void *cookie, bool queueBG,
@@ -849,8 +963,8 @@ private:
     Dispatcher                     *roDispatcher;
     Dispatcher                     *auxIODispatcher;
     Dispatcher                     *nonIODispatcher;
-    Flusher                        *flusher;
-    BgFetcher                      *bgFetcher;
+    std::vector<FlusherShard*>      shards;
+    std::vector<BgFetcher*>         bgFetchers;
     Warmup                         *warmupTask;
     VBucketMap                      vbuckets;
     SyncObject                      mutex;
@@ -859,14 +973,7 @@ private:
     MutationLogCompactorConfig      mlogCompactorConfig;
     MutationLog                     accessLog;
 
-    // The writing queue is used by the flusher thread to keep
-    // track of the objects it works on. It should _not_ be used
-    // by any other threads (because the flusher use it without
-    // locking...
-    vb_flush_queue_t writingQueues;
     Atomic<size_t> bgFetchQueue;
-    Atomic<bool> diskFlushAll;
-    TransactionContext tctx;
     Mutex vbsetMutex;
     uint32_t bgFetchDelay;
     struct ExpiryPagerDelta {
@@ -86,6 +86,39 @@ static ENGINE_ERROR_CODE sendResponse(ADD_RESPONSE response, const void *key,
     return rv;
 }
 
+/**
+ * Respond with the value of the given item. When the core supports it
+ * the value is sent straight from the item's blob instead of being
+ * copied into the response buffer. The item is released either way.
+ */
+static ENGINE_ERROR_CODE sendItemResponse(SERVER_HANDLE_V1 *serverApi,
+                                          ADD_RESPONSE response,
+                                          const void *key, uint16_t keylen,
+                                          const void *ext, uint8_t extlen,
+                                          Item *itm, uint16_t status,
+                                          const void *cookie)
+{
+    if (serverApi->cookie->add_item_response != NULL) {
+        EventuallyPersistentEngine *e = ObjectRegistry::onSwitchThread(NULL, true);
+        bool sent = serverApi->cookie->add_item_response(cookie, itm, key, keylen,
+                                                         ext, extlen,
+                                                         PROTOCOL_BINARY_RAW_BYTES,
+                                                         status, itm->getCas());
+        ObjectRegistry::onSwitchThread(e);
+        if (sent) {
+            return ENGINE_SUCCESS;
+        }
+    }
+
+    ENGINE_ERROR_CODE rv = sendResponse(response, key, keylen, ext, extlen,
+                                        static_cast<const void *>(itm->getData()),
+                                        itm->getNBytes(),
+                                        PROTOCOL_BINARY_RAW_BYTES, status,
+                                        itm->getCas(), cookie);
+    delete itm;
+    return rv;
+}
+
 void LookupCallback::callback(GetValue &value) {
     if (value.getStatus() == ENGINE_SUCCESS) {
         engine->addLookupResult(cookie, value.getValue());
@@ -268,6 +301,9 @@ extern "C" {
                 e->getConfiguration().setTapThrottleQueueCap(v);
             } else if (strcmp(keyz, "tap_throttle_cap_pcnt") == 0) {
                 e->getConfiguration().setTapThrottleCapPcnt(v);
+            } else if (strcmp(keyz, "tap_backfill_buffer_size") == 0) {
+                validate(v, 1, std::numeric_limits<int>::max());
+                e->getConfiguration().setTapBackfillBufferSize(v);
             } else {
                 *msg = "Unknown config param";
                 rv = PROTOCOL_BINARY_RESPONSE_KEY_ENOENT;
@@ -345,6 +381,12 @@ extern "C" {
                 e->getConfiguration().setMaxTxnSize(v);
             } else if (strcmp(keyz, "bg_fetch_delay") == 0) {
                 e->getConfiguration().setBgFetchDelay(v);
+            } else if (strcmp(keyz, "bg_fetch_batch_size") == 0) {
+                e->getConfiguration().setBgFetchBatchSize(v);
+            } else if (strcmp(keyz, "bg_fetch_latency_slo") == 0) {
+                e->getConfiguration().setBgFetchLatencySlo(v);
+            } else if (strcmp(keyz, "bg_fetch_max_window") == 0) {
+                e->getConfiguration().setBgFetchMaxWindow(v);
             } else if (strcmp(keyz, "flushall_enabled") == 0) {
                 if (strcmp(valz, "true") == 0) {
                     e->getConfiguration().setFlushallEnabled(true);
@@ -432,6 +474,14 @@ extern "C" {
                 e->getConfiguration().setPagerActiveVbPcnt(v);
             } else if (strcmp(keyz, "pager_unbiased_period") == 0) {
                 e->getConfiguration().setPagerUnbiasedPeriod(v);
+            } else if (strcmp(keyz, "pager_eviction_policy") == 0) {
+                e->getConfiguration().setPagerEvictionPolicy(valz);
+            } else if (strcmp(keyz, "pager_sample_size") == 0) {
+                e->getConfiguration().setPagerSampleSize(v);
+            } else if (strcmp(keyz, "value_compression") == 0) {
+                e->getConfiguration().setValueCompression(strcmp(valz, "true") == 0);
+            } else if (strcmp(keyz, "value_compression_min_size") == 0) {
+                e->getConfiguration().setValueCompressionMinSize(v);
             } else {
                 *msg = "Unknown config param";
                 rv = PROTOCOL_BINARY_RESPONSE_KEY_ENOENT;
@@ -974,25 +1024,17 @@ extern "C" {
         // Send a special response for getl since we don't want to send the key
         if (itm && request->request.opcode == CMD_GET_LOCKED) {
             uint32_t flags = itm->getFlags();
-            rv = sendResponse(response, NULL, 0, (const void *)&flags, sizeof(uint32_t),
-                              static_cast<const void *>(itm->getData()),
-                              itm->getNBytes(),
-                              PROTOCOL_BINARY_RAW_BYTES,
-                              static_cast<uint16_t>(res), itm->getCas(),
-                              cookie);
-            delete itm;
+            rv = sendItemResponse(h->getServerApi(), response, NULL, 0,
+                                  (const void *)&flags, sizeof(uint32_t), itm,
+                                  static_cast<uint16_t>(res), cookie);
         } else if (itm) {
             const std::string &key  = itm->getKey();
             uint32_t flags = itm->getFlags();
-            rv = sendResponse(response, static_cast<const void *>(key.data()),
-                              itm->getNKey(),
-                              (const void *)&flags, sizeof(uint32_t),
-                              static_cast<const void *>(itm->getData()),
-                              itm->getNBytes(),
-                              PROTOCOL_BINARY_RAW_BYTES,
-                              static_cast<uint16_t>(res), itm->getCas(),
-                              cookie);
-            delete itm;
+            rv = sendItemResponse(h->getServerApi(), response,
+                                  static_cast<const void *>(key.data()),
+                                  itm->getNKey(),
+                                  (const void *)&flags, sizeof(uint32_t), itm,
+                                  static_cast<uint16_t>(res), cookie);
         } else {
             msg_size = (msg_size > 0 || msg == NULL) ? msg_size : strlen(msg);
             rv = sendResponse(response, NULL, 0, NULL, 0,
@@ -1056,6 +1098,15 @@ extern "C" {
         return tap_event;
     }
 
+    static int EvpTapBatchIterator(ENGINE_HANDLE* handle,
+                                   const void *cookie,
+                                   tap_event_info *events,
+                                   int nevents) {
+        int n = getHandle(handle)->walkTapQueue(cookie, events, nevents);
+        releaseHandle(handle);
+        return n;
+    }
+
     static TAP_ITERATOR EvpGetTapIterator(ENGINE_HANDLE* handle,
                                           const void* cookie,
                                           const void* client,
@@ -1078,6 +1129,26 @@ extern "C" {
         return iterator;
     }
 
+    static TAP_BATCH_ITERATOR EvpGetTapBatchIterator(ENGINE_HANDLE* handle,
+                                                     const void* cookie,
+                                                     const void* client,
+                                                     size_t nclient,
+                                                     uint32_t flags,
+                                                     const void* userdata,
+                                                     size_t nuserdata)
+    {
+        EventuallyPersistentEngine *h = getHandle(handle);
+        TAP_BATCH_ITERATOR iterator = NULL;
+        {
+            std::string c(static_cast<const char*>(client), nclient);
+            if (h->createTapQueue(cookie, c, flags, userdata, nuserdata)) {
+                iterator = EvpTapBatchIterator;
+            }
+        }
+        releaseHandle(handle);
+        return iterator;
+    }
+
     static void EvpHandleDisconnect(const void *cookie,
                                     ENGINE_EVENT_TYPE type,
                                     const void *event_data,
@@ -1185,7 +1256,7 @@ EventuallyPersistentEngine::EventuallyPersistentEngine(GET_SERVER_API get_server
     startedEngineThreads(false),
     getServerApiFunc(get_server_api), getlExtension(NULL),
     tapConnMap(NULL), tapConfig(NULL), checkpointConfig(NULL),
-    warmingUp(true),
+    slabAllocator(new SlabAllocator()), warmingUp(true),
     flushAllEnabled(false), startupTime(0)
 {
     interface.interface = 1;
@@ -1203,6 +1274,7 @@ EventuallyPersistentEngine::EventuallyPersistentEngine(GET_SERVER_API get_server
     ENGINE_HANDLE_V1::flush = EvpFlush;
     ENGINE_HANDLE_V1::unknown_command = EvpUnknownCommand;
     ENGINE_HANDLE_V1::get_tap_iterator = EvpGetTapIterator;
+    ENGINE_HANDLE_V1::get_tap_batch_iterator = EvpGetTapBatchIterator;
     ENGINE_HANDLE_V1::tap_notify = EvpTapNotify;
     ENGINE_HANDLE_V1::item_set_cas = EvpItemSetCas;
     ENGINE_HANDLE_V1::get_item_info = EvpGetItemInfo;
@@ -1299,6 +1371,12 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::initialize(const char* config) {
     // Start updating the variables from the config!
     HashTable::setDefaultNumBuckets(configuration.getHtSize());
     HashTable::setDefaultNumLocks(configuration.getHtLocks());
+    if (!HashTable::setDefaultLayout(configuration.getHtLayout().c_str())) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Unhandled hash table layout: %s",
+                         configuration.getHtLayout().c_str());
+    }
+    HashTable::setDefaultOptimisticReads(configuration.isHtOptimisticReads());
     std::string storedValType = configuration.getStoredValType();
     if (storedValType.length() > 0) {
         if (!HashTable::setDefaultStorageValueType(storedValType.c_str())) {
@@ -1420,6 +1498,10 @@ public:
         return std::string("Performing flush.");
     }
 
+    bool isExclusive() {
+        return true;
+    }
+
 private:
     EventuallyPersistentStore *epstore;
     TapConnMap                &tapConnMap;
@@ -1719,6 +1801,76 @@ tap_event_t EventuallyPersistentEngine::walkTapQueue(const void *cookie,
         return TAP_DISCONNECT;
     }
 
+    return walkTapQueue(cookie, connection, itm, es, nes, ttl, flags,
+                        seqno, vbucket);
+}
+
+int EventuallyPersistentEngine::walkTapQueue(const void *cookie,
+                                             tap_event_info *events,
+                                             int nevents) {
+    assert(nevents > 0);
+    TapProducer *connection = getTapProducer(cookie);
+    if (!connection) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Failed to lookup TAP connection.. Disconnecting\n");
+        memset(events, 0, sizeof(*events));
+        events[0].event = TAP_DISCONNECT;
+        return 1;
+    }
+
+    // The engine specific data of the events points into the connection
+    // and is overwritten by the next event, so keep a copy per event.
+    const size_t slot = std::max(static_cast<size_t>(TapEngineSpecific::sizeTotal),
+                                 sizeof(connection->opaqueCommandCode));
+    connection->batchSpecificData.resize(nevents * slot);
+
+    int n = 0;
+    while (n < nevents) {
+        tap_event_info &ev = events[n];
+        ev.event = walkTapQueue(cookie, connection, &ev.itm,
+                                &ev.engine_specific, &ev.nengine_specific,
+                                &ev.ttl, &ev.flags, &ev.seqno, &ev.vbucket);
+        if (ev.nengine_specific > 0) {
+            assert(ev.nengine_specific <= slot);
+            uint8_t *copy = &connection->batchSpecificData[n * slot];
+            memcpy(copy, ev.engine_specific, ev.nengine_specific);
+            ev.engine_specific = copy;
+        }
+        ++n;
+        if (ev.event == TAP_PAUSE || ev.event == TAP_DISCONNECT) {
+            break;
+        }
+
+        if (n < nevents && (ev.event == TAP_MUTATION || ev.event == TAP_DELETION ||
+                            ev.event == TAP_CHECKPOINT_START ||
+                            ev.event == TAP_CHECKPOINT_END)) {
+            // The connection level checks done for this item hold for the
+            // items queued behind it as well, so pop those in one go.
+            size_t popped = connection->getNextItems(cookie, events + n, nevents - n,
+                                                     &connection->batchSpecificData[n * slot],
+                                                     slot);
+            if (popped > 0) {
+                connection->lastMsgTime = ep_current_time();
+                n += popped;
+                if (events[n - 1].event == TAP_DISCONNECT) {
+                    break;
+                }
+            }
+        }
+    }
+
+    return n;
+}
+
+tap_event_t EventuallyPersistentEngine::walkTapQueue(const void *cookie,
+                                                     TapProducer *connection,
+                                                     item **itm,
+                                                     void **es,
+                                                     uint16_t *nes,
+                                                     uint8_t *ttl,
+                                                     uint16_t *flags,
+                                                     uint32_t *seqno,
+                                                     uint16_t *vbucket) {
     // Clear the notifySent flag and the paused flag to cause
     // the backend to schedule notification while we're figuring if
     // we've got data to send or not (to avoid race conditions)
@@ -2604,6 +2756,8 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                     cookie);
     add_casted_stat("ep_bg_remaining_jobs", epstats.numRemainingBgJobs,
                     add_stat, cookie);
+    add_casted_stat("ep_bg_fetch_window", epstats.bgFetchWindow,
+                    add_stat, cookie);
     add_casted_stat("ep_tap_bg_fetched", stats.numTapBGFetched, add_stat, cookie);
     add_casted_stat("ep_tap_bg_fetch_requeued", stats.numTapBGFetchRequeued,
                     add_stat, cookie);
@@ -2617,6 +2771,24 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                     cookie);
     add_casted_stat("ep_num_eject_failures", epstats.numFailedEjects, add_stat,
                     cookie);
+    add_casted_stat("ep_pager_items_scanned", epstats.pagerItemsScanned,
+                    add_stat, cookie);
+    add_casted_stat("ep_pager_hot_ejects", epstats.pagerHotEjects,
+                    add_stat, cookie);
+    add_casted_stat("ep_value_compressions", epstats.numValueCompressions,
+                    add_stat, cookie);
+    add_casted_stat("ep_value_compress_in_bytes", epstats.valueCompressInBytes,
+                    add_stat, cookie);
+    add_casted_stat("ep_value_compress_out_bytes", epstats.valueCompressOutBytes,
+                    add_stat, cookie);
+    if (epstats.valueCompressOutBytes > 0) {
+        add_casted_stat("ep_value_compression_ratio",
+                        static_cast<double>(epstats.valueCompressInBytes.get()) /
+                        static_cast<double>(epstats.valueCompressOutBytes.get()),
+                        add_stat, cookie);
+    }
+    add_casted_stat("ep_value_decompressions", epstats.numValueDecompressions,
+                    add_stat, cookie);
     add_casted_stat("ep_num_not_my_vbuckets", epstats.numNotMyVBuckets, add_stat,
                     cookie);
 
@@ -2634,6 +2806,9 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                     epstats.pendingOpsMaxDuration,
                     add_stat, cookie);
 
+    add_casted_stat("ep_ht_resize_max_pause", epstats.htResizeMaxPause,
+                    add_stat, cookie);
+
     if (epstats.vbucketDeletions > 0) {
         add_casted_stat("ep_vbucket_del_max_walltime",
                         epstats.vbucketDelMaxWalltime,
@@ -2726,10 +2901,10 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
     add_casted_stat("ep_num_ops_del_meta", epstats.numOpsDelMeta,
                     add_stat, cookie);
     add_casted_stat("ep_chk_persistence_timeout",
-                    epstore->getFlusher()->getCheckpointFlushTimeout(),
+                    epstore->getCheckpointFlushTimeout(),
                     add_stat, cookie);
     add_casted_stat("ep_chk_persistence_remains",
-                    epstore->getFlusher()->getNumOfHighPriorityVBs(),
+                    epstore->getNumOfHighPriorityVBs(),
                     add_stat, cookie);
 
     return ENGINE_SUCCESS;
@@ -2829,6 +3004,8 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doHashStats(const void *cookie,
             add_casted_stat(buf, depthVisitor.size, add_stat, cookie);
             snprintf(buf, sizeof(buf), "vb_%d:resized", vbid);
             add_casted_stat(buf, vb->ht.getNumResizes(), add_stat, cookie);
+            snprintf(buf, sizeof(buf), "vb_%d:resize_remaining", vbid);
+            add_casted_stat(buf, vb->ht.getResizeRemaining(), add_stat, cookie);
             snprintf(buf, sizeof(buf), "vb_%d:mem_size", vbid);
             add_casted_stat(buf, vb->ht.memSize, add_stat, cookie);
             snprintf(buf, sizeof(buf), "vb_%d:mem_size_counted", vbid);
@@ -3054,6 +3231,8 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doTapStats(const void *cookie,
     add_casted_stat("ep_tap_total_fetched", stats.numTapFetched, add_stat, cookie);
     add_casted_stat("ep_tap_bg_max_pending", tapConfig->getBgMaxPending(),
                     add_stat, cookie);
+    add_casted_stat("ep_tap_backfill_buffer_size",
+                    tapConfig->getBackfillBufferSize(), add_stat, cookie);
     add_casted_stat("ep_tap_bg_fetched", stats.numTapBGFetched, add_stat, cookie);
     add_casted_stat("ep_tap_bg_fetch_requeued", stats.numTapBGFetchRequeued,
                     add_stat, cookie);
@@ -3206,6 +3385,12 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doTimingStats(const void *cookie,
     // Misc
     add_casted_stat("notify_io", stats.notifyIOHisto, add_stat, cookie);
     add_casted_stat("batch_read", stats.getMultiHisto, add_stat, cookie);
+    add_casted_stat("bg_batch_size", stats.bgFetchBatchSizeHisto,
+                    add_stat, cookie);
+    add_casted_stat("bg_batch_wait", stats.bgFetchBatchWaitHisto,
+                    add_stat, cookie);
+    add_casted_stat("value_decompress", stats.valueDecompressHisto,
+                    add_stat, cookie);
 
     // Disk stats
     add_casted_stat("disk_insert", stats.diskInsertHisto, add_stat, cookie);
@@ -3252,6 +3437,10 @@ static void showJobLog(const char *prefix, const char *logname,
                  prefix, logname, static_cast<int>(i));
         add_casted_stat(statname, log[i].getDuration(),
                         add_stat, cookie);
+        snprintf(statname, sizeof(statname), "%s:%s:%d:queuedelay",
+                 prefix, logname, static_cast<int>(i));
+        add_casted_stat(statname, log[i].getQueueDelay(),
+                        add_stat, cookie);
     }
 }
 
@@ -3284,6 +3473,14 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doDispatcherStats(const void *cook
     DispatcherState ds(epstore->getDispatcher()->getDispatcherState());
     doDispatcherStat("dispatcher", ds, cookie, add_stat);
 
+    for (size_t i = 1; i < epstore->getNumOfFlusherShards(); ++i) {
+        FlusherShard *shard = epstore->getFlusherShard(i);
+        DispatcherState sds(shard->dispatcher->getDispatcherState());
+        char prefix[32];
+        snprintf(prefix, sizeof(prefix), "dispatcher_%d", static_cast<int>(i));
+        doDispatcherStat(prefix, sds, cookie, add_stat);
+    }
+
     if (epstore->hasSeparateRODispatcher()) {
         DispatcherState rods(epstore->getRODispatcher()->getDispatcherState());
         doDispatcherStat("ro_dispatcher", rods, cookie, add_stat);
@@ -3294,9 +3491,39 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doDispatcherStats(const void *cook
         doDispatcherStat("auxio_dispatcher", tapds, cookie, add_stat);
     }
 
-    DispatcherState nds(epstore->getNonIODispatcher()->getDispatcherState());
+    Dispatcher *nd = epstore->getNonIODispatcher();
+    DispatcherState nds(nd->getDispatcherState());
     doDispatcherStat("nio_dispatcher", nds, cookie, add_stat);
+    for (size_t i = 1; i < nd->getNumWorkers(); ++i) {
+        DispatcherState wds(nd->getDispatcherState(i));
+        char prefix[32];
+        snprintf(prefix, sizeof(prefix), "nio_dispatcher_worker_%d",
+                 static_cast<int>(i));
+        doDispatcherStat(prefix, wds, cookie, add_stat);
+    }
+
+    return ENGINE_SUCCESS;
+}
 
+ENGINE_ERROR_CODE EventuallyPersistentEngine::doFlusherStats(const void *cookie,
+                                                             ADD_STAT add_stat) {
+    char statname[80] = {0};
+    for (size_t i = 0; i < epstore->getNumOfFlusherShards(); ++i) {
+        FlusherShard *shard = epstore->getFlusherShard(i);
+        int id = static_cast<int>(i);
+        snprintf(statname, sizeof(statname), "shard_%d:state", id);
+        add_casted_stat(statname, shard->flusher->stateName(), add_stat, cookie);
+        snprintf(statname, sizeof(statname), "shard_%d:todo", id);
+        add_casted_stat(statname, shard->todo, add_stat, cookie);
+        snprintf(statname, sizeof(statname), "shard_%d:uncommitted_items", id);
+        add_casted_stat(statname, shard->tctx.getNumUncommittedItems(),
+                        add_stat, cookie);
+        snprintf(statname, sizeof(statname), "shard_%d:commit_num", id);
+        add_casted_stat(statname, shard->tctx.getNumCommits(), add_stat, cookie);
+        snprintf(statname, sizeof(statname), "shard_%d:chk_persistence_remains", id);
+        add_casted_stat(statname, shard->flusher->getNumOfHighPriorityVBs(),
+                        add_stat, cookie);
+    }
     return ENGINE_SUCCESS;
 }
 
@@ -3349,6 +3576,8 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::getStats(const void* cookie,
         rv = doTimingStats(cookie, add_stat);
     } else if (nkey == 10 && strncmp(stat_key, "dispatcher", 10) == 0) {
         rv = doDispatcherStats(cookie, add_stat);
+    } else if (nkey == 7 && strncmp(stat_key, "flusher", 7) == 0) {
+        rv = doFlusherStats(cookie, add_stat);
     } else if (nkey == 6 && strncmp(stat_key, "memory", 6) == 0) {
         rv = doMemoryStats(cookie, add_stat);
     } else if (nkey > 4 && strncmp(stat_key, "key ", 4) == 0) {
@@ -3383,11 +3612,35 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::getStats(const void* cookie,
         rv = doKeyStats(cookie, add_stat, vbucket_id, key, true);
     } else if (nkey == 9 && strncmp(stat_key, "kvtimings", 9) == 0) {
         getEpStore()->getROUnderlying()->addTimingStats("ro", add_stat, cookie);
+        for (size_t i = 1; i < getEpStore()->getNumOfBgFetchers(); ++i) {
+            std::stringstream prefix;
+            prefix << "ro_" << i;
+            getEpStore()->getBgFetcherById(i)->getKVStore()->addTimingStats(prefix.str(),
+                                                                           add_stat, cookie);
+        }
         getEpStore()->getRWUnderlying()->addTimingStats("rw", add_stat, cookie);
+        for (size_t i = 1; i < getEpStore()->getNumOfFlusherShards(); ++i) {
+            std::stringstream prefix;
+            prefix << "rw_" << i;
+            getEpStore()->getFlusherShard(i)->store->addTimingStats(prefix.str(),
+                                                                   add_stat, cookie);
+        }
         rv = ENGINE_SUCCESS;
     } else if (nkey == 7 && strncmp(stat_key, "kvstore", 7) == 0) {
         getEpStore()->getROUnderlying()->addStats("ro", add_stat, cookie);
+        for (size_t i = 1; i < getEpStore()->getNumOfBgFetchers(); ++i) {
+            std::stringstream prefix;
+            prefix << "ro_" << i;
+            getEpStore()->getBgFetcherById(i)->getKVStore()->addStats(prefix.str(),
+                                                                     add_stat, cookie);
+        }
         getEpStore()->getRWUnderlying()->addStats("rw", add_stat, cookie);
+        for (size_t i = 1; i < getEpStore()->getNumOfFlusherShards(); ++i) {
+            std::stringstream prefix;
+            prefix << "rw_" << i;
+            getEpStore()->getFlusherShard(i)->store->addStats(prefix.str(),
+                                                             add_stat, cookie);
+        }
         rv = ENGINE_SUCCESS;
     } else if (nkey == 6 && strncmp(stat_key, "warmup", 6) == 0) {
         epstore->getWarmup()->addStats(add_stat, cookie);
@@ -3563,15 +3816,13 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::touch(const void *cookie,
             rv = sendResponse(response, NULL, 0, NULL, 0, NULL, 0,
                               PROTOCOL_BINARY_RAW_BYTES,
                               PROTOCOL_BINARY_RESPONSE_SUCCESS, 0, cookie);
+            delete it;
         } else {
             uint32_t flags = it->getFlags();
-            rv = sendResponse(response, NULL, 0, &flags, sizeof(flags),
-                              it->getData(), it->getNBytes(),
-                              PROTOCOL_BINARY_RAW_BYTES,
-                              PROTOCOL_BINARY_RESPONSE_SUCCESS, it->getCas(),
-                              cookie);
+            rv = sendItemResponse(serverApi, response, NULL, 0,
+                                  &flags, sizeof(flags), it,
+                                  PROTOCOL_BINARY_RESPONSE_SUCCESS, cookie);
         }
-        delete it;
     } else if (rv == ENGINE_KEY_ENOENT) {
         if (isDegradedMode()) {
             std::string msg("Temporary Failure");
@@ -3719,8 +3970,7 @@ EventuallyPersistentEngine::handleCheckpointCmds(const void *cookie,
                     uint16_t persisted_chk_id =
                         epstore->getVBuckets().getPersistenceCheckpointId(vbucket);
                     if (chk_id > persisted_chk_id) {
-                        Flusher *flusher = const_cast<Flusher *>(epstore->getFlusher());
-                        flusher->addHighPriorityVBEntry(vbucket, chk_id, cookie);
+                        epstore->addHighPriorityVBEntry(vbucket, chk_id, cookie);
                         storeEngineSpecific(cookie, this);
                         return ENGINE_EWOULDBLOCK;
                     }
@@ -24,6 +24,7 @@
 #include "tapconnection.hh"
 #include "tapthrottle.hh"
 #include "configuration.hh"
+#include "slab_allocator.hh"
 
 extern "C" {
     EXPORT_FUNCTION
@@ -385,6 +386,14 @@ public:
                              uint16_t *nes, uint8_t *ttl, uint16_t *flags,
                              uint32_t *seqno, uint16_t *vbucket);
 
+    /**
+     * Fetch up to nevents tap events at once. The fetching stops
+     * after a TAP_PAUSE or TAP_DISCONNECT event.
+     *
+     * @return the number of events fetched (at least one)
+     */
+    int walkTapQueue(const void *cookie, tap_event_info *events, int nevents);
+
     bool createTapQueue(const void *cookie,
                         std::string &client,
                         uint32_t flags,
@@ -550,6 +559,7 @@ public:
         delete kvstore;
         delete tapThrottle;
         delete getlExtension;
+        releaseSlabAllocator();
     }
 
     engine_info *getInfo() {
@@ -560,6 +570,10 @@ public:
         return stats;
     }
 
+    SlabAllocator *getSlabAllocator() {
+        return slabAllocator;
+    }
+
     EventuallyPersistentStore* getEpStore() { return epstore; }
 
     TapConnMap &getTapConnMap() { return *tapConnMap; }
@@ -647,6 +661,11 @@ private:
                                uint32_t *seqno, uint16_t *vbucket,
                                TapProducer *c, bool &retry);
 
+    tap_event_t walkTapQueue(const void *cookie, TapProducer *connection,
+                             item **itm, void **es, uint16_t *nes,
+                             uint8_t *ttl, uint16_t *flags, uint32_t *seqno,
+                             uint16_t *vbucket);
+
     ENGINE_ERROR_CODE processTapAck(const void *cookie,
                                     uint32_t seqno,
                                     uint16_t status,
@@ -706,6 +725,13 @@ private:
         }
     }
 
+    void releaseSlabAllocator(void) {
+        // Items still referenced elsewhere live in its slabs, so it
+        // goes away with the last of them.
+        slabAllocator->release();
+        slabAllocator = NULL;
+    }
+
 
     bool dbAccess(void) {
         bool ret = true;
@@ -740,6 +766,7 @@ private:
                                     const char *sep, size_t nsep);
     ENGINE_ERROR_CODE doTimingStats(const void *cookie, ADD_STAT add_stat);
     ENGINE_ERROR_CODE doDispatcherStats(const void *cookie, ADD_STAT add_stat);
+    ENGINE_ERROR_CODE doFlusherStats(const void *cookie, ADD_STAT add_stat);
     ENGINE_ERROR_CODE doKeyStats(const void *cookie, ADD_STAT add_stat,
                                  uint16_t vbid, std::string &key, bool validate=false);
 
@@ -811,6 +838,7 @@ private:
     size_t getlDefaultTimeout;
     size_t getlMaxTimeout;
     EPStats stats;
+    SlabAllocator *slabAllocator;
     Configuration configuration;
     Atomic<bool> warmingUp;
     Atomic<bool> trafficEnabled;
@@ -60,7 +60,9 @@ static bool validTransition(enum flusher_state from,
 
     switch (from) {
     case initializing:
-        return (to == running);
+        // A flusher shard may not have been scheduled yet when
+        // persistence is stopped.
+        return (to == running || to == pausing);
     case running:
         return (to == pausing);
     case pausing:
@@ -201,20 +203,20 @@ bool Flusher::step(Dispatcher &d, TaskId &tid) {
 }
 
 void Flusher::completeFlush() {
-    while (!store->diskQueueEmpty()) {
+    while (!store->diskQueueEmpty(shardId)) {
         doFlush();
     }
 }
 
 double Flusher::computeMinSleepTime() {
-    if (!store->outgoingQueueEmpty()) {
+    if (!store->outgoingQueueEmpty(shardId)) {
         flushRv = 0;
         prevFlushRv = 0;
         return 0.0;
     }
 
     if (flushRv + prevFlushRv == 0) {
-        if (!store->diskQueueEmpty()) {
+        if (!store->diskQueueEmpty(shardId)) {
             return 0.0;
         }
         minSleepTime = std::min(minSleepTime * 2, 1.0);
@@ -230,7 +232,7 @@ int Flusher::doFlush() {
     // On a fresh entry, flushQueue is null and we need to build one.
     if (!flushQueue) {
         flushRv = store->stats.min_data_age;
-        flushQueue = store->beginFlush();
+        flushQueue = store->beginFlush(shardId);
         if (flushQueue) {
             getLogger()->log(EXTENSION_LOG_DEBUG, NULL,
                              "Beginning a write queue flush.\n");
@@ -242,14 +244,15 @@ int Flusher::doFlush() {
 
     // Now do the every pass thing.
     if (flushQueue) {
-        int n = store->flushOutgoingQueue(flushQueue, flushPhase, nextVbid);
+        int n = store->flushOutgoingQueue(shardId, flushQueue, flushPhase,
+                                          nextVbid);
         if (_state == pausing) {
             transition_state(paused);
         }
         flushRv = std::min(n, flushRv);
 
-        if (store->outgoingQueueEmpty()) {
-            store->completeFlush(flushStart);
+        if (store->outgoingQueueEmpty(shardId)) {
+            store->completeFlush(shardId, flushStart);
             getLogger()->log(EXTENSION_LOG_INFO, NULL,
                              "Completed a flush, age of oldest item was %ds\n",
                              flushRv);
@@ -56,13 +56,14 @@ struct HighPriorityVBEntry {
 };
 
 /**
- * Manage persistence of data for an EventuallyPersistentStore.
+ * Manage persistence of data for one flusher shard of an
+ * EventuallyPersistentStore.
  */
 class Flusher {
 public:
 
-    Flusher(EventuallyPersistentStore *st, Dispatcher *d) :
-        store(st), _state(initializing), dispatcher(d),
+    Flusher(EventuallyPersistentStore *st, Dispatcher *d, uint16_t shard = 0) :
+        store(st), _state(initializing), dispatcher(d), shardId(shard),
         flushRv(0), prevFlushRv(0), minSleepTime(0.1),
         flushQueue(NULL),
         forceShutdownReceived(false), flushPhase(0), nextVbid(0),
@@ -115,6 +116,7 @@ private:
     Mutex                        taskMutex;
     TaskId                       task;
     Dispatcher                  *dispatcher;
+    uint16_t                     shardId;
 
     // Current flush cycle state.
     int                      flushRv;
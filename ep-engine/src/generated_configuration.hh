@@ -7,14 +7,22 @@
     void setAlogBlockSize(const size_t &nval);
     std::string getAlogPath() const;
     void setAlogPath(const std::string &nval);
+    size_t getAlogReaderThreads() const;
+    void setAlogReaderThreads(const size_t &nval);
     size_t getAlogSleepTime() const;
     void setAlogSleepTime(const size_t &nval);
     size_t getAlogTaskTime() const;
     void setAlogTaskTime(const size_t &nval);
     std::string getBackend() const;
     void setBackend(const std::string &nval);
+    size_t getBgFetchBatchSize() const;
+    void setBgFetchBatchSize(const size_t &nval);
     size_t getBgFetchDelay() const;
     void setBgFetchDelay(const size_t &nval);
+    size_t getBgFetchLatencySlo() const;
+    void setBgFetchLatencySlo(const size_t &nval);
+    size_t getBgFetchMaxWindow() const;
+    void setBgFetchMaxWindow(const size_t &nval);
     size_t getChkMaxItems() const;
     void setChkMaxItems(const size_t &nval);
     size_t getChkPeriod() const;
@@ -27,10 +35,28 @@
     void setConfigFile(const std::string &nval);
     std::string getCouchBucket() const;
     void setCouchBucket(const std::string &nval);
+    size_t getCouchDbCacheSize() const;
+    void setCouchDbCacheSize(const size_t &nval);
+    bool isCouchDirectIo() const;
+    void setCouchDirectIo(const bool &nval);
+    bool isCouchGroupCommit() const;
+    void setCouchGroupCommit(const bool &nval);
+    size_t getCouchGroupMaxDocs() const;
+    void setCouchGroupMaxDocs(const size_t &nval);
+    size_t getCouchGroupWindow() const;
+    void setCouchGroupWindow(const size_t &nval);
     std::string getCouchHost() const;
     void setCouchHost(const std::string &nval);
+    size_t getCouchMaxReadahead() const;
+    void setCouchMaxReadahead(const size_t &nval);
+    size_t getCouchNodeCacheSize() const;
+    void setCouchNodeCacheSize(const size_t &nval);
     size_t getCouchPort() const;
     void setCouchPort(const size_t &nval);
+    size_t getCouchReadBlockSize() const;
+    void setCouchReadBlockSize(const size_t &nval);
+    size_t getCouchReadBufferPoolSize() const;
+    void setCouchReadBufferPoolSize(const size_t &nval);
     size_t getCouchReconnectSleeptime() const;
     void setCouchReconnectSleeptime(const size_t &nval);
     size_t getCouchResponseTimeout() const;
@@ -51,8 +77,12 @@
     void setGetlDefaultTimeout(const size_t &nval);
     size_t getGetlMaxTimeout() const;
     void setGetlMaxTimeout(const size_t &nval);
+    std::string getHtLayout() const;
+    void setHtLayout(const std::string &nval);
     size_t getHtLocks() const;
     void setHtLocks(const size_t &nval);
+    bool isHtOptimisticReads() const;
+    void setHtOptimisticReads(const bool &nval);
     size_t getHtSize() const;
     void setHtSize(const size_t &nval);
     bool isInconsistentSlaveChk() const;
@@ -83,6 +113,12 @@
     void setMaxCheckpoints(const size_t &nval);
     size_t getMaxItemSize() const;
     void setMaxItemSize(const size_t &nval);
+    size_t getMaxNumBgfetchers() const;
+    void setMaxNumBgfetchers(const size_t &nval);
+    size_t getMaxNumFlushers() const;
+    void setMaxNumFlushers(const size_t &nval);
+    size_t getMaxNumNonioWorkers() const;
+    void setMaxNumNonioWorkers(const size_t &nval);
     size_t getMaxSize() const;
     void setMaxSize(const size_t &nval);
     size_t getMaxTxnSize() const;
@@ -99,6 +135,10 @@
     void setMutationMemThreshold(const size_t &nval);
     size_t getPagerActiveVbPcnt() const;
     void setPagerActiveVbPcnt(const size_t &nval);
+    std::string getPagerEvictionPolicy() const;
+    void setPagerEvictionPolicy(const std::string &nval);
+    size_t getPagerSampleSize() const;
+    void setPagerSampleSize(const size_t &nval);
     size_t getPagerUnbiasedPeriod() const;
     void setPagerUnbiasedPeriod(const size_t &nval);
     std::string getPostInitfile() const;
@@ -115,6 +155,8 @@
     void setTapAckInterval(const size_t &nval);
     size_t getTapAckWindowSize() const;
     void setTapAckWindowSize(const size_t &nval);
+    size_t getTapBackfillBufferSize() const;
+    void setTapBackfillBufferSize(const size_t &nval);
     float getTapBackfillResident() const;
     void setTapBackfillResident(const float &nval);
     size_t getTapBacklogLimit() const;
@@ -135,6 +177,10 @@
     void setTapThrottleQueueCap(const ssize_t &nval);
     size_t getTapThrottleThreshold() const;
     void setTapThrottleThreshold(const size_t &nval);
+    bool isValueCompression() const;
+    void setValueCompression(const bool &nval);
+    size_t getValueCompressionMinSize() const;
+    void setValueCompressionMinSize(const size_t &nval);
     bool isVb0() const;
     void setVb0(const bool &nval);
     bool isWaitforwarmup() const;
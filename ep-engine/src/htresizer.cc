@@ -7,6 +7,8 @@
 #include "stored-value.hh"
 
 static const double FREQUENCY(60.0);
+static const double MIGRATION_FREQUENCY(1.0);
+static const size_t MIGRATION_BATCH(65536);
 
 /**
  * Look at all the hash tables and make sure they're sized appropriately.
@@ -14,19 +16,27 @@ static const double FREQUENCY(60.0);
 class ResizingVisitor : public VBucketVisitor {
 public:
 
-    ResizingVisitor() { }
+    ResizingVisitor(shared_ptr<Atomic<size_t> > r) : resizing(r) { }
 
     bool visitBucket(RCPtr<VBucket> &vb) {
         vb->ht.resize();
+        vb->ht.migrate(MIGRATION_BATCH);
+        if (vb->ht.isResizing()) {
+            ++(*resizing);
+        }
         return false;
     }
 
+private:
+    shared_ptr<Atomic<size_t> > resizing;
 };
 
 bool HashtableResizer::callback(Dispatcher &d, TaskId &t) {
-    shared_ptr<ResizingVisitor> pv(new ResizingVisitor);
+    // Keep migrating often while the last pass left tables being resized.
+    bool migrating = resizing->swap(0) > 0;
+    shared_ptr<ResizingVisitor> pv(new ResizingVisitor(resizing));
     store->visit(pv, "Hashtable resizer", &d, Priority::ItemPagerPriority);
 
-    d.snooze(t, FREQUENCY);
+    d.snooze(t, migrating ? MIGRATION_FREQUENCY : FREQUENCY);
     return true;
 }
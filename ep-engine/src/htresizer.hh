@@ -4,6 +4,7 @@
 
 #include "config.h"
 
+#include "atomic.hh"
 #include "dispatcher.hh"
 
 class EventuallyPersistentStore;
@@ -15,7 +16,8 @@ class EventuallyPersistentStore;
 class HashtableResizer : public DispatcherCallback {
 public:
 
-    HashtableResizer(EventuallyPersistentStore *s) : store(s) {}
+    HashtableResizer(EventuallyPersistentStore *s)
+        : store(s), resizing(new Atomic<size_t>) {}
 
     bool callback(Dispatcher &d, TaskId &t);
 
@@ -25,6 +27,8 @@ public:
 
 private:
     EventuallyPersistentStore *store;
+    //! The number of hash tables left being resized by the last pass.
+    shared_ptr<Atomic<size_t> > resizing;
 };
 
 #endif // HTRESIZER_HH
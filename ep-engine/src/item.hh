@@ -32,7 +32,7 @@ public:
      */
     static Blob* New(const char *start, const size_t len) {
         size_t total_len = len + sizeof(Blob);
-        Blob *t = new (::operator new(total_len)) Blob(start, len);
+        Blob *t = new (ObjectRegistry::allocate(total_len)) Blob(start, len);
         assert(t->length() == len);
         return t;
     }
@@ -57,7 +57,7 @@ public:
      */
     static Blob* New(const size_t len) {
         size_t total_len = len + sizeof(Blob);
-        Blob *t = new (::operator new(total_len)) Blob(len);
+        Blob *t = new (ObjectRegistry::allocate(total_len)) Blob(len);
         assert(t->length() == len);
         return t;
     }
@@ -95,7 +95,7 @@ public:
     // This is necessary for making C++ happy when I'm doing a
     // placement new on fairly "normal" c++ heap allocations, just
     // with variable-sized objects.
-    void operator delete(void* p) { ::operator delete(p); }
+    void operator delete(void* p) { ObjectRegistry::deallocate(p); }
 
     ~Blob() {
         ObjectRegistry::onDeleteBlob(this);
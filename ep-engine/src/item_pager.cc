@@ -3,6 +3,8 @@
 #include "config.h"
 #include <iostream>
 #include <cstdlib>
+#include <cmath>
+#include <algorithm>
 #include <utility>
 #include <list>
 
@@ -16,11 +18,29 @@ static const size_t MAX_PERSISTENCE_QUEUE_SIZE = 1000000;
 
 const bool PagingConfig::phaseConfig[paging_max] = {false, true};
 
+/**
+ * Order sampled items from the least to the most recently accessed.
+ */
+class ColderThan {
+public:
+    ColderThan(bool nru) : useNru(nru) {}
+
+    bool operator()(StoredValue *a, StoredValue *b) const {
+        if (a->getAccessFrequency() != b->getAccessFrequency()) {
+            return a->getAccessFrequency() < b->getAccessFrequency();
+        }
+        return useNru && !a->isReferenced() && b->isReferenced();
+    }
+
+private:
+    bool useNru;
+};
+
 /**
  * As part of the ItemPager, visit all of the objects in memory and
  * eject some within a constrained probability
  */
-class PagingVisitor : public VBucketVisitor {
+class PagingVisitor : public VBucketVisitor, public HashTableSampleVisitor {
 public:
 
     /**
@@ -34,13 +54,18 @@ public:
      * @param sfin pointer to a bool to be set to true after run completes
      * @param pause flag indicating if PagingVisitor can pause between vbucket visits
      * @param nru false if ignoring reference bits
+     * @param sample the number of items to compare at a time, 0 to
+     *               visit all of the items instead
      */
     PagingVisitor(EventuallyPersistentStore &s, EPStats &st, double pcnt,
-                  bool *sfin, bool pause = false, double bias = 1, bool nru = true)
+                  bool *sfin, bool pause = false, double bias = 1, bool nru = true,
+                  size_t sample = 0)
       : store(s), stats(st), randomEvict(PagingConfig::phaseConfig[0]), percent(pcnt),
         activeBias(bias), ejected(0), totalEjected(0), totalEjectionAttempts(0),
-        startTime(ep_real_time()), stateFinalizer(sfin), canPause(pause),
-        useNru(nru) {}
+        scanned(0), hotEjected(0), startTime(ep_real_time()), stateFinalizer(sfin),
+        canPause(pause), useNru(nru), sampleSize(sample), currentLock(-1),
+        lockTarget(0), lockBudget(0), lockEjected(0), lockScanned(0),
+        compressMinSize(0) {}
 
     void visit(StoredValue *v) {
         // Remember expired objects -- we're going to delete them.
@@ -49,37 +74,59 @@ public:
             return;
         }
 
-        // return if not ItemPager, which uses valid eviction percentage
-        if (percent <= 0) {
-            return;
-        }
+        ++scanned;
 
         // always evict unreferenced items, or randomly evict referenced item
         double r = randomEvict == false ?
             1 : static_cast<double>(std::rand()) / static_cast<double>(RAND_MAX);
         if ((useNru && !v->isReferenced()) || percent >= r) {
-            ++totalEjectionAttempts;
-            if (!v->eligibleForEviction()) {
-                ++stats.numFailedEjects;
-                return;
+            evict(v);
+        }
+    }
+
+    bool visitSample(int lock, std::vector<StoredValue*> &sample) {
+        if (lock != currentLock) {
+            currentLock = lock;
+            lockEjected = 0;
+            lockScanned = 0;
+        }
+
+        std::vector<StoredValue*> candidates;
+        std::vector<StoredValue*>::iterator it;
+        for (it = sample.begin(); it != sample.end(); ++it) {
+            StoredValue *v = *it;
+            if ((v->isExpired(startTime) && !v->isDeleted()) || v->isTempItem()) {
+                expired.push_back(std::make_pair(currentBucket->getId(),
+                                                 v->getKey()));
+            } else if (v->isResident() && !v->isDeleted()) {
+                candidates.push_back(v);
             }
-            // Check if the key was already visited by all the cursors.
-            bool can_evict =
-                currentBucket->checkpointManager.eligibleForEviction(v->getKey());
-            if (can_evict && v->ejectValue(stats, currentBucket->ht)) {
-                ++ejected;
+        }
+        scanned += sample.size();
+        lockScanned += sample.size();
+
+        // Evict all of the items not accessed since they were last
+        // sampled, or else the least frequently accessed one.  The
+        // others age, so that the items accessed long ago become cold.
+        std::sort(candidates.begin(), candidates.end(), ColderThan(useNru));
+        bool evicted = false;
+        for (it = candidates.begin(); it != candidates.end(); ++it) {
+            StoredValue *v = *it;
+            if (lockEjected < lockTarget &&
+                (v->getAccessFrequency() == 0 || !evicted) && evict(v)) {
+                evicted = true;
+                ++lockEjected;
+            } else {
+                v->decayAccessFrequency();
             }
         }
+
+        return lockEjected < lockTarget && lockScanned < lockBudget;
     }
 
     bool visitBucket(RCPtr<VBucket> &vb) {
         update();
 
-        // fast path for expiry item pager
-        if (percent <= 0 ) {
-            return VBucketVisitor::visitBucket(vb);;
-        }
-
         // skip active vbuckets if active resident ratio is lower than replica
         double current = static_cast<double>(stats.getTotalMemoryUsed());
         double lower = static_cast<double>(stats.mem_low_wat);
@@ -95,7 +142,12 @@ public:
         if (current > lower) {
             double p = (current - static_cast<double>(lower)) / current;
             adjustPercent(p, vb->getState());
-            return VBucketVisitor::visitBucket(vb);
+            if (sampleSize == 0) {
+                return VBucketVisitor::visitBucket(vb);
+            }
+            if (VBucketVisitor::visitBucket(vb)) {
+                sampleBucket(vb->ht);
+            }
         }
         return false;
     }
@@ -117,6 +169,11 @@ public:
         totalEjected += (ejected + num_expired);
         ejected = 0;
         expired.clear();
+
+        stats.pagerItemsScanned.incr(scanned);
+        stats.pagerHotEjects.incr(hotEjected);
+        scanned = 0;
+        hotEjected = 0;
     }
 
     bool pauseVisitor() {
@@ -147,6 +204,17 @@ public:
      */
     size_t getTotalEjectionAttempts() { return totalEjectionAttempts; }
 
+    /**
+     * Compress the values picked for ejection the first time, instead
+     * of ejecting them.
+     *
+     * @param minSize the min length of the values to compress, 0 to
+     *                always eject the values
+     */
+    void setCompression(size_t minSize) {
+        compressMinSize = minSize;
+    }
+
     void configPaging(bool cfg) {
         randomEvict = cfg;
         if (store.getEPEngine().isDegradedMode()) {
@@ -155,6 +223,47 @@ public:
     }
 
 private:
+    bool evict(StoredValue *v) {
+        if (compressMinSize > 0 && v->isResident() && !v->isCompressed() &&
+            v->valLength() >= compressMinSize &&
+            v->isClean() && !v->isDeleted() &&
+            v->compressValue(stats, currentBucket->ht)) {
+            return true;
+        }
+
+        ++totalEjectionAttempts;
+        if (!v->eligibleForEviction()) {
+            ++stats.numFailedEjects;
+            return false;
+        }
+        // Check if the key was already visited by all the cursors.
+        bool can_evict =
+            currentBucket->checkpointManager.eligibleForEviction(v->getKey());
+        if (can_evict && v->ejectValue(stats, currentBucket->ht)) {
+            ++ejected;
+            if (v->getAccessFrequency() > 0) {
+                ++hotEjected;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * Sample the items under each lock of the hash table until the
+     * share of them to page out is ejected, looking at no more items
+     * than a full scan would.
+     */
+    void sampleBucket(HashTable &ht) {
+        double locks = static_cast<double>(ht.getNumLocks());
+        size_t items = ht.getNumItems();
+        size_t resident = items - std::min(items, ht.getNumNonResidentItems());
+        lockTarget = static_cast<size_t>(std::ceil(percent * resident / locks));
+        lockBudget = static_cast<size_t>(std::ceil(items / locks)) + sampleSize;
+        currentLock = -1;
+        ht.visitSample(*this, sampleSize);
+    }
+
     void adjustPercent(double prob, vbucket_state_t state) {
         if (state == vbucket_state_replica ||
             state == vbucket_state_dead)
@@ -178,10 +287,19 @@ private:
     size_t                     ejected;
     size_t                     totalEjected;
     size_t                     totalEjectionAttempts;
+    size_t                     scanned;
+    size_t                     hotEjected;
     time_t                     startTime;
     bool                      *stateFinalizer;
     bool                       canPause;
     bool                       useNru;
+    size_t                     sampleSize;
+    int                        currentLock;
+    size_t                     lockTarget;
+    size_t                     lockBudget;
+    size_t                     lockEjected;
+    size_t                     lockScanned;
+    size_t                     compressMinSize;
 };
 
 bool ItemPager::checkAccessScannerTask() {
@@ -227,11 +345,21 @@ bool ItemPager::callback(Dispatcher &d, TaskId &t) {
             ++phase;
         }
 
+        // compare samples of items rather than visiting all of them
+        size_t sampleSize = 0;
+        if (cfg.getPagerEvictionPolicy() == "sampled") {
+            sampleSize = cfg.getPagerSampleSize();
+        }
+
         available = false;
         shared_ptr<PagingVisitor> pv(new PagingVisitor(store, stats, toKill,
-                                                       &available, false, bias, nru));
+                                                       &available, false, bias, nru,
+                                                       sampleSize));
         std::srand(ep_real_time());
         pv->configPaging(PagingConfig::phaseConfig[phase]);
+        if (cfg.isValueCompression()) {
+            pv->setCompression(cfg.getValueCompressionMinSize());
+        }
         store.visit(pv, "Item pager", &d, Priority::ItemPagerPriority);
 
         phase = phase + 1;
@@ -269,15 +397,47 @@ bool ItemPager::callback(Dispatcher &d, TaskId &t) {
 }
 
 bool ExpiredItemPager::callback(Dispatcher &d, TaskId &t) {
-    if (available) {
-        ++stats.expiryPagerRuns;
+    ++stats.expiryPagerRuns;
 
-        available = false;
-        shared_ptr<PagingVisitor> pv(new PagingVisitor(store, stats,
-                                                       -1, &available, true));
-        store.visit(pv, "Expired item remover", &d, Priority::ItemPagerPriority,
-                    true, 10);
+    // Only look at the items whose expiry time came, as told by the
+    // expiry index of each vbucket.
+    time_t now = ep_real_time();
+    std::list<std::pair<uint16_t, std::string> > expired;
+    const VBucketMap &vbuckets = store.getVBuckets();
+    size_t num_vbuckets = vbuckets.getSize();
+    for (size_t i = 0; i < num_vbuckets; ++i) {
+        assert(i <= std::numeric_limits<uint16_t>::max());
+        uint16_t vbid = static_cast<uint16_t>(i);
+        RCPtr<VBucket> vb = vbuckets.getBucket(vbid);
+        if (!vb) {
+            continue;
+        }
+
+        std::vector<std::string> due;
+        vb->ht.getDueExpiries(now, due);
+        std::vector<std::string>::iterator it;
+        for (it = due.begin(); it != due.end(); ++it) {
+            int bucket_num(0);
+            LockHolder lh = vb->ht.getLockedBucket(*it, &bucket_num);
+            StoredValue *v = vb->ht.unlocked_find(*it, bucket_num, true, false);
+            if (!v) {
+                continue;
+            }
+            if ((v->isExpired(now) && !v->isDeleted()) || v->isTempItem()) {
+                expired.push_back(std::make_pair(vbid, *it));
+            } else if (!v->isDeleted()) {
+                // The expiry time was pushed back since it was indexed.
+                v->indexExpiry(vb->ht);
+            }
+        }
     }
+
+    if (!expired.empty()) {
+        store.deleteExpiredItems(expired);
+        getLogger()->log(EXTENSION_LOG_INFO, NULL,
+                         "Purged %ld expired items\n", expired.size());
+    }
+
     d.snooze(t, sleepTime);
     return true;
 }
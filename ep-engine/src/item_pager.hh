@@ -75,8 +75,7 @@ public:
      */
     ExpiredItemPager(EventuallyPersistentStore *s, EPStats &st,
                      size_t stime) :
-        store(*s), stats(st), sleepTime(static_cast<double>(stime)),
-        available(true) {}
+        store(*s), stats(st), sleepTime(static_cast<double>(stime)) {}
 
     bool callback(Dispatcher &d, TaskId &t);
 
@@ -86,7 +85,6 @@ private:
     EventuallyPersistentStore &store;
     EPStats                   &stats;
     double                     sleepTime;
-    bool                       available;
 };
 
 #endif /* ITEM_PAGER_HH */
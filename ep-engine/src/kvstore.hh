@@ -263,11 +263,50 @@ public:
         throw std::runtime_error("Backed does not support dumpKeys()");
     }
 
+    /**
+     * Dump the items of a given set of vbuckets, skipping the deleted
+     * ones
+     * @param vbids the vbuckets to dump
+     * @param cb the callback to fire for each document
+     */
+    virtual void dumpVBuckets(const std::vector<uint16_t> &vbids,
+                              shared_ptr<Callback<GetValue> > cb) {
+        (void)vbids; (void)cb;
+        throw std::runtime_error("Backend does not support dumpVBuckets()");
+    }
+
     virtual void dumpDeleted(uint16_t vbid, shared_ptr<Callback<GetValue> > cb) {
         (void) vbid; (void) cb;
         throw std::runtime_error("Backend does not support dumpDeleted()");
     }
 
+    /**
+     * Pass the stored data of the given vbucket, from the given
+     * sequence number on, through the given callback.  The callback
+     * stops the dump by setting a status other than ENGINE_SUCCESS on
+     * the value it got.
+     *
+     * Backends that can't resume a dump pass the whole vbucket.
+     *
+     * @param vbid the vbucket to dump
+     * @param since the sequence number to start from
+     * @param deletionsOnly true to dump the keys of the deleted items
+     * @param cb the callback to fire for each document
+     * @return the sequence number to resume the dump from, or 0 once
+     *         the whole vbucket was dumped
+     */
+    virtual uint64_t dumpSince(uint16_t vbid, uint64_t since,
+                               bool deletionsOnly,
+                               shared_ptr<Callback<GetValue> > cb) {
+        (void) since;
+        if (deletionsOnly) {
+            dumpDeleted(vbid, cb);
+        } else {
+            dump(vbid, cb);
+        }
+        return 0;
+    }
+
     /**
      * Get the number of data shards in this kvstore.
      */
@@ -66,6 +66,55 @@ private:
     void operator=(const LockHolder&);
 };
 
+/**
+ * RAII lock holder that may give up on a busy lock.
+ */
+class TryLockHolder {
+public:
+    /**
+     * Acquire the lock in the given mutex, unless somebody else holds
+     * it and we shouldn't wait for it.
+     */
+    TryLockHolder(Mutex &m, bool wait = false) : mutex(m), locked(false) {
+        if (wait) {
+            mutex.acquire();
+            locked = true;
+        } else {
+            locked = mutex.tryAcquire();
+        }
+    }
+
+    /**
+     * Release the lock if it was acquired.
+     */
+    ~TryLockHolder() {
+        unlock();
+    }
+
+    /**
+     * True if the lock was acquired.
+     */
+    bool isLocked() const {
+        return locked;
+    }
+
+    /**
+     * Manually unlock a lock.
+     */
+    void unlock() {
+        if (locked) {
+            locked = false;
+            mutex.release();
+        }
+    }
+
+private:
+    Mutex &mutex;
+    bool locked;
+
+    DISALLOW_COPY_AND_ASSIGN(TryLockHolder);
+};
+
 /**
  * RAII lock holder over multiple locks.
  */
@@ -18,6 +18,7 @@
 #include "memory_tracker.hh"
 
 #include "objectregistry.hh"
+#include "slab_allocator.hh"
 #include <memcached/engine.h>
 
 bool MemoryTracker::tracking = false;
@@ -97,6 +98,11 @@ MemoryTracker::~MemoryTracker() {
 }
 
 void MemoryTracker::getAllocatorStats(std::map<std::string, size_t> &alloc_stats) {
+    // The slabs come from the heap, so what they hold but don't use adds
+    // to the fragmentation seen by the engine.
+    SlabAllocator *slabs = ObjectRegistry::getSlabAllocator();
+    slabs->getStats(alloc_stats);
+
     if (!trackingMemoryAllocations()) {
         return;
     }
@@ -112,7 +118,8 @@ void MemoryTracker::getAllocatorStats(std::map<std::string, size_t> &alloc_stats
     alloc_stats.insert(std::pair<std::string, size_t>("total_free_bytes",
                                                       stats.free_size));
     alloc_stats.insert(std::pair<std::string, size_t>("total_fragmentation_bytes",
-                                                      stats.fragmentation_size));
+                                                      stats.fragmentation_size +
+                                                      slabs->getFragmentation()));
 }
 
 void MemoryTracker::getDetailedStats(char* buffer, int size) {
@@ -124,7 +131,8 @@ void MemoryTracker::updateStats() {
 }
 
 size_t MemoryTracker::getFragmentation() {
-    return stats.fragmentation_size;
+    return stats.fragmentation_size +
+        ObjectRegistry::getSlabAllocator()->getFragmentation();
 }
 
 size_t MemoryTracker::getTotalBytesAllocated() {
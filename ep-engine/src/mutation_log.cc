@@ -3,10 +3,16 @@
 #include "config.h"
 #include <algorithm>
 
+#include <sys/mman.h>
 #include <sys/stat.h>
 
+#ifdef HAVE_LIBSNAPPY
+#include <snappy-c.h>
+#endif
+
 #include "mutation_log.hh"
 #include "ep_engine.h"
+#include "syncobject.hh"
 
 extern "C" {
 #include "crc32.h"
@@ -50,12 +56,52 @@ static void writeFully(int fd, const uint8_t *buf, size_t nbytes) {
     }
 }
 
+// Entries of a compressed log start with a byte holding the type and a
+// flag telling the vbucket (two bytes) follows, else it's the vbucket
+// of the previous entry.  Then come the length of the prefix shared
+// with the previous key, the length and the bytes of the rest of the
+// key, and the rowid as a varint.  The first entry of a block shares
+// nothing with what came before, so blocks decode on their own.
+static const uint8_t ML_TYPE_MASK(0x07);
+static const uint8_t ML_NEW_VBUCKET(0x08);
+// Worst case size of an encoded entry without its key.
+static const size_t ML_MAX_ENCODED_OVERHEAD(1 + 2 + 1 + 1 + 10);
+// Bytes of entries buffered by a compressed log before sorting them
+// into blocks, in units of the block size.
+static const size_t ML_PENDING_BLOCKS(64);
+
+// A block of a compressed log may hold its entries compressed with
+// snappy, which is told by this bit of its entry count.  The length of
+// the compressed entries (four bytes) then precedes them.
+static const uint16_t ML_PACKED_BLOCK(0x8000);
+// Max bytes of entries packed into a block, in units of the block size.
+static const size_t ML_MAX_PACKED_BLOCKS(4);
+
+static size_t maxPackedBlocks(uint32_t version) {
+#ifdef HAVE_LIBSNAPPY
+    if (version == LOG_COMPRESSED_VERSION) {
+        return ML_MAX_PACKED_BLOCKS;
+    }
+#else
+    (void)version;
+#endif
+    return 1;
+}
+
+static bool entryLess(const mutation_log_entry_t &a,
+                      const mutation_log_entry_t &b) {
+    if (a.vbucket != b.vbucket) {
+        return a.vbucket < b.vbucket;
+    }
+    return a.key < b.key;
+}
+
 uint64_t MutationLogEntry::rowid() const {
     return ntohll(_rowid);
 }
 
 MutationLog::MutationLog(const std::string &path,
-                         const size_t bs)
+                         const size_t bs, uint32_t version)
     : paddingHisto(GrowingWidthGenerator<uint32_t>(0, 8, 1.5), 32),
     logPath(path),
     blockSize(bs),
@@ -63,12 +109,30 @@ MutationLog::MutationLog(const std::string &path,
     file(-1),
     entries(0),
     entryBuffer(static_cast<uint8_t*>(calloc(MutationLogEntry::len(256), 1))),
-    blockBuffer(static_cast<uint8_t*>(calloc(bs, 1))),
+    blockBuffer(NULL),
+    packBuffer(NULL),
+    blockLimit(bs),
     syncConfig(DEFAULT_SYNC_CONF),
-    readOnly(false)
+    readOnly(false),
+    pendingBytes(0),
+    lastVBucket(0)
 {
     assert(entryBuffer);
+    assert(version == LOG_VERSION || version == LOG_COMPRESSED_VERSION);
+    // A compressed block has to hold an entry with the longest key.
+    if (bs < HEADER_RESERVED + ML_MAX_ENCODED_OVERHEAD + 255) {
+        version = LOG_VERSION;
+    }
+    headerBlock.setVersion(version);
+    blockBuffer = static_cast<uint8_t*>(calloc(bs * maxPackedBlocks(version), 1));
     assert(blockBuffer);
+#ifdef HAVE_LIBSNAPPY
+    if (maxPackedBlocks(version) > 1) {
+        size_t len(snappy_max_compressed_length(bs * maxPackedBlocks(version)));
+        packBuffer = static_cast<uint8_t*>(malloc(len));
+        assert(packBuffer);
+    }
+#endif
     if (logPath == "") {
         file = DISABLED_FD;
     }
@@ -79,6 +143,7 @@ MutationLog::~MutationLog() {
     close();
     free(entryBuffer);
     free(blockBuffer);
+    free(packBuffer);
 }
 
 void MutationLog::disable() {
@@ -174,8 +239,13 @@ void MutationLog::readInitialBlock() {
 
     headerBlock.set(buf, sizeof(buf));
 
-    // These are reserved for future use.
-    assert(headerBlock.version() == LOG_VERSION);
+    if (headerBlock.version() != LOG_VERSION &&
+        headerBlock.version() != LOG_COMPRESSED_VERSION) {
+        std::stringstream ss;
+        ss << "Unsupported log version: " << headerBlock.version();
+        throw ReadException(ss.str());
+    }
+    // This is reserved for future use.
     assert(headerBlock.blockCount() == 1);
 
     blockSize = headerBlock.blockSize();
@@ -278,6 +348,11 @@ void MutationLog::open(bool _readOnly) {
             close();
             file = DISABLED_FD;
             throw ShortReadException();
+        } catch (ReadException &e) {
+            // Leave the header of a log we don't understand alone.
+            doClose(file);
+            file = DISABLED_FD;
+            throw;
         }
 
         if (!readOnly) {
@@ -358,11 +433,22 @@ bool MutationLog::replaceWith(MutationLog &mlog) {
 }
 
 void MutationLog::flush() {
+    if (isEnabled() && !pending.empty()) {
+        writePending();
+    }
+    flushBlock();
+}
+
+void MutationLog::flushBlock() {
     if (isEnabled() && blockPos > HEADER_RESERVED) {
         assert(isOpen());
         needWriteAccess();
         BlockTimer timer(&flushTimeHisto);
 
+        if (packBlock()) {
+            return;
+        }
+
         if (blockPos < blockSize) {
             size_t padding(blockSize - blockPos);
             memset(blockBuffer + blockPos, 0x00, padding);
@@ -384,14 +470,96 @@ void MutationLog::flush() {
     }
 }
 
+/**
+ * Compress the entries of the next block of a compressed log, or split
+ * them into smaller blocks if they don't fit in one once compressed.
+ *
+ * @return true if the entries were written out by splitting them
+ */
+bool MutationLog::packBlock() {
+#ifdef HAVE_LIBSNAPPY
+    if (packBuffer == NULL) {
+        return false;
+    }
+    size_t len(blockPos - HEADER_RESERVED);
+    size_t room(blockSize - HEADER_RESERVED - sizeof(uint32_t));
+    size_t clen(snappy_max_compressed_length(len));
+    if (snappy_compress(reinterpret_cast<char*>(blockBuffer + HEADER_RESERVED),
+                        len, reinterpret_cast<char*>(packBuffer),
+                        &clen) != SNAPPY_OK) {
+        clen = len;
+    }
+
+    // Aim the entries of the next blocks at what fits once compressed.
+    size_t fits(std::min(len, room) * 7 / 8);
+    if (clen < len) {
+        fits = len * room / clen * 7 / 8;
+    }
+    size_t limit(std::min(HEADER_RESERVED + fits,
+                          blockSize * ML_MAX_PACKED_BLOCKS));
+
+    if (clen < len && clen <= room) {
+        uint32_t n(htonl(static_cast<uint32_t>(clen)));
+        memcpy(blockBuffer + HEADER_RESERVED, &n, sizeof(n));
+        memcpy(blockBuffer + HEADER_RESERVED + sizeof(n), packBuffer, clen);
+        blockPos = HEADER_RESERVED + sizeof(n) + clen;
+        entries |= ML_PACKED_BLOCK;
+        blockLimit = std::max(limit, blockSize);
+        return false;
+    }
+    if (blockPos <= blockSize) {
+        blockLimit = blockSize;
+        return false;
+    }
+
+    // Too many entries for a block: encode them again with a lower limit.
+    std::vector<mutation_log_entry_t> split;
+    decodeEntries(blockBuffer + HEADER_RESERVED, blockBuffer + blockPos,
+                  entries, LOG_COMPRESSED_VERSION, split);
+    blockLimit = std::max(std::min(limit, blockLimit * 3 / 4), blockSize);
+    blockPos = HEADER_RESERVED;
+    entries = 0;
+    std::vector<mutation_log_entry_t>::iterator it;
+    for (it = split.begin(); it != split.end(); ++it) {
+        encodeEntry(*it);
+    }
+    flushBlock();
+    return true;
+#else
+    return false;
+#endif
+}
+
 void MutationLog::writeEntry(MutationLogEntry *mle) {
     assert(isEnabled());
     assert(isOpen());
     needWriteAccess();
 
+    if (getVersion() == LOG_COMPRESSED_VERSION) {
+        mutation_log_entry_t e;
+        e.key = mle->key();
+        e.rowid = mle->rowid();
+        e.type = mle->type();
+        e.vbucket = mle->vbucket();
+        if (e.type == ML_NEW || e.type == ML_DEL) {
+            pending.push_back(e);
+            pendingBytes += mle->len();
+            if (pendingBytes >= blockSize * ML_PENDING_BLOCKS) {
+                writePending();
+            }
+        } else {
+            // Entries are only reordered between these.
+            writePending();
+            encodeEntry(e);
+        }
+        ++itemsLogged[mle->type()];
+        delete mle;
+        return;
+    }
+
     size_t len(mle->len());
     if (blockPos + len > blockSize) {
-        flush();
+        flushBlock();
     }
     assert(len < blockSize);
 
@@ -404,6 +572,173 @@ void MutationLog::writeEntry(MutationLogEntry *mle) {
     delete mle;
 }
 
+void MutationLog::writePending() {
+    // A stable sort keeps the order of the entries of the same key.
+    std::stable_sort(pending.begin(), pending.end(), entryLess);
+    std::vector<mutation_log_entry_t>::iterator it;
+    for (it = pending.begin(); it != pending.end(); ++it) {
+        encodeEntry(*it);
+    }
+    pending.clear();
+    pendingBytes = 0;
+}
+
+void MutationLog::encodeEntry(const mutation_log_entry_t &e) {
+    assert(e.key.length() <= std::numeric_limits<uint8_t>::max());
+    if (blockPos + ML_MAX_ENCODED_OVERHEAD + e.key.length() > blockLimit ||
+        entries == ML_PACKED_BLOCK - 1) {
+        flushBlock();
+    }
+
+    size_t shared(0);
+    bool newVBucket(true);
+    if (entries > 0) {
+        size_t max(std::min(e.key.length(), lastKey.length()));
+        while (shared < max && e.key[shared] == lastKey[shared]) {
+            ++shared;
+        }
+        newVBucket = e.vbucket != lastVBucket;
+    }
+
+    uint8_t *p(blockBuffer + blockPos);
+    *p++ = e.type | (newVBucket ? ML_NEW_VBUCKET : 0);
+    if (newVBucket) {
+        uint16_t vb(htons(e.vbucket));
+        memcpy(p, &vb, sizeof(vb));
+        p += sizeof(vb);
+    }
+    *p++ = static_cast<uint8_t>(shared);
+    *p++ = static_cast<uint8_t>(e.key.length() - shared);
+    memcpy(p, e.key.data() + shared, e.key.length() - shared);
+    p += e.key.length() - shared;
+    uint64_t rowid(e.rowid);
+    do {
+        uint8_t b(rowid & 0x7f);
+        rowid >>= 7;
+        *p++ = b | (rowid ? 0x80 : 0);
+    } while (rowid);
+
+    blockPos = p - blockBuffer;
+    ++entries;
+    lastKey = e.key;
+    lastVBucket = e.vbucket;
+}
+
+uint16_t MutationLog::checkBlock(const uint8_t *block, size_t bs) {
+    uint32_t crc32(crc32buf(const_cast<uint8_t*>(block) + 2, bs - 2));
+    uint16_t computed_crc16(crc32 & 0xffff);
+    uint16_t retrieved_crc16;
+    memcpy(&retrieved_crc16, block, sizeof(retrieved_crc16));
+    retrieved_crc16 = ntohs(retrieved_crc16);
+    if (computed_crc16 != retrieved_crc16) {
+        throw CRCReadException();
+    }
+
+    uint16_t items;
+    memcpy(&items, block + 2, sizeof(items));
+    return ntohs(items);
+}
+
+void MutationLog::decodeBlock(const uint8_t *block, size_t bs,
+                              uint32_t version,
+                              std::vector<mutation_log_entry_t> &out) {
+    uint16_t items(checkBlock(block, bs));
+    const uint8_t *p(block + HEADER_RESERVED);
+    const uint8_t *end(block + bs);
+    if (version != LOG_COMPRESSED_VERSION || (items & ML_PACKED_BLOCK) == 0) {
+        decodeEntries(p, end, items, version, out);
+        return;
+    }
+
+#ifdef HAVE_LIBSNAPPY
+    uint32_t clen;
+    size_t len;
+    if (static_cast<size_t>(end - p) < sizeof(clen)) {
+        throw ReadException("Corrupt log block");
+    }
+    memcpy(&clen, p, sizeof(clen));
+    clen = ntohl(clen);
+    p += sizeof(clen);
+    const char *packed(reinterpret_cast<const char*>(p));
+    if (clen > static_cast<size_t>(end - p) ||
+        snappy_uncompressed_length(packed, clen, &len) != SNAPPY_OK) {
+        throw ReadException("Corrupt log block");
+    }
+    std::vector<uint8_t> buf(len + 1);
+    if (snappy_uncompress(packed, clen, reinterpret_cast<char*>(&buf[0]),
+                          &len) != SNAPPY_OK) {
+        throw ReadException("Corrupt log block");
+    }
+    decodeEntries(&buf[0], &buf[0] + len, items & ~ML_PACKED_BLOCK,
+                  version, out);
+#else
+    throw ReadException("Log block compressed with snappy");
+#endif
+}
+
+void MutationLog::decodeEntries(const uint8_t *p, const uint8_t *end,
+                                uint16_t items, uint32_t version,
+                                std::vector<mutation_log_entry_t> &out) {
+    mutation_log_entry_t e;
+    e.vbucket = 0;
+
+    for (uint16_t i = 0; i < items; ++i) {
+        if (version == LOG_VERSION) {
+            if (static_cast<size_t>(end - p) < MutationLogEntry::len(0)) {
+                throw ReadException("Corrupt log block");
+            }
+            const MutationLogEntry *mle =
+                MutationLogEntry::newEntry(const_cast<uint8_t*>(p), end - p);
+            e.key = mle->key();
+            e.rowid = mle->rowid();
+            e.type = mle->type();
+            e.vbucket = mle->vbucket();
+            p += mle->len();
+            out.push_back(e);
+            continue;
+        }
+
+        if (end - p < 3) {
+            throw ReadException("Corrupt log block");
+        }
+        uint8_t flags(*p++);
+        e.type = flags & ML_TYPE_MASK;
+        if (flags & ML_NEW_VBUCKET) {
+            uint16_t vb;
+            memcpy(&vb, p, sizeof(vb));
+            e.vbucket = ntohs(vb);
+            p += sizeof(vb);
+        } else if (i == 0) {
+            throw ReadException("Corrupt log block");
+        }
+        if (end - p < 2) {
+            throw ReadException("Corrupt log block");
+        }
+        size_t shared(*p++);
+        size_t rest(*p++);
+        if (shared > e.key.length() || static_cast<size_t>(end - p) < rest ||
+            e.type >= MUTATION_LOG_TYPES) {
+            throw ReadException("Corrupt log block");
+        }
+        e.key.resize(shared);
+        e.key.append(reinterpret_cast<const char*>(p), rest);
+        p += rest;
+
+        e.rowid = 0;
+        for (int shift = 0; ; shift += 7) {
+            if (p == end || shift > 63) {
+                throw ReadException("Corrupt log block");
+            }
+            uint8_t b(*p++);
+            e.rowid |= static_cast<uint64_t>(b & 0x7f) << shift;
+            if ((b & 0x80) == 0) {
+                break;
+            }
+        }
+        out.push_back(e);
+    }
+}
+
 static const char* logType(uint8_t t) {
     switch(t) {
     case ML_NEW:
@@ -436,7 +771,8 @@ MutationLog::iterator::iterator(const MutationLog *l, bool e)
     p(buf),
     offset(l->header().blockSize() * l->header().blockCount()),
     items(0),
-    isEnd(e)
+    isEnd(e),
+    decodedPos(0)
 {
     assert(log);
 }
@@ -448,7 +784,9 @@ MutationLog::iterator::iterator(const MutationLog::iterator& mit)
     p(NULL),
     offset(mit.offset),
     items(mit.items),
-    isEnd(mit.isEnd)
+    isEnd(mit.isEnd),
+    decoded(mit.decoded),
+    decodedPos(mit.decodedPos)
 {
     assert(log);
     if (mit.buf != NULL) {
@@ -471,17 +809,27 @@ MutationLog::iterator::~iterator() {
 }
 
 void MutationLog::iterator::prepItem() {
-    MutationLogEntry *e = MutationLogEntry::newEntry(p, bufferBytesRemaining());
     if (entryBuf == NULL) {
         entryBuf = static_cast<uint8_t*>(calloc(1, LOG_ENTRY_BUF_SIZE));
         assert(entryBuf);
     }
+    if (log->getVersion() == LOG_COMPRESSED_VERSION) {
+        const mutation_log_entry_t &d(decoded[decodedPos]);
+        MutationLogEntry::newEntry(entryBuf, d.rowid,
+                                   static_cast<mutation_log_type_t>(d.type),
+                                   d.vbucket, d.key);
+        return;
+    }
+    MutationLogEntry *e = MutationLogEntry::newEntry(p, bufferBytesRemaining());
     memcpy(entryBuf, p, e->len());
 }
 
 MutationLog::iterator& MutationLog::iterator::operator++() {
     if (--items == 0) {
         nextBlock();
+    } else if (log->getVersion() == LOG_COMPRESSED_VERSION) {
+        ++decodedPos;
+        prepItem();
     } else {
         size_t l(operator*()->len());
         p += l;
@@ -535,18 +883,15 @@ void MutationLog::iterator::nextBlock() {
     }
     offset += bytesread;
 
-    uint32_t crc32(crc32buf(buf + 2, log->header().blockSize() - 2));
-    uint16_t computed_crc16(crc32 & 0xffff);
-    uint16_t retrieved_crc16;
-    memcpy(&retrieved_crc16, buf, sizeof(retrieved_crc16));
-    retrieved_crc16 = ntohs(retrieved_crc16);
-    if (computed_crc16 != retrieved_crc16) {
-        throw CRCReadException();
+    if (log->getVersion() == LOG_COMPRESSED_VERSION) {
+        decoded.clear();
+        decodedPos = 0;
+        decodeBlock(buf, log->header().blockSize(), log->getVersion(), decoded);
+        items = static_cast<uint16_t>(decoded.size());
+    } else {
+        items = checkBlock(buf, log->header().blockSize());
     }
 
-    memcpy(&items, buf + 2, 2);
-    items = ntohs(items);
-
     p = p + 4;
 
     prepItem();
@@ -558,70 +903,309 @@ void MutationLog::resetCounts(size_t *items) {
     }
 }
 
+// ----------------------------------------------------------------------
+// Parallel log reader
+// ----------------------------------------------------------------------
+
+extern "C" {
+    static void *launch_log_reader_thread(void *arg);
+}
+
+/**
+ * Reads a log through a memory map of its file.
+ *
+ * Reader threads decode chunks of blocks ahead of the consumer, who
+ * gets the chunks back in file order.  Only a few chunks are decoded
+ * ahead, so the memory used doesn't grow with the size of the log.
+ */
+class MutationLogReader {
+public:
+    MutationLogReader(MutationLog &log, size_t numReaders);
+
+    ~MutationLogReader();
+
+    /**
+     * Get the entries of the next chunk of blocks.
+     *
+     * @return false at the end of the log
+     * @throw MutationLog::ReadException if a block is damaged
+     */
+    bool next(std::vector<mutation_log_entry_t> &out);
+
+    void run();
+
+private:
+
+    enum chunk_state_t { CHUNK_EMPTY, CHUNK_DONE, CHUNK_CRC_ERROR, CHUNK_CORRUPT };
+
+    struct Chunk {
+        Chunk() : state(CHUNK_EMPTY) {}
+
+        chunk_state_t state;
+        std::vector<mutation_log_entry_t> entries;
+    };
+
+    static const size_t blocksPerChunk;
+
+    Chunk &slot(size_t c) {
+        return chunks[c % chunks.size()];
+    }
+
+    uint8_t               *base;
+    size_t                 mapSize;
+    size_t                 blockSize;
+    uint32_t               version;
+    size_t                 firstBlock;
+    size_t                 numBlocks;
+    size_t                 numChunks;
+    bool                   partialBlock;
+    SyncObject             sync;
+    std::vector<Chunk>     chunks;
+    size_t                 nextChunk;  // next chunk to decode
+    size_t                 consumed;   // chunks handed out by next()
+    bool                   stopping;
+    std::vector<pthread_t> threads;
+};
+
+const size_t MutationLogReader::blocksPerChunk = 64;
+
+static void *launch_log_reader_thread(void *arg) {
+    MutationLogReader *reader = static_cast<MutationLogReader*>(arg);
+    try {
+        reader->run();
+    } catch (std::exception& e) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Log reader exception caught: %s", e.what());
+    } catch(...) {
+        getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                         "Caught a fatal exception in the log reader thread");
+    }
+    return NULL;
+}
+
+MutationLogReader::MutationLogReader(MutationLog &log, size_t numReaders)
+    : base(NULL), mapSize(0), blockSize(log.header().blockSize()),
+      version(log.getVersion()),
+      firstBlock(log.header().blockSize() * log.header().blockCount()),
+      numBlocks(0), numChunks(0), partialBlock(false),
+      chunks(numReaders * 2), nextChunk(0), consumed(0), stopping(false)
+{
+    assert(numReaders > 0);
+    int fd = ::open(log.getLogFile().c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::stringstream ss;
+        ss << "Unable to open log file: " << strerror(errno);
+        throw MutationLog::ReadException(ss.str());
+    }
+    struct stat st;
+    int stat_result = fstat(fd, &st);
+    assert(stat_result == 0);
+    mapSize = static_cast<size_t>(st.st_size);
+    if (mapSize > firstBlock) {
+        void *m = mmap(NULL, mapSize, PROT_READ, MAP_SHARED, fd, 0);
+        if (m == MAP_FAILED) {
+            std::stringstream ss;
+            ss << "Unable to map log file: " << strerror(errno);
+            doClose(fd);
+            throw MutationLog::ReadException(ss.str());
+        }
+        base = static_cast<uint8_t*>(m);
+        (void)madvise(m, mapSize, MADV_SEQUENTIAL);
+        numBlocks = (mapSize - firstBlock) / blockSize;
+        partialBlock = (mapSize - firstBlock) % blockSize != 0;
+    }
+    doClose(fd);
+
+    numChunks = (numBlocks + blocksPerChunk - 1) / blocksPerChunk;
+    numReaders = std::min(numReaders, numChunks);
+    for (size_t i = 0; i < numReaders; ++i) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, launch_log_reader_thread, this) != 0) {
+            break;
+        }
+        threads.push_back(tid);
+    }
+    if (threads.empty() && numChunks > 0) {
+        if (base != NULL) {
+            munmap(base, mapSize);
+        }
+        throw MutationLog::ReadException("Unable to start a log reader");
+    }
+}
+
+MutationLogReader::~MutationLogReader() {
+    LockHolder lh(sync);
+    stopping = true;
+    sync.notify();
+    lh.unlock();
+
+    std::vector<pthread_t>::iterator it;
+    for (it = threads.begin(); it != threads.end(); ++it) {
+        pthread_join(*it, NULL);
+    }
+    if (base != NULL) {
+        munmap(base, mapSize);
+    }
+}
+
+void MutationLogReader::run() {
+    LockHolder lh(sync);
+    while (!stopping && nextChunk < numChunks) {
+        if (nextChunk >= consumed + chunks.size()) {
+            sync.wait();
+            continue;
+        }
+        size_t c = nextChunk++;
+        lh.unlock();
+
+        std::vector<mutation_log_entry_t> entries;
+        chunk_state_t state(CHUNK_DONE);
+        size_t last = std::min(numBlocks, (c + 1) * blocksPerChunk);
+        try {
+            for (size_t b = c * blocksPerChunk; b < last; ++b) {
+                MutationLog::decodeBlock(base + firstBlock + b * blockSize,
+                                         blockSize, version, entries);
+            }
+        } catch (MutationLog::CRCReadException &e) {
+            state = CHUNK_CRC_ERROR;
+        } catch (MutationLog::ReadException &e) {
+            state = CHUNK_CORRUPT;
+        } catch (std::exception &e) {
+            // Anything else would end the thread and leave next() waiting
+            // for this chunk forever
+            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                             "Failed to decode log chunk %lu: %s\n",
+                             static_cast<unsigned long>(c), e.what());
+            state = CHUNK_CORRUPT;
+        } catch (...) {
+            getLogger()->log(EXTENSION_LOG_WARNING, NULL,
+                             "Failed to decode log chunk %lu\n",
+                             static_cast<unsigned long>(c));
+            state = CHUNK_CORRUPT;
+        }
+
+        lh.lock();
+        Chunk &chunk(slot(c));
+        chunk.entries.swap(entries);
+        chunk.state = state;
+        sync.notify();
+    }
+}
+
+bool MutationLogReader::next(std::vector<mutation_log_entry_t> &out) {
+    out.clear();
+    if (consumed == numChunks) {
+        if (partialBlock) {
+            throw MutationLog::ShortReadException();
+        }
+        return false;
+    }
+
+    LockHolder lh(sync);
+    Chunk &chunk(slot(consumed));
+    while (chunk.state == CHUNK_EMPTY) {
+        sync.wait();
+    }
+    chunk_state_t state(chunk.state);
+    out.swap(chunk.entries);
+    chunk.state = CHUNK_EMPTY;
+    ++consumed;
+    sync.notify();
+    lh.unlock();
+
+    if (state == CHUNK_CRC_ERROR) {
+        throw MutationLog::CRCReadException();
+    } else if (state == CHUNK_CORRUPT) {
+        throw MutationLog::ReadException("Corrupt log block");
+    }
+    return true;
+}
+
 // ----------------------------------------------------------------------
 // Reading entries
 // ----------------------------------------------------------------------
 
-bool MutationLogHarvester::load() {
+bool MutationLogHarvester::load(size_t readers) {
     bool clean(false);
     std::set<uint16_t> shouldClear;
+    if (readers > 1 && mlog.isOpen()) {
+        MutationLogReader reader(mlog, readers);
+        std::vector<mutation_log_entry_t> entries;
+        while (reader.next(entries)) {
+            std::vector<mutation_log_entry_t>::iterator it;
+            for (it = entries.begin(); it != entries.end(); ++it) {
+                clean = loadEntry(it->type, it->vbucket, it->key, it->rowid,
+                                  shouldClear);
+            }
+        }
+        return clean;
+    }
+
     for (MutationLog::iterator it(mlog.begin()); it != mlog.end(); ++it) {
         const MutationLogEntry *le = *it;
-        ++itemsSeen[le->type()];
-        clean = false;
-
-        switch (le->type()) {
-        case ML_DEL:
-            // FALLTHROUGH
-        case ML_NEW:
-            if (vbid_set.find(le->vbucket()) != vbid_set.end()) {
-                loading[le->vbucket()][le->key()] = std::make_pair(le->rowid(), le->type());
-            }
-            break;
-        case ML_COMMIT2: {
-            clean = true;
-            for (std::set<uint16_t>::iterator vit(shouldClear.begin()); vit != shouldClear.end(); ++vit) {
-                committed[*vit].clear();
-            }
-            shouldClear.clear();
-
-            for (std::set<uint16_t>::const_iterator vit = vbid_set.begin(); vit != vbid_set.end(); ++vit) {
-                uint16_t vb(*vit);
-
-                unordered_map<std::string, mutation_log_event_t>::iterator copyit2;
-                for (copyit2 = loading[vb].begin();
-                     copyit2 != loading[vb].end();
-                     ++copyit2) {
-
-                    mutation_log_event_t t = copyit2->second;
-
-                    switch (t.second) {
-                    case ML_NEW:
-                        committed[vb][copyit2->first] = t.first;
-                        break;
-                    case ML_DEL:
-                        committed[vb].erase(copyit2->first);
-                        break;
-                    default:
-                        abort();
-                    }
+        clean = loadEntry(le->type(), le->vbucket(), le->key(), le->rowid(),
+                          shouldClear);
+    }
+    return clean;
+}
+
+bool MutationLogHarvester::loadEntry(uint8_t type, uint16_t vb,
+                                     const std::string &key, uint64_t rowid,
+                                     std::set<uint16_t> &shouldClear) {
+    bool clean(false);
+    ++itemsSeen[type];
+
+    switch (type) {
+    case ML_DEL:
+        // FALLTHROUGH
+    case ML_NEW:
+        if (vbid_set.find(vb) != vbid_set.end()) {
+            loading[vb][key] = std::make_pair(rowid, type);
+        }
+        break;
+    case ML_COMMIT2: {
+        clean = true;
+        for (std::set<uint16_t>::iterator vit(shouldClear.begin()); vit != shouldClear.end(); ++vit) {
+            committed[*vit].clear();
+        }
+        shouldClear.clear();
+
+        for (std::set<uint16_t>::const_iterator vit = vbid_set.begin(); vit != vbid_set.end(); ++vit) {
+            uint16_t vbid(*vit);
+
+            unordered_map<std::string, mutation_log_event_t>::iterator copyit2;
+            for (copyit2 = loading[vbid].begin();
+                 copyit2 != loading[vbid].end();
+                 ++copyit2) {
+
+                mutation_log_event_t t = copyit2->second;
+
+                switch (t.second) {
+                case ML_NEW:
+                    committed[vbid][copyit2->first] = t.first;
+                    break;
+                case ML_DEL:
+                    committed[vbid].erase(copyit2->first);
+                    break;
+                default:
+                    abort();
                 }
             }
         }
-            loading.clear();
-            break;
-        case ML_COMMIT1:
-            // nothing in particular
-            break;
-        case ML_DEL_ALL:
-            if (vbid_set.find(le->vbucket()) != vbid_set.end()) {
-                loading[le->vbucket()].clear();
-                shouldClear.insert(le->vbucket());
-            }
-            break;
-        default:
-            abort();
+    }
+        loading.clear();
+        break;
+    case ML_COMMIT1:
+        // nothing in particular
+        break;
+    case ML_DEL_ALL:
+        if (vbid_set.find(vb) != vbid_set.end()) {
+            loading[vb].clear();
+            shouldClear.insert(vb);
         }
+        break;
+    default:
+        abort();
     }
     return clean;
 }
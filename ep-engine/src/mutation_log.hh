@@ -25,6 +25,8 @@ const size_t MIN_LOG_HEADER_SIZE(4096);
 const uint8_t MUTATION_LOG_MAGIC(0x45);
 const size_t HEADER_RESERVED(4);
 const uint32_t LOG_VERSION(1);
+//! Blocks of key prefix compressed entries, sorted by vbucket and key.
+const uint32_t LOG_COMPRESSED_VERSION(2);
 const size_t LOG_ENTRY_BUF_SIZE(512);
 const int DISABLED_FD(-3);
 
@@ -51,6 +53,10 @@ public:
         _blockCount = htonl(bc);
     }
 
+    void setVersion(uint32_t v) {
+        _version = htonl(v);
+    }
+
     void set(const uint8_t *buf, size_t buflen) {
         assert(buflen == MIN_LOG_HEADER_SIZE);
         int offset(0);
@@ -208,6 +214,16 @@ private:
 
 std::ostream& operator <<(std::ostream &out, const MutationLogEntry &mle);
 
+/**
+ * A log entry decoded out of its block.
+ */
+struct mutation_log_entry_t {
+    std::string key;
+    uint64_t    rowid;
+    uint8_t     type;
+    uint16_t    vbucket;
+};
+
 
 /**
  * The MutationLog records major key events to allow ep-engine to more
@@ -216,7 +232,8 @@ std::ostream& operator <<(std::ostream &out, const MutationLogEntry &mle);
 class MutationLog {
 public:
 
-    MutationLog(const std::string &path, const size_t bs=4096);
+    MutationLog(const std::string &path, const size_t bs=4096,
+                uint32_t version=LOG_VERSION);
 
     ~MutationLog();
 
@@ -264,6 +281,10 @@ public:
         return blockSize;
     }
 
+    uint32_t getVersion() const {
+        return headerBlock.version();
+    }
+
     bool exists() const;
 
     const std::string &getLogFile() const { return logPath; }
@@ -377,8 +398,37 @@ public:
         off_t              offset;
         uint16_t           items;
         bool               isEnd;
+        //! Entries of the current block of a compressed log.
+        std::vector<mutation_log_entry_t> decoded;
+        size_t             decodedPos;
     };
 
+    /**
+     * Check the CRC of a block read from the log.
+     *
+     * @return the number of entries in the block
+     * @throw CRCReadException if the block is damaged
+     */
+    static uint16_t checkBlock(const uint8_t *block, size_t bs);
+
+    /**
+     * Append the entries of a block of a log of the given version.
+     *
+     * @throw ReadException if the block can't be decoded
+     */
+    static void decodeBlock(const uint8_t *block, size_t bs,
+                            uint32_t version,
+                            std::vector<mutation_log_entry_t> &out);
+
+    /**
+     * Append the given number of entries encoded in a buffer.
+     *
+     * @throw ReadException if the entries can't be decoded
+     */
+    static void decodeEntries(const uint8_t *p, const uint8_t *end,
+                              uint16_t items, uint32_t version,
+                              std::vector<mutation_log_entry_t> &out);
+
     /**
      * An iterator pointing to the beginning of the log file.
      */
@@ -413,6 +463,10 @@ private:
         }
     }
     void writeEntry(MutationLogEntry *mle);
+    void encodeEntry(const mutation_log_entry_t &e);
+    void writePending();
+    void flushBlock();
+    bool packBlock();
 
     void writeInitialBlock();
     void readInitialBlock();
@@ -429,9 +483,18 @@ private:
     int                file;
     uint16_t           entries;
     uint8_t           *entryBuffer;
+    //! Entries of the next block; those of a compressed log fill up to
+    //! blockLimit bytes and are packed into a block by flushBlock().
     uint8_t           *blockBuffer;
+    uint8_t           *packBuffer;
+    size_t             blockLimit;
     uint8_t            syncConfig;
     bool               readOnly;
+    //! Entries of a compressed log waiting to be sorted into blocks.
+    std::vector<mutation_log_entry_t> pending;
+    size_t             pendingBytes;
+    std::string        lastKey;
+    uint16_t           lastVBucket;
 
     DISALLOW_COPY_AND_ASSIGN(MutationLog);
 };
@@ -484,9 +547,12 @@ public:
     /**
      * Load the entries from the file.
      *
+     * With more than one reader the file is memory mapped and its
+     * blocks are decoded on that many threads.
+     *
      * @return true if the file was clean and can likely be trusted.
      */
-    bool load();
+    bool load(size_t readers = 1);
 
     /**
      * Apply the processed log entries through the given function.
@@ -513,6 +579,9 @@ public:
 
 private:
 
+    bool loadEntry(uint8_t type, uint16_t vb, const std::string &key,
+                   uint64_t rowid, std::set<uint16_t> &shouldClear);
+
     MutationLog &mlog;
     EventuallyPersistentEngine *engine;
     std::set<uint16_t> vbid_set;
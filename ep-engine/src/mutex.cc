@@ -17,8 +17,9 @@
 #include "config.h"
 #include "mutex.hh"
 #include "common.hh"
+#include "atomic.hh"
 
-Mutex::Mutex() : held(false)
+Mutex::Mutex() : held(false), sequenced(false), sequence(0)
 {
     pthread_mutexattr_t *attr = NULL;
     int e=0;
@@ -84,13 +85,41 @@ void Mutex::acquire() {
         abort();
     }
     setHolder(true);
+    if (sequenced) {
+        ++sequence;
+        ep_sync_synchronize();
+    }
+
+    EP_MUTEX_ACQUIRED(this);
+}
+
+bool Mutex::tryAcquire() {
+    int e = pthread_mutex_trylock(&mutex);
+    if (e == EBUSY) {
+        return false;
+    } else if (e != 0) {
+        std::cerr << "MUTEX ERROR: Failed to try to acquire lock: ";
+        std::cerr << std::strerror(e) << std::endl;
+        std::cerr.flush();
+        abort();
+    }
+    setHolder(true);
+    if (sequenced) {
+        ++sequence;
+        ep_sync_synchronize();
+    }
 
     EP_MUTEX_ACQUIRED(this);
+    return true;
 }
 
 void Mutex::release() {
     assert(held && pthread_equal(holder, pthread_self()));
     setHolder(false);
+    if (sequenced) {
+        ep_sync_synchronize();
+        ++sequence;
+    }
     int e;
     if ((e = pthread_mutex_unlock(&mutex)) != 0) {
         std::cerr << "MUTEX ERROR: Failed to release lock: ";
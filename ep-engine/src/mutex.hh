@@ -30,13 +30,32 @@ public:
         return held && pthread_equal(holder, pthread_self());
     }
 
+    /**
+     * Count the acquisitions and releases of this lock, so readers of
+     * the data it guards that don't take it can tell whether anybody
+     * held it while they read.
+     */
+    void setSequenced() {
+        sequenced = true;
+    }
+
+    /**
+     * Get the number of acquisitions and releases of a sequenced lock
+     * (odd while it is held).
+     */
+    uint32_t getSequence() const {
+        return sequence;
+    }
+
 protected:
 
     // The holders of locks twiddle these flags.
     friend class LockHolder;
     friend class MultiLockHolder;
+    friend class TryLockHolder;
 
     void acquire();
+    bool tryAcquire();
     void release();
 
     void setHolder(bool isHeld) {
@@ -47,6 +66,8 @@ protected:
     pthread_mutex_t mutex;
     pthread_t holder;
     bool held;
+    bool sequenced;
+    volatile uint32_t sequence;
 
     DISALLOW_COPY_AND_ASSIGN(Mutex);
 };
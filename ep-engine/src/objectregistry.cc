@@ -16,9 +16,12 @@
  */
 #include "config.h"
 #include "ep_engine.h"
+#include "slab_allocator.hh"
 
 static ThreadLocal<EventuallyPersistentEngine*> *th;
 static ThreadLocal<Atomic<size_t>*> *initial_track;
+// Serves the threads that don't run on behalf of an engine.
+static SlabAllocator *default_allocator;
 
 /**
  * Object registry link hook for getting the registry thread local
@@ -30,6 +33,7 @@ public:
       if (th == NULL) {
          th = new ThreadLocal<EventuallyPersistentEngine*>();
          initial_track = new ThreadLocal<Atomic<size_t>*>();
+         default_allocator = new SlabAllocator();
       }
    }
 } install;
@@ -69,6 +73,17 @@ void ObjectRegistry::onDeleteBlob(Blob *blob)
    }
 }
 
+void ObjectRegistry::onDecompressBlob(Blob *blob, hrtime_t elapsed)
+{
+   (void)blob;
+   EventuallyPersistentEngine *engine = th->get();
+   if (verifyEngine(engine)) {
+       EPStats &stats = engine->getEpStats();
+       ++stats.numValueDecompressions;
+       stats.valueDecompressHisto.add(elapsed / 1000);
+   }
+}
+
 void ObjectRegistry::onCreateQueuedItem(QueuedItem *qi)
 {
    EventuallyPersistentEngine *engine = th->get();
@@ -124,6 +139,19 @@ void ObjectRegistry::setStats(Atomic<size_t>* init_track) {
     initial_track->set(init_track);
 }
 
+SlabAllocator *ObjectRegistry::getSlabAllocator() {
+    EventuallyPersistentEngine *engine = th->get();
+    return engine ? engine->getSlabAllocator() : default_allocator;
+}
+
+void *ObjectRegistry::allocate(size_t n) {
+    return getSlabAllocator()->allocate(n);
+}
+
+void ObjectRegistry::deallocate(void *p) {
+    SlabAllocator::deallocate(p);
+}
+
 bool ObjectRegistry::memoryAllocated(size_t mem) {
     EventuallyPersistentEngine *engine = th->get();
     if (initial_track->get()) {
@@ -20,12 +20,18 @@
 class EventuallyPersistentEngine;
 class Blob;
 class QueuedItem;
+class SlabAllocator;
 
 class ObjectRegistry {
 public:
     static void onCreateBlob(Blob *blob);
     static void onDeleteBlob(Blob *blob);
 
+    /**
+     * Account the decompression of a value into the given blob.
+     */
+    static void onDecompressBlob(Blob *blob, hrtime_t elapsed);
+
     static void onCreateQueuedItem(QueuedItem *qi);
     static void onDeleteQueuedItem(QueuedItem *qi);
 
@@ -36,6 +42,23 @@ public:
                                                       bool want_old_thread_local = false);
 
     static void setStats(Atomic<size_t>* init_track);
+
+    /**
+     * Get the slab allocator of the engine of this thread.
+     */
+    static SlabAllocator *getSlabAllocator();
+
+    /**
+     * Allocate memory for a Blob or StoredValue from the slab allocator
+     * of the engine of this thread.
+     */
+    static void *allocate(size_t n);
+
+    /**
+     * Free memory returned by allocate().
+     */
+    static void deallocate(void *p);
+
     static bool memoryAllocated(size_t mem);
     static bool memoryDeallocated(size_t mem);
 };
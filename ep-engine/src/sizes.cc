@@ -74,6 +74,7 @@ int main(int, char **) {
     display("Blob", sizeof(Blob));
     display("value_t", sizeof(value_t));
     display("HashTable", sizeof(HashTable));
+    display("HashBucket", sizeof(HashBucket));
     display("Item", sizeof(Item));
     display("QueuedItem", sizeof(QueuedItem));
     display("VBucket", sizeof(VBucket));
@@ -0,0 +1,472 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#include "config.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <new>
+
+#include "common.hh"
+#include "locks.hh"
+#include "slab_allocator.hh"
+
+const size_t SlabAllocator::slabSize = 256 * 1024;
+
+// Slab objects are 16 byte aligned while objects from the heap are
+// handed out 8 bytes past a 16 byte boundary, which tells them apart.
+static const uintptr_t largeMark = 8;
+static const size_t largeHeaderSize = 24;
+static const size_t maxClassSize = 16 * 1024;
+// Bytes of free objects a thread keeps in each size class.
+static const size_t threadCacheBytes = 16 * 1024;
+
+/**
+ * Header at the start of every slab.
+ */
+struct SlabAllocator::Slab {
+    SlabAllocator *owner;
+    int            sizeClass;
+    size_t         inUse;      // objects not on the free list
+    size_t         capacity;
+    char          *unused;     // objects never handed out start here
+    void          *freeList;
+    Slab          *prev;
+    Slab          *next;
+    bool           listed;     // on the partial list of its class
+};
+
+static const size_t slabHeaderSize = 128;
+
+/**
+ * Header of the objects that come straight from the heap.
+ */
+struct LargeHeader {
+    SlabAllocator *owner;
+    size_t         size;
+};
+
+/**
+ * Free objects kept by a thread.
+ */
+struct SlabAllocator::ThreadCache {
+    ThreadCache(SlabAllocator *o) : owner(o), cached(0) {
+        std::fill_n(heads, static_cast<int>(maxClasses), static_cast<void*>(NULL));
+        std::fill_n(counts, static_cast<int>(maxClasses), 0);
+    }
+
+    SlabAllocator *owner;
+    void          *heads[maxClasses];
+    size_t         counts[maxClasses];
+    size_t         cached;     // bytes of the objects above
+};
+
+/**
+ * The size classes: 16 byte steps up to 256 bytes, then steps of about
+ * an eighth of the size.
+ */
+class SlabClasses {
+public:
+    SlabClasses() : num(0) {
+        for (size_t s = 16; s <= maxClassSize; ++num) {
+            sizes[num] = s;
+            size_t step = std::max(static_cast<size_t>(16), (s / 8 + 15) & ~15);
+            s += step;
+        }
+        assert(num <= 64);
+        int c = 0;
+        for (size_t i = 0; i < sizeof(small) / sizeof(small[0]); ++i) {
+            while (sizes[c] < i * 16) {
+                ++c;
+            }
+            small[i] = c;
+        }
+    }
+
+    int forSize(size_t n) const {
+        if (n > sizes[num - 1]) {
+            return -1;
+        }
+        size_t i = (n + 15) / 16;
+        if (i < sizeof(small) / sizeof(small[0])) {
+            return small[i];
+        }
+        int c = small[sizeof(small) / sizeof(small[0]) - 1];
+        while (sizes[c] < n) {
+            ++c;
+        }
+        return c;
+    }
+
+    size_t sizes[64];
+    int    num;
+    int    small[65];   // class of sizes up to 1024, in 16 byte steps
+};
+
+static SlabClasses slabClasses;
+
+static void *popObject(void **head) {
+    void *rv = *head;
+    *head = *static_cast<void**>(rv);
+    return rv;
+}
+
+static void pushObject(void **head, void *p) {
+    *static_cast<void**>(p) = *head;
+    *head = p;
+}
+
+static size_t cacheLimit(int c) {
+    return std::max(static_cast<size_t>(2),
+                    threadCacheBytes / slabClasses.sizes[c]);
+}
+
+SlabAllocator::SlabAllocator() : threadCache(onThreadExit), refs(1),
+                                 released(false) {
+    assert(sizeof(Slab) <= slabHeaderSize);
+    assert(slabClasses.num <= maxClasses);
+}
+
+SlabAllocator::~SlabAllocator() {
+    // Every thread cache and every object holds a reference.
+    assert(threadCaches.empty());
+    std::set<Slab*>::iterator sit;
+    for (sit = slabs.begin(); sit != slabs.end(); ++sit) {
+        free(*sit);
+    }
+}
+
+void SlabAllocator::release() {
+    released = true;
+
+    ThreadCache *tc = threadCache.get();
+    if (tc != NULL) {
+        threadCache.set(NULL);
+        releaseThreadCache(tc);
+    }
+
+    // Empty slabs aren't kept around for reuse any more.
+    size_t freed = 0;
+    for (int c = 0; c < slabClasses.num; ++c) {
+        SizeClass &sc = classes[c];
+        LockHolder lh(sc.mutex);
+        if (sc.spare != NULL) {
+            freeSlab(sc.spare);
+            sc.spare = NULL;
+            ++freed;
+        }
+    }
+    unref(freed + 1);
+}
+
+void SlabAllocator::unref(size_t n) {
+    if (refs.decr(n) == 0) {
+        delete this;
+    }
+}
+
+int SlabAllocator::getNumClasses() {
+    return slabClasses.num;
+}
+
+size_t SlabAllocator::getClassSize(int c) {
+    assert(c >= 0 && c < slabClasses.num);
+    return slabClasses.sizes[c];
+}
+
+int SlabAllocator::getClassForSize(size_t n) {
+    return slabClasses.forSize(n);
+}
+
+void *SlabAllocator::allocate(size_t n) {
+    assert(!released);
+    int c = slabClasses.forSize(n);
+    if (c < 0) {
+        return allocateLarge(n);
+    }
+
+    ThreadCache *tc = getThreadCache();
+    if (tc->counts[c] == 0) {
+        refill(tc, c);
+    }
+    --tc->counts[c];
+    tc->cached -= slabClasses.sizes[c];
+    return popObject(&tc->heads[c]);
+}
+
+void SlabAllocator::deallocate(void *p) {
+    if (p == NULL) {
+        return;
+    }
+    if (reinterpret_cast<uintptr_t>(p) & largeMark) {
+        deallocateLarge(p);
+        return;
+    }
+
+    Slab *s = reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(p) &
+                                      ~(static_cast<uintptr_t>(slabSize) - 1));
+    int c = s->sizeClass;
+    SlabAllocator *owner = s->owner;
+    ThreadCache *tc = owner->threadCache.get();
+    if (tc == NULL || owner->released) {
+        // Only the threads allocating from the allocator cache objects,
+        // the others give them straight back to their slab.
+        owner->freeObject(c, p);
+        if (tc != NULL) {
+            owner->threadCache.set(NULL);
+            owner->releaseThreadCache(tc);
+        }
+        return;
+    }
+    pushObject(&tc->heads[c], p);
+    ++tc->counts[c];
+    tc->cached += slabClasses.sizes[c];
+    if (tc->counts[c] > cacheLimit(c)) {
+        owner->flush(tc, c, cacheLimit(c) / 2);
+    }
+}
+
+void *SlabAllocator::allocateLarge(size_t n) {
+    // The heap only promises the alignment of its largest fundamental
+    // type, ask for the 16 bytes the large mark relies on.
+    void *v = NULL;
+    if (posix_memalign(&v, 16, n + largeHeaderSize) != 0) {
+        throw std::bad_alloc();
+    }
+    char *m = static_cast<char*>(v);
+    LargeHeader *h = reinterpret_cast<LargeHeader*>(m);
+    h->owner = this;
+    h->size = n + largeHeaderSize;
+    refs.incr(1);
+    heapSize.incr(h->size);
+    largeSize.incr(h->size);
+    return m + largeHeaderSize;
+}
+
+void SlabAllocator::deallocateLarge(void *p) {
+    char *m = static_cast<char*>(p) - largeHeaderSize;
+    LargeHeader *h = reinterpret_cast<LargeHeader*>(m);
+    SlabAllocator *owner = h->owner;
+    owner->heapSize.decr(h->size);
+    owner->largeSize.decr(h->size);
+    free(m);
+    owner->unref();
+}
+
+SlabAllocator::ThreadCache *SlabAllocator::getThreadCache() {
+    ThreadCache *tc = threadCache.get();
+    if (tc == NULL) {
+        tc = new ThreadCache(this);
+        refs.incr(1);
+        LockHolder lh(mutex);
+        threadCaches.insert(tc);
+        lh.unlock();
+        threadCache.set(tc);
+    }
+    return tc;
+}
+
+void SlabAllocator::onThreadExit(void *arg) {
+    ThreadCache *tc = static_cast<ThreadCache*>(arg);
+    tc->owner->releaseThreadCache(tc);
+}
+
+void SlabAllocator::releaseThreadCache(ThreadCache *tc) {
+    for (int c = 0; c < slabClasses.num; ++c) {
+        flush(tc, c, 0);
+    }
+    LockHolder lh(mutex);
+    threadCaches.erase(tc);
+    lh.unlock();
+    delete tc;
+    unref();
+}
+
+void SlabAllocator::refill(ThreadCache *tc, int c) {
+    size_t size = slabClasses.sizes[c];
+    size_t want = std::max(static_cast<size_t>(1), cacheLimit(c) / 2);
+    SizeClass &sc = classes[c];
+
+    LockHolder lh(sc.mutex);
+    while (want > 0) {
+        Slab *s = sc.partial;
+        if (s == NULL) {
+            s = sc.spare;
+            sc.spare = NULL;
+            if (s == NULL) {
+                s = newSlab(c);
+            }
+            s->prev = NULL;
+            s->next = NULL;
+            s->listed = true;
+            sc.partial = s;
+        }
+
+        while (want > 0 && s->inUse < s->capacity) {
+            void *p;
+            if (s->freeList) {
+                p = popObject(&s->freeList);
+            } else {
+                p = s->unused;
+                s->unused += size;
+            }
+            ++s->inUse;
+            pushObject(&tc->heads[c], p);
+            ++tc->counts[c];
+            tc->cached += size;
+            slabFree.decr(size);
+            --want;
+        }
+
+        if (s->inUse == s->capacity) {
+            // Full slabs come back to the list when an object is freed.
+            sc.partial = s->next;
+            if (sc.partial) {
+                sc.partial->prev = NULL;
+            }
+            s->listed = false;
+        }
+    }
+}
+
+void SlabAllocator::flush(ThreadCache *tc, int c, size_t keep) {
+    size_t size = slabClasses.sizes[c];
+    size_t freed = 0;
+
+    LockHolder lh(classes[c].mutex);
+    while (tc->counts[c] > keep) {
+        void *p = popObject(&tc->heads[c]);
+        --tc->counts[c];
+        tc->cached -= size;
+        if (putBack_UNLOCKED(c, p)) {
+            ++freed;
+        }
+    }
+    lh.unlock();
+
+    if (freed > 0) {
+        unref(freed);
+    }
+}
+
+void SlabAllocator::freeObject(int c, void *p) {
+    LockHolder lh(classes[c].mutex);
+    bool freed = putBack_UNLOCKED(c, p);
+    lh.unlock();
+
+    if (freed) {
+        unref();
+    }
+}
+
+/**
+ * Put an object back on the free list of its slab.  The caller holds
+ * the lock of the size class, and drops the slab's reference once it
+ * released the lock if the slab went back to the heap.
+ *
+ * @return true if the slab went back to the heap
+ */
+bool SlabAllocator::putBack_UNLOCKED(int c, void *p) {
+    SizeClass &sc = classes[c];
+    slabFree.incr(slabClasses.sizes[c]);
+
+    Slab *s = reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(p) &
+                                      ~(static_cast<uintptr_t>(slabSize) - 1));
+    assert(s->owner == this && s->sizeClass == c);
+    pushObject(&s->freeList, p);
+    --s->inUse;
+
+    if (!s->listed) {
+        s->prev = NULL;
+        s->next = sc.partial;
+        if (sc.partial) {
+            sc.partial->prev = s;
+        }
+        sc.partial = s;
+        s->listed = true;
+    }
+
+    if (s->inUse == 0) {
+        // Keep one empty slab around, give the others back.
+        if (s->prev) {
+            s->prev->next = s->next;
+        } else {
+            sc.partial = s->next;
+        }
+        if (s->next) {
+            s->next->prev = s->prev;
+        }
+        s->listed = false;
+        s->freeList = NULL;
+        s->unused = reinterpret_cast<char*>(s) + slabHeaderSize;
+        if (sc.spare == NULL && !released) {
+            sc.spare = s;
+        } else {
+            freeSlab(s);
+            return true;
+        }
+    }
+    return false;
+}
+
+SlabAllocator::Slab *SlabAllocator::newSlab(int c) {
+    void *m = NULL;
+    if (posix_memalign(&m, slabSize, slabSize) != 0) {
+        throw std::bad_alloc();
+    }
+    Slab *s = static_cast<Slab*>(m);
+    s->owner = this;
+    s->sizeClass = c;
+    s->inUse = 0;
+    s->capacity = (slabSize - slabHeaderSize) / slabClasses.sizes[c];
+    s->unused = static_cast<char*>(m) + slabHeaderSize;
+    s->freeList = NULL;
+    s->prev = NULL;
+    s->next = NULL;
+    s->listed = false;
+
+    refs.incr(1);
+    heapSize.incr(slabSize);
+    slabFree.incr(s->capacity * slabClasses.sizes[c]);
+    slabOverhead.incr(slabSize - s->capacity * slabClasses.sizes[c]);
+    LockHolder lh(mutex);
+    slabs.insert(s);
+    return s;
+}
+
+void SlabAllocator::freeSlab(Slab *s) {
+    size_t objects = s->capacity * slabClasses.sizes[s->sizeClass];
+    heapSize.decr(slabSize);
+    slabFree.decr(objects);
+    slabOverhead.decr(slabSize - objects);
+    LockHolder lh(mutex);
+    slabs.erase(s);
+    lh.unlock();
+    free(s);
+}
+
+size_t SlabAllocator::getHeapSize() {
+    return heapSize.get();
+}
+
+size_t SlabAllocator::getAllocatedSize() {
+    // Other threads update their cache sizes without locking, this
+    // is only an estimate for the stats.
+    size_t held(slabFree.get() + slabOverhead.get());
+    LockHolder lh(mutex);
+    std::set<ThreadCache*>::iterator it;
+    for (it = threadCaches.begin(); it != threadCaches.end(); ++it) {
+        held += (*it)->cached;
+    }
+    lh.unlock();
+
+    size_t heap = heapSize.get();
+    return heap > held ? heap - held : 0;
+}
+
+void SlabAllocator::getStats(std::map<std::string, size_t> &stats) {
+    size_t heap(getHeapSize()), allocated(getAllocatedSize());
+    stats["ep_slab_heap_bytes"] = heap;
+    stats["ep_slab_allocated_bytes"] = allocated;
+    stats["ep_slab_fragmentation_bytes"] = heap > allocated ? heap - allocated : 0;
+    stats["ep_slab_large_bytes"] = largeSize.get();
+}
@@ -0,0 +1,146 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+#ifndef SLAB_ALLOCATOR_HH
+#define SLAB_ALLOCATOR_HH 1
+
+#include "config.h"
+
+#include <map>
+#include <set>
+#include <string>
+
+#include "atomic.hh"
+#include "mutex.hh"
+
+/**
+ * Size classed slab allocator for values and StoredValues.
+ *
+ * Objects are carved out of aligned slabs holding objects of a single
+ * size class, so churn reuses the same slabs instead of scattering
+ * holes of all sizes over the heap.  Slabs whose objects are all free
+ * again go back to the heap.
+ *
+ * Every thread keeps a few free objects of each class, so allocating
+ * and freeing only takes the class lock to move batches of objects
+ * between the thread and the slabs.
+ *
+ * Objects larger than the biggest size class come straight from the
+ * heap.
+ *
+ * Objects may outlive the owner of the allocator, so the allocator is
+ * reference counted by its owner, its slabs, its large objects and the
+ * thread caches.  The owner gives up its reference with release(), and
+ * the allocator deletes itself once everything else is gone too.
+ */
+class SlabAllocator {
+public:
+
+    SlabAllocator();
+
+    /**
+     * Drop the owner's reference.  No more objects may be allocated
+     * afterwards, but the objects still in use can be freed.
+     */
+    void release();
+
+    /**
+     * Allocate n bytes.
+     *
+     * @throw std::bad_alloc if there's no memory left
+     */
+    void *allocate(size_t n);
+
+    /**
+     * Free memory returned by allocate() of any SlabAllocator.
+     */
+    static void deallocate(void *p);
+
+    /**
+     * Get the number of bytes this allocator got from the heap.
+     */
+    size_t getHeapSize();
+
+    /**
+     * Get the number of bytes of the objects in use (rounded up to
+     * their size class).
+     */
+    size_t getAllocatedSize();
+
+    /**
+     * Get the number of bytes this allocator holds but aren't in use.
+     */
+    size_t getFragmentation() {
+        size_t heap(getHeapSize()), allocated(getAllocatedSize());
+        return heap > allocated ? heap - allocated : 0;
+    }
+
+    /**
+     * Add the stats of this allocator to the given map.
+     */
+    void getStats(std::map<std::string, size_t> &stats);
+
+    /**
+     * Get the number of size classes.
+     */
+    static int getNumClasses();
+
+    /**
+     * Get the size of the objects of the given class.
+     */
+    static size_t getClassSize(int c);
+
+    /**
+     * Get the size class serving objects of n bytes, or -1 for objects
+     * coming straight from the heap.
+     */
+    static int getClassForSize(size_t n);
+
+    static const size_t slabSize;
+
+private:
+
+    struct Slab;
+    struct ThreadCache;
+
+    //! The free slabs and the slabs with free objects of a size class.
+    struct SizeClass {
+        SizeClass() : partial(NULL), spare(NULL) {}
+
+        Mutex  mutex;
+        Slab  *partial;
+        Slab  *spare;
+    };
+
+    ~SlabAllocator();
+
+    ThreadCache *getThreadCache();
+    void refill(ThreadCache *tc, int c);
+    void flush(ThreadCache *tc, int c, size_t keep);
+    void freeObject(int c, void *p);
+    bool putBack_UNLOCKED(int c, void *p);
+    void releaseThreadCache(ThreadCache *tc);
+    void unref(size_t n = 1);
+    Slab *newSlab(int c);
+    void freeSlab(Slab *s);
+    void *allocateLarge(size_t n);
+
+    static void deallocateLarge(void *p);
+    static void onThreadExit(void *arg);
+
+    static const int maxClasses = 64;
+
+    SizeClass                 classes[maxClasses];
+    ThreadLocal<ThreadCache*> threadCache;
+    Mutex                     mutex;     // guards slabs and threadCaches
+    std::set<Slab*>           slabs;
+    std::set<ThreadCache*>    threadCaches;
+    Atomic<size_t>            heapSize;
+    Atomic<size_t>            slabFree;  // bytes of free objects in slabs
+    Atomic<size_t>            slabOverhead; // slab headers and tails
+    Atomic<size_t>            largeSize;
+    Atomic<size_t>            refs;
+    volatile bool             released;
+
+    DISALLOW_COPY_AND_ASSIGN(SlabAllocator);
+};
+
+#endif /* SLAB_ALLOCATOR_HH */
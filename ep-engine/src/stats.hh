@@ -141,6 +141,18 @@ public:
     Atomic<size_t> numValueEjects;
     //! Number of times a value could not be ejected
     Atomic<size_t> numFailedEjects;
+    //! Number of items the item pager looked at for ejection
+    Atomic<size_t> pagerItemsScanned;
+    //! Number of values the item pager ejected although accessed recently
+    Atomic<size_t> pagerHotEjects;
+    //! Number of times a value got compressed in memory
+    Atomic<size_t> numValueCompressions;
+    //! Number of bytes of the values before they got compressed
+    Atomic<size_t> valueCompressInBytes;
+    //! Number of bytes of the values after they got compressed
+    Atomic<size_t> valueCompressOutBytes;
+    //! Number of times a compressed value got decompressed for a read
+    Atomic<size_t> numValueDecompressions;
     //! Number of times "Not my bucket" happened
     Atomic<size_t> numNotMyVBuckets;
     //! Total size of stored objects.
@@ -186,6 +198,20 @@ public:
     Atomic<size_t> bg_meta_fetched;
     //! Number of remaining bg fetch jobs.
     Atomic<size_t> numRemainingBgJobs;
+    //! Number of pending bg fetches that are fetched without waiting.
+    Atomic<size_t> bgFetchBatchSize;
+    //! Target 99th percentile bg fetch latency (in usec).
+    Atomic<hrtime_t> bgFetchLatencySLO;
+    //! Max time (in usec) bg fetches wait to be batched with others.
+    Atomic<size_t> bgFetchMaxWindow;
+    //! Current time (in usec) bg fetches wait to be batched with others.
+    Atomic<size_t> bgFetchWindow;
+    //! Histogram of the number of items per batched bg fetch.
+    Histogram<size_t> bgFetchBatchSizeHisto;
+    //! Histogram of the time the oldest item of a batch waited for it.
+    Histogram<hrtime_t> bgFetchBatchWaitHisto;
+    //! Histogram of the time taken to decompress a value for a read.
+    Histogram<hrtime_t> valueDecompressHisto;
     //! The number of samples the bgWaitDelta and bgLoadDelta contains of
     Atomic<size_t> bgNumOperations;
     /** The sum of the deltas (in usec) from an item was put in queue until
@@ -217,6 +243,9 @@ public:
     //! Total wall time of deleting vbuckets
     Atomic<hrtime_t> vbucketDelTotWalltime;
 
+    //! Longest time (µs) a hash table resize held bucket locks
+    Atomic<hrtime_t> htResizeMaxPause;
+
     //! Histogram of time an item spends non-resident.
     Histogram<rel_time_t> pagedOutTimeHisto;
 
@@ -367,6 +396,12 @@ public:
         itemsRemovedFromCheckpoints.set(0);
         numValueEjects.set(0);
         numFailedEjects.set(0);
+        pagerItemsScanned.set(0);
+        pagerHotEjects.set(0);
+        numValueCompressions.set(0);
+        valueCompressInBytes.set(0);
+        valueCompressOutBytes.set(0);
+        numValueDecompressions.set(0);
         numNotMyVBuckets.set(0);
         io_num_read.set(0);
         io_num_write.set(0);
@@ -394,6 +429,7 @@ public:
         numTapFetched.set(0);
         vbucketDelMaxWalltime.set(0);
         vbucketDelTotWalltime.set(0);
+        htResizeMaxPause.set(0);
 
         mlogCompactorRuns.set(0);
         alogRuns.set(0);
@@ -414,6 +450,7 @@ public:
         tapMutationHisto.reset();
         tapVbucketSetHisto.reset();
         notifyIOHisto.reset();
+        valueDecompressHisto.reset();
         getStatsCmdHisto.reset();
         chkPersistenceHisto.reset();
         diskInsertHisto.reset();
@@ -427,6 +464,8 @@ public:
         dirtyAgeHisto.reset();
         mlogCompactorHisto.reset();
         getMultiHisto.reset();
+        bgFetchBatchSizeHisto.reset();
+        bgFetchBatchWaitHisto.reset();
     }
 
     // Used by stats logging infrastructure.
@@ -1,10 +1,16 @@
 /* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
 #include "config.h"
 #include <cassert>
+#include <cstdlib>
 #include <limits>
+#include <sched.h>
 
 #include "stored-value.hh"
 
+#ifdef HAVE_LIBSNAPPY
+#include <snappy-c.h>
+#endif
+
 #ifndef DEFAULT_HT_SIZE
 #define DEFAULT_HT_SIZE 1531
 #endif
@@ -12,6 +18,11 @@
 size_t HashTable::defaultNumBuckets = DEFAULT_HT_SIZE;
 size_t HashTable::defaultNumLocks = 193;
 enum stored_value_type HashTable::defaultStoredValueType = featured;
+enum hash_table_layout HashTable::defaultLayout = chained;
+bool HashTable::defaultOptimisticReads = true;
+const size_t HashTable::resizeStep = 4;
+const size_t HashTable::retireBatch = 16;
+const int HashTable::optimisticReadAttempts = 3;
 double StoredValue::mutation_mem_threshold = 0.9;
 const int64_t StoredValue::state_id_cleared = -1;
 const int64_t StoredValue::state_id_pending = -2;
@@ -26,33 +37,46 @@ static ssize_t prime_size_table[] = {
     1610612741, -1
 };
 
+void StoredValue::assignValue(const value_t &nv, HashTable &ht) {
+    value_t old(value);
+    value = nv;
+    // Lock free readers may still be copying the old value.
+    ht.retireValue(old);
+}
+
+void StoredValue::replaceValue(const value_t &nv, EPStats &stats,
+                               HashTable &ht) {
+    size_t oldsize = size();
+    size_t old_valsize = value->length();
+    assignValue(nv, ht);
+    size_t newsize = size();
+    size_t new_valsize = value->length();
+
+    // ejecting the value may increase the object size....
+    if (oldsize < newsize) {
+        increaseCacheSize(ht, newsize - oldsize);
+    } else if (newsize < oldsize) {
+        reduceCacheSize(ht, oldsize - newsize);
+    }
+    // Add or substract the key/meta data overhead differenece.
+    size_t old_keymeta_overhead = (oldsize - old_valsize);
+    size_t new_keymeta_overhead = (newsize - new_valsize);
+    if (old_keymeta_overhead < new_keymeta_overhead) {
+        increaseCurrentSize(stats, new_keymeta_overhead - old_keymeta_overhead);
+    } else if (new_keymeta_overhead < old_keymeta_overhead) {
+        reduceCurrentSize(stats, old_keymeta_overhead - new_keymeta_overhead);
+    }
+}
+
 bool StoredValue::ejectValue(EPStats &stats, HashTable &ht) {
     if (eligibleForEviction()) {
-        size_t oldsize = size();
-        size_t old_valsize = value->length();
         blobval uval;
         uval.len = valLength();
         value_t sp(Blob::New(uval.chlen, sizeof(uval)));
         extra.feature.resident = false;
+        extra.feature.compressed = false;
         timestampEviction();
-        value = sp;
-        size_t newsize = size();
-        size_t new_valsize = value->length();
-
-        // ejecting the value may increase the object size....
-        if (oldsize < newsize) {
-            increaseCacheSize(ht, newsize - oldsize);
-        } else if (newsize < oldsize) {
-            reduceCacheSize(ht, oldsize - newsize);
-        }
-        // Add or substract the key/meta data overhead differenece.
-        size_t old_keymeta_overhead = (oldsize - old_valsize);
-        size_t new_keymeta_overhead = (newsize - new_valsize);
-        if (old_keymeta_overhead < new_keymeta_overhead) {
-            increaseCurrentSize(stats, new_keymeta_overhead - old_keymeta_overhead);
-        } else if (new_keymeta_overhead < old_keymeta_overhead) {
-            reduceCurrentSize(stats, old_keymeta_overhead - new_keymeta_overhead);
-        }
+        replaceValue(sp, stats, ht);
         ++stats.numValueEjects;
         ++ht.numNonResidentItems;
         ++ht.numEjects;
@@ -65,11 +89,104 @@ bool StoredValue::ejectValue(EPStats &stats, HashTable &ht) {
     return false;
 }
 
+bool StoredValue::compressValue(EPStats &stats, HashTable &ht) {
+#ifdef HAVE_LIBSNAPPY
+    if (_isSmall || isDeleted() || !isResident() || isCompressed()) {
+        return false;
+    }
+    size_t len = value->length();
+    size_t clen = snappy_max_compressed_length(len);
+    std::vector<char> buf(clen);
+    if (snappy_compress(value->getData(), len, &buf[0], &clen) != SNAPPY_OK ||
+        clen > len - len / 8) {
+        // Not worth decompressing it when it gets accessed again.
+        return false;
+    }
+    value_t sp(Blob::New(&buf[0], clen));
+    replaceValue(sp, stats, ht);
+    extra.feature.compressed = true;
+    ++stats.numValueCompressions;
+    stats.valueCompressInBytes.incr(len);
+    stats.valueCompressOutBytes.incr(clen);
+    return true;
+#else
+    (void)stats;
+    (void)ht;
+    return false;
+#endif
+}
+
+void StoredValue::inflateValue(EPStats &stats, HashTable &ht) {
+    if (!isCompressed()) {
+        return;
+    }
+    value_t sp(decompressValue());
+    extra.feature.compressed = false;
+    replaceValue(sp, stats, ht);
+}
+
+value_t StoredValue::decompressValue() const {
+#ifdef HAVE_LIBSNAPPY
+    hrtime_t start = gethrtime();
+    size_t len = decompressedLength();
+    Blob *data = Blob::New(len);
+    snappy_status rv = snappy_uncompress(value->getData(), value->length(),
+                                         const_cast<char*>(data->getData()),
+                                         &len);
+    assert(rv == SNAPPY_OK);
+    assert(len == data->length());
+    ObjectRegistry::onDecompressBlob(data, gethrtime() - start);
+    return value_t(data);
+#else
+    abort();
+    return value;
+#endif
+}
+
+size_t StoredValue::decompressedLength() const {
+#ifdef HAVE_LIBSNAPPY
+    size_t len(0);
+    snappy_status rv = snappy_uncompressed_length(value->getData(),
+                                                  value->length(), &len);
+    assert(rv == SNAPPY_OK);
+    return len;
+#else
+    abort();
+    return 0;
+#endif
+}
+
 void StoredValue::referenced(HashTable &ht) {
-    if (!_isSmall && extra.feature.nru == false) {
+    if (_isSmall) {
+        return;
+    }
+    if (extra.feature.nru == false) {
         extra.feature.nru = true;
         ++ht.numReferenced;
     }
+    if (extra.feature.freq < maxAccessFrequency) {
+        ++extra.feature.freq;
+    }
+}
+
+void StoredValue::indexExpiry(HashTable &ht, time_t previous) {
+    if (_isSmall) {
+        return;
+    }
+    time_t exptime = extra.feature.exptime;
+    if (exptime == 0) {
+        unindexExpiry(ht);
+    } else if (!extra.feature.expiryIndexed || exptime != previous) {
+        ht.expiryIndex.add(getKey(), exptime);
+        extra.feature.expiryIndexed = true;
+    }
+}
+
+void StoredValue::unindexExpiry(HashTable &ht) {
+    if (!_isSmall && extra.feature.expiryIndexed) {
+        ht.expiryIndex.remove(getKey());
+        extra.feature.expiryIndexed = false;
+    }
 }
 
 bool StoredValue::isReferenced(bool reset, HashTable *ht) {
@@ -122,7 +239,7 @@ bool StoredValue::unlocked_restoreValue(Item *itm, EPStats &stats,
         rel_time_t evicted_time(getEvictedTime());
         stats.pagedOutTimeHisto.add(ep_current_time() - evicted_time);
         extra.feature.resident = true;
-        value = itm->getValue();
+        assignValue(itm->getValue(), ht);
 
         size_t newsize = size();
         size_t new_valsize = value->length();
@@ -153,18 +270,19 @@ mutation_type_t HashTable::insert(const Item &itm, bool eject, bool partial) {
 
     assert(itm.getCas() != static_cast<uint64_t>(-1));
 
+    migrateSome();
     int bucket_num(0);
     LockHolder lh = getLockedBucket(itm.getKey(), &bucket_num);
     StoredValue *v = unlocked_find(itm.getKey(), bucket_num, true, false);
 
     if (v == NULL) {
-        v = valFact(itm, values[bucket_num], *this);
+        v = valFact(itm, NULL, *this);
         v->markClean(NULL);
         if (partial) {
             v->extra.feature.resident = false;
             ++numNonResidentItems;
         }
-        values[bucket_num] = v;
+        unlocked_link(v, bucket_num);
         ++numItems;
     } else {
         if (partial) {
@@ -262,18 +380,40 @@ HashTableStatVisitor HashTable::clear(bool deactivate) {
     if (deactivate) {
         setActiveState(false);
     }
-    for (int i = 0; i < (int)size; i++) {
-        while (values[i]) {
-            StoredValue *v = values[i];
+    StoredValue *detached = NULL;
+    for (int i = 0; i < (int)table.size; i++) {
+        StoredValue *v = detachIn(table, i);
+        while (v) {
+            StoredValue *next = v->next;
+            rv.visit(v);
+            v->next = detached;
+            detached = v;
+            v = next;
+        }
+    }
+    for (int i = 0; i < (int)resizeTable.size; i++) {
+        StoredValue *v = detachIn(resizeTable, i);
+        while (v) {
+            StoredValue *next = v->next;
             rv.visit(v);
-            values[i] = v->next;
-            delete v;
+            v->next = detached;
+            detached = v;
+            v = next;
         }
     }
+    if (optimisticReads) {
+        reclaim(true);
+    }
+    while (detached) {
+        StoredValue *next = detached->next;
+        delete detached;
+        detached = next;
+    }
 
     stats.currentSize.decr(rv.memSize - rv.valSize);
     assert(stats.currentSize.get() < GIGANTOR);
 
+    expiryIndex.clear();
     numItems.set(0);
     numTempItems.set(0);
     numNonResidentItems.set(0);
@@ -286,62 +426,127 @@ HashTableStatVisitor HashTable::clear(bool deactivate) {
 }
 
 void HashTable::resize(size_t newSize) {
+    if (startResize(newSize)) {
+        migrate(std::numeric_limits<size_t>::max());
+    }
+}
+
+bool HashTable::startResize(size_t newSize) {
     assert(isActive());
 
     // Due to the way hashing works, we can't fit anything larger than
     // an int.
     if (newSize > static_cast<size_t>(std::numeric_limits<int>::max())) {
-        return;
+        return false;
+    }
+
+    LockHolder rlh(resizeMutex);
+    if (isResizing()) {
+        // Only one resize at a time, the next attempt will have to
+        // pick up any other size.
+        return newSize == resizeTable.size;
     }
 
     // Don't resize to the same size, either.
-    if (newSize == size) {
-        return;
+    if (newSize == table.size) {
+        return false;
+    }
+
+    // Get a place for the new items.  If we can't allocate memory,
+    // don't move stuff around.
+    BucketArray a;
+    if (!allocateArray(a, newSize)) {
+        return false;
+    }
+
+    stats.memOverhead.decr(memorySize());
+    resizeMutexes = new Mutex[n_locks];
+    assert(migrated.get() == 0);
+    // Nothing looks at the new buckets before the first one is migrated.
+    resizeTable = a;
+    ep_sync_synchronize();
+    stats.memOverhead.incr(memorySize());
+    assert(stats.memOverhead.get() < GIGANTOR);
+    return true;
+}
+
+size_t HashTable::migrate(size_t n, bool wait) {
+    if (!isResizing()) {
+        return 0;
+    }
+
+    TryLockHolder rlh(resizeMutex, wait);
+    if (!rlh.isLocked() || !isResizing()) {
+        return getResizeRemaining();
     }
 
+    for (; n > 0 && migrated.get() < table.size; --n) {
+        int bucket_num = static_cast<int>(migrated.get());
+        TryLockHolder lh(mutexes[mutexForBucket(bucket_num)], wait);
+        if (!lh.isLocked()) {
+            break;
+        }
+        hrtime_t start = gethrtime();
+        if (visitors.get() > 0) {
+            // Visitors walk the buckets that weren't migrated yet and
+            // then the new ones, don't move items between the two
+            // under their feet.
+            break;
+        }
+
+        StoredValue *v = detachIn(table, bucket_num);
+        while (v) {
+            StoredValue *next = v->next;
+            int h = hash(v->getKeyBytes(), v->getKeyLen());
+            int nb = getResizedBucketForHash(h);
+            LockHolder nlh(resizeMutexes[mutexForBucket(nb)]);
+            linkIn(resizeTable, nb, v, h);
+            v = next;
+        }
+        ++migrated;
+        lh.unlock();
+        stats.htResizeMaxPause.setIfBigger((gethrtime() - start) / 1000);
+    }
+
+    if (migrated.get() == table.size && wait) {
+        finishResize();
+    }
+    return getResizeRemaining();
+}
+
+void HashTable::finishResize() {
     MultiLockHolder mlh(mutexes, n_locks);
+    hrtime_t start = gethrtime();
     if (visitors.get() > 0) {
-        // Do not allow a resize while any visitors are actually
+        // Do not swap the tables while any visitors are actually
         // processing.  The next attempt will have to pick it up.  New
         // visitors cannot start doing meaningful work (we own all
         // locks at this point).
         return;
     }
 
-    // Get a place for the new items.
-    StoredValue **newValues = static_cast<StoredValue**>(calloc(newSize,
-                                                                sizeof(StoredValue*)));
-    // If we can't allocate memory, don't move stuff around.
-    if (!newValues) {
-        return;
-    }
-
     stats.memOverhead.decr(memorySize());
     ++numResizes;
 
-    // Set the new size so all the hashy stuff works.
-    size_t oldSize = size;
-    size = newSize;
-    ep_sync_synchronize();
-
-    // Move existing records into the new space.
-    for (size_t i = 0; i < oldSize; i++) {
-        while (values[i]) {
-            StoredValue *v = values[i];
-            values[i] = v->next;
-
-            int newBucket = getBucketForHash(hash(v->getKeyBytes(), v->getKeyLen()));
-            v->next = newValues[newBucket];
-            newValues[newBucket] = v;
-        }
-    }
-
-    // values still points to the old (now empty) table.
-    free(values);
-    values = newValues;
+    // Everything lives in the new buckets now, the old ones are empty.
+    BucketArray old = table;
+    table = resizeTable;
+    resizeTable = BucketArray();
+    migrated.set(0);
+    delete []resizeMutexes;
+    resizeMutexes = NULL;
 
     stats.memOverhead.incr(memorySize());
     assert(stats.memOverhead.get() < GIGANTOR);
+    mlh.unlock();
+    stats.htResizeMaxPause.setIfBigger((gethrtime() - start) / 1000);
+
+    if (optimisticReads) {
+        // Lock free readers may still be looking at the old buckets,
+        // wait for them without holding up the writers.
+        ReaderEpoch::synchronize();
+    }
+    freeArray(old);
 }
 
 static size_t distance(size_t a, size_t b) {
@@ -359,6 +564,10 @@ static bool isCurrently(size_t size, ssize_t a, ssize_t b) {
 
 void HashTable::resize() {
     size_t ni = getNumItems();
+    if (layout == cacheline) {
+        // Aim for buckets that are about two thirds full.
+        ni = ni / (HashBucket::numSlots * 2 / 3);
+    }
     int i(0);
     size_t new_size(0);
 
@@ -374,16 +583,16 @@ void HashTable::resize() {
     } else if (prime_size_table[i] < static_cast<ssize_t>(defaultNumBuckets)) {
         // Was going to be smaller than the configured ht_size.
         new_size = defaultNumBuckets;
-    } else if (isCurrently(size, prime_size_table[i-1], prime_size_table[i])) {
+    } else if (isCurrently(table.size, prime_size_table[i-1], prime_size_table[i])) {
         // If one of the candidate sizes is the current size, maintain
         // the current size in order to remain stable.
-        new_size = size;
+        new_size = table.size;
     } else {
         // Somewhere in the middle, use the one we're closer to.
         new_size = nearest(ni, prime_size_table[i-1], prime_size_table[i]);
     }
 
-    resize(new_size);
+    startResize(new_size);
 }
 
 void HashTable::visit(HashTableVisitor &visitor) {
@@ -395,23 +604,43 @@ void HashTable::visit(HashTableVisitor &visitor) {
     size_t visited = 0;
     for (int l = 0; isActive() && !aborted && l < static_cast<int>(n_locks); l++) {
         LockHolder lh(mutexes[l]);
-        for (int i = l; i < static_cast<int>(size); i+= n_locks) {
+        for (int i = l; i < static_cast<int>(table.size); i+= n_locks) {
             assert(l == mutexForBucket(i));
-            StoredValue *v = values[i];
-            assert(v == NULL || i == getBucketForHash(hash(v->getKeyBytes(),
-                                                           v->getKeyLen())));
-            while (v) {
-                visitor.visit(v);
-                v = v->next;
-            }
+            visitIn(table, i, visitor);
             ++visited;
         }
         lh.unlock();
         aborted = !visitor.shouldContinue();
     }
-    assert(aborted || visited == size);
+    assert(aborted || visited == table.size);
+
+    // The migrated buckets were left empty above, their items are in
+    // the new buckets.
+    for (int i = 0; isActive() && !aborted && isResizing() &&
+             i < static_cast<int>(resizeTable.size); i++) {
+        visitResized(i, visitor);
+        if ((i % n_locks) == 0) {
+            aborted = !visitor.shouldContinue();
+        }
+    }
 }
 
+/**
+ * Hash table visitor summing up the values of a single bucket.
+ */
+class BucketDepthVisitor : public HashTableVisitor {
+public:
+    BucketDepthVisitor() : depth(0), mem(0) {}
+
+    void visit(StoredValue *v) {
+        ++depth;
+        mem += v->size();
+    }
+
+    size_t depth;
+    size_t mem;
+};
+
 void HashTable::visitDepth(HashTableDepthVisitor &visitor) {
     if (numItems.get() == 0 || !isActive()) {
         return;
@@ -421,23 +650,246 @@ void HashTable::visitDepth(HashTableDepthVisitor &visitor) {
 
     for (int l = 0; l < static_cast<int>(n_locks); l++) {
         LockHolder lh(mutexes[l]);
-        for (int i = l; i < static_cast<int>(size); i+= n_locks) {
-            size_t depth = 0;
-            StoredValue *p = values[i];
-            assert(p == NULL || i == getBucketForHash(hash(p->getKeyBytes(),
-                                                           p->getKeyLen())));
-            size_t mem(0);
-            while (p) {
-                depth++;
-                mem += p->size();
-                p = p->next;
-            }
-            visitor.visit(i, depth, mem);
+        for (int i = l; i < static_cast<int>(table.size); i+= n_locks) {
             ++visited;
+            if (isMigrated(i)) {
+                continue;
+            }
+            BucketDepthVisitor bucket;
+            visitIn(table, i, bucket);
+            visitor.visit(i, bucket.depth, bucket.mem);
+        }
+    }
+
+    assert(visited == table.size);
+
+    for (int i = 0; isResizing() && i < static_cast<int>(resizeTable.size); i++) {
+        BucketDepthVisitor bucket;
+        visitResized(i, bucket);
+        visitor.visit(i, bucket.depth, bucket.mem);
+    }
+}
+
+/**
+ * Hash table visitor collecting the keys of a bucket.
+ */
+class KeyCollectingVisitor : public HashTableVisitor {
+public:
+    void visit(StoredValue *v) {
+        keys.push_back(v->getKey());
+    }
+
+    std::vector<std::string> keys;
+};
+
+/**
+ * Hash table visitor collecting the values of a bucket.
+ */
+class ValueCollectingVisitor : public HashTableVisitor {
+public:
+    ValueCollectingVisitor(std::vector<StoredValue*> &v) : values(v) {}
+
+    void visit(StoredValue *v) {
+        values.push_back(v);
+    }
+
+    std::vector<StoredValue*> &values;
+};
+
+void HashTable::visitSample(HashTableSampleVisitor &visitor,
+                            size_t sampleSize) {
+    if (numItems.get() == 0 || !isActive()) {
+        return;
+    }
+    assert(sampleSize > 0);
+    VisitorTracker vt(&visitors);
+    std::vector<StoredValue*> sample;
+    ValueCollectingVisitor collector(sample);
+    int size = static_cast<int>(table.size);
+    int locks = static_cast<int>(n_locks);
+
+    for (int l = 0; isActive() && l < locks && l < size; l++) {
+        int lockBuckets = (size - l + locks - 1) / locks;
+        LockHolder lh(mutexes[l]);
+        do {
+            sample.clear();
+            // Empty and migrated buckets don't add anything, so give up
+            // on filling the sample of a sparse lock after a few picks.
+            for (size_t picks = 0; sample.size() < sampleSize &&
+                     picks < sampleSize * 4; ++picks) {
+                int i = l + (std::rand() % lockBuckets) * locks;
+                assert(l == mutexForBucket(i));
+                if (!isMigrated(i)) {
+                    visitIn(table, i, collector);
+                }
+            }
+            std::sort(sample.begin(), sample.end());
+            sample.erase(std::unique(sample.begin(), sample.end()),
+                         sample.end());
+        } while (!sample.empty() && visitor.visitSample(l, sample));
+    }
+}
+
+void HashTable::visitResized(int bucket_num, HashTableVisitor &visitor) {
+    // The items of the new buckets are guarded by the locks of the
+    // buckets they were migrated from, so look them up one at a time.
+    KeyCollectingVisitor collector;
+    LockHolder rlh(resizeMutexes[mutexForBucket(bucket_num)]);
+    visitIn(resizeTable, bucket_num, collector);
+    rlh.unlock();
+
+    std::vector<std::string>::iterator it;
+    for (it = collector.keys.begin(); it != collector.keys.end(); ++it) {
+        int h = hash(*it);
+        int bucket(0);
+        LockHolder lh = getLockedBucket(h, &bucket);
+        StoredValue *v = unlocked_lookup(*it, h, bucket);
+        if (v) {
+            visitor.visit(v);
+        }
+    }
+}
+
+void ExpiryIndex::add(const std::string &key, time_t exptime) {
+    LockHolder lh(mutex);
+    if (wheel.empty()) {
+        wheel.resize((1 << fineBits) + (1 << coarseBits));
+    }
+
+    std::pair<unordered_map<std::string, time_t>::iterator, bool> rv;
+    rv = entries.insert(std::make_pair(key, exptime));
+    if (rv.second) {
+        stats.memOverhead.incr(entrySize(key));
+        assert(stats.memOverhead.get() < GIGANTOR);
+    } else if (rv.first->second == exptime) {
+        return;
+    } else {
+        unlink(key, rv.first->second);
+        rv.first->second = exptime;
+    }
+    locate(exptime, true)->insert(key);
+}
+
+void ExpiryIndex::remove(const std::string &key) {
+    LockHolder lh(mutex);
+    unordered_map<std::string, time_t>::iterator it = entries.find(key);
+    if (it != entries.end()) {
+        unlink(key, it->second);
+        entries.erase(it);
+        stats.memOverhead.decr(entrySize(key));
+    }
+}
+
+void ExpiryIndex::getDue(time_t now, std::vector<std::string> &keys) {
+    LockHolder lh(mutex);
+    if (entries.empty()) {
+        current = std::max(current, now);
+        return;
+    }
+    if (now - current > (1 << (fineBits + coarseBits))) {
+        rebuild(now);
+    } else {
+        advance(now);
+    }
+    Slot::iterator it;
+    for (it = due.begin(); it != due.end(); ++it) {
+        keys.push_back(*it);
+        entries.erase(*it);
+        stats.memOverhead.decr(entrySize(*it));
+    }
+    due.clear();
+}
+
+void ExpiryIndex::clear() {
+    LockHolder lh(mutex);
+    unordered_map<std::string, time_t>::iterator it;
+    for (it = entries.begin(); it != entries.end(); ++it) {
+        stats.memOverhead.decr(entrySize(it->first));
+    }
+    entries.clear();
+    due.clear();
+    std::vector<Slot>().swap(wheel);
+    overflow.clear();
+}
+
+/**
+ * Get the slot holding the keys expiring at the given time.  Where a
+ * key is only depends on its time and the current time, as advance()
+ * moves the keys down the wheels when their minute or hour comes.
+ */
+ExpiryIndex::Slot *ExpiryIndex::locate(time_t exptime, bool create) {
+    // The wheels cover the minute and the hour of the next second.
+    time_t next = current + 1;
+    if (exptime <= current) {
+        return &due;
+    } else if ((exptime >> fineBits) == (next >> fineBits)) {
+        return &wheel[exptime & fineMask];
+    } else if ((exptime >> (fineBits + coarseBits)) ==
+               (next >> (fineBits + coarseBits))) {
+        return &wheel[(1 << fineBits) + ((exptime >> fineBits) & coarseMask)];
+    } else if (create) {
+        return &overflow[exptime];
+    }
+    std::map<time_t, Slot>::iterator it = overflow.find(exptime);
+    return it == overflow.end() ? NULL : &it->second;
+}
+
+void ExpiryIndex::unlink(const std::string &key, time_t exptime) {
+    Slot *slot = locate(exptime, false);
+    assert(slot);
+    slot->erase(key);
+    if (slot->empty() && exptime > current &&
+        (exptime >> (fineBits + coarseBits)) !=
+        ((current + 1) >> (fineBits + coarseBits))) {
+        overflow.erase(exptime);
+    }
+}
+
+void ExpiryIndex::advance(time_t now) {
+    while (current < now) {
+        time_t next = current + 1;
+        if ((next & fineMask) == 0) {
+            // A new minute: move its keys down to the fine wheel, after
+            // those of a new hour were moved from the overflow map.
+            time_t minute = next >> fineBits;
+            if ((minute & coarseMask) == 0) {
+                time_t end = (minute + (1 << coarseBits)) << fineBits;
+                std::map<time_t, Slot>::iterator upper;
+                upper = overflow.lower_bound(end);
+                std::map<time_t, Slot>::iterator it;
+                for (it = overflow.begin(); it != upper; ++it) {
+                    Slot &slot = wheel[(1 << fineBits) +
+                                       ((it->first >> fineBits) & coarseMask)];
+                    slot.insert(it->second.begin(), it->second.end());
+                }
+                overflow.erase(overflow.begin(), upper);
+            }
+            Slot moved;
+            moved.swap(wheel[(1 << fineBits) + (minute & coarseMask)]);
+            Slot::iterator it;
+            for (it = moved.begin(); it != moved.end(); ++it) {
+                wheel[entries[*it] & fineMask].insert(*it);
+            }
         }
+        Slot &slot = wheel[next & fineMask];
+        due.insert(slot.begin(), slot.end());
+        slot.clear();
+        current = next;
     }
+}
 
-    assert(visited == size);
+void ExpiryIndex::rebuild(time_t now) {
+    // Too far behind to turn the wheels second by second.
+    std::vector<Slot>::iterator sit;
+    for (sit = wheel.begin(); sit != wheel.end(); ++sit) {
+        sit->clear();
+    }
+    overflow.clear();
+    current = now;
+    unordered_map<std::string, time_t>::iterator it;
+    for (it = entries.begin(); it != entries.end(); ++it) {
+        locate(it->second, true)->insert(it->first);
+    }
 }
 
 bool HashTable::setDefaultStorageValueType(const char *t) {
@@ -470,6 +922,397 @@ const char* HashTable::getDefaultStorageValueTypeStr() {
     return rv;
 }
 
+bool HashTable::setDefaultLayout(const char *l) {
+    bool rv = false;
+    if (l && strcmp(l, "chained") == 0) {
+        setDefaultLayout(chained);
+        rv = true;
+    } else if (l && strcmp(l, "cacheline") == 0) {
+        setDefaultLayout(cacheline);
+        rv = true;
+    }
+    return rv;
+}
+
+void HashTable::setDefaultLayout(enum hash_table_layout l) {
+    defaultLayout = l;
+}
+
+enum hash_table_layout HashTable::getDefaultLayout() {
+    return defaultLayout;
+}
+
+void HashTable::setDefaultOptimisticReads(bool to) {
+    defaultOptimisticReads = to;
+}
+
+bool HashTable::getDefaultOptimisticReads() {
+    return defaultOptimisticReads;
+}
+
+Item *HashTable::optimisticGet(const std::string &key, uint16_t vbucket,
+                               time_t asOf, bool trackReference,
+                               bool &referenced) {
+    if (!optimisticReads || !isActive()) {
+        return NULL;
+    }
+    int h = hash(key);
+    uint8_t tag = tagForHash(h);
+
+    ReaderEpochHolder reh;
+    for (int attempt = 0; attempt < optimisticReadAttempts; ++attempt) {
+        if (!isActive() || isResizing()) {
+            return NULL;
+        }
+        BucketArray a = table;
+        int bucket_num = abs(h % static_cast<int>(a.size));
+        const Mutex &m = mutexes[mutexForBucket(bucket_num)];
+        uint32_t seq = m.getSequence();
+        ep_sync_synchronize();
+        // The buckets are swapped with all the locks held, check we
+        // didn't copy them halfway through.
+        if ((seq & 1) || a.size != table.size || a.values != table.values ||
+            a.buckets != table.buckets) {
+            continue;
+        }
+
+        StoredValue *v = optimisticLookup(a, bucket_num, key, tag, m, seq);
+        if (v == NULL || !v->isGettableUnlocked(asOf, trackReference)) {
+            if (m.getSequence() != seq) {
+                continue;
+            }
+            return NULL;
+        }
+
+        // The value (or the StoredValue) may be unlinked as we read
+        // it, but it isn't freed before we leave our epoch.
+        Blob *blob = v->value.get();
+        if (blob == NULL) {
+            continue;
+        }
+        value_t val(blob);
+        bool ref = v->isReferenced();
+        Item *rv = new Item(v->getKey(), v->getFlags(), v->getExptime(), val,
+                            v->getCas(), v->getId(), vbucket, v->getSeqno());
+        ep_sync_synchronize();
+        if (m.getSequence() == seq) {
+            referenced = ref;
+            return rv;
+        }
+        delete rv;
+    }
+    return NULL;
+}
+
+StoredValue *HashTable::optimisticLookup(const BucketArray &a, int bucket_num,
+                                         const std::string &key, uint8_t tag,
+                                         const Mutex &m, uint32_t seq) {
+    StoredValue *v;
+    if (layout == cacheline) {
+        const HashBucket &b = a.buckets[bucket_num];
+        int match = b.match(tag);
+        while (match) {
+            int i = ffs(match) - 1;
+            v = b.slots[i];
+            if (v && v->hasKey(key)) {
+                return v;
+            }
+            match &= match - 1;
+        }
+        v = b.overflow;
+    } else {
+        v = a.values[bucket_num];
+    }
+    // Links may change under our feet, give up as soon as they do.
+    while (v && m.getSequence() == seq) {
+        if (v->hasKey(key)) {
+            return v;
+        }
+        v = v->next;
+    }
+    return NULL;
+}
+
+void HashTable::retire(const value_t &v, StoredValue *sv) {
+    if (ReaderEpoch::idle()) {
+        // No reader can see this or anything retired before it, free
+        // it right away so that ejections give the memory back.
+        delete sv;
+        if (numRetired.get() > 0) {
+            reclaim(false);
+        }
+        return;
+    }
+
+    SpinLockHolder lh(&retiredLock);
+    retired.push_back(Retired(ReaderEpoch::current(), v, sv));
+    ++numRetired;
+    bool full = retired.size() >= retireBatch;
+    lh.unlock();
+    if (full) {
+        reclaim(false);
+    }
+}
+
+void HashTable::reclaim(bool all) {
+    uint64_t oldest = 0;
+    if (all) {
+        ReaderEpoch::synchronize();
+    } else {
+        oldest = ReaderEpoch::advance();
+    }
+
+    std::vector<Retired> done;
+    SpinLockHolder lh(&retiredLock);
+    while (!retired.empty() && (all || retired.front().epoch < oldest)) {
+        done.push_back(retired.front());
+        retired.pop_front();
+        --numRetired;
+    }
+    lh.unlock();
+
+    std::vector<Retired>::iterator it;
+    for (it = done.begin(); it != done.end(); ++it) {
+        delete it->storedValue;
+    }
+}
+
+/**
+ * The epoch a reader thread is in, 0 while it isn't reading.
+ */
+struct ReaderSlot {
+    ReaderSlot() : epoch(0), inUse(true), next(NULL) {}
+
+    volatile uint64_t epoch;
+    Atomic<bool>      inUse;
+    ReaderSlot       *next;
+    // Keep the epochs of different threads on different cache lines.
+    char              pad[64];
+};
+
+static Atomic<uint64_t> readerEpoch(1);
+static AtomicPtr<ReaderSlot> readerSlots;
+
+extern "C" {
+    static void releaseReaderSlot(void *slot) {
+        static_cast<ReaderSlot*>(slot)->inUse.set(false);
+    }
+}
+
+static ThreadLocal<ReaderSlot*> readerSlot(releaseReaderSlot);
+
+static ReaderSlot *getReaderSlot() {
+    ReaderSlot *rv = readerSlot.get();
+    if (rv == NULL) {
+        // Take over the slot of a thread that exited, if any.
+        for (rv = readerSlots.get(); rv != NULL; rv = rv->next) {
+            if (!rv->inUse.get() && rv->inUse.cas(false, true)) {
+                break;
+            }
+        }
+        if (rv == NULL) {
+            rv = new ReaderSlot();
+            do {
+                rv->next = readerSlots.get();
+            } while (!readerSlots.cas(rv->next, rv));
+        }
+        readerSlot.set(rv);
+    }
+    return rv;
+}
+
+void ReaderEpoch::enter() {
+    getReaderSlot()->epoch = readerEpoch.get();
+    ep_sync_synchronize();
+}
+
+void ReaderEpoch::leave() {
+    ep_sync_synchronize();
+    getReaderSlot()->epoch = 0;
+}
+
+uint64_t ReaderEpoch::current() {
+    ep_sync_synchronize();
+    return readerEpoch.get();
+}
+
+uint64_t ReaderEpoch::advance() {
+    uint64_t rv = ++readerEpoch;
+    for (ReaderSlot *s = readerSlots.get(); s != NULL; s = s->next) {
+        uint64_t e = s->epoch;
+        if (e != 0 && e < rv) {
+            rv = e;
+        }
+    }
+    return rv;
+}
+
+bool ReaderEpoch::idle() {
+    // Order the unlinking of whatever is about to be freed before
+    // looking at the readers.
+    ep_sync_synchronize();
+    for (ReaderSlot *s = readerSlots.get(); s != NULL; s = s->next) {
+        if (s->epoch != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ReaderEpoch::synchronize() {
+    uint64_t e = current();
+    while (advance() <= e) {
+        sched_yield();
+    }
+}
+
+HashBucket *HashTable::newBuckets(size_t n) {
+    void *p = NULL;
+    if (posix_memalign(&p, 64, n * sizeof(HashBucket)) != 0) {
+        return NULL;
+    }
+    std::memset(p, 0, n * sizeof(HashBucket));
+    return static_cast<HashBucket*>(p);
+}
+
+bool HashTable::allocateArray(BucketArray &a, size_t n) {
+    if (layout == cacheline) {
+        a.buckets = newBuckets(n);
+    } else {
+        a.values = static_cast<StoredValue**>(calloc(n, sizeof(StoredValue*)));
+    }
+    if (!a.values && !a.buckets) {
+        return false;
+    }
+    a.size = n;
+    return true;
+}
+
+void HashTable::freeArray(BucketArray &a) {
+    free(a.values);
+    free(a.buckets);
+    a = BucketArray();
+}
+
+StoredValue *HashTable::unlocked_lookupResized(const std::string &key, int h) {
+    int nb = getResizedBucketForHash(h);
+    LockHolder rlh(resizeMutexes[mutexForBucket(nb)]);
+    return lookupIn(resizeTable, nb, key, h);
+}
+
+void HashTable::unlocked_link(StoredValue *v, int bucket_num) {
+    unlocked_link(v, bucket_num, hash(v->getKeyBytes(), v->getKeyLen()));
+}
+
+void HashTable::unlocked_link(StoredValue *v, int bucket_num, int h) {
+    if (isMigrated(bucket_num)) {
+        int nb = getResizedBucketForHash(h);
+        LockHolder rlh(resizeMutexes[mutexForBucket(nb)]);
+        linkIn(resizeTable, nb, v, h);
+    } else {
+        linkIn(table, bucket_num, v, h);
+    }
+}
+
+void HashTable::unlocked_unlink(StoredValue *v, int bucket_num) {
+    if (isMigrated(bucket_num)) {
+        int nb = getResizedBucketForHash(hash(v->getKeyBytes(),
+                                              v->getKeyLen()));
+        LockHolder rlh(resizeMutexes[mutexForBucket(nb)]);
+        unlinkIn(resizeTable, nb, v);
+    } else {
+        unlinkIn(table, bucket_num, v);
+    }
+}
+
+void HashTable::linkIn(BucketArray &a, int bucket_num, StoredValue *v, int h) {
+    if (layout == cacheline) {
+        HashBucket &b = a.buckets[bucket_num];
+        int free_slots = b.match(0);
+        if (free_slots) {
+            int i = ffs(free_slots) - 1;
+            b.tags[i] = tagForHash(h);
+            b.slots[i] = v;
+            v->next = NULL;
+        } else {
+            v->next = b.overflow;
+            b.overflow = v;
+        }
+    } else {
+        v->next = a.values[bucket_num];
+        a.values[bucket_num] = v;
+    }
+}
+
+void HashTable::unlinkIn(BucketArray &a, int bucket_num, StoredValue *v) {
+    StoredValue **p;
+    if (layout == cacheline) {
+        HashBucket &b = a.buckets[bucket_num];
+        for (int i = 0; i < HashBucket::numSlots; ++i) {
+            if (b.slots[i] == v) {
+                // Move an overflowing value into the freed slot.
+                StoredValue *o = b.overflow;
+                if (o) {
+                    b.overflow = o->next;
+                    o->next = NULL;
+                    b.tags[i] = tagForHash(hash(o->getKeyBytes(), o->getKeyLen()));
+                } else {
+                    b.tags[i] = 0;
+                }
+                b.slots[i] = o;
+                return;
+            }
+        }
+        p = &b.overflow;
+    } else {
+        p = &a.values[bucket_num];
+    }
+    while (*p != v) {
+        assert(*p);
+        p = &(*p)->next;
+    }
+    *p = v->next;
+}
+
+StoredValue *HashTable::detachIn(BucketArray &a, int bucket_num) {
+    StoredValue *rv;
+    if (layout == cacheline) {
+        HashBucket &b = a.buckets[bucket_num];
+        rv = b.overflow;
+        for (int i = 0; i < HashBucket::numSlots; ++i) {
+            if (b.slots[i]) {
+                b.slots[i]->next = rv;
+                rv = b.slots[i];
+            }
+        }
+        std::memset(&b, 0, sizeof(b));
+    } else {
+        rv = a.values[bucket_num];
+        a.values[bucket_num] = NULL;
+    }
+    return rv;
+}
+
+void HashTable::visitIn(BucketArray &a, int bucket_num,
+                        HashTableVisitor &visitor) {
+    StoredValue *v;
+    if (layout == cacheline) {
+        HashBucket &b = a.buckets[bucket_num];
+        for (int i = 0; i < HashBucket::numSlots; ++i) {
+            if (b.slots[i]) {
+                visitor.visit(b.slots[i]);
+            }
+        }
+        v = b.overflow;
+    } else {
+        v = a.values[bucket_num];
+    }
+    while (v) {
+        visitor.visit(v);
+        v = v->next;
+    }
+}
+
 add_type_t HashTable::unlocked_add(int &bucket_num,
                                    const Item &val,
                                    bool isDirty,
@@ -495,11 +1338,16 @@ add_type_t HashTable::unlocked_add(int &bucket_num,
                 v->markClean(NULL);
             }
         } else {
-            v = valFact(itm, values[bucket_num], *this, isDirty);
-            values[bucket_num] = v;
+            v = valFact(itm, NULL, *this, isDirty);
+            unlocked_link(v, bucket_num);
 
             if (v->isTempItem()) {
                 ++numTempItems;
+                // Temporary items are removed by the next expiry pager run.
+                expiryIndex.add(v->getKey(), ep_real_time());
+                if (!v->_isSmall) {
+                    v->extra.feature.expiryIndexed = true;
+                }
             } else {
                 ++numItems;
             }
@@ -517,7 +1365,7 @@ add_type_t HashTable::unlocked_add(int &bucket_num,
             v->ejectValue(stats, *this);
         }
         if (v->isTempItem()) {
-            v->resetValue();
+            v->resetValue(*this);
         } else {
             v->referenced(*this);
         }
@@ -598,7 +1446,7 @@ bool StoredValue::hasAvailableSpace(EPStats &st, const Item &itm) {
 
 Item* StoredValue::toItem(bool lck, uint16_t vbucket) const {
     return new Item(getKey(), getFlags(), getExptime(),
-                    value,
+                    getValue(),
                     lck ? static_cast<uint64_t>(-1) : getCas(),
                     id, vbucket, getSeqno());
 }
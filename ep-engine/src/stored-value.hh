@@ -4,7 +4,14 @@
 
 #include <climits>
 #include <cstring>
+#include <strings.h>
 #include <algorithm>
+#include <deque>
+#include <map>
+#include <set>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "common.hh"
 #include "item.hh"
@@ -44,6 +51,9 @@ struct feature_data {
     bool       locked : 1;      //!< True if this item is locked
     bool       resident : 1;    //!< True if this object's value is in memory.
     bool       nru : 1;         //!< True if referenced since last sweep
+    uint8_t    freq : 4;        //!< Saturating access count, aged by the pager
+    bool       expiryIndexed : 1; //!< True if in the expiry index by its exptime
+    bool       compressed : 1;  //!< True if the resident value is compressed
     uint8_t    keylen;          //!< Length of the key
     char       keybytes[1];     //!< The key itself.
 };
@@ -71,7 +81,7 @@ class StoredValue {
 public:
 
     void operator delete(void* p) {
-        ::operator delete(p);
+        ObjectRegistry::deallocate(p);
      }
 
     /**
@@ -85,8 +95,53 @@ public:
 
     bool isReferenced(bool reset=false, HashTable *ht=NULL);
 
+    /**
+     * True if a get of this item doesn't need to change it: it is
+     * resident, uncompressed, neither locked nor expired, and its
+     * reference bits are already up to date.  Such a get doesn't
+     * touch() a clean item either; the access time is refreshed by the
+     * next locked access.
+     *
+     * @param asOf the current real time
+     * @param trackReference true if the get counts as an access
+     */
+    bool isGettableUnlocked(time_t asOf, bool trackReference) {
+        if (isDeleted() || isTempItem() || !isResident() || isExpired(asOf)) {
+            return false;
+        }
+        if (_isSmall) {
+            return true;
+        }
+        if (extra.feature.locked || extra.feature.compressed) {
+            return false;
+        }
+        return !trackReference ||
+            (extra.feature.nru && extra.feature.freq == maxAccessFrequency);
+    }
+
     void referenced(HashTable &ht);
 
+    /**
+     * Get the approximate access frequency of this item.  It grows
+     * with each reference and halves each time the item pager samples
+     * the item without evicting it.
+     */
+    uint8_t getAccessFrequency() const {
+        return _isSmall ? 0 : extra.feature.freq;
+    }
+
+    /**
+     * Age the access frequency of this item.
+     */
+    void decayAccessFrequency() {
+        if (!_isSmall) {
+            extra.feature.freq >>= 1;
+        }
+    }
+
+    //! The access frequency at which it stops growing.
+    static const uint8_t maxAccessFrequency = 15;
+
     /**
      * Mark this item as needing to be persisted.
      */
@@ -196,12 +251,51 @@ public:
     }
 
     /**
-     * Get this item's value.
+     * Get this item's value, decompressed if it's kept compressed.
+     * Accessed items are kept decompressed (see inflateValue), so this
+     * only copies the value of an item that wasn't accessed since the
+     * item pager compressed it.
+     */
+    value_t getValue() const {
+        return isCompressed() ? decompressValue() : value;
+    }
+
+    /**
+     * Get the length of the value as kept in memory, which is less
+     * than its actual length when compressed.
      */
-    const value_t &getValue() const {
-        return value;
+    size_t getMemValueLength() const {
+        return isDeleted() ? 0 : value->length();
     }
 
+    /**
+     * True if the resident value of this item is kept compressed.
+     */
+    bool isCompressed() const {
+        return !_isSmall && extra.feature.compressed;
+    }
+
+    /**
+     * Compress the resident value of this item if that saves enough
+     * memory.  It stays compressed until it is accessed, replaced
+     * or ejected.
+     *
+     * @param stats the global stats
+     * @param ht the hashtable that contains this StoredValue instance
+     *
+     * @return true if the value got compressed
+     */
+    bool compressValue(EPStats &stats, HashTable &ht);
+
+    /**
+     * Decompress the value of this item in place, until the item pager
+     * picks it again.
+     *
+     * @param stats the global stats
+     * @param ht the hashtable that contains this StoredValue instance
+     */
+    void inflateValue(EPStats &stats, HashTable &ht);
+
     /**
      * Get the expiration time of this item.
      *
@@ -222,6 +316,22 @@ public:
         }
     }
 
+    /**
+     * Index this item by its expiry time in its hash table, replacing
+     * the time it was indexed with before, or drop it from the index if
+     * it no longer expires.
+     *
+     * @param ht the hash table holding this item
+     * @param previous the expiry time of the item when last indexed,
+     *                 0 if unknown
+     */
+    void indexExpiry(HashTable &ht, time_t previous = 0);
+
+    /**
+     * Drop this item from the expiry index of its hash table.
+     */
+    void unindexExpiry(HashTable &ht);
+
     /**
      * Get the client-defined flags of this item.
      *
@@ -247,15 +357,17 @@ public:
      * @param preserveSeqno Preserve the sequence number from the item.
      */
     void setValue(Item &itm, EPStats &stats, HashTable &ht, bool preserveSeqno) {
+        time_t previousExptime = getExptime();
         size_t currSize = size();
         reduceCacheSize(ht, currSize);
         reduceCurrentSize(stats, isDeleted() ? currSize : currSize - value->length());
-        value = itm.getValue();
+        assignValue(itm.getValue(), ht);
         setResident();
         flags = itm.getFlags();
         if (!_isSmall) {
             extra.feature.cas = itm.getCas();
             extra.feature.exptime = itm.getExptime();
+            extra.feature.compressed = false;
             if (preserveSeqno) {
                 extra.feature.seqno = itm.getSeqno();
             } else {
@@ -267,23 +379,27 @@ public:
         size_t newSize = size();
         increaseCacheSize(ht, newSize);
         increaseCurrentSize(stats, newSize - value->length());
+        indexExpiry(ht, previousExptime);
     }
 
     /**
      * Reset the value of this item.
      */
-    void resetValue() {
+    void resetValue(HashTable &ht) {
         assert(!isDeleted());
-        value.reset();
+        assignValue(value_t(NULL), ht);
         // item no longer resident once reset the value
         if (!_isSmall) {
             extra.feature.resident = false;
+            extra.feature.compressed = false;
         }
     }
 
     size_t valLength() {
         if (isDeleted()) {
             return 0;
+        } else if (isCompressed()) {
+            return decompressedLength();
         } else if (isResident()) {
             return value->length();
         } else {
@@ -574,7 +690,8 @@ public:
         size_t oldsize = size();
         size_t old_valsize = value->length();
 
-        resetValue();
+        unindexExpiry(ht);
+        resetValue(ht);
         markDirty();
         if (!isMetaDelete) {
             setCas(getCas() + 1);
@@ -677,6 +794,9 @@ private:
             extra.feature.locked = false;
             extra.feature.resident = true;
             extra.feature.nru = false;
+            extra.feature.freq = 0;
+            extra.feature.expiryIndexed = false;
+            extra.feature.compressed = false;
             extra.feature.lock_expiry = 0;
             extra.feature.keylen = itm.getKey().length();
             extra.feature.seqno = itm.getSeqno();
@@ -704,6 +824,11 @@ private:
         dirtiness = ep_current_time() >> 2;
     }
 
+    void assignValue(const value_t &nv, HashTable &ht);
+    void replaceValue(const value_t &nv, EPStats &stats, HashTable &ht);
+    value_t decompressValue() const;
+    size_t decompressedLength() const;
+
     friend class HashTable;
     friend class StoredValueFactory;
 
@@ -778,6 +903,25 @@ public:
     virtual bool shouldContinue() { return true; }
 };
 
+/**
+ * Base class for visiting random samples of a hash table.
+ */
+class HashTableSampleVisitor {
+public:
+    virtual ~HashTableSampleVisitor() {}
+
+    /**
+     * Visit items sampled from the buckets of one lock, while holding
+     * that lock.
+     *
+     * @param lock the lock guarding the sampled buckets
+     * @param sample the distinct sampled items
+     *
+     * @return true to get another sample from the buckets of this lock
+     */
+    virtual bool visitSample(int lock, std::vector<StoredValue*> &sample) = 0;
+};
+
 /**
  * Hash table visitor that reports the depth of each hashtable bucket.
  */
@@ -835,7 +979,7 @@ public:
     void visit(StoredValue *v) {
         ++numTotal;
         memSize += v->size();
-        valSize += v->isDeleted() ? 0 : v->getValue()->length();
+        valSize += v->getMemValueLength();
 
         if (v->isResident()) {
             cacheSize += v->size();
@@ -885,6 +1029,112 @@ enum stored_value_type {
     featured                    //!< Full featured stored values.
 };
 
+/**
+ * Layouts of the hash table buckets.
+ */
+enum hash_table_layout {
+    chained,                    //!< A chain of StoredValues per bucket.
+    cacheline                   //!< Cache line sized buckets of tagged StoredValues.
+};
+
+/**
+ * A cache line sized hash table bucket.
+ *
+ * The bucket holds up to numSlots StoredValues along with a one byte tag
+ * taken from the hash of each key, so a lookup only compares the keys
+ * whose tag matches. StoredValues that don't fit are chained off the
+ * overflow pointer.
+ */
+struct HashBucket {
+    static const int numSlots = 6;
+
+    /**
+     * Get a bit mask of the slots with the given tag (all the tags are
+     * compared at once with SSE2 where it is available).
+     */
+    int match(uint8_t tag) const {
+#ifdef __SSE2__
+        __m128i t = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(tags));
+        __m128i m = _mm_cmpeq_epi8(t, _mm_set1_epi8(static_cast<char>(tag)));
+        return _mm_movemask_epi8(m) & ((1 << numSlots) - 1);
+#else
+        int rv = 0;
+        for (int i = 0; i < numSlots; ++i) {
+            if (tags[i] == tag) {
+                rv |= 1 << i;
+            }
+        }
+        return rv;
+#endif
+    }
+
+    uint8_t      tags[8];           // 0 marks a free slot, the last 2 are unused
+    StoredValue *slots[numSlots];
+    StoredValue *overflow;
+};
+
+/**
+ * Grace periods for the memory the lock free hash table readers may be
+ * looking at.
+ *
+ * A reader publishes the epoch it started in until it is done.
+ * Anything unlinked from a hash table in an epoch can be freed once no
+ * reader is left in that epoch or an older one.
+ */
+class ReaderEpoch {
+public:
+
+    /**
+     * Start reading (reads don't nest).
+     */
+    static void enter();
+
+    /**
+     * Done reading.
+     */
+    static void leave();
+
+    /**
+     * Get the current epoch, to tag something just unlinked.
+     */
+    static uint64_t current();
+
+    /**
+     * Start a new epoch.
+     *
+     * @return the oldest epoch a reader may still be in
+     */
+    static uint64_t advance();
+
+    /**
+     * True if no reader is reading, so nothing unlinked so far can be
+     * seen anymore.
+     */
+    static bool idle();
+
+    /**
+     * Wait for the readers that may see anything unlinked so far.
+     */
+    static void synchronize();
+};
+
+/**
+ * Holder of a ReaderEpoch for the length of a read.
+ */
+class ReaderEpochHolder {
+public:
+    ReaderEpochHolder() {
+        ReaderEpoch::enter();
+    }
+
+    ~ReaderEpochHolder() {
+        ReaderEpoch::leave();
+    }
+
+private:
+    DISALLOW_COPY_AND_ASSIGN(ReaderEpochHolder);
+};
+
 /**
  * Creator of StoredValue instances.
  */
@@ -928,12 +1178,13 @@ private:
         assert(key.length() < 256);
         size_t len = key.length() + base;
 
-        StoredValue *t = new (::operator new(len))
+        StoredValue *t = new (ObjectRegistry::allocate(len))
             StoredValue(itm, n, *stats, ht, setDirty, small);
         if (small) {
             std::memcpy(t->extra.small.keybytes, key.data(), key.length());
         } else {
             std::memcpy(t->extra.feature.keybytes, key.data(), key.length());
+            t->indexExpiry(ht);
         }
 
         return t;
@@ -944,6 +1195,98 @@ private:
 
 };
 
+/**
+ * The keys of a hash table's items that have an expiry time, grouped
+ * by when they expire, so that the expiry pager only looks at the
+ * items whose time has come.
+ *
+ * A timer wheel of one second slots holds the keys expiring within
+ * the current minute, a wheel of one minute slots those expiring
+ * within the current hour or so, and an overflow map the later ones.
+ * Keys move down to the finer wheel as time advances.  A key is in the
+ * index at most once: adding it again moves it to its new time, and
+ * it is removed when its item is deleted.  The memory of the index is
+ * accounted as overhead.
+ */
+class ExpiryIndex {
+public:
+
+    ExpiryIndex(EPStats &st) : stats(st), current(ep_real_time()) {}
+
+    ~ExpiryIndex() {
+        clear();
+    }
+
+    /**
+     * Add the key of an item expiring at the given time, replacing the
+     * time it was added with before.
+     */
+    void add(const std::string &key, time_t exptime);
+
+    /**
+     * Remove the key of an item from the index, if it's there.
+     */
+    void remove(const std::string &key);
+
+    /**
+     * Remove the keys expiring up to the given time.
+     *
+     * @param now the time up to which keys are due
+     * @param keys the vector the due keys are appended to
+     */
+    void getDue(time_t now, std::vector<std::string> &keys);
+
+    /**
+     * Forget all of the keys.
+     */
+    void clear();
+
+    /**
+     * Get the number of keys in the index.
+     */
+    size_t size() {
+        LockHolder lh(mutex);
+        return entries.size();
+    }
+
+    /**
+     * Get the approximate memory used by a key in the index.
+     */
+    static size_t entrySize(const std::string &key) {
+        // A copy of the key in its slot and one in the entries, with
+        // the nodes holding them.
+        return 2 * (sizeof(std::string) + key.length()) + sizeof(time_t) +
+            8 * sizeof(void*);
+    }
+
+private:
+
+    typedef std::set<std::string> Slot;
+
+    Slot *locate(time_t exptime, bool create);
+    void unlink(const std::string &key, time_t exptime);
+    void advance(time_t now);
+    void rebuild(time_t now);
+
+    static const int    fineBits = 6;
+    static const int    coarseBits = 6;
+    static const time_t fineMask = (1 << fineBits) - 1;
+    static const time_t coarseMask = (1 << coarseBits) - 1;
+
+    EPStats                        &stats;
+    Mutex                           mutex;
+    //! Every key expiring up to this time is in due.
+    time_t                          current;
+    Slot                            due;
+    //! The fine then the coarse slots, allocated with the first key.
+    std::vector<Slot>               wheel;
+    std::map<time_t, Slot>          overflow;
+    //! The expiry time each key is indexed with.
+    unordered_map<std::string, time_t> entries;
+
+    DISALLOW_COPY_AND_ASSIGN(ExpiryIndex);
+};
+
 /**
  * A container of StoredValue instances.
  */
@@ -959,15 +1302,25 @@ public:
      * @param t the type of StoredValues this hash table will contain
      */
     HashTable(EPStats &st, size_t s = 0, size_t l = 0,
-              enum stored_value_type t = featured) : stats(st), valFact(st, t) {
-        size = HashTable::getNumBuckets(s);
+              enum stored_value_type t = featured) :
+        expiryIndex(st), stats(st), valFact(st, t) {
+        size_t size = HashTable::getNumBuckets(s);
         n_locks = HashTable::getNumLocks(l);
         valFact = StoredValueFactory(st, getDefaultStorageValueType());
+        layout = getDefaultLayout();
         assert(size > 0);
         assert(n_locks > 0);
         assert(visitors == 0);
-        values = static_cast<StoredValue**>(calloc(size, sizeof(StoredValue*)));
+        bool allocated = allocateArray(table, size);
+        assert(allocated);
+        resizeMutexes = NULL;
         mutexes = new Mutex[n_locks];
+        optimisticReads = getDefaultOptimisticReads();
+        if (optimisticReads) {
+            for (size_t i = 0; i < n_locks; ++i) {
+                mutexes[i].setSequenced();
+            }
+        }
         activeState = true;
     }
 
@@ -978,26 +1331,52 @@ public:
             usleep(100);
         }
         delete []mutexes;
-        free(values);
-        values = NULL;
+        delete []resizeMutexes;
+        freeArray(table);
+        freeArray(resizeTable);
     }
 
     size_t memorySize() {
-        return sizeof(HashTable)
-            + (size * sizeof(StoredValue*))
+        size_t rv = sizeof(HashTable)
+            + arraySize(table.size)
             + (n_locks * sizeof(Mutex));
+        if (isResizing()) {
+            rv += arraySize(resizeTable.size) + (n_locks * sizeof(Mutex));
+        }
+        return rv;
+    }
+
+    /**
+     * Get the number of hash table buckets this hash table has (or
+     * will have once the current resize completes).
+     */
+    size_t getSize(void) {
+        return isResizing() ? resizeTable.size : table.size;
     }
 
     /**
-     * Get the number of hash table buckets this hash table has.
+     * True while an incremental resize is migrating buckets.
      */
-    size_t getSize(void) { return size; }
+    bool isResizing(void) { return resizeTable.size != 0; }
+
+    /**
+     * Get the number of buckets still to be migrated by the current
+     * resize.
+     */
+    size_t getResizeRemaining(void) {
+        return isResizing() ? table.size - migrated.get() : 0;
+    }
 
     /**
      * Get the number of locks in this hash table.
      */
     size_t getNumLocks(void) { return n_locks; }
 
+    /**
+     * Get the bucket layout of this hash table.
+     */
+    enum hash_table_layout getLayout(void) { return layout; }
+
     /**
      * Get the number of items within this hash table.
      */
@@ -1049,14 +1428,38 @@ public:
 
     /**
      * Automatically resize to fit the current data.
+     *
+     * This only starts an incremental resize; the buckets are migrated
+     * by migrate() from mutations and the hash table resizer.
      */
     void resize();
 
     /**
-     * Resize to the specified size.
+     * Resize to the specified size, migrating all the buckets before
+     * returning unless visitors are walking the table.
      */
     void resize(size_t to);
 
+    /**
+     * Start an incremental resize to the specified size.
+     *
+     * @return true if the table is being resized to this size
+     */
+    bool startResize(size_t to);
+
+    /**
+     * Migrate buckets of an incremental resize to the new bucket array.
+     *
+     * Buckets aren't migrated while visitors walk the table.  Once they
+     * are all migrated, a waiting caller finishes the resize by briefly
+     * taking all the locks to retire the old bucket array.
+     *
+     * @param n the maximum number of buckets to migrate
+     * @param wait false if busy locks should be left alone
+     * @return the number of buckets still to be migrated
+     */
+    size_t migrate(size_t n, bool wait = true);
+
     /**
      * Find the item with the given key.
      *
@@ -1065,9 +1468,40 @@ public:
      */
     StoredValue *find(std::string &key, bool trackReference=true) {
         assert(isActive());
+        int h = hash(key);
         int bucket_num(0);
-        LockHolder lh = getLockedBucket(key, &bucket_num);
-        return unlocked_find(key, bucket_num, false, trackReference);
+        LockHolder lh = getLockedBucket(h, &bucket_num);
+        return unlocked_find(key, h, bucket_num, false, trackReference);
+    }
+
+    /**
+     * Get the item with the given key without locking its bucket.
+     *
+     * The bucket is read optimistically, and read again if anybody
+     * held its lock in the meantime.  Items whose get would change
+     * them (see StoredValue::isGettableUnlocked) are left to the
+     * locked path, as are the gets that keep colliding with writers.
+     * While an incremental resize is in progress every get takes the
+     * locked path, since an item may be in either bucket array.
+     *
+     * @param key the key of the item to get
+     * @param vbucket the vbucket of the item
+     * @param asOf the current real time
+     * @param trackReference true if the get counts as an access
+     * @param referenced set to the reference bit of the item
+     * @return the item, or NULL if it must be looked up under the lock
+     */
+    Item *optimisticGet(const std::string &key, uint16_t vbucket,
+                        time_t asOf, bool trackReference, bool &referenced);
+
+    /**
+     * Let go of a value unlinked from an item of this hash table,
+     * once the lock free readers that may be copying it are done.
+     */
+    void retireValue(const value_t &v) {
+        if (optimisticReads && v.get() != NULL) {
+            retire(v, NULL);
+        }
     }
 
     /**
@@ -1084,9 +1518,9 @@ public:
             return false;
         }
 
-        StoredValue *v = valFact(itm, values[bucket_num], *this);
+        StoredValue *v = valFact(itm, NULL, *this);
         assert(v);
-        values[bucket_num] = v;
+        unlocked_link(v, bucket_num);
         ++numItems;
         if (op == queue_op_del) {
             unlocked_softDelete(v, itm.getCas());
@@ -1127,10 +1561,12 @@ public:
             return NOMEM;
         }
 
+        migrateSome();
         mutation_type_t rv = NOT_FOUND;
+        int h = hash(val.getKey());
         int bucket_num(0);
-        LockHolder lh = getLockedBucket(val.getKey(), &bucket_num);
-        StoredValue *v = unlocked_find(val.getKey(), bucket_num, true,
+        LockHolder lh = getLockedBucket(h, &bucket_num);
+        StoredValue *v = unlocked_find(val.getKey(), h, bucket_num, true,
                                        trackReference);
 
         /*
@@ -1188,8 +1624,8 @@ public:
             if (!hasMetaData) {
                 itm.setCas();
             }
-            v = valFact(itm, values[bucket_num], *this);
-            values[bucket_num] = v;
+            v = valFact(itm, NULL, *this);
+            unlocked_link(v, bucket_num, h);
             ++numItems;
             if (trackReference && !v->isTempItem()) {
                 v->referenced(*this);
@@ -1232,6 +1668,7 @@ public:
      */
     add_type_t add(const Item &val, bool isDirty = true, bool storeVal = true) {
         assert(isActive());
+        migrateSome();
         int bucket_num(0);
         LockHolder lh = getLockedBucket(val.getKey(), &bucket_num);
         return unlocked_add(bucket_num, val, isDirty, storeVal);
@@ -1275,9 +1712,10 @@ public:
      */
     mutation_type_t softDelete(const std::string &key, uint64_t cas) {
         assert(isActive());
+        int h = hash(key);
         int bucket_num(0);
-        LockHolder lh = getLockedBucket(key, &bucket_num);
-        StoredValue *v = unlocked_find(key, bucket_num, false, false);
+        LockHolder lh = getLockedBucket(h, &bucket_num);
+        StoredValue *v = unlocked_find(key, h, bucket_num, false, false);
         return unlocked_softDelete(v, cas);
     }
 
@@ -1356,21 +1794,25 @@ public:
      */
     StoredValue *unlocked_find(const std::string &key, int bucket_num,
                                bool wantsDeleted=false, bool trackReference=true) {
-        StoredValue *v = values[bucket_num];
-        while (v) {
-            if (v->hasKey(key)) {
-                if (trackReference && !v->isDeleted()) {
-                    v->referenced(*this);
-                }
-                if (wantsDeleted || !v->isDeleted()) {
-                    return v;
-                } else {
-                    return NULL;
-                }
-            }
-            v = v->next;
-        }
-        return NULL;
+        return found(unlocked_lookup(key, bucket_num), wantsDeleted,
+                     trackReference);
+    }
+
+    /**
+     * Find an item within a specific bucket assuming you already
+     * locked the bucket, given the hash of its key.
+     *
+     * @param key the key of the item to find
+     * @param h the hash of the key
+     * @param bucket_num the bucket number
+     * @param wantsDeleted true if soft deleted items should be returned
+     *
+     * @return a pointer to a StoredValue -- NULL if not found
+     */
+    StoredValue *unlocked_find(const std::string &key, int h, int bucket_num,
+                               bool wantsDeleted, bool trackReference) {
+        return found(unlocked_lookup(key, h, bucket_num), wantsDeleted,
+                     trackReference);
     }
 
     /**
@@ -1457,60 +1899,40 @@ public:
      */
     bool unlocked_del(const std::string &key, int bucket_num) {
         assert(isActive());
-        StoredValue *v = values[bucket_num];
+        return unlocked_del(unlocked_lookup(key, bucket_num), bucket_num);
+    }
 
-        // Special case empty bucket.
+    /**
+     * Delete the given StoredValue of a locked bucket, as unlocked_del
+     * above.
+     */
+    bool unlocked_del(StoredValue *v, int bucket_num) {
         if (!v) {
             return false;
         }
 
-        // Special case the first one
-        if (v->hasKey(key)) {
-            if (!v->isDeleted() && v->isLocked(ep_current_time())) {
-                return false;
-            }
-
-            values[bucket_num] = v->next;
-            size_t currSize = v->size();
-            StoredValue::reduceCacheSize(*this, currSize);
-            StoredValue::reduceCurrentSize(stats, v->isDeleted() ? currSize
-                                           : currSize - v->getValue()->length());
-            StoredValue::reduceMetaDataSize(*this, v->metaDataSize());
-            if (v->isTempItem()) {
-                --numTempItems;
-            } else {
-                --numItems;
-            }
-            delete v;
-            return true;
+        if (!v->isDeleted() && v->isLocked(ep_current_time())) {
+            return false;
         }
 
-        while (v->next) {
-            if (v->next->hasKey(key)) {
-                StoredValue *tmp = v->next;
-                if (!tmp->isDeleted() && tmp->isLocked(ep_current_time())) {
-                    return false;
-                }
-
-                v->next = v->next->next;
-                size_t currSize = tmp->size();
-                StoredValue::reduceCacheSize(*this, currSize);
-                StoredValue::reduceCurrentSize(stats, tmp->isDeleted() ? currSize
-                                               : currSize - tmp->getValue()->length());
-                StoredValue::reduceMetaDataSize(*this, tmp->metaDataSize());
-                if (tmp->isTempItem()) {
-                    --numTempItems;
-                } else {
-                    --numItems;
-                }
-                delete tmp;
-                return true;
-            } else {
-                v = v->next;
-            }
+        unlocked_unlink(v, bucket_num);
+        v->unindexExpiry(*this);
+        size_t currSize = v->size();
+        StoredValue::reduceCacheSize(*this, currSize);
+        StoredValue::reduceCurrentSize(stats, v->isDeleted() ? currSize
+                                       : currSize - v->value->length());
+        StoredValue::reduceMetaDataSize(*this, v->metaDataSize());
+        if (v->isTempItem()) {
+            --numTempItems;
+        } else {
+            --numItems;
         }
-
-        return false;
+        if (optimisticReads) {
+            retire(value_t(NULL), v);
+        } else {
+            delete v;
+        }
+        return true;
     }
 
     /**
@@ -1521,9 +1943,11 @@ public:
      */
     bool del(const std::string &key) {
         assert(isActive());
+        migrateSome();
+        int h = hash(key);
         int bucket_num(0);
-        LockHolder lh = getLockedBucket(key, &bucket_num);
-        return unlocked_del(key, bucket_num);
+        LockHolder lh = getLockedBucket(h, &bucket_num);
+        return unlocked_del(unlocked_lookup(key, h, bucket_num), bucket_num);
     }
 
     /**
@@ -1531,11 +1955,38 @@ public:
      */
     void visit(HashTableVisitor &visitor);
 
+    /**
+     * Get the keys of the items that expire up to the given time.
+     * Some of them may have been deleted, or their expiry time
+     * changed, since they were indexed.
+     *
+     * @param now the time up to which keys are due
+     * @param keys the vector the due keys are appended to
+     */
+    void getDueExpiries(time_t now, std::vector<std::string> &keys) {
+        expiryIndex.getDue(now, keys);
+    }
+
+    /**
+     * Get the number of keys in the expiry index.
+     */
+    size_t getNumExpiryKeys(void) { return expiryIndex.size(); }
+
     /**
      * Visit all items within this call with a depth visitor.
      */
     void visitDepth(HashTableDepthVisitor &visitor);
 
+    /**
+     * Visit random samples of the items of each lock's buckets,
+     * instead of all of them.  The buckets already migrated by an
+     * incremental resize are not sampled.
+     *
+     * @param visitor the visitor given the samples
+     * @param sampleSize the number of items to sample at a time
+     */
+    void visitSample(HashTableSampleVisitor &visitor, size_t sampleSize);
+
     /**
      * Get the number of buckets that should be used for initialization.
      *
@@ -1584,6 +2035,35 @@ public:
      */
     static const char* getDefaultStorageValueTypeStr();
 
+    /**
+     * Set the default bucket layout by name.
+     *
+     * @param l either "chained" or "cacheline"
+     *
+     * @return true if this layout is handled.
+     */
+    static bool setDefaultLayout(const char *l);
+
+    /**
+     * Set the default bucket layout by enum value.
+     */
+    static void setDefaultLayout(enum hash_table_layout);
+
+    /**
+     * Get the default bucket layout.
+     */
+    static enum hash_table_layout getDefaultLayout();
+
+    /**
+     * Set whether new hash tables serve gets without locking.
+     */
+    static void setDefaultOptimisticReads(bool to);
+
+    /**
+     * True if new hash tables serve gets without locking.
+     */
+    static bool getDefaultOptimisticReads();
+
     /**
      * Get the max deleted seqno seen so far.
      */
@@ -1616,14 +2096,49 @@ public:
     Atomic<size_t>       cacheSize;
     //! Meta-data size.
     Atomic<size_t>       metaDataMemory;
+    //! The keys of the items with an expiry time.
+    ExpiryIndex          expiryIndex;
 
 private:
     inline bool isActive() const { return activeState; }
     inline void setActiveState(bool newv) { activeState = newv; }
 
-    size_t               size;
+    /**
+     * The buckets of a hash table.  There are two generations of them
+     * while an incremental resize is in progress.
+     */
+    struct BucketArray {
+        BucketArray() : size(0), values(NULL), buckets(NULL) {}
+
+        size_t        size;
+        StoredValue **values;    // chained layout
+        HashBucket   *buckets;   // cacheline layout
+    };
+
+    /**
+     * Something unlinked while lock free readers may be looking at it.
+     */
+    struct Retired {
+        Retired(uint64_t e, const value_t &v, StoredValue *sv) :
+            epoch(e), value(v), storedValue(sv) {}
+
+        uint64_t     epoch;
+        value_t      value;
+        StoredValue *storedValue;
+    };
+
     size_t               n_locks;
-    StoredValue        **values;
+    enum hash_table_layout layout;
+    //! The buckets a key's lock is picked from.
+    BucketArray          table;
+    //! The buckets an incremental resize migrates to.
+    BucketArray          resizeTable;
+    //! The number of buckets of table already migrated to resizeTable.
+    Atomic<size_t>       migrated;
+    //! Guards the resizeTable buckets, in addition to the bucket locks.
+    Mutex               *resizeMutexes;
+    //! Serializes the migration of buckets.
+    Mutex                resizeMutex;
     Mutex               *mutexes;
     EPStats&             stats;
     StoredValueFactory   valFact;
@@ -1632,13 +2147,143 @@ private:
     Atomic<size_t>       numResizes;
     Atomic<size_t>       numTempItems;
     bool                 activeState;
+    bool                 optimisticReads;
+    //! What lock free readers may still see, oldest first.
+    std::deque<Retired>  retired;
+    Atomic<size_t>       numRetired;
+    SpinLock             retiredLock;
 
     static size_t                 defaultNumBuckets;
     static size_t                 defaultNumLocks;
     static enum stored_value_type defaultStoredValueType;
+    static enum hash_table_layout defaultLayout;
+    static bool                   defaultOptimisticReads;
+
+    static HashBucket *newBuckets(size_t n);
+
+    bool allocateArray(BucketArray &a, size_t n);
+    void freeArray(BucketArray &a);
+
+    size_t arraySize(size_t n) {
+        return n * (layout == cacheline ? sizeof(HashBucket)
+                                        : sizeof(StoredValue*));
+    }
+
+    /**
+     * Get the tag of a key with the given hash in a cacheline bucket.
+     */
+    static uint8_t tagForHash(int h) {
+        // Take the tag from other bits than the ones picking the bucket,
+        // and keep 0 for free slots.
+        return static_cast<uint8_t>(0x80 |
+                                    ((static_cast<uint32_t>(h) * 2654435761U) >> 25));
+    }
+
+    /**
+     * True if the items of the given bucket were moved to the
+     * resizeTable.
+     */
+    bool isMigrated(int bucket_num) {
+        return static_cast<size_t>(bucket_num) < migrated.get();
+    }
+
+    /**
+     * Find the StoredValue with the given key in a locked bucket,
+     * regardless of its state.
+     */
+    StoredValue *unlocked_lookup(const std::string &key, int h, int bucket_num) {
+        if (isMigrated(bucket_num)) {
+            return unlocked_lookupResized(key, h);
+        }
+        return lookupIn(table, bucket_num, key, h);
+    }
+
+    /**
+     * Find the StoredValue with the given key in a locked bucket when
+     * the hash of the key isn't at hand. Only the cacheline layout and
+     * the migrated buckets need it.
+     */
+    StoredValue *unlocked_lookup(const std::string &key, int bucket_num) {
+        if (layout == cacheline || isMigrated(bucket_num)) {
+            return unlocked_lookup(key, hash(key), bucket_num);
+        }
+        return lookupIn(table, bucket_num, key, 0);
+    }
+
+    StoredValue *lookupIn(BucketArray &a, int bucket_num,
+                          const std::string &key, int h) {
+        StoredValue *v;
+        if (layout == cacheline) {
+            HashBucket &b = a.buckets[bucket_num];
+            int m = b.match(tagForHash(h));
+            while (m) {
+                int i = ffs(m) - 1;
+                if (b.slots[i]->hasKey(key)) {
+                    return b.slots[i];
+                }
+                m &= m - 1;
+            }
+            v = b.overflow;
+        } else {
+            v = a.values[bucket_num];
+        }
+        while (v && !v->hasKey(key)) {
+            v = v->next;
+        }
+        return v;
+    }
+
+    /**
+     * What unlocked_find returns for the StoredValue it looked up.
+     */
+    StoredValue *found(StoredValue *v, bool wantsDeleted, bool trackReference) {
+        if (v) {
+            if (trackReference && !v->isDeleted()) {
+                v->referenced(*this);
+                v->inflateValue(stats, *this);
+            }
+            if (wantsDeleted || !v->isDeleted()) {
+                return v;
+            }
+        }
+        return NULL;
+    }
+
+    StoredValue *optimisticLookup(const BucketArray &a, int bucket_num,
+                                  const std::string &key, uint8_t tag,
+                                  const Mutex &m, uint32_t seq);
+    void retire(const value_t &v, StoredValue *sv);
+    void reclaim(bool all);
+    StoredValue *unlocked_lookupResized(const std::string &key, int h);
+    void unlocked_link(StoredValue *v, int bucket_num);
+    void unlocked_link(StoredValue *v, int bucket_num, int h);
+    void unlocked_unlink(StoredValue *v, int bucket_num);
+    void linkIn(BucketArray &a, int bucket_num, StoredValue *v, int h);
+    void unlinkIn(BucketArray &a, int bucket_num, StoredValue *v);
+    StoredValue *detachIn(BucketArray &a, int bucket_num);
+    void visitIn(BucketArray &a, int bucket_num, HashTableVisitor &visitor);
+    void visitResized(int bucket_num, HashTableVisitor &visitor);
+    void finishResize();
+
+    /**
+     * Migrate a few buckets on behalf of a mutation.
+     */
+    void migrateSome() {
+        if (isResizing()) {
+            migrate(resizeStep, false);
+        }
+    }
+
+    static const size_t resizeStep;
+    static const size_t retireBatch;
+    static const int optimisticReadAttempts;
 
     int getBucketForHash(int h) {
-        return abs(h % static_cast<int>(size));
+        return abs(h % static_cast<int>(table.size));
+    }
+
+    int getResizedBucketForHash(int h) {
+        return abs(h % static_cast<int>(resizeTable.size));
     }
 
     inline int mutexForBucket(int bucket_num) {
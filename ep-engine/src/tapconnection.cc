@@ -155,6 +155,8 @@ public:
             config.setBgMaxPending(value);
         } else if (key.compare("tap_backlog_limit") == 0) {
             config.setBackfillBacklogLimit(value);
+        } else if (key.compare("tap_backfill_buffer_size") == 0) {
+            config.setBackfillBufferSize(value);
         }
     }
 
@@ -184,6 +186,7 @@ TapConfig::TapConfig(EventuallyPersistentEngine &e)
     backoffSleepTime = config.getTapBackoffPeriod();
     requeueSleepTime = config.getTapRequeueSleepTime();
     backfillBacklogLimit = config.getTapBacklogLimit();
+    backfillBufferSize = config.getTapBackfillBufferSize();
     backfillResidentThreshold = config.getTapBackfillResident();
 }
 
@@ -205,6 +208,8 @@ void TapConfig::addConfigChangeListener(EventuallyPersistentEngine &engine) {
                               new TapConfigChangeListener(engine.getTapConfig()));
     configuration.addValueChangedListener("tap_backlog_limit",
                               new TapConfigChangeListener(engine.getTapConfig()));
+    configuration.addValueChangedListener("tap_backfill_buffer_size",
+                              new TapConfigChangeListener(engine.getTapConfig()));
     configuration.addValueChangedListener("tap_backfill_resident",
                               new TapConfigChangeListener(engine.getTapConfig()));
 }
@@ -216,6 +221,8 @@ TapProducer::TapProducer(EventuallyPersistentEngine &theEngine,
     TapConnection(theEngine, c, n),
     queue(NULL),
     queueSize(0),
+    backfilledBytes(0),
+    diskBackfillPauses(0),
     flags(f),
     recordsFetched(0),
     pendingFlush(false),
@@ -562,7 +569,10 @@ bool TapProducer::windowIsFull() {
 
 bool TapProducer::requestAck(tap_event_t event, uint16_t vbucket) {
     LockHolder lh(queueLock);
+    return requestAck_UNLOCKED(event, vbucket);
+}
 
+bool TapProducer::requestAck_UNLOCKED(tap_event_t event, uint16_t vbucket) {
     if (!supportAck) {
         // If backfill was scheduled before, check if the backfill is completed or not.
         checkBackfillCompletion_UNLOCKED();
@@ -622,6 +632,8 @@ void TapProducer::clearQueues_UNLOCKED() {
     }
     mem_overhead += (bgResultSize * sizeof(Item *));
     bgResultSize = 0;
+    backfilledBytes = 0;
+    wakeDiskBackfills_UNLOCKED();
 
     // Reset bg result size in a checkpoint state.
     std::map<uint16_t, TapCheckpointState>::iterator it = tapCheckpointState.begin();
@@ -1184,7 +1196,7 @@ void TapProducer::queueBGFetch_UNLOCKED(const std::string &key, uint64_t id, uin
     assert(bgJobIssued > bgJobCompleted);
 }
 
-void TapProducer::completeBGFetchJob(Item *itm, uint16_t vbid, bool implicitEnqueue) {
+bool TapProducer::completeBGFetchJob(Item *itm, uint16_t vbid, bool implicitEnqueue) {
     LockHolder lh(queueLock);
     std::map<uint16_t, TapCheckpointState>::iterator it = tapCheckpointState.find(vbid);
 
@@ -1205,6 +1217,7 @@ void TapProducer::completeBGFetchJob(Item *itm, uint16_t vbid, bool implicitEnqu
 
     if (itm && vbucketFilter(itm->getVBucketId())) {
         backfilledItems.push(itm);
+        backfilledBytes += itm->size();
         ++bgResultSize;
         if (it != tapCheckpointState.end()) {
             ++(it->second.bgResultSize);
@@ -1214,6 +1227,25 @@ void TapProducer::completeBGFetchJob(Item *itm, uint16_t vbid, bool implicitEnqu
     } else {
         delete itm;
     }
+    return backfilledBytes >= engine.getTapConfig().getBackfillBufferSize();
+}
+
+bool TapProducer::pauseDiskBackfill(Dispatcher &d, TaskId &task) {
+    LockHolder lh(queueLock);
+    if (backfilledBytes < engine.getTapConfig().getBackfillBufferSize()) {
+        return false;
+    }
+    pausedDiskBackfills.push_back(std::make_pair(&d, task));
+    ++diskBackfillPauses;
+    return true;
+}
+
+void TapProducer::wakeDiskBackfills_UNLOCKED() {
+    std::list<std::pair<Dispatcher*, TaskId> >::iterator it;
+    for (it = pausedDiskBackfills.begin(); it != pausedDiskBackfills.end(); ++it) {
+        it->first->wake(it->second);
+    }
+    pausedDiskBackfills.clear();
 }
 
 Item* TapProducer::nextBgFetchedItem_UNLOCKED() {
@@ -1221,6 +1253,7 @@ Item* TapProducer::nextBgFetchedItem_UNLOCKED() {
     Item *rv = backfilledItems.front();
     assert(rv);
     backfilledItems.pop();
+    backfilledBytes -= std::min(backfilledBytes, rv->size());
     --bgResultSize;
 
     std::map<uint16_t, TapCheckpointState>::iterator it =
@@ -1232,6 +1265,12 @@ Item* TapProducer::nextBgFetchedItem_UNLOCKED() {
     stats.memOverhead.decr(sizeof(Item *));
     assert(stats.memOverhead.get() < GIGANTOR);
 
+    // Resume the paused disk backfills once half of the buffer is free.
+    if (!pausedDiskBackfills.empty() &&
+        backfilledBytes <= engine.getTapConfig().getBackfillBufferSize() / 2) {
+        wakeDiskBackfills_UNLOCKED();
+    }
+
     return rv;
 }
 
@@ -1251,6 +1290,8 @@ void TapProducer::addStats(ADD_STAT add_stat, const void *c) {
     addStat("idle", idle_UNLOCKED(), add_stat, c);
     addStat("has_queued_item", !emptyQueue_UNLOCKED(), add_stat, c);
     addStat("bg_result_size", bgResultSize, add_stat, c);
+    addStat("bg_result_bytes", backfilledBytes, add_stat, c);
+    addStat("disk_backfill_pauses", diskBackfillPauses, add_stat, c);
     addStat("bg_jobs_issued", bgJobIssued, add_stat, c);
     addStat("bg_jobs_completed", bgJobCompleted, add_stat, c);
     addStat("flags", flagsText, add_stat, c);
@@ -1769,6 +1810,84 @@ void TapProducer::scheduleBackfill_UNLOCKED(const std::vector<uint16_t> &vblist)
 Item* TapProducer::getNextItem(const void *c, uint16_t *vbucket, tap_event_t &ret,
                                bool &referenced) {
     LockHolder lh(queueLock);
+    return getNextItem_UNLOCKED(c, vbucket, ret, referenced);
+}
+
+size_t TapProducer::getNextItems(const void *c, tap_event_info *events, size_t n,
+                                 uint8_t *es, size_t nes) {
+    LockHolder lh(queueLock);
+    size_t count = 0;
+    while (count < n && !windowIsFull()) {
+        tap_event_info &ev = events[count];
+        tap_event_t ret = TAP_PAUSE;
+        bool referenced = false;
+        uint16_t vbucket = 0;
+        Item *itm = getNextItem_UNLOCKED(c, &vbucket, ret, referenced);
+
+        uint16_t nspecific = 0;
+        switch (ret) {
+        case TAP_MUTATION:
+            nspecific = TapEngineSpecific::packSpecificData(ret, this, itm->getSeqno(),
+                                                            referenced);
+            break;
+        case TAP_DELETION:
+            nspecific = TapEngineSpecific::packSpecificData(ret, this, itm->getSeqno());
+            break;
+        case TAP_CHECKPOINT_START:
+            {
+                // Send the current value of the max deleted seqno
+                RCPtr<VBucket> vb = engine.getVBucket(vbucket);
+                if (!vb) {
+                    delete itm;
+                    continue;
+                }
+                nspecific = TapEngineSpecific::packSpecificData(ret, this,
+                                                vb->ht.getMaxDeletedSeqno());
+            }
+            break;
+        case TAP_CHECKPOINT_END:
+            break;
+        case TAP_NOOP:
+            continue;
+        case TAP_DISCONNECT:
+            memset(&ev, 0, sizeof(ev));
+            ev.event = TAP_DISCONNECT;
+            return count + 1;
+        default:
+            return count;
+        }
+
+        ev.event = ret;
+        ev.itm = itm;
+        ev.ttl = (uint8_t)-1;
+        ev.flags = 0;
+        ev.vbucket = vbucket;
+        ev.engine_specific = NULL;
+        ev.nengine_specific = nspecific;
+        if (nspecific > 0) {
+            assert(nspecific <= nes);
+            uint8_t *copy = es + count * nes;
+            memcpy(copy, specificData, nspecific);
+            ev.engine_specific = copy;
+        }
+
+        ++stats.numTapFetched;
+        ev.seqno = seqno;
+        if (requestAck_UNLOCKED(ret, vbucket)) {
+            ev.flags = TAP_FLAG_ACK;
+            seqnoAckRequested = ev.seqno;
+        }
+        if (ret == TAP_MUTATION && haveTapFlagByteorderSupport()) {
+            ev.flags |= TAP_FLAG_NETWORK_BYTE_ORDER;
+        }
+        ++count;
+    }
+
+    return count;
+}
+
+Item* TapProducer::getNextItem_UNLOCKED(const void *c, uint16_t *vbucket,
+                                        tap_event_t &ret, bool &referenced) {
     Item *itm = NULL;
 
     // Check if there are any checkpoint start / end messages to be sent to the TAP client.
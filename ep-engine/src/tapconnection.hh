@@ -9,6 +9,7 @@
 #include "mutex.hh"
 #include "locks.hh"
 #include "vbucket.hh"
+#include "dispatcher.hh"
 
 // forward decl
 class EventuallyPersistentEngine;
@@ -207,6 +208,10 @@ public:
         return backfillBacklogLimit;
     }
 
+    size_t getBackfillBufferSize() const {
+        return backfillBufferSize;
+    }
+
     double getBackfillResidentThreshold() const {
         return backfillResidentThreshold;
     }
@@ -247,6 +252,10 @@ protected:
         backfillBacklogLimit = value;
     }
 
+    void setBackfillBufferSize(size_t value) {
+        backfillBufferSize = value;
+    }
+
     void setBackfillResidentThreshold(double value) {
         if (value < MINIMUM_BACKFILL_RESIDENT_THRESHOLD) {
             value = DEFAULT_BACKFILL_RESIDENT_THRESHOLD;
@@ -275,6 +284,7 @@ private:
 
     // Parameters to control the backfill
     size_t backfillBacklogLimit;
+    size_t backfillBufferSize;
     double backfillResidentThreshold;
 
     EventuallyPersistentEngine &engine;
@@ -586,8 +596,21 @@ public:
 
     /**
      * Invoked each time a background item fetch completes.
+     *
+     * @return true if the backfilled items waiting to be sent fill up
+     *         the backfill buffer of this connection
      */
-    void completeBGFetchJob(Item *item, uint16_t vbid, bool implicitEnqueue);
+    bool completeBGFetchJob(Item *item, uint16_t vbid, bool implicitEnqueue);
+
+    /**
+     * Park a disk backfill task until this connection sent enough of
+     * the items already backfilled.
+     *
+     * @param d the dispatcher running the task
+     * @param task the task to wake up once the buffer drained
+     * @return false if the buffer has room already
+     */
+    bool pauseDiskBackfill(Dispatcher &d, TaskId &task);
 
     /**
      * Find out how many items are still remaining from backfill.
@@ -649,6 +672,21 @@ private:
      */
     Item *getNextItem(const void *c, uint16_t *vbucket, tap_event_t &ret,
                       bool &referenced);
+    Item *getNextItem_UNLOCKED(const void *c, uint16_t *vbucket, tap_event_t &ret,
+                               bool &referenced);
+
+    /**
+     * Pop up to n mutations, deletions and checkpoint messages under a
+     * single acquisition of the queue lock, and fill in their events the
+     * way walkTapQueue does. The engine specific data of event i is
+     * copied to es + i * nes. Stops early at the first event of any other
+     * kind or when the ack window fills up; a disconnect is returned as
+     * the last event.
+     *
+     * @return the number of events filled in
+     */
+    size_t getNextItems(const void *c, tap_event_info *events, size_t n,
+                        uint8_t *es, size_t nes);
 
     /**
      * Check if TAP_DUMP or TAP_TAKEOVER is completed and close the connection if
@@ -982,6 +1020,7 @@ private:
      * @return true if we should request a tap ack (and start a new sequence)
      */
     bool requestAck(tap_event_t event, uint16_t vbucket);
+    bool requestAck_UNLOCKED(tap_event_t event, uint16_t vbucket);
 
     /**
      * Get the current tap sequence number.
@@ -1050,6 +1089,7 @@ private:
 
     void clearQueues_UNLOCKED();
 
+    void wakeDiskBackfills_UNLOCKED();
 
     //! Lock held during queue operations.
     Mutex queueLock;
@@ -1059,6 +1099,12 @@ private:
     size_t queueSize;
     //! Queue of items backfilled from disk
     std::queue<Item*> backfilledItems;
+    //! Bytes of the items backfilled from disk
+    size_t backfilledBytes;
+    //! Disk backfills waiting for the backfilled items to drain
+    std::list<std::pair<Dispatcher*, TaskId> > pausedDiskBackfills;
+    //! Number of times a disk backfill paused for the items to drain
+    size_t diskBackfillPauses;
     //! List of items that are waiting for acks from the client
     std::list<TapLogElement> tapLog;
 
@@ -1161,6 +1207,8 @@ private:
 
     //! EP-engine specific item info
     uint8_t *specificData;
+    //! Copies of the engine specific data of the last batch of events
+    std::vector<uint8_t> batchSpecificData;
     //! Timestamp of backfill start
     time_t backfillTimestamp;
 
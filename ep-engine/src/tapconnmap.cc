@@ -601,7 +601,11 @@ void CompletedBGFetchTapOperation::perform(TapProducer *tc, Item *arg) {
         delete arg;
         return;
     }
-    tc->completeBGFetchJob(arg, vbid, implicitEnqueue);
+    bufferFull = tc->completeBGFetchJob(arg, vbid, implicitEnqueue);
+}
+
+void PauseDiskBackfillTapOperation::perform(TapProducer *tc, TaskId arg) {
+    paused = tc->pauseDiskBackfill(dispatcher, arg);
 }
 
 bool TAPSessionStats::wasReplicationCompleted(const std::string &name) const {
@@ -10,6 +10,7 @@
 #include "queueditem.hh"
 #include "locks.hh"
 #include "syncobject.hh"
+#include "dispatcher.hh"
 
 // Forward declaration
 class TapConnection;
@@ -61,13 +62,40 @@ public:
 class CompletedBGFetchTapOperation : public TapOperation<Item*> {
 public:
     CompletedBGFetchTapOperation(hrtime_t token, uint16_t vb, bool ie=false) :
-        connToken(token), vbid(vb), implicitEnqueue(ie) {}
+        connToken(token), vbid(vb), implicitEnqueue(ie), bufferFull(false) {}
 
     void perform(TapProducer *tc, Item* arg);
+
+    /**
+     * True if the connection has enough backfilled items to send
+     * already.
+     */
+    bool isBufferFull() const {
+        return bufferFull;
+    }
 private:
     hrtime_t connToken;
     uint16_t vbid;
     bool implicitEnqueue;
+    bool bufferFull;
+};
+
+/**
+ * Pause a disk backfill task until the tap connection sent the items
+ * it backfilled already.
+ */
+class PauseDiskBackfillTapOperation : public TapOperation<TaskId> {
+public:
+    PauseDiskBackfillTapOperation(Dispatcher &d) : dispatcher(d), paused(false) {}
+
+    void perform(TapProducer *tc, TaskId arg);
+
+    bool isPaused() const {
+        return paused;
+    }
+private:
+    Dispatcher &dispatcher;
+    bool paused;
 };
 
 class TAPSessionStats {
@@ -213,7 +213,7 @@ bool VBucket::getBGFetchItems(vb_bgfetch_queue_t &fetches) {
     LockHolder lh(pendingBGFetchesLock);
     while (!pendingBGFetches.empty()) {
         VBucketBGFetchItem *it = pendingBGFetches.front();
-        fetches[it->value.getId()].push_back(it);
+        fetches[it->key].push_back(it);
         pendingBGFetches.pop();
     }
     return fetches.size() > 0;
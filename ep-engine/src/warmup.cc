@@ -149,9 +149,13 @@ private:
     EPStats    &stats;
     EventuallyPersistentStore *epstore;
     time_t      startTime;
-    bool        hasPurged;
+    Atomic<bool> hasPurged;
     bool        maybeEnableTraffic;
     int         warmupState;
+    // Readers load different vbuckets in parallel through the same
+    // callback, these serialize what they share.
+    Mutex       purgeMutex;
+    Mutex       logMutex;
 };
 
 void LoadStorageKVPairCallback::initVBucket(uint16_t vbid,
@@ -188,7 +192,7 @@ void LoadStorageKVPairCallback::callback(GetValue &val) {
             switch (vb->ht.insert(*i, shouldEject(), val.isPartial())) {
             case NOMEM:
                 if (retry == 2) {
-                    if (hasPurged) {
+                    if (hasPurged.get()) {
                         if (++stats.warmOOM == 1) {
                             getLogger()->log(EXTENSION_LOG_WARNING, NULL,
                                              "Warmup dataload failure: max_size too low.");
@@ -242,6 +246,7 @@ void LoadStorageKVPairCallback::callback(GetValue &val) {
                                 &itemMeta);
         }
         if (succeeded && epstore->warmupTask->doReconstructLog() && !expired) {
+            LockHolder lh(logMutex);
             epstore->mutationLog.newItem(i->getVBucketId(), i->getKey(), i->getId());
         }
         delete i;
@@ -268,6 +273,12 @@ void LoadStorageKVPairCallback::callback(GetValue &val) {
 }
 
 void LoadStorageKVPairCallback::purge() {
+    LockHolder lh(purgeMutex);
+    if (hasPurged.get()) {
+        // Another reader purged while we waited.
+        return;
+    }
+
     class EmergencyPurgeVisitor : public VBucketVisitor {
     public:
         EmergencyPurgeVisitor(EPStats &s) : stats(s) {}
@@ -289,9 +300,40 @@ void LoadStorageKVPairCallback::purge() {
             vb->ht.visit(epv);
         }
     }
-    hasPurged = true;
+    hasPurged.set(true);
 }
 
+/**
+ * Loads vbuckets for the warmup through the KVStore of a bg fetcher,
+ * on the dispatcher of that fetcher.
+ */
+class WarmupVBucketLoader : public DispatcherCallback {
+public:
+    WarmupVBucketLoader(Warmup *w, KVStore *k,
+                        shared_ptr<Callback<GetValue> > c, bool keys)
+        : warmup(w), kvstore(k), cb(c), keysOnly(keys) { }
+
+    bool callback(Dispatcher &, TaskId &) {
+        warmup->loadPendingVBuckets(kvstore, cb, keysOnly);
+        return false;
+    }
+
+    std::string description() {
+        return std::string("Loading vbuckets for the warmup.");
+    }
+
+    hrtime_t maxExpectedDuration() {
+        // Like the warmup itself.
+        return 10 * 60 * 1000 * 1000;
+    }
+
+private:
+    Warmup *warmup;
+    KVStore *kvstore;
+    shared_ptr<Callback<GetValue> > cb;
+    bool keysOnly;
+};
+
 //////////////////////////////////////////////////////////////////////////////
 //                                                                          //
 //    Implementation of the warmup class                                    //
@@ -307,7 +349,75 @@ Warmup::Warmup(EventuallyPersistentStore *st, Dispatcher *d) :
     corruptAccessLog(false),
     estimatedWarmupCount(std::numeric_limits<size_t>::max())
 {
+    pendingVBuckets.loading = 0;
+}
 
+void Warmup::loadVBuckets(shared_ptr<Callback<GetValue> > cb, bool keysOnly)
+{
+    LockHolder lh(pendingVBuckets.sync);
+    std::map<uint16_t, vbucket_state>::const_iterator it;
+    for (it = initialVbState.begin(); it != initialVbState.end(); ++it) {
+        if (it->second.state == vbucket_state_active) {
+            pendingVBuckets.vbuckets.push_back(it->first);
+        }
+    }
+    for (it = initialVbState.begin(); it != initialVbState.end(); ++it) {
+        if (it->second.state == vbucket_state_replica) {
+            pendingVBuckets.vbuckets.push_back(it->first);
+        }
+    }
+    lh.unlock();
+
+    // The first bg fetcher reads through roUnderlying on this
+    // dispatcher, the others help from their own.
+    for (size_t i = 1; i < store->getNumOfBgFetchers(); ++i) {
+        BgFetcher *fetcher = store->getBgFetcherById(i);
+        shared_ptr<DispatcherCallback>
+            loader(new WarmupVBucketLoader(this, fetcher->getKVStore(), cb,
+                                           keysOnly));
+        fetcher->getDispatcher()->schedule(loader, NULL,
+                                           Priority::WarmupPriority);
+    }
+    loadPendingVBuckets(store->roUnderlying, cb, keysOnly);
+
+    // Wait for the vbuckets still being loaded by the others.  Loaders
+    // that never got to run have nothing to wait for.
+    lh.lock();
+    while (pendingVBuckets.loading > 0) {
+        pendingVBuckets.sync.wait();
+    }
+}
+
+void Warmup::loadPendingVBuckets(KVStore *kvstore,
+                                 shared_ptr<Callback<GetValue> > cb,
+                                 bool keysOnly)
+{
+    EventuallyPersistentEngine &engine = store->getEPEngine();
+    // Stop when the warmup completes, like a single dump would.
+    bool degraded = engine.isDegradedMode();
+    std::vector<uint16_t> vbids(1);
+
+    LockHolder lh(pendingVBuckets.sync);
+    while (!pendingVBuckets.vbuckets.empty()) {
+        if (degraded && !engine.stillWarmingUp()) {
+            pendingVBuckets.vbuckets.clear();
+            break;
+        }
+        vbids[0] = pendingVBuckets.vbuckets.front();
+        pendingVBuckets.vbuckets.pop_front();
+        ++pendingVBuckets.loading;
+        lh.unlock();
+
+        if (keysOnly) {
+            kvstore->dumpKeys(vbids, cb);
+        } else {
+            kvstore->dumpVBuckets(vbids, cb);
+        }
+
+        lh.lock();
+        --pendingVBuckets.loading;
+        pendingVBuckets.sync.notify();
+    }
 }
 
 void Warmup::setEstimatedItemCount(size_t to)
@@ -402,17 +512,7 @@ bool Warmup::keyDump(Dispatcher&, TaskId &)
     if (store->roUnderlying->isKeyDumpSupported()) {
         shared_ptr<Callback<GetValue> > cb(createLKVPCB(initialVbState, false,
                                                         state.getState()));
-        std::map<uint16_t, vbucket_state>::const_iterator it;
-        std::vector<uint16_t> vbids;
-        for (it = initialVbState.begin(); it != initialVbState.end(); ++it) {
-            uint16_t vbid = it->first;
-            vbucket_state vbs = it->second;
-            if (vbs.state == vbucket_state_active || vbs.state == vbucket_state_replica) {
-                vbids.push_back(vbid);
-            }
-        }
-
-        store->roUnderlying->dumpKeys(vbids, cb);
+        loadVBuckets(cb, true);
         success = true;
     }
 
@@ -523,7 +623,11 @@ bool Warmup::loadingKVPairs(Dispatcher&, TaskId &)
 {
     shared_ptr<Callback<GetValue> > cb(createLKVPCB(initialVbState, false,
                                                     state.getState()));
-    store->roUnderlying->dump(cb);
+    if (store->getNumOfBgFetchers() > 0) {
+        loadVBuckets(cb, false);
+    } else {
+        store->roUnderlying->dump(cb);
+    }
 
     if (doReconstructLog()) {
         store->mutationLog.commit1();
@@ -541,7 +645,11 @@ bool Warmup::loadingData(Dispatcher&, TaskId &)
 
     shared_ptr<Callback<GetValue> > cb(createLKVPCB(initialVbState, true,
                                        state.getState()));
-    store->roUnderlying->dump(cb);
+    if (store->getNumOfBgFetchers() > 0) {
+        loadVBuckets(cb, false);
+    } else {
+        store->roUnderlying->dump(cb);
+    }
     transition(WarmupState::Done);
     return true;
 }
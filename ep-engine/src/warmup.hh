@@ -81,6 +81,14 @@ public:
 
     hrtime_t getTime(void) { return warmup; }
 
+    /**
+     * Load the vbuckets left to warm up through the given KVStore,
+     * one at a time, until there are none left.
+     */
+    void loadPendingVBuckets(KVStore *kvstore,
+                             shared_ptr<Callback<GetValue> > cb,
+                             bool keysOnly);
+
 private:
     template <typename T>
     void addStat(const char *nm, T val, ADD_STAT add_stat, const void *c) const;
@@ -99,6 +107,8 @@ private:
 
     void transition(int to, bool force=false);
 
+    void loadVBuckets(shared_ptr<Callback<GetValue> > cb, bool keysOnly);
+
 
     LoadStorageKVPairCallback *createLKVPCB(const std::map<uint16_t, vbucket_state> &st,
                                             bool maybeEnable, int warmupState);
@@ -126,6 +136,13 @@ private:
         std::list<WarmupStateListener*> listeners;
     } stateListeners;
 
+    //! The vbuckets the readers still have to load.
+    struct {
+        SyncObject sync;
+        std::deque<uint16_t> vbuckets;
+        size_t loading;
+    } pendingVBuckets;
+
     DISALLOW_COPY_AND_ASSIGN(Warmup);
 };
 
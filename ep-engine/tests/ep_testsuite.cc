@@ -19,6 +19,7 @@
 #include <iostream>
 #include <sstream>
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 #include <sstream>
@@ -1154,6 +1155,105 @@ static enum test_result test_flush_multiv_restart(ENGINE_HANDLE *h, ENGINE_HANDL
     return SUCCESS;
 }
 
+static enum test_result test_flush_multi_shard(ENGINE_HANDLE *h,
+                                               ENGINE_HANDLE_V1 *h1) {
+    // Four flushers, each persisting the vbucket ids equal to its own
+    // shard id modulo four.
+    for (uint16_t vb = 1; vb < 8; ++vb) {
+        check(set_vbucket_state(h, h1, vb, vbucket_state_active),
+              "Failed to set vbucket state.");
+    }
+    for (uint16_t vb = 0; vb < 8; ++vb) {
+        item *i = NULL;
+        std::stringstream ss;
+        ss << "key" << vb;
+        check(store(h, h1, NULL, OPERATION_SET, ss.str().c_str(),
+                    "somevalue", &i, 0, vb) == ENGINE_SUCCESS,
+              "Failed set.");
+        h1->release(h, NULL, i);
+    }
+    wait_for_flusher_to_settle(h, h1);
+    check(get_int_stat(h, h1, "ep_total_persisted") == 8,
+          "Expected all the items to be persisted");
+    for (int shard = 0; shard < 4; ++shard) {
+        std::stringstream ss;
+        ss << "shard_" << shard << ":commit_num";
+        check(get_int_stat(h, h1, ss.str().c_str(), "flusher") > 0,
+              "Expected every flusher to commit");
+    }
+
+    testHarness.reload_engine(&h, &h1,
+                              testHarness.engine_path,
+                              testHarness.get_current_testcase()->cfg,
+                              true, false);
+    wait_for_warmup_complete(h, h1);
+    for (uint16_t vb = 0; vb < 8; ++vb) {
+        // Only vbucket 0 comes back active from the warmup.
+        check(set_vbucket_state(h, h1, vb, vbucket_state_active),
+              "Failed to set vbucket state.");
+        std::stringstream ss;
+        ss << "key" << vb;
+        check_key_value(h, h1, ss.str().c_str(), "somevalue", 9, vb);
+    }
+
+    // Flushing all deletes the vbucket files of every shard.
+    check(h1->flush(h, NULL, 0) == ENGINE_SUCCESS, "Failed to flush");
+    testHarness.reload_engine(&h, &h1,
+                              testHarness.engine_path,
+                              testHarness.get_current_testcase()->cfg,
+                              true, false);
+    wait_for_warmup_complete(h, h1);
+    check(ENGINE_KEY_ENOENT == verify_key(h, h1, "key0"), "Expected missing key");
+    for (uint16_t vb = 1; vb < 8; ++vb) {
+        check(verify_vbucket_missing(h, h1, vb), "Vbucket came back.");
+    }
+    return SUCCESS;
+}
+
+static enum test_result test_group_commit(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
+    for (uint16_t vb = 1; vb < 4; ++vb) {
+        check(set_vbucket_state(h, h1, vb, vbucket_state_active),
+              "Failed to set vbucket state.");
+    }
+
+    // Queue up mutations for several vbuckets, so that they are all
+    // persisted by the same transaction.
+    stop_persistence(h, h1);
+    for (uint16_t vb = 0; vb < 4; ++vb) {
+        for (int j = 0; j < 2; ++j) {
+            item *i = NULL;
+            std::stringstream ss;
+            ss << "key" << vb << "_" << j;
+            check(store(h, h1, NULL, OPERATION_SET, ss.str().c_str(),
+                        "somevalue", &i, 0, vb) == ENGINE_SUCCESS,
+                  "Failed set.");
+            h1->release(h, NULL, i);
+        }
+    }
+    start_persistence(h, h1);
+    wait_for_flusher_to_settle(h, h1);
+    check(get_int_stat(h, h1, "rw:lastCommDocs", "kvstore") == 8,
+          "Expected the docs of all vbuckets to be committed together.");
+
+    testHarness.reload_engine(&h, &h1,
+                              testHarness.engine_path,
+                              testHarness.get_current_testcase()->cfg,
+                              true, false);
+    wait_for_warmup_complete(h, h1);
+
+    for (uint16_t vb = 0; vb < 4; ++vb) {
+        // Only vbucket 0 comes back active from the warmup.
+        check(set_vbucket_state(h, h1, vb, vbucket_state_active),
+              "Failed to set vbucket state.");
+        for (int j = 0; j < 2; ++j) {
+            std::stringstream ss;
+            ss << "key" << vb << "_" << j;
+            check_key_value(h, h1, ss.str().c_str(), "somevalue", 9, vb);
+        }
+    }
+    return SUCCESS;
+}
+
 static enum test_result test_delete(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
     item *i = NULL;
     // First try to delete something we know to not be there.
@@ -2665,6 +2765,104 @@ static enum test_result test_tap_stream(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1)
     return SUCCESS;
 }
 
+static enum test_result test_tap_backfill_flow_control(ENGINE_HANDLE *h,
+                                                       ENGINE_HANDLE_V1 *h1) {
+    const int num_keys = 200;
+    const size_t buffer_size = 4096;
+    std::string value(256, 'x');
+    std::vector<int> received(num_keys, 0);
+
+    for (int ii = 0; ii < num_keys; ++ii) {
+        std::stringstream ss;
+        ss << "key" << ii;
+        check(store(h, h1, NULL, OPERATION_SET, ss.str().c_str(),
+                    value.c_str(), NULL, 0, 0) == ENGINE_SUCCESS,
+              "Failed to store an item.");
+    }
+    wait_for_flusher_to_settle(h, h1);
+
+    for (int ii = 0; ii < num_keys; ++ii) {
+        std::stringstream ss;
+        ss << "key" << ii;
+        evict_key(h, h1, ss.str().c_str(), 0, "Ejected.");
+    }
+
+    // Room for a dozen of the backfilled items at a time
+    std::stringstream bs;
+    bs << buffer_size;
+    set_param(h, h1, engine_param_tap, "tap_backfill_buffer_size",
+              bs.str().c_str());
+
+    const void *cookie = testHarness.create_cookie();
+    testHarness.lock_cookie(cookie);
+    std::string name = "tap_client_thread";
+    TAP_ITERATOR iter = h1->get_tap_iterator(h, cookie, name.c_str(),
+                                             name.length(),
+                                             TAP_CONNECT_FLAG_DUMP, NULL,
+                                             0);
+    check(iter != NULL, "Failed to create a tap iterator");
+
+    item *it;
+    void *engine_specific;
+    uint16_t nengine_specific;
+    uint8_t ttl;
+    uint16_t flags;
+    uint32_t seqno;
+    uint16_t vbucket;
+    tap_event_t event;
+    std::string key;
+    int pauses = 0;
+
+    do {
+        event = iter(h, cookie, &it, &engine_specific,
+                     &nengine_specific, &ttl, &flags,
+                     &seqno, &vbucket);
+
+        switch (event) {
+        case TAP_PAUSE:
+            testHarness.waitfor_cookie(cookie);
+            break;
+        case TAP_OPAQUE:
+        case TAP_NOOP:
+            break;
+        case TAP_MUTATION:
+            testHarness.unlock_cookie(cookie);
+            check(get_key(h, h1, it, key), "Failed to read out the key");
+            check(key.compare(0, 3, "key") == 0, "Unexpected key");
+            ++received[atoi(key.c_str() + 3)];
+            check(verify_item(h, h1, it, NULL, 0, value.c_str(),
+                              value.length()) == SUCCESS,
+                  "Unexpected item arrived on tap stream");
+            h1->release(h, cookie, it);
+
+            // The disk backfill stops reading once the buffer is full
+            check(get_int_stat(h, h1, "eq_tapq:tap_client_thread:bg_result_bytes",
+                               "tap") < static_cast<int>(2 * buffer_size),
+                  "Backfilled items overflowed the backfill buffer");
+            pauses = get_int_stat(h, h1,
+                                  "eq_tapq:tap_client_thread:disk_backfill_pauses",
+                                  "tap");
+            testHarness.lock_cookie(cookie);
+            break;
+        case TAP_DISCONNECT:
+            break;
+        default:
+            std::cerr << "Unexpected event:  " << event << std::endl;
+            return FAIL;
+        }
+
+    } while (event != TAP_DISCONNECT);
+    testHarness.unlock_cookie(cookie);
+
+    // Every key arrives once, the backfill resumed where it paused
+    for (int ii = 0; ii < num_keys; ++ii) {
+        check(received[ii] == 1, "Lost or duplicated a backfilled key");
+    }
+    check(pauses > 0, "Expected the disk backfill to pause");
+
+    return SUCCESS;
+}
+
 static enum test_result test_tap_sends_deleted(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1) {
     const int num_keys = 5;
     for (int ii = 0; ii < num_keys; ++ii) {
@@ -3205,6 +3403,148 @@ static enum test_result test_tap_ack_stream(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *
     return SUCCESS;
 }
 
+static enum test_result test_tap_batch_stream(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1)
+{
+    check(h1->get_tap_batch_iterator != NULL,
+          "The engine should provide a batched tap iterator");
+
+    const void *cookie = testHarness.create_cookie();
+    testHarness.lock_cookie(cookie);
+    uint16_t vbucketfilter[2];
+    vbucketfilter[0] = htons(1);
+    vbucketfilter[1] = htons(0);
+
+    std::string name = "tap_batch";
+    TAP_BATCH_ITERATOR iter = h1->get_tap_batch_iterator(h, cookie, name.c_str(),
+                                                         name.length(),
+                                                         TAP_CONNECT_FLAG_LIST_VBUCKETS |
+                                                         TAP_CONNECT_CHECKPOINT |
+                                                         TAP_CONNECT_SUPPORT_ACK,
+                                                         static_cast<void*>(vbucketfilter),
+                                                         4);
+    check(iter != NULL, "Failed to create a batched tap iterator");
+
+    // The stream sends the changes made from now on. Key i is stored
+    // i + 1 times, so its revision seqno tells it apart.
+    const int nkeys = 20;
+    for (int i = 0; i < nkeys; ++i) {
+        std::stringstream ss;
+        ss << i;
+        for (int j = 0; j <= i; ++j) {
+            check(store(h, h1, NULL, OPERATION_SET, ss.str().c_str(),
+                        "value", NULL, 0, 0) == ENGINE_SUCCESS,
+                  "Failed to store an item.");
+        }
+    }
+    check(store(h, h1, NULL, OPERATION_SET, "gone", "value",
+                NULL, 0, 0) == ENGINE_SUCCESS,
+          "Failed to store an item.");
+    checkeq(ENGINE_SUCCESS, del(h, h1, "gone", 0, 0), "Delete failed");
+
+    const int nevents = 8;
+    tap_event_info events[nevents];
+    std::string key;
+    int nextKey = 0;
+    bool deleted = false;
+    std::set<uint32_t> opaques;
+    uint32_t lastSeqno = 0;
+    uint32_t lastAck = 0;
+    int batches = 0;
+
+    while (nextKey < nkeys || !deleted) {
+        int n = iter(h, cookie, events, nevents);
+        check(n >= 1 && n <= nevents, "Invalid number of tap events");
+        ++batches;
+
+        std::vector<uint32_t> acks;
+        for (int ii = 0; ii < n; ++ii) {
+            tap_event_info &ev = events[ii];
+            if (ev.event == TAP_PAUSE || ev.event == TAP_DISCONNECT) {
+                check(ii == n - 1, "The batch went on after a pause");
+            } else if (ev.event != TAP_NOOP) {
+                check(ev.seqno > lastSeqno, "Tap seqnos out of order");
+                lastSeqno = ev.seqno;
+                if (ev.flags & TAP_FLAG_ACK) {
+                    acks.push_back(ev.seqno);
+                }
+            }
+
+            uint64_t revSeqno;
+            uint32_t opaque;
+            switch (ev.event) {
+            case TAP_PAUSE:
+            case TAP_NOOP:
+                break;
+            case TAP_OPAQUE:
+                check(ev.nengine_specific == sizeof(opaque),
+                      "Unexpected engine specific data for an opaque");
+                memcpy(&opaque, ev.engine_specific, sizeof(opaque));
+                opaques.insert(ntohl(opaque));
+                break;
+            case TAP_CHECKPOINT_START:
+            case TAP_CHECKPOINT_END:
+                h1->release(h, cookie, ev.itm);
+                break;
+            case TAP_MUTATION:
+                check(get_key(h, h1, ev.itm, key), "Failed to read out the key");
+                // The checkpoint keeps the order the keys were stored in
+                check(atoi(key.c_str()) == nextKey, "Keys out of order");
+                check(ev.nengine_specific >= sizeof(revSeqno),
+                      "Missing the revision seqno of a mutation");
+                memcpy(&revSeqno, ev.engine_specific, sizeof(revSeqno));
+                check(ntohll(revSeqno) == static_cast<uint64_t>(nextKey + 1),
+                      "Wrong revision seqno for a mutation of the batch");
+                ++nextKey;
+                h1->release(h, cookie, ev.itm);
+                break;
+            case TAP_DELETION:
+                check(get_key(h, h1, ev.itm, key), "Failed to read out the key");
+                check(key == "gone" && nextKey == nkeys,
+                      "Unexpected deletion on the tap stream");
+                check(ev.nengine_specific == sizeof(revSeqno),
+                      "Missing the revision seqno of a deletion");
+                deleted = true;
+                h1->release(h, cookie, ev.itm);
+                break;
+            case TAP_DISCONNECT:
+                std::cerr << "Unexpected disconnect" << std::endl;
+                return FAIL;
+            default:
+                std::cerr << "Unexpected event:  " << ev.event << std::endl;
+                return FAIL;
+            }
+        }
+
+        if (!acks.empty()) {
+            // Like a tap consumer, ack every event of the batch that
+            // asked for it, in the order they were sent
+            testHarness.unlock_cookie(cookie);
+            std::vector<uint32_t>::iterator it = acks.begin();
+            for (; it != acks.end(); ++it) {
+                h1->tap_notify(h, cookie, NULL, 0, 0,
+                               PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                               TAP_ACK, *it, NULL, 0,
+                               0, 0, 0, NULL, 0, 0);
+            }
+            testHarness.lock_cookie(cookie);
+            lastAck = acks.back();
+        } else if (events[n - 1].event == TAP_PAUSE) {
+            testHarness.waitfor_cookie(cookie);
+        }
+    }
+    testHarness.unlock_cookie(cookie);
+
+    check(batches < nkeys, "Expected several events per batch");
+    check(opaques.count(TAP_OPAQUE_ENABLE_AUTO_NACK) == 1 &&
+          opaques.count(TAP_OPAQUE_ENABLE_CHECKPOINT_SYNC) == 1,
+          "Missing the opaque messages of the stream");
+    check(lastAck != 0, "Expected the stream to ask for acks");
+    check(get_int_stat(h, h1, "eq_tapq:tap_batch:recv_ack_seqno", "tap") ==
+          static_cast<int>(lastAck), "The last ack wasn't processed");
+
+    return SUCCESS;
+}
+
 static enum test_result test_tap_implicit_ack_stream(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1)
 {
     const int nkeys = 10;
@@ -3850,8 +4190,8 @@ static enum test_result test_notifier_stats(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *
     int error = get_int_stat(h, h1, "rw:notify_vbucket_update:error", "kvstore");
     check(error == 0, "expected zero notify_vbucket_update error");
 
-    // every file update should increment the same number of file close
-    // and notify_vbucket_udpate
+    // with the db handle cache disabled, every file update should increment
+    // the same number of file close and notify_vbucket_udpate
     int close = get_int_stat(h, h1, "rw:close", "kvstore");
     int sent = get_int_stat(h, h1, "rw:notify_vbucket_update:sent", "kvstore");
     check(close == sent, "expected notify_vbucket_update equals to close");
@@ -6509,7 +6849,7 @@ engine_test_t* get_tests(void) {
         TestCase("startup token stat", test_cbd_225, test_setup,
                  teardown, NULL, prepare, cleanup),
         TestCase("mccouch notifier stat", test_notifier_stats, test_setup,
-                 teardown, NULL, prepare, cleanup),
+                 teardown, "couch_db_cache_size=0", prepare, cleanup),
 
         // eviction
         TestCase("value eviction", test_value_eviction, test_setup,
@@ -6553,6 +6893,10 @@ engine_test_t* get_tests(void) {
                  test_setup, teardown, NULL, prepare, cleanup),
         TestCase("tap stream", test_tap_stream, test_setup,
                  teardown, NULL, prepare, cleanup),
+        TestCase("tap batch stream", test_tap_batch_stream, test_setup,
+                 teardown, NULL, prepare, cleanup),
+        TestCase("tap backfill flow control", test_tap_backfill_flow_control,
+                 test_setup, teardown, NULL, prepare, cleanup),
         TestCase("tap stream send deletes", test_tap_sends_deleted, test_setup,
                  teardown, NULL, prepare, cleanup),
         TestCase("tap agg stats", test_tap_agg_stats, test_setup,
@@ -6587,6 +6931,13 @@ engine_test_t* get_tests(void) {
                  teardown, NULL, prepare, cleanup),
         TestCase("flush multiv+restart", test_flush_multiv_restart,
                  test_setup, teardown, NULL, prepare, cleanup),
+        TestCase("flush multi shards", test_flush_multi_shard,
+                 test_setup, teardown,
+                 "flushall_enabled=true;max_vbuckets=16;max_num_flushers=4",
+                 prepare, cleanup),
+        TestCase("group commit", test_group_commit, test_setup, teardown,
+                 "couch_group_commit=true;max_num_flushers=1",
+                 prepare, cleanup),
         TestCase("test kill -9 bucket", test_kill9_bucket,
                  test_setup, teardown, NULL, prepare, cleanup),
         TestCase("test shutdown with force", test_flush_shutdown_force,
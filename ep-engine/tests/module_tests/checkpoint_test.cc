@@ -142,12 +142,153 @@ static void *launch_set_thread(void *arg) {
 }
 }
 
+static void queueKey(CheckpointManager &manager, RCPtr<VBucket> &vbucket, int i) {
+    std::stringstream key;
+    key << "key-" << i;
+    queued_item qi(new QueuedItem(key.str(), vbucket->getId(), queue_op_set));
+    manager.queueDirty(qi, vbucket);
+}
+
+// Return the keys of the mutations a TAP cursor reads until it runs out of items.
+static std::vector<std::string> drainTAPCursor(CheckpointManager &manager,
+                                               const std::string &name) {
+    std::vector<std::string> keys;
+    bool isLastItem = false;
+    while (true) {
+        queued_item qi = manager.nextItem(name, isLastItem);
+        if (qi->getOperation() == queue_op_empty) {
+            break;
+        }
+        if (qi->getOperation() == queue_op_set) {
+            keys.push_back(qi->getKey());
+        }
+    }
+    return keys;
+}
+
+static void testDeduplication() {
+    RCPtr<VBucket> vbucket(new VBucket(1, vbucket_state_active, global_stats,
+                                       checkpoint_config));
+    CheckpointManager manager(global_stats, 1, checkpoint_config, 1);
+    manager.registerTAPCursor("tap");
+
+    for (int i = 0; i < 10; ++i) {
+        queueKey(manager, vbucket, i);
+    }
+    std::vector<queued_item> items;
+    manager.getAllItemsForPersistence(items);
+    assert(items.size() == 11); // checkpoint start and 10 mutations
+
+    // Update the same keys over and over, which leaves lots of empty slots
+    // in the checkpoint queue to compact.
+    for (int n = 0; n < 100; ++n) {
+        for (int i = 0; i < 10; ++i) {
+            queueKey(manager, vbucket, i);
+        }
+        if (n == 50) {
+            items.clear();
+            manager.getAllItemsForPersistence(items);
+            assert(items.size() == 10);
+        }
+    }
+    assert(manager.getNumItemsForPersistence() == 10);
+    items.clear();
+    manager.getAllItemsForPersistence(items);
+    assert(items.size() == 10);
+    std::set<std::string> keys;
+    for (size_t i = 0; i < items.size(); ++i) {
+        keys.insert(items[i]->getKey());
+    }
+    assert(keys.size() == 10);
+
+    queueKey(manager, vbucket, 3);
+    items.clear();
+    manager.getAllItemsForPersistence(items);
+    assert(items.size() == 1 && items[0]->getKey() == "key-3");
+
+    std::vector<std::string> tapKeys = drainTAPCursor(manager, "tap");
+    assert(tapKeys.size() == 10);
+    assert(std::set<std::string>(tapKeys.begin(), tapKeys.end()).size() == 10);
+    assert(tapKeys.back() == "key-3");
+    assert(manager.getNumCheckpoints() == 1);
+}
+
+static void testCollapseClosedCheckpoints() {
+    RCPtr<VBucket> vbucket(new VBucket(2, vbucket_state_replica, global_stats,
+                                       checkpoint_config));
+    CheckpointManager manager(global_stats, 2, checkpoint_config, 1);
+    manager.registerTAPCursor("slow");
+
+    for (int i = 0; i < 10; ++i) {
+        queueKey(manager, vbucket, i);
+    }
+    assert(manager.createNewCheckpoint() == 2);
+    // This cursor sits on the first meta item of the checkpoint the others
+    // are collapsed into.
+    manager.registerTAPCursor("fast", 2);
+    for (int i = 5; i < 15; ++i) {
+        queueKey(manager, vbucket, i);
+    }
+    assert(manager.createNewCheckpoint() == 3);
+    queueKey(manager, vbucket, 20);
+    assert(manager.getNumCheckpoints() == 3);
+
+    std::vector<queued_item> items;
+    manager.getAllItemsForPersistence(items);
+
+    bool newCheckpointCreated;
+    manager.removeClosedUnrefCheckpoints(vbucket, newCheckpointCreated);
+    assert(manager.getNumCheckpoints() == 2);
+
+    std::vector<std::string> slowKeys = drainTAPCursor(manager, "slow");
+    assert(slowKeys.size() == 16);
+    for (int i = 0; i < 15; ++i) {
+        std::stringstream key;
+        key << "key-" << i;
+        assert(slowKeys[i] == key.str());
+    }
+    assert(slowKeys[15] == "key-20");
+
+    std::vector<std::string> fastKeys = drainTAPCursor(manager, "fast");
+    assert(fastKeys == slowKeys);
+}
+
+static void testQueueGrowth() {
+    CheckpointQueue queue;
+    queue.push_back(queued_item(new QueuedItem("key-0", 0, queue_op_set)));
+    // A queue with a single item doesn't take a whole chunk.
+    assert(queue.memorySize() <
+           CheckpointQueue::chunkSize * sizeof(queued_item));
+
+    for (int i = 1; i < 1000; ++i) {
+        std::stringstream key;
+        key << "key-" << i;
+        queue.push_back(queued_item(new QueuedItem(key.str(), 0, queue_op_set)));
+    }
+    queue.push_front(queued_item(new QueuedItem("front", 0, queue_op_set)));
+    assert(queue.size() == 1001);
+
+    CheckpointQueue::iterator it = queue.begin();
+    assert((*it)->getKey() == "front");
+    for (int i = 0; i < 1000; ++i) {
+        std::stringstream key;
+        key << "key-" << i;
+        assert((*(++it))->getKey() == key.str());
+    }
+    assert(++it == queue.end());
+}
+
 int main(int argc, char **argv) {
     (void)argc; (void)argv;
     putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
 
     HashTable::setDefaultNumBuckets(5);
     HashTable::setDefaultNumLocks(1);
+
+    testQueueGrowth();
+    testDeduplication();
+    testCollapseClosedCheckpoints();
+
     RCPtr<VBucket> vbucket(new VBucket(0, vbucket_state_active, global_stats, checkpoint_config));
 
     CheckpointManager *checkpoint_manager = new CheckpointManager(global_stats, 0,
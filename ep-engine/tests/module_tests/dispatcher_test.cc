@@ -56,6 +56,90 @@ bool TestCallback::callback(Dispatcher &d, TaskId &t) {
     return thing->doSomething(d, t);
 }
 
+static Atomic<bool> slowTaskDone;
+
+class SlowCallback : public DispatcherCallback {
+public:
+    bool callback(Dispatcher &d, TaskId &t) {
+        (void)d; (void)t;
+        // Keep a worker busy until the quick tasks ran on the others.
+        while (callbacks < 10) {
+            usleep(100);
+        }
+        slowTaskDone = true;
+        return false;
+    }
+
+    std::string description() { return std::string("Slow"); }
+};
+
+static void testWorkers() {
+    Dispatcher d(*engine, "Workers", 4);
+    assert(d.getNumWorkers() == 4);
+    callbacks = 0;
+    Thing t;
+
+    d.start();
+    d.schedule(shared_ptr<SlowCallback>(new SlowCallback), NULL,
+               Priority::BackfillTaskPriority);
+    for (int i = 0; i < 10; ++i) {
+        d.schedule(shared_ptr<TestCallback>(new TestCallback(&t)), NULL,
+                   Priority::ItemPagerPriority);
+    }
+    while (!slowTaskDone) {
+        usleep(100);
+    }
+    d.stop();
+    assert(callbacks == 10);
+
+    for (size_t i = 0; i < d.getNumWorkers(); ++i) {
+        DispatcherState ds(d.getDispatcherState(i));
+        assert(std::string(ds.getStateName()) == "dispatcher_stopped");
+        assert(!ds.isRunningTask());
+    }
+}
+
+static Atomic<int> exclusiveRunning;
+static Atomic<int> exclusiveDone;
+static Atomic<bool> exclusiveOverlap;
+
+class ExclusiveCallback : public DispatcherCallback {
+public:
+    bool callback(Dispatcher &d, TaskId &t) {
+        (void)d; (void)t;
+        if (++exclusiveRunning > 1) {
+            exclusiveOverlap = true;
+        }
+        usleep(1000);
+        --exclusiveRunning;
+        ++exclusiveDone;
+        return false;
+    }
+
+    std::string description() { return std::string("Exclusive"); }
+
+    bool isExclusive() { return true; }
+};
+
+static void testExclusiveTasks() {
+    Dispatcher d(*engine, "Exclusive", 4);
+    callbacks = 0;
+    Thing t;
+
+    d.start();
+    for (int i = 0; i < 8; ++i) {
+        d.schedule(shared_ptr<ExclusiveCallback>(new ExclusiveCallback), NULL,
+                   Priority::ItemPagerPriority);
+        d.schedule(shared_ptr<TestCallback>(new TestCallback(&t)), NULL,
+                   Priority::ItemPagerPriority);
+    }
+    while (exclusiveDone < 8 || callbacks < 8) {
+        usleep(100);
+    }
+    d.stop();
+    assert(!exclusiveOverlap);
+}
+
 int main(int argc, char **argv) {
     (void)argc; (void)argv;
     int expected_num_callbacks=3;
@@ -87,5 +171,8 @@ int main(int argc, char **argv) {
     IdleTask it;
     assert(hrtime2text(it.maxExpectedDuration()) == std::string("3600 ms"));
 
+    testWorkers();
+    testExclusiveTasks();
+
     return 0;
 }
@@ -0,0 +1,209 @@
+#include "config.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+
+#include <ep.hh>
+#include <item.hh>
+#include <stats.hh>
+
+/*
+ * Compares the chained and the cacheline hash table layouts, and the
+ * locked and the optimistic gets from concurrent readers.
+ *
+ * usage: hash_table_bench [number of keys] [number of lookups]
+ */
+
+time_t time_offset;
+
+extern "C" {
+    static rel_time_t basic_current_time(void) {
+        return 0;
+    }
+
+    rel_time_t (*ep_current_time)() = basic_current_time;
+
+    time_t ep_real_time() {
+        return time(NULL) + time_offset;
+    }
+}
+
+EPStats global_stats;
+
+static std::vector<std::string> generateKeys(size_t num, const char *prefix) {
+    std::vector<std::string> rv;
+    rv.reserve(num);
+    for (size_t i = 0; i < num; i++) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%s%lu", prefix, static_cast<unsigned long>(i));
+        rv.push_back(std::string(buf));
+    }
+    return rv;
+}
+
+static void report(const char *layout, const char *op, size_t n,
+                   hrtime_t start) {
+    hrtime_t spent = gethrtime() - start;
+    printf("%-10s %-12s %10lu ops %8.1f ns/op\n", layout, op,
+           static_cast<unsigned long>(n),
+           static_cast<double>(spent) / static_cast<double>(n));
+}
+
+static void resize(HashTable &h) {
+    h.resize();
+    h.migrate(std::numeric_limits<size_t>::max());
+}
+
+static void run(enum hash_table_layout layout, const char *name,
+                const std::vector<std::string> &keys,
+                const std::vector<std::string> &missing,
+                const std::vector<size_t> &order) {
+    HashTable::setDefaultLayout(layout);
+    HashTable h(global_stats);
+
+    hrtime_t start = gethrtime();
+    std::vector<std::string>::const_iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        Item i(*it, 0, 0, it->c_str(), it->length());
+        h.set(i);
+        if (h.getNumItems() > 4 * h.getSize()) {
+            resize(h);
+        }
+    }
+    resize(h);
+    report(name, "set", keys.size(), start);
+
+    size_t found = 0;
+    start = gethrtime();
+    std::vector<size_t>::const_iterator oit;
+    for (oit = order.begin(); oit != order.end(); ++oit) {
+        std::string &k = const_cast<std::string&>(keys[*oit]);
+        found += h.find(k, false) ? 1 : 0;
+    }
+    report(name, "find_hit", order.size(), start);
+    assert(found == order.size());
+
+    found = 0;
+    start = gethrtime();
+    for (oit = order.begin(); oit != order.end(); ++oit) {
+        std::string &k = const_cast<std::string&>(missing[*oit]);
+        found += h.find(k, false) ? 1 : 0;
+    }
+    report(name, "find_miss", order.size(), start);
+    assert(found == 0);
+
+    start = gethrtime();
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        h.del(*it);
+    }
+    report(name, "del", keys.size(), start);
+    assert(h.getNumItems() == 0);
+
+    printf("%-10s %lu buckets, %lu bytes of table overhead\n\n", name,
+           static_cast<unsigned long>(h.getSize()),
+           static_cast<unsigned long>(h.memorySize()));
+}
+
+struct GetRun {
+    HashTable *ht;
+    const std::vector<std::string> *keys;
+    size_t nkeys;
+    size_t nlookups;
+    bool optimistic;
+    size_t found;
+};
+
+extern "C" {
+    static void *runGets(void *arg) {
+        GetRun *r = static_cast<GetRun*>(arg);
+        HashTable &h = *r->ht;
+        unsigned int seed = static_cast<unsigned int>(
+                                reinterpret_cast<uintptr_t>(arg));
+        for (size_t i = 0; i < r->nlookups; ++i) {
+            const std::string &k = (*r->keys)[rand_r(&seed) % r->nkeys];
+            Item *it = NULL;
+            if (r->optimistic) {
+                bool referenced;
+                it = h.optimisticGet(k, 0, ep_real_time(), false, referenced);
+            }
+            if (it == NULL) {
+                int bucket_num(0);
+                LockHolder lh = h.getLockedBucket(k, &bucket_num);
+                StoredValue *v = h.unlocked_find(k, bucket_num, false, false);
+                if (v) {
+                    it = v->toItem(false, 0);
+                }
+            }
+            if (it) {
+                ++r->found;
+                delete it;
+            }
+        }
+        return NULL;
+    }
+}
+
+static void runConcurrentGets(const char *name, bool optimistic, size_t nhot,
+                              const std::vector<std::string> &keys,
+                              size_t nlookups) {
+    HashTable::setDefaultLayout(chained);
+    HashTable::setDefaultOptimisticReads(optimistic);
+    HashTable h(global_stats);
+    std::vector<std::string>::const_iterator it;
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        Item i(*it, 0, 0, it->c_str(), it->length());
+        h.set(i);
+    }
+    resize(h);
+
+    const size_t nthreads[] = { 1, 4, 16, 32 };
+    for (size_t n = 0; n < sizeof(nthreads) / sizeof(nthreads[0]); ++n) {
+        std::vector<GetRun> runs(nthreads[n]);
+        std::vector<pthread_t> threads(nthreads[n]);
+        hrtime_t start = gethrtime();
+        for (size_t i = 0; i < nthreads[n]; ++i) {
+            GetRun r = { &h, &keys, std::min(nhot, keys.size()),
+                         nlookups / nthreads[n], optimistic, 0 };
+            runs[i] = r;
+            assert(pthread_create(&threads[i], NULL, runGets, &runs[i]) == 0);
+        }
+        for (size_t i = 0; i < nthreads[n]; ++i) {
+            assert(pthread_join(threads[i], NULL) == 0);
+            assert(runs[i].found == runs[i].nlookups);
+        }
+        char op[32];
+        snprintf(op, sizeof(op), "get_%lut", static_cast<unsigned long>(nthreads[n]));
+        report(name, op, nlookups, start);
+    }
+    printf("\n");
+    HashTable::setDefaultOptimisticReads(true);
+}
+
+int main(int argc, char **argv) {
+    putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
+    global_stats.setMaxDataSize(std::numeric_limits<size_t>::max());
+
+    size_t nkeys = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    size_t nlookups = argc > 2 ? strtoul(argv[2], NULL, 10) : 4000000;
+
+    std::vector<std::string> keys = generateKeys(nkeys, "key");
+    std::vector<std::string> missing = generateKeys(nkeys, "missing");
+    std::vector<size_t> order;
+    order.reserve(nlookups);
+    srand(918475);
+    for (size_t i = 0; i < nlookups; ++i) {
+        order.push_back(static_cast<size_t>(rand()) % nkeys);
+    }
+
+    run(chained, "chained", keys, missing, order);
+    run(cacheline, "cacheline", keys, missing, order);
+
+    // A few hot keys, so the readers keep hitting the same locks.
+    runConcurrentGets("locked", false, 64, keys, nlookups);
+    runConcurrentGets("optimistic", true, 64, keys, nlookups);
+    exit(0);
+}
@@ -5,6 +5,7 @@
 #include <limits>
 #include <cassert>
 #include <algorithm>
+#include <set>
 
 #include <ep.hh>
 #include <item.hh>
@@ -271,6 +272,47 @@ static void testResize() {
     verifyFound(h, keys);
 }
 
+static void testIncrementalResize() {
+    HashTable h(global_stats, 769, 3);
+
+    std::vector<std::string> keys = generateKeys(5000);
+    storeMany(h, keys);
+
+    assert(h.startResize(6143));
+    assert(h.isResizing());
+    assert(h.getSize() == 6143);
+    assert(h.getResizeRemaining() == 769);
+    assert(!h.startResize(12289));
+
+    // Both bucket arrays are used while the resize is in progress.
+    assert(h.migrate(300) == 469);
+    verifyFound(h, keys);
+    assert(count(h) == 5000);
+
+    HashTableDepthStatVisitor depthCounter;
+    h.visitDepth(depthCounter);
+    assert(depthCounter.size == 5000);
+
+    // Mutations migrate a few buckets along the way.
+    std::vector<std::string> gone = generateKeys(1000);
+    std::vector<std::string>::iterator it;
+    for (it = gone.begin(); it != gone.end(); ++it) {
+        assert(h.del(*it));
+    }
+    assert(h.getResizeRemaining() < 469);
+    assert(h.getNumItems() == 4000);
+    storeMany(h, gone);
+    assert(count(h) == 5000);
+
+    assert(h.getNumResizes() == 0);
+    assert(h.migrate(std::numeric_limits<size_t>::max()) == 0);
+    assert(!h.isResizing());
+    assert(h.getSize() == 6143);
+    assert(h.getNumResizes() == 1);
+    verifyFound(h, keys);
+    assert(count(h) == 5000);
+}
+
 class AccessGenerator : public Generator<bool> {
 public:
 
@@ -548,6 +590,424 @@ static void testSizeStatsEjectFlush() {
     free(someval);
 }
 
+static void testCachelineAutoResize() {
+    HashTable h(global_stats, 5, 3);
+    assert(h.getLayout() == cacheline);
+
+    std::vector<std::string> keys = generateKeys(5000);
+    storeMany(h, keys);
+
+    verifyFound(h, keys);
+
+    // The buckets hold several values each, so fewer of them are needed.
+    h.resize();
+    assert(h.getSize() == 1531);
+    verifyFound(h, keys);
+}
+
+class Sampler : public HashTableSampleVisitor {
+public:
+    Sampler(size_t l, size_t r) : locks(l), rounds(r), samples(0) {}
+
+    bool visitSample(int lock, std::vector<StoredValue*> &sample) {
+        assert(lock >= 0 && static_cast<size_t>(lock) < locks);
+        std::set<StoredValue*> distinct(sample.begin(), sample.end());
+        assert(distinct.size() == sample.size());
+        seen.insert(sample.begin(), sample.end());
+        ++samples;
+        return samples % rounds != 0;
+    }
+
+    size_t locks;
+    size_t rounds;
+    size_t samples;
+    std::set<StoredValue*> seen;
+};
+
+static void testSampling() {
+    HashTable h(global_stats, 1531, 47);
+    std::vector<std::string> keys = generateKeys(5000);
+    storeMany(h, keys);
+
+    // Each lock gets the asked number of samples.
+    Sampler sampler(h.getNumLocks(), 3);
+    h.visitSample(sampler, 16);
+    assert(sampler.samples == h.getNumLocks() * 3);
+    assert(sampler.seen.size() > h.getNumLocks() * 16);
+    assert(sampler.seen.size() < keys.size());
+
+    // The access frequency grows with each reference, up to its max.
+    StoredValue *v = h.find(keys[0], false);
+    uint8_t stored = v->getAccessFrequency();
+    assert(h.find(keys[0])->getAccessFrequency() == stored + 1);
+    for (int i = 0; i < 100; ++i) {
+        h.find(keys[0]);
+    }
+    assert(v->getAccessFrequency() == StoredValue::maxAccessFrequency);
+    v->decayAccessFrequency();
+    assert(v->getAccessFrequency() == StoredValue::maxAccessFrequency / 2);
+    assert(h.find(keys[1], false)->getAccessFrequency() == stored);
+}
+
+static void testExpiryIndex() {
+    size_t overhead = global_stats.memOverhead.get();
+    ExpiryIndex index(global_stats);
+    time_t now = ep_real_time();
+    const char *names[] = {"past", "soon", "minutes", "hours", "days"};
+    time_t exptimes[] = {now - 10, now + 5, now + 300, now + 3 * 3600,
+                         now + 3 * 86400};
+    for (int i = 0; i < 5; ++i) {
+        index.add(names[i], exptimes[i]);
+    }
+    assert(index.size() == 5);
+
+    std::vector<std::string> keys;
+    index.getDue(now, keys);
+    assert(keys.size() == 1 && keys[0] == "past");
+
+    // Turning the wheels, each key comes due within a step of its time.
+    for (time_t t = now + 1; t < now + 4 * 3600; t += 13) {
+        keys.clear();
+        index.getDue(t, keys);
+        std::vector<std::string>::iterator it;
+        for (it = keys.begin(); it != keys.end(); ++it) {
+            int i = std::find(names, names + 5, *it) - names;
+            assert(i > 0 && i < 4);
+            assert(t >= exptimes[i] && t < exptimes[i] + 13);
+        }
+    }
+    assert(index.size() == 1);
+
+    // Far behind, the remaining keys are placed again.
+    keys.clear();
+    index.getDue(now + 86400, keys);
+    assert(keys.empty());
+    index.getDue(now + 3 * 86400, keys);
+    assert(keys.size() == 1 && keys[0] == "days");
+    assert(index.size() == 0);
+    assert(global_stats.memOverhead.get() == overhead);
+}
+
+static void testExpiryIndexReplace() {
+    size_t overhead = global_stats.memOverhead.get();
+    ExpiryIndex index(global_stats);
+    time_t now = ep_real_time();
+    index.add("key", now + 3 * 86400);
+    assert(global_stats.memOverhead.get() ==
+           overhead + ExpiryIndex::entrySize("key"));
+
+    // Adding a key again moves it, whichever wheel it was in.
+    index.add("key", now + 3 * 3600);
+    index.add("key", now + 300);
+    index.add("key", now + 5);
+    index.add("key", now + 30);
+    assert(index.size() == 1);
+    assert(global_stats.memOverhead.get() ==
+           overhead + ExpiryIndex::entrySize("key"));
+
+    std::vector<std::string> keys;
+    index.getDue(now + 10, keys);
+    assert(keys.empty());
+    index.getDue(now + 30, keys);
+    assert(keys.size() == 1 && keys[0] == "key");
+
+    index.add("gone", now + 3 * 86400);
+    index.add("gone", now + 5);
+    index.remove("gone");
+    index.remove("gone");
+    assert(index.size() == 0);
+    keys.clear();
+    index.getDue(now + 4 * 86400, keys);
+    assert(keys.empty());
+    assert(global_stats.memOverhead.get() == overhead);
+
+    index.add("cleared", now + 60);
+    index.clear();
+    assert(index.size() == 0);
+    assert(global_stats.memOverhead.get() == overhead);
+}
+
+static void testExpiryIndexing() {
+    HashTable h(global_stats, 5, 1);
+    time_t now = ep_real_time();
+    std::string k("exp");
+    Item i(k, 0, now + 100, k.c_str(), k.length());
+    assert(h.set(i) == WAS_CLEAN);
+    assert(h.getNumExpiryKeys() == 1);
+
+    // A new expiry time replaces the one the key was indexed with.
+    Item later(k, 0, now + 200, k.c_str(), k.length());
+    h.set(later);
+    assert(h.getNumExpiryKeys() == 1);
+    Item earlier(k, 0, now + 50, k.c_str(), k.length());
+    h.set(earlier);
+    assert(h.getNumExpiryKeys() == 1);
+
+    std::string other("noexp");
+    store(h, other);
+    assert(h.getNumExpiryKeys() == 1);
+
+    std::vector<std::string> keys;
+    h.getDueExpiries(now + 100, keys);
+    assert(keys.size() == 1 && keys[0] == k);
+    assert(h.getNumExpiryKeys() == 0);
+
+    // Items that stop expiring or go away leave the index.
+    Item expiring(k, 0, now + 100, k.c_str(), k.length());
+    h.set(expiring);
+    expiring.setCas(0);
+    assert(h.getNumExpiryKeys() == 1);
+    Item forever(k, 0, 0, k.c_str(), k.length());
+    h.set(forever);
+    assert(h.getNumExpiryKeys() == 0);
+
+    h.set(expiring);
+    assert(h.getNumExpiryKeys() == 1);
+    assert(h.softDelete(k, 0) == WAS_DIRTY);
+    assert(h.getNumExpiryKeys() == 0);
+
+    Item again(other, 0, now + 100, other.c_str(), other.length());
+    h.set(again);
+    assert(h.getNumExpiryKeys() == 1);
+    assert(h.del(other));
+    assert(h.getNumExpiryKeys() == 0);
+}
+
+static void testValueCompression() {
+#ifdef HAVE_LIBSNAPPY
+    HashTable h(global_stats, 5, 1);
+    std::string k("compressed");
+    std::string data(4096, 'x');
+    Item i(k, 0, 0, data.c_str(), data.length());
+    h.set(i);
+
+    StoredValue *v = h.find(k);
+    size_t cacheSize = h.cacheSize.get();
+    assert(v->compressValue(global_stats, h));
+    assert(v->isCompressed());
+    assert(!v->compressValue(global_stats, h));
+    assert(h.cacheSize.get() < cacheSize - 3000);
+    assert(v->getMemValueLength() < 1000);
+    assert(v->valLength() == data.length());
+    assert(v->getValue()->to_s() == data);
+
+    // Lookups that don't count as an access leave it compressed.
+    assert(h.find(k, false) == v);
+    assert(v->isCompressed());
+
+    // An access decompresses it in place, until it gets compressed again.
+    assert(h.find(k) == v);
+    assert(!v->isCompressed());
+    assert(h.cacheSize.get() == cacheSize);
+    assert(v->getMemValueLength() == data.length());
+    assert(v->getValue()->to_s() == data);
+    assert(v->compressValue(global_stats, h));
+
+    // The ejected value keeps the actual length.
+    v->markClean(NULL);
+    assert(v->ejectValue(global_stats, h));
+    assert(!v->isCompressed());
+    assert(v->valLength() == data.length());
+
+    // Values that don't shrink are left alone.
+    std::string k2("random");
+    std::string noise;
+    for (int n = 0; n < 4096; ++n) {
+        noise.push_back(static_cast<char>(std::rand()));
+    }
+    Item i2(k2, 0, 0, noise.c_str(), noise.length());
+    h.set(i2);
+    assert(!h.find(k2)->compressValue(global_stats, h));
+#endif
+}
+
+extern "C" {
+    static rel_time_t later_current_time(void) {
+        return 60;
+    }
+}
+
+static void testOptimisticGet() {
+    HashTable h(global_stats, 5, 1);
+    std::string k("key");
+    store(h, k);
+    time_t now = ep_real_time();
+    bool ref(false);
+
+    Item *it = h.optimisticGet(k, 3, now, false, ref);
+    assert(it);
+    assert(it->getKey() == k);
+    assert(it->getValue()->to_s() == k);
+    assert(it->getVBucketId() == 3);
+    delete it;
+
+    std::string missing("missing");
+    assert(h.optimisticGet(missing, 0, now, false, ref) == NULL);
+
+    // Gets that would touch the item are left to the locked path.
+    assert(h.optimisticGet(k, 0, now, true, ref) == NULL);
+    for (int i = 0; i < 2 * StoredValue::maxAccessFrequency; ++i) {
+        assert(h.find(k));
+    }
+    it = h.optimisticGet(k, 0, now, true, ref);
+    assert(it && ref);
+    delete it;
+
+    StoredValue *v = h.find(k);
+    v->markClean(NULL);
+    it = h.optimisticGet(k, 0, now, false, ref);
+    assert(it);
+    delete it;
+    // A clean item is still served long after it was last touched.
+    rel_time_t (*orig_current_time)() = ep_current_time;
+    ep_current_time = later_current_time;
+    it = h.optimisticGet(k, 0, now, false, ref);
+    assert(it);
+    delete it;
+    ep_current_time = orig_current_time;
+
+    v->lock(1);
+    assert(h.optimisticGet(k, 0, now, false, ref) == NULL);
+    v->unlock();
+
+    v->markClean(NULL);
+    assert(v->ejectValue(global_stats, h));
+    assert(h.optimisticGet(k, 0, now, false, ref) == NULL);
+
+    std::string expiring("expiring");
+    Item e(expiring, 0, now + 10, expiring.c_str(), expiring.length());
+    h.set(e);
+    it = h.optimisticGet(expiring, 0, now, false, ref);
+    assert(it);
+    delete it;
+    assert(h.optimisticGet(expiring, 0, now + 11, false, ref) == NULL);
+
+    h.del(expiring);
+    assert(h.optimisticGet(expiring, 0, now, false, ref) == NULL);
+
+    HashTable::setDefaultOptimisticReads(false);
+    HashTable locked(global_stats, 5, 1);
+    store(locked, k);
+    assert(locked.optimisticGet(k, 0, now, false, ref) == NULL);
+    HashTable::setDefaultOptimisticReads(true);
+}
+
+class OptimisticReader : public Generator<bool> {
+public:
+
+    OptimisticReader(const std::vector<std::string> &k, HashTable &h,
+                     Atomic<bool> &d) : keys(k), ht(h), done(d) {}
+
+    bool operator()() {
+        size_t hits(0);
+        while (!done.get()) {
+            std::vector<std::string>::iterator it;
+            for (it = keys.begin(); it != keys.end(); ++it) {
+                bool ref;
+                Item *itm = ht.optimisticGet(*it, 0, ep_real_time(), false,
+                                             ref);
+                if (itm) {
+                    assert(itm->getKey() == *it);
+                    assert(itm->getValue()->to_s() == *it);
+                    delete itm;
+                    ++hits;
+                }
+            }
+        }
+        return hits > 0;
+    }
+
+private:
+    std::vector<std::string>  keys;
+    HashTable                &ht;
+    Atomic<bool>             &done;
+};
+
+static void *launchOptimisticReader(void *arg) {
+    OptimisticReader *r = static_cast<OptimisticReader*>(arg);
+    return (*r)() ? arg : NULL;
+}
+
+static void testConcurrentOptimisticGet() {
+    std::vector<std::string> keys = generateKeys(500);
+    HashTable h(global_stats, 31, 4);
+    storeMany(h, keys);
+
+    Atomic<bool> done(false);
+    const int n = 4;
+    OptimisticReader reader(keys, h, done);
+    pthread_t threads[n];
+    for (int i = 0; i < n; ++i) {
+        assert(pthread_create(&threads[i], NULL,
+                              launchOptimisticReader, &reader) == 0);
+    }
+
+    // Replace, delete, eject and move the items around under the readers.
+    for (int round = 0; round < 10; ++round) {
+        std::vector<std::string>::iterator it;
+        for (it = keys.begin(); it != keys.end(); ++it) {
+            switch (rand() % 4) {
+            case 0:
+                h.del(*it);
+                break;
+            case 1: {
+                StoredValue *v = h.find(*it);
+                if (v) {
+                    v->markClean(NULL);
+                    v->ejectValue(global_stats, h);
+                }
+                break;
+            }
+            default: {
+                Item i(*it, 0, 0, it->c_str(), it->length());
+                h.set(i);
+            }
+            }
+        }
+        if (round % 3 == 0) {
+            h.resize(round % 2 ? 31 : 1021);
+        } else {
+            h.startResize(round % 2 ? 31 : 1021);
+            h.migrate(100);
+        }
+        for (it = keys.begin(); it != keys.end(); ++it) {
+            Item i(*it, 0, 0, it->c_str(), it->length());
+            h.set(i);
+        }
+    }
+    h.migrate(std::numeric_limits<size_t>::max());
+    done.set(true);
+
+    for (int i = 0; i < n; ++i) {
+        void *rv;
+        assert(pthread_join(threads[i], &rv) == 0);
+        assert(rv == &reader);
+    }
+    assert(count(h) == 500);
+}
+
+static void testCachelineLayout() {
+    HashTable::setDefaultLayout(cacheline);
+    testHashSize();
+    testHashSizeTwo();
+    testReverseDeletions();
+    testForwardDeletions();
+    testFind();
+    testAdd();
+    testPoisonKey();
+    testResize();
+    testIncrementalResize();
+    testConcurrentAccessResize();
+    testCachelineAutoResize();
+    testOptimisticGet();
+    testConcurrentOptimisticGet();
+    testSizeStats();
+    testSizeStatsSoftDel();
+    testSizeStatsEject();
+    testSampling();
+    HashTable::setDefaultLayout(chained);
+}
+
 int main() {
     putenv(strdup("ALLOW_NO_STATS_UPDATE=yeah"));
     global_stats.setMaxDataSize(64*1024*1024);
@@ -564,13 +1024,22 @@ int main() {
     testDepthCounting();
     testPoisonKey();
     testResize();
+    testIncrementalResize();
     testConcurrentAccessResize();
     testAutoResize();
+    testOptimisticGet();
+    testConcurrentOptimisticGet();
     testSizeStats();
     testSizeStatsFlush();
     testSizeStatsSoftDel();
     testSizeStatsSoftDelFlush();
     testSizeStatsEject();
     testSizeStatsEjectFlush();
+    testSampling();
+    testExpiryIndex();
+    testExpiryIndexReplace();
+    testExpiryIndexing();
+    testValueCompression();
+    testCachelineLayout();
     exit(0);
 }
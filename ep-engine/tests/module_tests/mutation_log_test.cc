@@ -8,6 +8,9 @@
 #include <map>
 #include <algorithm>
 #include <stdexcept>
+#include <sstream>
+
+#include <sys/stat.h>
 
 #include "assert.h"
 #include "mutation_log.hh"
@@ -472,6 +475,169 @@ static void testYUNOOPEN() {
     assert(remove(TMP_LOG_FILE) == 0);
 }
 
+static void testCompressedLogging() {
+    remove(TMP_LOG_FILE);
+
+    {
+        MutationLog ml(TMP_LOG_FILE, 4096, LOG_COMPRESSED_VERSION);
+        ml.open();
+        assert(ml.getVersion() == LOG_COMPRESSED_VERSION);
+
+        // Enough keys for many blocks, logged out of order.
+        for (int i = 0; i < 20000; ++i) {
+            std::stringstream ss;
+            ss << "key" << (i * 7919) % 20000;
+            ml.newItem(i % 4, ss.str(), i);
+        }
+        ml.delItem(0, "key0");
+        ml.commit1();
+        ml.commit2();
+        ml.newItem(1, "uncommitted", 1);
+        ml.flush();
+
+        assert(ml.itemsLogged[ML_NEW] == 20001);
+        assert(ml.itemsLogged[ML_DEL] == 1);
+    }
+
+    // The uncompressed log of the same keys takes more blocks.
+    {
+        MutationLog ml(TMP_LOG_FILE ".v1", 4096);
+        ml.open();
+        for (int i = 0; i < 20000; ++i) {
+            std::stringstream ss;
+            ss << "key" << (i * 7919) % 20000;
+            ml.newItem(i % 4, ss.str(), i);
+        }
+        ml.commit1();
+        ml.commit2();
+        ml.flush();
+
+        struct stat v1, v2;
+        assert(stat(TMP_LOG_FILE ".v1", &v1) == 0);
+        assert(stat(TMP_LOG_FILE, &v2) == 0);
+        assert(v2.st_size < v1.st_size / 2);
+    }
+    remove(TMP_LOG_FILE ".v1");
+
+    for (size_t readers = 1; readers <= 4; readers += 3) {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        assert(ml.getVersion() == LOG_COMPRESSED_VERSION);
+        MutationLogHarvester h(ml);
+        for (uint16_t vb = 0; vb < 4; ++vb) {
+            h.setVBucket(vb);
+        }
+
+        assert(!h.load(readers));
+        assert(h.getItemsSeen()[ML_NEW] == 20001);
+        assert(h.getItemsSeen()[ML_DEL] == 1);
+        assert(h.getItemsSeen()[ML_COMMIT2] == 1);
+
+        std::map<std::string, uint64_t> maps[4];
+        h.apply(&maps, loaderFun);
+        assert(maps[0].size() + maps[1].size() + maps[2].size() +
+               maps[3].size() == 19999);
+        assert(maps[0].find("key0") == maps[0].end());
+        // key1 is logged by i == 17679
+        assert(maps[3]["key1"] == 17679);
+
+        std::vector<mutation_log_uncommitted_t> leftovers;
+        h.getUncommitted(leftovers);
+        assert(leftovers.size() == 1);
+        assert(leftovers[0].key == "uncommitted");
+    }
+
+    // Break a block in the middle of the log.
+    int file = open(TMP_LOG_FILE, O_RDWR, 0666);
+    assert(lseek(file, 4096 * 10 + 100, SEEK_SET) == 4096 * 10 + 100);
+    uint8_t b;
+    assert(read(file, &b, sizeof(b)) == 1);
+    b = ~b;
+    assert(pwrite(file, &b, sizeof(b), 4096 * 10 + 100) == 1);
+    close(file);
+
+    for (size_t readers = 1; readers <= 4; readers += 3) {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        MutationLogHarvester h(ml);
+        h.setVBucket(0);
+        try {
+            h.load(readers);
+            abort();
+        } catch(MutationLog::CRCReadException e) {
+            // expected
+        }
+    }
+
+    remove(TMP_LOG_FILE);
+}
+
+static void testPackedBlocks() {
+#ifdef HAVE_LIBSNAPPY
+    remove(TMP_LOG_FILE);
+
+    {
+        MutationLog ml(TMP_LOG_FILE, 4096, LOG_COMPRESSED_VERSION);
+        ml.open();
+        // Random keys hardly compress, so their blocks are left as is.
+        srand(7);
+        for (int i = 0; i < 2000; ++i) {
+            std::string key("rnd");
+            for (int j = 0; j < 40; ++j) {
+                key.push_back("abcdefghijklmnopqrstuvwxyz0123456789"[rand() % 36]);
+            }
+            ml.newItem(0, key, i);
+        }
+        ml.commit1();
+        ml.commit2();
+        for (int i = 0; i < 20000; ++i) {
+            std::stringstream ss;
+            ss << "user::profile::" << i << "::settings";
+            ml.newItem(1, ss.str(), i);
+        }
+        ml.commit1();
+        ml.commit2();
+        ml.flush();
+    }
+
+    size_t packed(0), plain(0);
+    int file = open(TMP_LOG_FILE, O_RDONLY);
+    assert(file >= 0);
+    uint8_t block[4096];
+    for (off_t off = 4096; pread(file, block, sizeof(block), off) == 4096;
+         off += sizeof(block)) {
+        uint16_t items;
+        memcpy(&items, block + 2, sizeof(items));
+        if (ntohs(items) & 0x8000) {
+            ++packed;
+        } else {
+            ++plain;
+        }
+    }
+    close(file);
+    assert(packed > 0 && plain > 0);
+
+    for (size_t readers = 1; readers <= 4; readers += 3) {
+        MutationLog ml(TMP_LOG_FILE);
+        ml.open();
+        MutationLogHarvester h(ml);
+        h.setVBucket(0);
+        h.setVBucket(1);
+        assert(h.load(readers));
+        assert(h.getItemsSeen()[ML_NEW] == 22000);
+        assert(h.getItemsSeen()[ML_COMMIT2] == 2);
+
+        std::map<std::string, uint64_t> maps[4];
+        h.apply(&maps, loaderFun);
+        assert(maps[0].size() == 2000);
+        assert(maps[1].size() == 20000);
+        assert(maps[1]["user::profile::12345::settings"] == 12345);
+    }
+
+    remove(TMP_LOG_FILE);
+#endif
+}
+
 // @todo
 //   Test Read Only log
 //   Test close / open / close / open
@@ -511,6 +677,8 @@ int main(int, char **) {
     testLoggingDirty();
     testLoggingBadCRC();
     testLoggingShortRead();
+    testCompressedLogging();
+    testPackedBlocks();
     testYUNOOPEN();
 
     remove(TMP_LOG_FILE);
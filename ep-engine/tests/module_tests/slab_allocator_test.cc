@@ -0,0 +1,162 @@
+#include "config.h"
+
+#include <pthread.h>
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+#include "common.hh"
+#include "slab_allocator.hh"
+
+static void testSizeClasses() {
+    int num = SlabAllocator::getNumClasses();
+    assert(num > 0);
+    for (int c = 0; c < num; ++c) {
+        size_t size = SlabAllocator::getClassSize(c);
+        assert(size % 16 == 0);
+        assert(SlabAllocator::getClassForSize(size) == c);
+        if (c > 0) {
+            assert(size > SlabAllocator::getClassSize(c - 1));
+            assert(SlabAllocator::getClassForSize(SlabAllocator::getClassSize(c - 1) + 1) == c);
+        }
+    }
+    assert(SlabAllocator::getClassForSize(1) == 0);
+    size_t largest = SlabAllocator::getClassSize(num - 1);
+    assert(SlabAllocator::getClassForSize(largest + 1) == -1);
+}
+
+static void testAllocate() {
+    SlabAllocator &sa(*new SlabAllocator());
+    std::vector<char*> objects;
+    for (size_t n = 1; n < 20000; n += 37) {
+        char *p = static_cast<char*>(sa.allocate(n));
+        assert(p);
+        memset(p, 'x', n);
+        objects.push_back(p);
+    }
+    assert(sa.getAllocatedSize() > 0);
+    assert(sa.getHeapSize() >= sa.getAllocatedSize());
+
+    std::vector<char*>::iterator it;
+    for (it = objects.begin(); it != objects.end(); ++it) {
+        SlabAllocator::deallocate(*it);
+    }
+    assert(sa.getAllocatedSize() == 0);
+    SlabAllocator::deallocate(NULL);
+    sa.release();
+}
+
+static void testReuse() {
+    SlabAllocator &sa(*new SlabAllocator());
+    std::vector<void*> objects;
+    for (int i = 0; i < 100000; ++i) {
+        objects.push_back(sa.allocate(100));
+    }
+    size_t heap = sa.getHeapSize();
+    assert(heap > 100000 * 100);
+
+    for (int round = 0; round < 10; ++round) {
+        for (size_t i = 0; i < objects.size(); i += 2) {
+            SlabAllocator::deallocate(objects[i]);
+        }
+        for (size_t i = 0; i < objects.size(); i += 2) {
+            objects[i] = sa.allocate(100);
+        }
+    }
+    // Churn within a size class reuses the slabs.
+    assert(sa.getHeapSize() == heap);
+
+    std::vector<void*>::iterator it;
+    for (it = objects.begin(); it != objects.end(); ++it) {
+        SlabAllocator::deallocate(*it);
+    }
+    assert(sa.getAllocatedSize() == 0);
+    // Empty slabs go back to the heap.
+    assert(sa.getHeapSize() < heap / 10);
+    sa.release();
+}
+
+struct ThreadArgs {
+    SlabAllocator *sa;
+    std::vector<void*> objects;
+};
+
+static void *allocateObjects(void *arg) {
+    ThreadArgs *args = static_cast<ThreadArgs*>(arg);
+    for (int i = 0; i < 10000; ++i) {
+        args->objects.push_back(args->sa->allocate(64 + i % 512));
+    }
+    return NULL;
+}
+
+static void *freeObjects(void *arg) {
+    ThreadArgs *args = static_cast<ThreadArgs*>(arg);
+    std::vector<void*>::iterator it;
+    for (it = args->objects.begin(); it != args->objects.end(); ++it) {
+        SlabAllocator::deallocate(*it);
+    }
+    return NULL;
+}
+
+static void testThreads() {
+    SlabAllocator &sa(*new SlabAllocator());
+    const int n = 4;
+    ThreadArgs args[n];
+    pthread_t threads[n];
+
+    for (int i = 0; i < n; ++i) {
+        args[i].sa = &sa;
+        assert(pthread_create(&threads[i], NULL, allocateObjects, &args[i]) == 0);
+    }
+    for (int i = 0; i < n; ++i) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+    size_t allocated = sa.getAllocatedSize();
+    assert(allocated >= n * 10000 * 64);
+
+    // Free the objects on threads other than the ones allocating them.
+    for (int i = 0; i < n; ++i) {
+        assert(pthread_create(&threads[i], NULL, freeObjects,
+                              &args[(i + 1) % n]) == 0);
+    }
+    for (int i = 0; i < n; ++i) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+    assert(sa.getAllocatedSize() == 0);
+    sa.release();
+}
+
+static void testRelease() {
+    SlabAllocator *sa = new SlabAllocator();
+    ThreadArgs args;
+    args.sa = sa;
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, allocateObjects, &args) == 0);
+    assert(pthread_join(thread, NULL) == 0);
+    args.objects.push_back(sa->allocate(100000));
+    size_t allocated = sa->getAllocatedSize();
+
+    // The objects outlive the owner's reference...
+    sa->release();
+    size_t half = args.objects.size() / 2;
+    for (size_t i = 0; i < half; ++i) {
+        SlabAllocator::deallocate(args.objects[i]);
+    }
+    args.objects.erase(args.objects.begin(), args.objects.begin() + half);
+    assert(sa->getAllocatedSize() < allocated);
+
+    // ...and the last of them takes the allocator with it.
+    assert(pthread_create(&thread, NULL, freeObjects, &args) == 0);
+    assert(pthread_join(thread, NULL) == 0);
+}
+
+int main(int argc, char **argv) {
+    (void)argc; (void)argv;
+
+    testSizeClasses();
+    testAllocate();
+    testReuse();
+    testThreads();
+    testRelease();
+    return 0;
+}
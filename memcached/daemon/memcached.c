@@ -777,6 +777,8 @@ static void add_connection_stats(ADD_STAT add_stats, conn *d, conn *c) {
         append_stat("aiostat", add_stats, d, "%u", c->aiostat);
         append_stat("ewouldblock", add_stats, d, "%u", c->ewouldblock);
         append_stat("tap_iterator", add_stats, d, "%p", c->tap_iterator);
+        append_stat("tap_batch_iterator", add_stats, d, "%p",
+                    c->tap_batch_iterator);
     }
 }
 
@@ -937,6 +939,7 @@ static void conn_cleanup(conn *c) {
 
     c->engine_storage = NULL;
     c->tap_iterator = NULL;
+    c->tap_batch_iterator = NULL;
     c->thread = NULL;
     assert(c->next == NULL);
     c->ascii_cmd = NULL;
@@ -1084,7 +1087,7 @@ void conn_set_state(conn *c, STATE_FUNC state) {
          * New messages may appear from both sides, so we can't block on
          * read from the nework / engine
          */
-        if (c->tap_iterator != NULL) {
+        if (c->tap_iterator != NULL || c->tap_batch_iterator != NULL) {
             if (state == conn_waiting) {
                 c->which = EV_WRITE;
                 state = conn_ship_log;
@@ -1116,6 +1119,12 @@ void conn_set_state(conn *c, STATE_FUNC state) {
 static int ensure_iov_space(conn *c) {
     assert(c != NULL);
 
+#ifndef NDEBUG
+    if (settings.max_iovs > 0 && c->iovused >= settings.max_iovs) {
+        return -1;
+    }
+#endif
+
     if (c->iovused >= c->iovsize) {
         int i, iovnum;
         struct iovec *new_iov = (struct iovec *)realloc(c->iov,
@@ -2506,13 +2515,17 @@ static bool authenticated(conn *c) {
     return rv;
 }
 
-static bool binary_response_handler(const void *key, uint16_t keylen,
-                                    const void *ext, uint8_t extlen,
-                                    const void *body, uint32_t bodylen,
-                                    uint8_t datatype, uint16_t status,
-                                    uint64_t cas, const void *cookie)
+/**
+ * Append a response packet to the dynamic buffer. The last valuelen
+ * bytes of the packet body are not copied: they're sent from the value
+ * of the item added by add_item_response.
+ */
+static bool append_bin_response(conn *c, const void *key, uint16_t keylen,
+                                const void *ext, uint8_t extlen,
+                                const void *body, uint32_t bodylen,
+                                uint32_t valuelen, uint8_t datatype,
+                                uint16_t status, uint64_t cas)
 {
-    conn *c = (conn*)cookie;
     /* Look at append_bin_stats */
     size_t needed = keylen + extlen + bodylen + sizeof(protocol_binary_response_header);
     if (!grow_dynamic_buffer(c, needed)) {
@@ -2532,7 +2545,7 @@ static bool binary_response_handler(const void *key, uint16_t keylen,
         .response.extlen = extlen,
         .response.datatype = datatype,
         .response.status = (uint16_t)htons(status),
-        .response.bodylen = htonl(bodylen + keylen + extlen),
+        .response.bodylen = htonl(bodylen + valuelen + keylen + extlen),
         .response.opaque = c->opaque,
         .response.cas = memcached_htonll(cas),
     };
@@ -2559,6 +2572,78 @@ static bool binary_response_handler(const void *key, uint16_t keylen,
     return true;
 }
 
+static bool binary_response_handler(const void *key, uint16_t keylen,
+                                    const void *ext, uint8_t extlen,
+                                    const void *body, uint32_t bodylen,
+                                    uint8_t datatype, uint16_t status,
+                                    uint64_t cas, const void *cookie)
+{
+    conn *c = (conn*)cookie;
+    if (c->item != NULL) {
+        /* The item response must be the last one of the command */
+        return false;
+    }
+    return append_bin_response(c, key, keylen, ext, extlen, body, bodylen,
+                               0, datatype, status, cas);
+}
+
+static bool add_item_response(const void *cookie, item *it,
+                              const void *key, uint16_t keylen,
+                              const void *ext, uint8_t extlen,
+                              uint8_t datatype, uint16_t status,
+                              uint64_t cas)
+{
+    conn *c = (conn*)cookie;
+    item_info_holder info = { .info = { .nvalue = 1 } };
+
+    if (c->item != NULL ||
+        !settings.engine.v1->get_item_info(settings.engine.v0, c, it,
+                                           (void*)&info) ||
+        !append_bin_response(c, key, keylen, ext, extlen, NULL, 0,
+                             info.info.nbytes, datatype, status, cas)) {
+        return false;
+    }
+
+    /* Released by reset_cmd_handler once the response is sent */
+    c->item = it;
+    return true;
+}
+
+/**
+ * Queue the dynamic buffer followed by the value of the item added by
+ * add_item_response, so the value goes from the engine's memory
+ * straight to the socket. If the iovecs can't all be queued the
+ * connection's message list is restored to what it was before, so
+ * nothing refers to the dynamic buffer any more.
+ */
+static bool add_item_response_iovs(conn *c) {
+    item_info_holder info = { .info = { .nvalue = IOV_MAX } };
+    int iovused = c->iovused;
+    int msgused = c->msgused;
+    int msgbytes = c->msgbytes;
+    size_t iovlen = c->msglist[msgused - 1].msg_iovlen;
+
+    if (!settings.engine.v1->get_item_info(settings.engine.v0, c, c->item,
+                                           (void*)&info)) {
+        return false;
+    }
+
+    bool ok = add_iov(c, c->dynamic_buffer.buffer,
+                      c->dynamic_buffer.offset) == 0;
+    for (int ii = 0; ok && ii < info.info.nvalue; ++ii) {
+        ok = add_iov(c, info.info.value[ii].iov_base,
+                     info.info.value[ii].iov_len) == 0;
+    }
+
+    if (!ok) {
+        c->iovused = iovused;
+        c->msgused = msgused;
+        c->msgbytes = msgbytes;
+        c->msglist[msgused - 1].msg_iovlen = iovlen;
+    }
+    return ok;
+}
+
 /**
  * Tap stats (these are only used by the tap thread, so they don't need
  * to be in the threadlocal struct right now...
@@ -2580,240 +2665,295 @@ struct tap_stats {
     struct tap_cmd_stats received;
 } tap_stats = { .mutex = PTHREAD_MUTEX_INITIALIZER };
 
-static void ship_tap_log(conn *c) {
-    c->msgcurr = 0;
-    c->msgused = 0;
-    c->iovused = 0;
-    if (add_msghdr(c) != 0) {
-        if (settings.verbose) {
+/**
+ * Build the message of a tap event in the write buffer and queue it
+ * (and the item it carries) for sending.
+ *
+ * @return false if the event ends the events to send for now
+ */
+static bool add_tap_event(conn *c, tap_event_info *ev, bool *send_data,
+                          bool *disconnect) {
+    item *it = ev->itm;
+    void *engine = ev->engine_specific;
+    uint16_t nengine = ev->nengine_specific;
+    uint8_t ttl = ev->ttl;
+    uint16_t tap_flags = ev->flags;
+    uint32_t bodylen;
+
+    union {
+        protocol_binary_request_tap_mutation mutation;
+        protocol_binary_request_tap_delete delete;
+        protocol_binary_request_tap_flush flush;
+        protocol_binary_request_tap_opaque opaque;
+        protocol_binary_request_noop noop;
+    } msg = {
+        .mutation.message.header.request.magic = (uint8_t)PROTOCOL_BINARY_REQ,
+    };
+
+    msg.opaque.message.header.request.opaque = htonl(ev->seqno);
+    msg.opaque.message.body.tap.enginespecific_length = htons(nengine);
+    msg.opaque.message.body.tap.ttl = ttl;
+    msg.opaque.message.body.tap.flags = htons(tap_flags);
+    msg.opaque.message.header.request.extlen = 8;
+    msg.opaque.message.header.request.vbucket = htons(ev->vbucket);
+    item_info_holder info = { .info = { .nvalue = IOV_MAX } };
+
+    switch (ev->event) {
+    case TAP_NOOP :
+        *send_data = true;
+        msg.noop.message.header.request.opcode = PROTOCOL_BINARY_CMD_NOOP;
+        msg.noop.message.header.request.extlen = 0;
+        msg.noop.message.header.request.bodylen = htonl(0);
+        memcpy(c->wcurr, msg.noop.bytes, sizeof(msg.noop.bytes));
+        add_iov(c, c->wcurr, sizeof(msg.noop.bytes));
+        c->wcurr += sizeof(msg.noop.bytes);
+        c->wbytes += sizeof(msg.noop.bytes);
+        break;
+    case TAP_PAUSE :
+        return false;
+    case TAP_CHECKPOINT_START:
+    case TAP_CHECKPOINT_END:
+    case TAP_MUTATION:
+        if (!settings.engine.v1->get_item_info(settings.engine.v0, c, it,
+                                               (void*)&info)) {
+            settings.engine.v1->release(settings.engine.v0, c, it);
             settings.extensions.logger->log(EXTENSION_LOG_WARNING, c,
-                                            "%d: Failed to create output headers. Shutting down tap connection\n", c->sfd);
+                                            "%d: Failed to get item info\n", c->sfd);
+            break;
         }
-        conn_set_state(c, conn_closing);
-        return ;
-    }
-    /* @todo add check for buffer overflow of c->wbuf) */
-    c->wcurr = c->wbuf;
+        *send_data = true;
+        c->ilist[c->ileft++] = it;
 
-    bool more_data = true;
-    bool send_data = false;
-    bool disconnect = false;
+        if (ev->event == TAP_CHECKPOINT_START) {
+            msg.mutation.message.header.request.opcode =
+                PROTOCOL_BINARY_CMD_TAP_CHECKPOINT_START;
+            pthread_mutex_lock(&tap_stats.mutex);
+            tap_stats.sent.checkpoint_start++;
+            pthread_mutex_unlock(&tap_stats.mutex);
+        } else if (ev->event == TAP_CHECKPOINT_END) {
+            msg.mutation.message.header.request.opcode =
+                PROTOCOL_BINARY_CMD_TAP_CHECKPOINT_END;
+            pthread_mutex_lock(&tap_stats.mutex);
+            tap_stats.sent.checkpoint_end++;
+            pthread_mutex_unlock(&tap_stats.mutex);
+        } else if (ev->event == TAP_MUTATION) {
+            msg.mutation.message.header.request.opcode = PROTOCOL_BINARY_CMD_TAP_MUTATION;
+            pthread_mutex_lock(&tap_stats.mutex);
+            tap_stats.sent.mutation++;
+            pthread_mutex_unlock(&tap_stats.mutex);
+        }
 
-    item *it;
-    uint32_t bodylen;
-    int ii = 0;
-    c->icurr = c->ilist;
-    do {
-        /* @todo fixme! */
-        if (ii++ == 10) {
-            break;
+        msg.mutation.message.header.request.cas = memcached_htonll(info.info.cas);
+        msg.mutation.message.header.request.keylen = htons(info.info.nkey);
+        msg.mutation.message.header.request.extlen = 16;
+
+        bodylen = 16 + info.info.nkey + nengine;
+        if ((tap_flags & TAP_FLAG_NO_VALUE) == 0) {
+            bodylen += info.info.nbytes;
         }
+        msg.mutation.message.header.request.bodylen = htonl(bodylen);
 
-        void *engine;
-        uint16_t nengine;
-        uint8_t ttl;
-        uint16_t tap_flags;
-        uint32_t seqno;
-        uint16_t vbucket;
-
-        tap_event_t event = c->tap_iterator(settings.engine.v0, c, &it,
-                                            &engine, &nengine, &ttl,
-                                            &tap_flags, &seqno, &vbucket);
-        union {
-            protocol_binary_request_tap_mutation mutation;
-            protocol_binary_request_tap_delete delete;
-            protocol_binary_request_tap_flush flush;
-            protocol_binary_request_tap_opaque opaque;
-            protocol_binary_request_noop noop;
-        } msg = {
-            .mutation.message.header.request.magic = (uint8_t)PROTOCOL_BINARY_REQ,
-        };
-
-        msg.opaque.message.header.request.opaque = htonl(seqno);
-        msg.opaque.message.body.tap.enginespecific_length = htons(nengine);
-        msg.opaque.message.body.tap.ttl = ttl;
-        msg.opaque.message.body.tap.flags = htons(tap_flags);
-        msg.opaque.message.header.request.extlen = 8;
-        msg.opaque.message.header.request.vbucket = htons(vbucket);
-        item_info_holder info = { .info = { .nvalue = IOV_MAX } };
-
-        switch (event) {
-        case TAP_NOOP :
-            send_data = true;
-            msg.noop.message.header.request.opcode = PROTOCOL_BINARY_CMD_NOOP;
-            msg.noop.message.header.request.extlen = 0;
-            msg.noop.message.header.request.bodylen = htonl(0);
-            memcpy(c->wcurr, msg.noop.bytes, sizeof(msg.noop.bytes));
-            add_iov(c, c->wcurr, sizeof(msg.noop.bytes));
-            c->wcurr += sizeof(msg.noop.bytes);
-            c->wbytes += sizeof(msg.noop.bytes);
-            break;
-        case TAP_PAUSE :
-            more_data = false;
-            break;
-        case TAP_CHECKPOINT_START:
-        case TAP_CHECKPOINT_END:
-        case TAP_MUTATION:
-            if (!settings.engine.v1->get_item_info(settings.engine.v0, c, it,
-                                                   (void*)&info)) {
-                settings.engine.v1->release(settings.engine.v0, c, it);
-                settings.extensions.logger->log(EXTENSION_LOG_WARNING, c,
-                                                "%d: Failed to get item info\n", c->sfd);
-                break;
-            }
-            send_data = true;
-            c->ilist[c->ileft++] = it;
-
-            if (event == TAP_CHECKPOINT_START) {
-                msg.mutation.message.header.request.opcode =
-                    PROTOCOL_BINARY_CMD_TAP_CHECKPOINT_START;
-                pthread_mutex_lock(&tap_stats.mutex);
-                tap_stats.sent.checkpoint_start++;
-                pthread_mutex_unlock(&tap_stats.mutex);
-            } else if (event == TAP_CHECKPOINT_END) {
-                msg.mutation.message.header.request.opcode =
-                    PROTOCOL_BINARY_CMD_TAP_CHECKPOINT_END;
-                pthread_mutex_lock(&tap_stats.mutex);
-                tap_stats.sent.checkpoint_end++;
-                pthread_mutex_unlock(&tap_stats.mutex);
-            } else if (event == TAP_MUTATION) {
-                msg.mutation.message.header.request.opcode = PROTOCOL_BINARY_CMD_TAP_MUTATION;
-                pthread_mutex_lock(&tap_stats.mutex);
-                tap_stats.sent.mutation++;
-                pthread_mutex_unlock(&tap_stats.mutex);
-            }
-
-            msg.mutation.message.header.request.cas = memcached_htonll(info.info.cas);
-            msg.mutation.message.header.request.keylen = htons(info.info.nkey);
-            msg.mutation.message.header.request.extlen = 16;
-
-            bodylen = 16 + info.info.nkey + nengine;
-            if ((tap_flags & TAP_FLAG_NO_VALUE) == 0) {
-                bodylen += info.info.nbytes;
-            }
-            msg.mutation.message.header.request.bodylen = htonl(bodylen);
+        if ((tap_flags & TAP_FLAG_NETWORK_BYTE_ORDER) == 0) {
+            msg.mutation.message.body.item.flags = htonl(info.info.flags);
+        } else {
+            msg.mutation.message.body.item.flags = info.info.flags;
+        }
+        msg.mutation.message.body.item.expiration = htonl(info.info.exptime);
+        msg.mutation.message.body.tap.enginespecific_length = htons(nengine);
+        msg.mutation.message.body.tap.ttl = ttl;
+        msg.mutation.message.body.tap.flags = htons(tap_flags);
+        memcpy(c->wcurr, msg.mutation.bytes, sizeof(msg.mutation.bytes));
 
-            if ((tap_flags & TAP_FLAG_NETWORK_BYTE_ORDER) == 0) {
-                msg.mutation.message.body.item.flags = htonl(info.info.flags);
-            } else {
-                msg.mutation.message.body.item.flags = info.info.flags;
-            }
-            msg.mutation.message.body.item.expiration = htonl(info.info.exptime);
-            msg.mutation.message.body.tap.enginespecific_length = htons(nengine);
-            msg.mutation.message.body.tap.ttl = ttl;
-            msg.mutation.message.body.tap.flags = htons(tap_flags);
-            memcpy(c->wcurr, msg.mutation.bytes, sizeof(msg.mutation.bytes));
-
-            add_iov(c, c->wcurr, sizeof(msg.mutation.bytes));
-            c->wcurr += sizeof(msg.mutation.bytes);
-            c->wbytes += sizeof(msg.mutation.bytes);
-
-            if (nengine > 0) {
-                memcpy(c->wcurr, engine, nengine);
-                add_iov(c, c->wcurr, nengine);
-                c->wcurr += nengine;
-                c->wbytes += nengine;
-            }
-
-            add_iov(c, info.info.key, info.info.nkey);
-            if ((tap_flags & TAP_FLAG_NO_VALUE) == 0) {
-                for (int xx = 0; xx < info.info.nvalue; ++xx) {
-                    add_iov(c, info.info.value[xx].iov_base,
-                            info.info.value[xx].iov_len);
-                }
+        add_iov(c, c->wcurr, sizeof(msg.mutation.bytes));
+        c->wcurr += sizeof(msg.mutation.bytes);
+        c->wbytes += sizeof(msg.mutation.bytes);
+
+        if (nengine > 0) {
+            memcpy(c->wcurr, engine, nengine);
+            add_iov(c, c->wcurr, nengine);
+            c->wcurr += nengine;
+            c->wbytes += nengine;
+        }
+
+        add_iov(c, info.info.key, info.info.nkey);
+        if ((tap_flags & TAP_FLAG_NO_VALUE) == 0) {
+            for (int xx = 0; xx < info.info.nvalue; ++xx) {
+                add_iov(c, info.info.value[xx].iov_base,
+                        info.info.value[xx].iov_len);
             }
+        }
 
+        break;
+    case TAP_DELETION:
+        /* This is a delete */
+        if (!settings.engine.v1->get_item_info(settings.engine.v0, c, it,
+                                               (void*)&info)) {
+            settings.engine.v1->release(settings.engine.v0, c, it);
+            settings.extensions.logger->log(EXTENSION_LOG_WARNING, c,
+                                            "%d: Failed to get item info\n", c->sfd);
             break;
-        case TAP_DELETION:
-            /* This is a delete */
-            if (!settings.engine.v1->get_item_info(settings.engine.v0, c, it,
-                                                   (void*)&info)) {
-                settings.engine.v1->release(settings.engine.v0, c, it);
-                settings.extensions.logger->log(EXTENSION_LOG_WARNING, c,
-                                                "%d: Failed to get item info\n", c->sfd);
-                break;
-            }
-            send_data = true;
-            c->ilist[c->ileft++] = it;
-            msg.delete.message.header.request.opcode = PROTOCOL_BINARY_CMD_TAP_DELETE;
-            msg.delete.message.header.request.cas = memcached_htonll(info.info.cas);
-            msg.delete.message.header.request.keylen = htons(info.info.nkey);
+        }
+        *send_data = true;
+        c->ilist[c->ileft++] = it;
+        msg.delete.message.header.request.opcode = PROTOCOL_BINARY_CMD_TAP_DELETE;
+        msg.delete.message.header.request.cas = memcached_htonll(info.info.cas);
+        msg.delete.message.header.request.keylen = htons(info.info.nkey);
 
-            bodylen = 8 + info.info.nkey + nengine;
-            if ((tap_flags & TAP_FLAG_NO_VALUE) == 0) {
-                bodylen += info.info.nbytes;
-            }
-            msg.delete.message.header.request.bodylen = htonl(bodylen);
+        bodylen = 8 + info.info.nkey + nengine;
+        if ((tap_flags & TAP_FLAG_NO_VALUE) == 0) {
+            bodylen += info.info.nbytes;
+        }
+        msg.delete.message.header.request.bodylen = htonl(bodylen);
 
-            memcpy(c->wcurr, msg.delete.bytes, sizeof(msg.delete.bytes));
-            add_iov(c, c->wcurr, sizeof(msg.delete.bytes));
-            c->wcurr += sizeof(msg.delete.bytes);
-            c->wbytes += sizeof(msg.delete.bytes);
+        memcpy(c->wcurr, msg.delete.bytes, sizeof(msg.delete.bytes));
+        add_iov(c, c->wcurr, sizeof(msg.delete.bytes));
+        c->wcurr += sizeof(msg.delete.bytes);
+        c->wbytes += sizeof(msg.delete.bytes);
 
-            if (nengine > 0) {
-                memcpy(c->wcurr, engine, nengine);
-                add_iov(c, c->wcurr, nengine);
-                c->wcurr += nengine;
-                c->wbytes += nengine;
-            }
+        if (nengine > 0) {
+            memcpy(c->wcurr, engine, nengine);
+            add_iov(c, c->wcurr, nengine);
+            c->wcurr += nengine;
+            c->wbytes += nengine;
+        }
 
-            add_iov(c, info.info.key, info.info.nkey);
-            if ((tap_flags & TAP_FLAG_NO_VALUE) == 0) {
-                for (int xx = 0; xx < info.info.nvalue; ++xx) {
-                    add_iov(c, info.info.value[xx].iov_base,
-                            info.info.value[xx].iov_len);
-                }
+        add_iov(c, info.info.key, info.info.nkey);
+        if ((tap_flags & TAP_FLAG_NO_VALUE) == 0) {
+            for (int xx = 0; xx < info.info.nvalue; ++xx) {
+                add_iov(c, info.info.value[xx].iov_base,
+                        info.info.value[xx].iov_len);
             }
+        }
 
+        pthread_mutex_lock(&tap_stats.mutex);
+        tap_stats.sent.delete++;
+        pthread_mutex_unlock(&tap_stats.mutex);
+        break;
+
+    case TAP_DISCONNECT:
+        *disconnect = true;
+        return false;
+    case TAP_VBUCKET_SET:
+    case TAP_FLUSH:
+    case TAP_OPAQUE:
+        *send_data = true;
+
+        if (ev->event == TAP_OPAQUE) {
+            msg.flush.message.header.request.opcode = PROTOCOL_BINARY_CMD_TAP_OPAQUE;
             pthread_mutex_lock(&tap_stats.mutex);
-            tap_stats.sent.delete++;
+            tap_stats.sent.opaque++;
             pthread_mutex_unlock(&tap_stats.mutex);
-            break;
 
-        case TAP_DISCONNECT:
-            disconnect = true;
-            more_data = false;
-            break;
-        case TAP_VBUCKET_SET:
-        case TAP_FLUSH:
-        case TAP_OPAQUE:
-            send_data = true;
-
-            if (event == TAP_OPAQUE) {
-                msg.flush.message.header.request.opcode = PROTOCOL_BINARY_CMD_TAP_OPAQUE;
-                pthread_mutex_lock(&tap_stats.mutex);
-                tap_stats.sent.opaque++;
-                pthread_mutex_unlock(&tap_stats.mutex);
-
-            } else if (event == TAP_FLUSH) {
-                msg.flush.message.header.request.opcode = PROTOCOL_BINARY_CMD_TAP_FLUSH;
-                pthread_mutex_lock(&tap_stats.mutex);
-                tap_stats.sent.flush++;
-                pthread_mutex_unlock(&tap_stats.mutex);
-            } else if (event == TAP_VBUCKET_SET) {
-                msg.flush.message.header.request.opcode = PROTOCOL_BINARY_CMD_TAP_VBUCKET_SET;
-                msg.flush.message.body.tap.flags = htons(tap_flags);
-                pthread_mutex_lock(&tap_stats.mutex);
-                tap_stats.sent.vbucket_set++;
-                pthread_mutex_unlock(&tap_stats.mutex);
-            }
-
-            msg.flush.message.header.request.bodylen = htonl(8 + nengine);
-            memcpy(c->wcurr, msg.flush.bytes, sizeof(msg.flush.bytes));
-            add_iov(c, c->wcurr, sizeof(msg.flush.bytes));
-            c->wcurr += sizeof(msg.flush.bytes);
-            c->wbytes += sizeof(msg.flush.bytes);
-            if (nengine > 0) {
-                memcpy(c->wcurr, engine, nengine);
-                add_iov(c, c->wcurr, nengine);
-                c->wcurr += nengine;
-                c->wbytes += nengine;
+        } else if (ev->event == TAP_FLUSH) {
+            msg.flush.message.header.request.opcode = PROTOCOL_BINARY_CMD_TAP_FLUSH;
+            pthread_mutex_lock(&tap_stats.mutex);
+            tap_stats.sent.flush++;
+            pthread_mutex_unlock(&tap_stats.mutex);
+        } else if (ev->event == TAP_VBUCKET_SET) {
+            msg.flush.message.header.request.opcode = PROTOCOL_BINARY_CMD_TAP_VBUCKET_SET;
+            msg.flush.message.body.tap.flags = htons(tap_flags);
+            pthread_mutex_lock(&tap_stats.mutex);
+            tap_stats.sent.vbucket_set++;
+            pthread_mutex_unlock(&tap_stats.mutex);
+        }
+
+        msg.flush.message.header.request.bodylen = htonl(8 + nengine);
+        memcpy(c->wcurr, msg.flush.bytes, sizeof(msg.flush.bytes));
+        add_iov(c, c->wcurr, sizeof(msg.flush.bytes));
+        c->wcurr += sizeof(msg.flush.bytes);
+        c->wbytes += sizeof(msg.flush.bytes);
+        if (nengine > 0) {
+            memcpy(c->wcurr, engine, nengine);
+            add_iov(c, c->wcurr, nengine);
+            c->wcurr += nengine;
+            c->wbytes += nengine;
+        }
+        break;
+    default:
+        abort();
+    }
+
+    return true;
+}
+
+/**
+ * Make room in the write buffer for the messages of a batch of tap
+ * events.
+ */
+static bool grow_tap_wbuf(conn *c, tap_event_info *events, int nevents) {
+    size_t needed = 0;
+    for (int ii = 0; ii < nevents; ++ii) {
+        needed += sizeof(protocol_binary_request_tap_mutation) +
+            events[ii].nengine_specific;
+    }
+    if (needed > c->wsize) {
+        char *newbuf = realloc(c->wbuf, needed);
+        if (newbuf == NULL) {
+            return false;
+        }
+        c->wbuf = c->wcurr = newbuf;
+        c->wsize = needed;
+    }
+    return true;
+}
+
+static void ship_tap_log(conn *c) {
+    c->msgcurr = 0;
+    c->msgused = 0;
+    c->iovused = 0;
+    if (add_msghdr(c) != 0) {
+        if (settings.verbose) {
+            settings.extensions.logger->log(EXTENSION_LOG_WARNING, c,
+                                            "%d: Failed to create output headers. Shutting down tap connection\n", c->sfd);
+        }
+        conn_set_state(c, conn_closing);
+        return ;
+    }
+    c->wcurr = c->wbuf;
+
+    bool send_data = false;
+    bool disconnect = false;
+    tap_event_info events[TAP_BATCH_SIZE];
+    int ii = 0;
+
+    c->icurr = c->ilist;
+    if (c->tap_batch_iterator != NULL) {
+        int nevents = c->tap_batch_iterator(settings.engine.v0, c, events,
+                                            TAP_BATCH_SIZE);
+        if (!grow_tap_wbuf(c, events, nevents)) {
+            settings.extensions.logger->log(EXTENSION_LOG_WARNING, c,
+                                            "%d: Failed to grow the write buffer. Shutting down tap connection\n", c->sfd);
+            for (ii = 0; ii < nevents; ++ii) {
+                switch (events[ii].event) {
+                case TAP_CHECKPOINT_START:
+                case TAP_CHECKPOINT_END:
+                case TAP_MUTATION:
+                case TAP_DELETION:
+                    settings.engine.v1->release(settings.engine.v0, c,
+                                                events[ii].itm);
+                    break;
+                default:
+                    break;
+                }
             }
-            break;
-        default:
-            abort();
+            conn_set_state(c, conn_closing);
+            return ;
+        }
+        while (ii < nevents &&
+               add_tap_event(c, &events[ii], &send_data, &disconnect)) {
+            ++ii;
         }
-    } while (more_data);
+    } else {
+        /* @todo add check for buffer overflow of c->wbuf) */
+        tap_event_info *ev = &events[0];
+        do {
+            ev->event = c->tap_iterator(settings.engine.v0, c, &ev->itm,
+                                        &ev->engine_specific,
+                                        &ev->nengine_specific, &ev->ttl,
+                                        &ev->flags, &ev->seqno,
+                                        &ev->vbucket);
+        } while (add_tap_event(c, ev, &send_data, &disconnect) && ++ii < 10);
+    }
 
     c->ewouldblock = false;
     if (send_data) {
@@ -2885,6 +3025,12 @@ static void process_bin_unknown_packet(conn *c) {
     switch (ret) {
     case ENGINE_SUCCESS:
         if (c->dynamic_buffer.buffer != NULL) {
+            if (c->item != NULL && !add_item_response_iovs(c)) {
+                free(c->dynamic_buffer.buffer);
+                c->dynamic_buffer.buffer = NULL;
+                write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_ENOMEM, 0);
+                break;
+            }
             write_and_free(c, c->dynamic_buffer.buffer, c->dynamic_buffer.offset);
             c->dynamic_buffer.buffer = NULL;
         } else {
@@ -2975,11 +3121,20 @@ static void process_bin_tap_connect(conn *c) {
                                         c->sfd, buffer);
     }
 
-    TAP_ITERATOR iterator = settings.engine.v1->get_tap_iterator(
-        settings.engine.v0, c, key, c->binary_header.request.keylen,
-        flags, data, ndata);
+    TAP_BATCH_ITERATOR batch_iterator = NULL;
+    TAP_ITERATOR iterator = NULL;
+    if (settings.engine.v1->get_tap_batch_iterator != NULL) {
+        batch_iterator = settings.engine.v1->get_tap_batch_iterator(
+            settings.engine.v0, c, key, c->binary_header.request.keylen,
+            flags, data, ndata);
+    }
+    if (batch_iterator == NULL && settings.engine.v1->get_tap_iterator != NULL) {
+        iterator = settings.engine.v1->get_tap_iterator(
+            settings.engine.v0, c, key, c->binary_header.request.keylen,
+            flags, data, ndata);
+    }
 
-    if (iterator == NULL) {
+    if (iterator == NULL && batch_iterator == NULL) {
         settings.extensions.logger->log(EXTENSION_LOG_WARNING, c,
                                         "%d: FATAL: The engine does not support tap\n",
                                         c->sfd);
@@ -2987,6 +3142,7 @@ static void process_bin_tap_connect(conn *c) {
         c->write_and_go = conn_closing;
     } else {
         c->tap_iterator = iterator;
+        c->tap_batch_iterator = batch_iterator;
         c->which = EV_WRITE;
         conn_set_state(c, conn_ship_log);
     }
@@ -3332,7 +3488,8 @@ static void dispatch_bin_command(conn *c) {
             }
             break;
        case PROTOCOL_BINARY_CMD_TAP_CONNECT:
-            if (settings.engine.v1->get_tap_iterator == NULL) {
+            if (settings.engine.v1->get_tap_iterator == NULL &&
+                settings.engine.v1->get_tap_batch_iterator == NULL) {
                 write_bin_packet(c, PROTOCOL_BINARY_RESPONSE_NOT_SUPPORTED, bodylen);
             } else {
                 bin_read_chunk(c, bin_reading_packet,
@@ -7154,7 +7311,8 @@ static SERVER_HANDLE_V1 *get_server_api(void)
         .get_socket_fd = get_socket_fd,
         .notify_io_complete = notify_io_complete,
         .reserve = reserve_cookie,
-        .release = release_cookie
+        .release = release_cookie,
+        .add_item_response = add_item_response
     };
 
     static SERVER_STAT_API server_stat_api = {
@@ -7622,6 +7780,13 @@ int main (int argc, char **argv) {
         settings.reqs_per_tap_event = DEFAULT_REQS_PER_TAP_EVENT;
     }
 
+#ifndef NDEBUG
+    /* Lets the tests run out of iovecs without running out of memory */
+    if (getenv("MEMCACHED_MAX_IOVS") != NULL) {
+        settings.max_iovs = atoi(getenv("MEMCACHED_MAX_IOVS"));
+    }
+#endif
+
 
     if (install_sigterm_handler() != 0) {
         settings.extensions.logger->log(EXTENSION_LOG_WARNING, NULL,
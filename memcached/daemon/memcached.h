@@ -35,6 +35,9 @@
 /** Initial size of list of items being returned by "get". */
 #define ITEM_LIST_INITIAL 200
 
+/** Max number of tap events fetched with one call to a batch iterator. */
+#define TAP_BATCH_SIZE 32
+
 /** Initial size of list of CAS suffixes appended to "gets" lines. */
 #define SUFFIX_LIST_INITIAL 20
 
@@ -194,6 +197,11 @@ struct settings {
                                io-event. */
     int reqs_per_tap_event; /* Maximum number of tap io to process on each
                                io-event. */
+#ifndef NDEBUG
+    int max_iovs;           /* Maximum number of iovecs queued on a
+                               connection (0 means unlimited), for the
+                               tests only. */
+#endif
     bool use_cas;
     enum protocol binding_protocol;
     int backlog;
@@ -374,6 +382,7 @@ struct conn {
     ENGINE_ERROR_CODE aiostat;
     bool ewouldblock;
     TAP_ITERATOR tap_iterator;
+    TAP_BATCH_ITERATOR tap_batch_iterator;
     int parent_port; /* Listening port that creates this connection instance */
 };
 
@@ -653,6 +653,15 @@ static bool touch(struct default_engine *e, const void *cookie,
         if (request->request.opcode == PROTOCOL_BINARY_CMD_TOUCH) {
             ret = response(NULL, 0, NULL, 0, NULL, 0, PROTOCOL_BINARY_RAW_BYTES,
                            PROTOCOL_BINARY_RESPONSE_SUCCESS, 0, cookie);
+        } else if (e->server.cookie->add_item_response != NULL &&
+                   e->server.cookie->add_item_response(cookie, item, NULL, 0,
+                                                       &item->flags,
+                                                       sizeof(item->flags),
+                                                       PROTOCOL_BINARY_RAW_BYTES,
+                                                       PROTOCOL_BINARY_RESPONSE_SUCCESS,
+                                                       item_get_cas(item))) {
+            /* The core releases the item once the value is sent */
+            return true;
         } else {
             ret = response(NULL, 0, &item->flags, sizeof(item->flags),
                            item_get_data(item), item->nbytes,
@@ -122,6 +122,42 @@ extern "C" {
                                         uint32_t *seqno,
                                         uint16_t *vbucket);
 
+    /**
+     * An event of a tap stream, with the arguments a TAP_ITERATOR
+     * returns for it.
+     */
+    typedef struct {
+        tap_event_t event;
+        item *itm;
+        void *engine_specific;
+        uint16_t nengine_specific;
+        uint8_t ttl;
+        uint16_t flags;
+        uint32_t seqno;
+        uint16_t vbucket;
+    } tap_event_info;
+
+    /**
+     * A batched version of the TAP_ITERATOR, returning several events
+     * of the tap stream in one call so the core can send them all in
+     * one go.
+     *
+     * The engine stops filling the events after returning a TAP_PAUSE
+     * or a TAP_DISCONNECT event.  The engine specific data of all the
+     * events should be valid until the next invocation of the iterator,
+     * or until the connection is closed.
+     *
+     * @param handle the engine handle
+     * @param cookie identification for the tap stream
+     * @param events where to store the events to send
+     * @param nevents the maximum number of events to return
+     * @return the number of events returned (at least one)
+     */
+    typedef int (*TAP_BATCH_ITERATOR)(ENGINE_HANDLE* handle,
+                                      const void *cookie,
+                                      tap_event_info *events,
+                                      int nevents);
+
     /**
      * The signature for the "create_instance" function exported from the module.
      *
@@ -530,6 +566,28 @@ extern "C" {
         size_t (*errinfo)(ENGINE_HANDLE *handle, const void* cookie,
                           char *buffer, size_t buffsz);
 
+        /**
+         * Get (or create) a batched Tap iterator for this connection.
+         *
+         * This is optional: the core uses get_tap_iterator if the
+         * engine doesn't provide it (or returns NULL).
+         *
+         * @param handle the engine handle
+         * @param cookie The connection cookie
+         * @param client The "name" of the client
+         * @param nclient The number of bytes in the client name
+         * @param flags Tap connection flags
+         * @param userdata Specific userdata the engine may know how to use
+         * @param nuserdata The size of the userdata
+         * @return a tap iterator to iterate through the event stream
+         */
+        TAP_BATCH_ITERATOR (*get_tap_batch_iterator)(ENGINE_HANDLE* handle,
+                                                     const void* cookie,
+                                                     const void* client,
+                                                     size_t nclient,
+                                                     uint32_t flags,
+                                                     const void* userdata,
+                                                     size_t nuserdata);
 
 
     } ENGINE_HANDLE_V1;
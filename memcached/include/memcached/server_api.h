@@ -145,6 +145,32 @@ extern "C" {
          */
         ENGINE_ERROR_CODE (*release)(const void *cookie);
 
+        /**
+         * Add the response to the current unknown_command sending the
+         * value of the given item as its body, without copying it. The
+         * core takes over the reference to the item and releases it
+         * once the response is written, so the engine must keep the
+         * value returned by get_item_info valid until then. This must
+         * be the last response added for the command.
+         *
+         * @param cookie The cookie provided by the frontend
+         * @param it the item whose value is the body of the response
+         * @param key the key to put in the response
+         * @param keylen the length of the key
+         * @param ext the data to put in the extension field
+         * @param extlen the length of the extension field
+         * @param datatype the datatype of the value
+         * @param status the status code of the response
+         * @param cas the cas value to put in the response
+         *
+         * @return true if the core took over the item, false if the
+         *         engine still owns it (and must respond otherwise)
+         */
+        bool (*add_item_response)(const void *cookie, item *it,
+                                  const void *key, uint16_t keylen,
+                                  const void *ext, uint8_t extlen,
+                                  uint8_t datatype, uint16_t status,
+                                  uint64_t cas);
 
     } SERVER_COOKIE_API;
 
@@ -19,6 +19,7 @@ struct mock_engine {
     ENGINE_HANDLE_V1 me;
     ENGINE_HANDLE_V1 *the_engine;
     TAP_ITERATOR iterator;
+    TAP_BATCH_ITERATOR batch_iterator;
 };
 
 static bool color_enabled;
@@ -45,6 +46,15 @@ static tap_event_t mock_tap_iterator(ENGINE_HANDLE* handle,
                        ttl, flags, seqno, vbucket);
 }
 
+static int mock_tap_batch_iterator(ENGINE_HANDLE* handle,
+                                   const void *cookie,
+                                   tap_event_info *events,
+                                   int nevents) {
+   struct mock_engine *me = get_handle(handle);
+   return me->batch_iterator((ENGINE_HANDLE*)me->the_engine, cookie,
+                             events, nevents);
+}
+
 static const engine_info* mock_get_info(ENGINE_HANDLE* handle) {
     struct mock_engine *me = get_handle(handle);
     return me->the_engine->get_info((ENGINE_HANDLE*)me->the_engine);
@@ -455,6 +465,20 @@ static TAP_ITERATOR mock_get_tap_iterator(ENGINE_HANDLE* handle, const void* coo
     return (me->iterator != NULL) ? mock_tap_iterator : NULL;
 }
 
+static TAP_BATCH_ITERATOR mock_get_tap_batch_iterator(ENGINE_HANDLE* handle,
+                                                      const void* cookie,
+                                                      const void* client,
+                                                      size_t nclient,
+                                                      uint32_t flags,
+                                                      const void* userdata,
+                                                      size_t nuserdata) {
+    struct mock_engine *me = get_handle(handle);
+    me->batch_iterator = me->the_engine->get_tap_batch_iterator((ENGINE_HANDLE*)me->the_engine,
+                                                                cookie, client, nclient,
+                                                                flags, userdata, nuserdata);
+    return (me->batch_iterator != NULL) ? mock_tap_batch_iterator : NULL;
+}
+
 static size_t mock_errinfo(ENGINE_HANDLE *handle, const void* cookie,
                            char *buffer, size_t buffsz) {
     struct mock_engine *me = get_handle(handle);
@@ -630,6 +654,11 @@ static ENGINE_HANDLE_V1 *start_your_engines(const char *engine, const char* cfg,
     if (mock_engine.the_engine->get_tap_iterator == NULL) {
         mock_engine.me.get_tap_iterator = NULL;
     }
+    // Only offer the batched tap iterator when the engine has one, so
+    // that the tests exercise the same path the server would pick.
+    if (mock_engine.the_engine->get_tap_batch_iterator != NULL) {
+        mock_engine.me.get_tap_batch_iterator = mock_get_tap_batch_iterator;
+    }
     if (mock_engine.the_engine->errinfo == NULL) {
         mock_engine.me.errinfo = NULL;
     }
@@ -1,5 +1,9 @@
 /* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
 #include "config.h"
+#ifdef NDEBUG
+/* The server leaves its test only limits out of such builds */
+#define SERVER_NDEBUG 1
+#endif
 #undef NDEBUG
 #include <pthread.h>
 #include <sys/types.h>
@@ -1101,6 +1105,30 @@ static off_t arithmetic_command(char* buf,
     return key_offset + keylen;
 }
 
+static off_t touch_command(char* buf,
+                           size_t bufsz,
+                           uint8_t cmd,
+                           const void* key,
+                           size_t keylen,
+                           uint32_t exptime) {
+    protocol_binary_request_gat *request = (void*)buf;
+    assert(bufsz > sizeof(*request) + keylen);
+
+    memset(request, 0, sizeof(*request));
+    request->message.header.request.magic = PROTOCOL_BINARY_REQ;
+    request->message.header.request.opcode = cmd;
+    request->message.header.request.keylen = htons(keylen);
+    request->message.header.request.extlen = 4;
+    request->message.header.request.bodylen = htonl(keylen + 4);
+    request->message.header.request.opaque = 0xdeadbeef;
+    request->message.body.expiration = htonl(exptime);
+
+    off_t key_offset = sizeof(protocol_binary_request_no_extras) + 4;
+
+    memcpy(buf + key_offset, key, keylen);
+    return key_offset + keylen;
+}
+
 static void validate_response_header(protocol_binary_response_no_extras *response,
                                      uint8_t cmd, uint16_t status)
 {
@@ -2325,6 +2353,120 @@ static enum test_return test_binary_bad_tap_ttl(void) {
     return TEST_PASS;
 }
 
+static enum test_return test_binary_gat(void) {
+    union {
+        protocol_binary_request_no_extras request;
+        protocol_binary_response_no_extras response;
+        char bytes[1024];
+    } send, receive;
+    const char *key = "test_binary_gat";
+
+    size_t len = touch_command(send.bytes, sizeof(send.bytes),
+                               PROTOCOL_BINARY_CMD_GAT,
+                               key, strlen(key), 0);
+    safe_send(send.bytes, len, false);
+    safe_recv_packet(receive.bytes, sizeof(receive.bytes));
+    validate_response_header(&receive.response, PROTOCOL_BINARY_CMD_GAT,
+                             PROTOCOL_BINARY_RESPONSE_KEY_ENOENT);
+
+    store_object((char*)key, "world");
+
+    /* The value is sent from the item itself, so pipeline a few */
+    len = 0;
+    for (int ii = 0; ii < 10; ++ii) {
+        len += touch_command(send.bytes + len, sizeof(send.bytes) - len,
+                             PROTOCOL_BINARY_CMD_GAT,
+                             key, strlen(key), 0);
+    }
+    safe_send(send.bytes, len, false);
+    for (int ii = 0; ii < 10; ++ii) {
+        safe_recv_packet(receive.bytes, sizeof(receive.bytes));
+        validate_response_header(&receive.response, PROTOCOL_BINARY_CMD_GAT,
+                                 PROTOCOL_BINARY_RESPONSE_SUCCESS);
+        assert(receive.response.message.header.response.extlen == 4);
+        assert(receive.response.message.header.response.bodylen == 4 + 5);
+        assert(memcmp(receive.bytes + sizeof(receive.response) + 4,
+                      "world", 5) == 0);
+    }
+
+    return TEST_PASS;
+}
+
+static enum test_return test_binary_gat_iov_enomem(void) {
+#ifndef SERVER_NDEBUG
+    union {
+        protocol_binary_request_no_extras request;
+        protocol_binary_response_no_extras response;
+        char bytes[8192];
+    } send, receive;
+    char value[4096];
+    const char *key = "test_binary_gat_iov_enomem";
+
+    /*
+     * With only two iovecs per connection the header and the value of a
+     * value bigger than the first datagram can't all be queued
+     */
+    setenv("MEMCACHED_MAX_IOVS", "2", 1);
+    in_port_t myport;
+    pid_t pid = start_server(&myport, false, 60);
+    unsetenv("MEMCACHED_MAX_IOVS");
+    int oldsock = sock;
+    sock = connect_server("127.0.0.1", myport, false);
+
+    memset(value, 'x', sizeof(value));
+    size_t len = storage_command(send.bytes, sizeof(send.bytes),
+                                 PROTOCOL_BINARY_CMD_SET,
+                                 key, strlen(key), value, sizeof(value),
+                                 0, 0);
+    safe_send(send.bytes, len, false);
+    safe_recv_packet(receive.bytes, sizeof(receive.bytes));
+    validate_response_header(&receive.response, PROTOCOL_BINARY_CMD_SET,
+                             PROTOCOL_BINARY_RESPONSE_SUCCESS);
+
+    /* The partial response is dropped and replaced by the error */
+    len = touch_command(send.bytes, sizeof(send.bytes),
+                        PROTOCOL_BINARY_CMD_GAT, key, strlen(key), 0);
+    len += raw_command(send.bytes + len, sizeof(send.bytes) - len,
+                       PROTOCOL_BINARY_CMD_NOOP, NULL, 0, NULL, 0);
+    safe_send(send.bytes, len, false);
+    safe_recv_packet(receive.bytes, sizeof(receive.bytes));
+    validate_response_header(&receive.response, PROTOCOL_BINARY_CMD_GAT,
+                             PROTOCOL_BINARY_RESPONSE_ENOMEM);
+    assert(receive.response.message.header.response.bodylen ==
+           strlen("Out of memory"));
+    assert(memcmp(receive.bytes + sizeof(receive.response),
+                  "Out of memory", strlen("Out of memory")) == 0);
+    safe_recv_packet(receive.bytes, sizeof(receive.bytes));
+    validate_response_header(&receive.response, PROTOCOL_BINARY_CMD_NOOP,
+                             PROTOCOL_BINARY_RESPONSE_SUCCESS);
+
+    /* A value that fits is still sent from the item */
+    len = storage_command(send.bytes, sizeof(send.bytes),
+                          PROTOCOL_BINARY_CMD_SET,
+                          key, strlen(key), "world", 5, 0, 0);
+    safe_send(send.bytes, len, false);
+    safe_recv_packet(receive.bytes, sizeof(receive.bytes));
+    validate_response_header(&receive.response, PROTOCOL_BINARY_CMD_SET,
+                             PROTOCOL_BINARY_RESPONSE_SUCCESS);
+    len = touch_command(send.bytes, sizeof(send.bytes),
+                        PROTOCOL_BINARY_CMD_GAT, key, strlen(key), 0);
+    safe_send(send.bytes, len, false);
+    safe_recv_packet(receive.bytes, sizeof(receive.bytes));
+    validate_response_header(&receive.response, PROTOCOL_BINARY_CMD_GAT,
+                             PROTOCOL_BINARY_RESPONSE_SUCCESS);
+    assert(receive.response.message.header.response.bodylen == 4 + 5);
+    assert(memcmp(receive.bytes + sizeof(receive.response) + 4,
+                  "world", 5) == 0);
+
+    close(sock);
+    sock = oldsock;
+    assert(kill(pid, SIGTERM) == 0);
+    return TEST_PASS;
+#else
+    return TEST_SKIP;
+#endif
+}
+
 static enum test_return test_issue_101(void) {
 #define max 2
     enum test_return ret = TEST_PASS;
@@ -2460,6 +2602,8 @@ struct testcase testcases[] = {
     { "binary_read", test_binary_read },
     { "binary_write", test_binary_write },
     { "binary_bad_tap_ttl", test_binary_bad_tap_ttl },
+    { "binary_gat", test_binary_gat },
+    { "binary_gat_iov_enomem", test_binary_gat_iov_enomem },
     { "binary_pipeline_hickup", test_binary_pipeline_hickup },
     { "stop_server", stop_memcached_server },
     { NULL, NULL }